@@ -19,6 +19,9 @@ typedef enum {
 #define MODULE_MASK_DEVICE              LM_MODULE_MASK(LM_MODULE_DEVICE)
 #define MODULE_MASK_PLAYER              LM_MODULE_MASK(LM_MODULE_PLAYER)
 #define MODULE_MASK_TRANSPORT           LM_MODULE_MASK(LM_MODULE_TRANSPORT)
+#define MODULE_MASK_ENDPOINT            LM_MODULE_MASK(LM_MODULE_ENDPOINT)
+#define MODULE_MASK_GATT                LM_MODULE_MASK(LM_MODULE_GATT)
+#define MODULE_MASK_PAIRING             LM_MODULE_MASK(LM_MODULE_PAIRING)
 typedef guint32 lm_callback_module_mask_t;
 
 typedef lm_status_t (*lm_app_callback_func_t)(lm_msg_type_t msg, lm_status_t status, void *buf);
@@ -6,6 +6,8 @@
 #include "lm_forward_decl.h"
 #include "lm_device.h"
 
+#define LM_ADAPTER_DEFAULT_RSSI_MAX_AGE_MS     10000
+
 typedef enum {
     LM_ADAPTER_POWER_ON = 0,
     LM_ADAPTER_POWER_OFF,
@@ -27,6 +29,12 @@ typedef enum {
     LM_ADAPTER_BCAST_DISCOVERED_BY_SINK_SCAN = 1,
 } lm_adapter_bcast_discovery_method_t;
 
+/* where signals and async replies of an adapter and its devices are dispatched */
+typedef enum {
+    LM_ADAPTER_CONTEXT_SHARED = 0,      /* lea manager dbus thread, as lm_adapter_get_default() */
+    LM_ADAPTER_CONTEXT_DEDICATED,       /* own GMainContext and worker thread per adapter */
+} lm_adapter_context_mode_t;
+
 typedef struct {
     lm_adapter_t *adapter;
 } lm_adapter_power_on_cnf_t;
@@ -66,8 +74,39 @@ typedef struct {
 } lm_adapter_local_bcast_transport_state_change_ind_t;
 #define LM_ADAPTER_LOCAL_BCAST_TRANSPORT_STATE_CHANGE_IND  (LM_MODULE_ADAPTER | 0x0007)
 
+/*
+ * Completion of a request returned by lm_adapter_set_discovery_filter() or
+ * lm_adapter_clear_discovery_filter(). The event status is
+ * LM_STATUS_SUCCESS, LM_STATUS_FAIL, LM_STATUS_TIMEOUT or LM_STATUS_CANCELLED.
+ */
+typedef struct {
+    lm_adapter_t *adapter;
+    guint request_id;
+} lm_adapter_set_discovery_filter_cnf_t;
+#define LM_ADAPTER_SET_DISCOVERY_FILTER_CNF    (LM_MODULE_ADAPTER | 0x0008)
+
+/* Completion of a request returned by lm_adapter_remove_device(), status as above */
+typedef struct {
+    lm_adapter_t *adapter;
+    guint request_id;
+    const gchar *device_path;
+} lm_adapter_remove_device_cnf_t;
+#define LM_ADAPTER_REMOVE_DEVICE_CNF           (LM_MODULE_ADAPTER | 0x0009)
+
 lm_adapter_t *lm_adapter_get_default(void);
 
+/*
+ * Returns every adapter known to bluez, free the array with
+ * g_ptr_array_free(adapters, TRUE) and each adapter with lm_adapter_destroy().
+ * With LM_ADAPTER_CONTEXT_DEDICATED the events of an adapter and its devices
+ * are delivered on that adapter's thread, so callbacks for different adapters
+ * may run concurrently. lm_adapter_destroy() must not be called from there.
+ */
+GPtrArray *lm_adapter_get_all(lm_adapter_context_mode_t mode);
+
+/* The context the adapter is dispatched on, g_main_context_default() when shared */
+GMainContext *lm_adapter_get_context(lm_adapter_t *adapter);
+
 void lm_adapter_destroy(lm_adapter_t *adapter);
 
 gboolean lm_adapter_is_power_on(lm_adapter_t *adapter);
@@ -84,14 +123,31 @@ lm_status_t lm_adapter_start_discovery(lm_adapter_t *adapter);
 
 lm_status_t lm_adapter_stop_discovery(lm_adapter_t *adapter);
 
-void lm_adapter_set_discovery_filter(lm_adapter_t *adapter,
+/*
+ * Returns the request id of LM_ADAPTER_SET_DISCOVERY_FILTER_CNF. RSSI, pattern
+ * and UUIDs are also passed to bluez to cut the traffic, but bluez merges the
+ * filters of all its clients, so every result is still checked locally.
+ * max_devices and timeout are handled here only.
+ */
+guint lm_adapter_set_discovery_filter(lm_adapter_t *adapter,
                                             gint16 rssi_threshold,
                                             const GPtrArray *service_uuids,
                                             const gchar *pattern,
                                             guint max_devices,
                                             guint timeout);
 
-void lm_adapter_clear_discovery_filter(lm_adapter_t *adapter);
+guint lm_adapter_clear_discovery_filter(lm_adapter_t *adapter);
+
+/*
+ * Discovery results must also match one of the rules, checked locally on each
+ * update. The filter is borrowed, keep it until it is replaced or the adapter
+ * is destroyed; it is no longer used once this returns with another one.
+ * NULL removes it.
+ */
+void lm_adapter_set_discovery_rules(lm_adapter_t *adapter, const lm_filter_t *rules);
+
+/* Discovery results are also published to feed, borrowed like the rules above, NULL stops publishing */
+void lm_adapter_set_scan_feed(lm_adapter_t *adapter, lm_scan_feed_t *feed);
 
 lm_status_t lm_adapter_discoverable_on(lm_adapter_t *adapter);
 
@@ -115,6 +171,17 @@ const gchar *lm_adapter_get_address(lm_adapter_t *adapter);
 
 GList *lm_adapter_get_connected_devices(lm_adapter_t *adapter);
 
+/*
+ * Object paths of up to k devices with the strongest smoothed RSSI, strongest
+ * first. Devices whose RSSI is older than the max age are left out. The paths
+ * are copies, the devices may be removed from the cache meanwhile. Free the
+ * array with g_ptr_array_free(paths, TRUE).
+ */
+GPtrArray *lm_adapter_get_top_rssi(lm_adapter_t *adapter, guint k);
+
+/* 0 disables aging */
+void lm_adapter_set_rssi_max_age(lm_adapter_t *adapter, guint max_age_ms);
+
 GDBusConnection *lm_adapter_get_dbus_conn(lm_adapter_t *adapter);
 
 gboolean lm_adapter_is_advertising(lm_adapter_t *adapter);
@@ -123,8 +190,17 @@ lm_status_t lm_adapter_start_adv(lm_adapter_t *adapter, lm_adv_t *adv);
 
 lm_status_t lm_adapter_stop_adv(lm_adapter_t *adapter, lm_adv_t *adv);
 
-lm_status_t lm_adapter_remove_device(lm_adapter_t *adapter, lm_device_t *device);
+/* Returns the request id of LM_ADAPTER_REMOVE_DEVICE_CNF */
+guint lm_adapter_remove_device(lm_adapter_t *adapter, lm_device_t *device);
+
+/* The request completes with LM_STATUS_CANCELLED, LM_STATUS_INVALID_ARGS when it already completed */
+lm_status_t lm_adapter_cancel_request(lm_adapter_t *adapter, guint request_id);
+
+guint lm_adapter_get_pending_request_count(lm_adapter_t *adapter);
 
 GHashTable *lm_adapter_get_device_cache(lm_adapter_t *adapter);
 
+/* Signals delivered to the adapter, and how many of them were for another adapter */
+void lm_adapter_get_signal_stats(lm_adapter_t *adapter, guint *received, guint *dropped);
+
 #endif //__LM_ADAPTER_H__
\ No newline at end of file
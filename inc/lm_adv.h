@@ -22,6 +22,10 @@ lm_adv_t *lm_adv_create(void);
 
 void lm_adv_destroy(lm_adv_t *adv);
 
+/*
+ * Setters on a registered adv emit PropertiesChanged, bluetoothd then
+ * updates the advertising data without an unregister/register cycle.
+ */
 void lm_adv_set_type(lm_adv_t *adv, lm_adv_type_t type);
 
 lm_adv_type_t lm_adv_get_type(lm_adv_t *adv);
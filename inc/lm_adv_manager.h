@@ -0,0 +1,48 @@
+#ifndef __LM_ADV_MANAGER_H__
+#define __LM_ADV_MANAGER_H__
+
+#include <glib.h>
+#include "lm_type.h"
+#include "lm_forward_decl.h"
+
+/*
+ * Advertises more logical sets than the controller has instances. Up to
+ * SupportedInstances advs are registered with BlueZ at a time, pinned advs
+ * keep their instance, the rest share the remaining ones round-robin and
+ * are swapped every slot.
+ */
+
+#define LM_ADV_MANAGER_DEFAULT_SLOT_MS      1000
+
+typedef struct {
+    guint64 airtime_ms;         /* time registered with BlueZ, including the running slot */
+    guint activations;          /* successful RegisterAdvertisement calls */
+    guint failures;             /* rejected RegisterAdvertisement calls */
+    gboolean active;
+} lm_adv_manager_stats_t;
+
+/*
+ * Reads SupportedInstances of the adapter, max_instances caps it, 0 uses all.
+ * Returns NULL when the adapter has no advertising manager.
+ */
+lm_adv_manager_t *lm_adv_manager_create(lm_adapter_t *adapter, guint max_instances, guint slot_ms);
+
+/* Unregisters every adv, call before the adapter is destroyed */
+void lm_adv_manager_destroy(lm_adv_manager_t *manager);
+
+/* The adv stays owned by the caller and must outlive lm_adv_manager_remove() */
+lm_status_t lm_adv_manager_add(lm_adv_manager_t *manager, lm_adv_t *adv, gboolean pinned);
+
+lm_status_t lm_adv_manager_remove(lm_adv_manager_t *manager, lm_adv_t *adv);
+
+/* Takes effect with the next slot */
+void lm_adv_manager_set_slot_duration(lm_adv_manager_t *manager, guint slot_ms);
+
+guint lm_adv_manager_get_instances(lm_adv_manager_t *manager);
+
+/* Number of slot rotations so far */
+guint lm_adv_manager_get_rotations(lm_adv_manager_t *manager);
+
+lm_status_t lm_adv_manager_get_stats(lm_adv_manager_t *manager, lm_adv_t *adv, lm_adv_manager_stats_t *stats);
+
+#endif //__LM_ADV_MANAGER_H__
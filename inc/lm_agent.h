@@ -3,6 +3,7 @@
 
 #include <glib.h>
 #include <gio/gio.h>
+#include "lm_type.h"
 #include "lm_forward_decl.h"
 
 typedef enum {
@@ -13,12 +14,30 @@ typedef enum {
     LM_AGENT_IO_CAPA_KEYBOARD_DISPLAY
 } lm_agent_io_capability_t;
 
+#define LM_AGENT_DEFAULT_REQUEST_TIMEOUT_MS     30000
+
+/*
+ * The request stays pending after the callback returns, answer it with
+ * lm_agent_reply_passkey() or lm_agent_reject() from any thread.
+ */
 typedef struct {
+    lm_agent_t *agent;
     lm_device_t *device;
-    guint32 passkey;
+    guint request_id;
 } lm_agent_req_passkey_ind_t;
 #define LM_AGENT_REQ_PASSKEY_IND        (LM_MODULE_AGENT | 0x0001)
 
+/*
+ * A pending request ended without an answer, status LM_STATUS_TIMEOUT or
+ * LM_STATUS_CANCELLED when bluez cancelled the pairing.
+ */
+typedef struct {
+    lm_agent_t *agent;
+    lm_device_t *device;
+    guint request_id;
+} lm_agent_req_cancelled_ind_t;
+#define LM_AGENT_REQ_CANCELLED_IND      (LM_MODULE_AGENT | 0x0002)
+
 lm_agent_t *lm_agent_create(lm_adapter_t *adapter, lm_agent_io_capability_t io_capability);
 
 void lm_agent_destroy(lm_agent_t *agent);
@@ -27,4 +46,14 @@ const gchar *lm_agent_get_path(const lm_agent_t *agent);
 
 lm_adapter_t *lm_agent_get_adapter(const lm_agent_t *agent);
 
+/* LM_STATUS_INVALID_ARGS when the request already ended */
+lm_status_t lm_agent_reply_passkey(lm_agent_t *agent, guint request_id, guint32 passkey);
+
+lm_status_t lm_agent_reject(lm_agent_t *agent, guint request_id);
+
+/* Applies to requests received afterwards, 0 waits for bluez to cancel */
+void lm_agent_set_request_timeout(lm_agent_t *agent, guint timeout_ms);
+
+guint lm_agent_get_pending_request_count(lm_agent_t *agent);
+
 #endif //__LM_AGENT_H__
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef __LM_DBUS_H__
+#define __LM_DBUS_H__
+
+#include <glib.h>
+#include "lm_type.h"
+
+/*
+ * Every outbound method call of the library goes through one wrapper that
+ * records its round trip into the LM_STATS_HISTOGRAM_METHOD histogram of
+ * "interface.method". The trace ring additionally keeps the last calls with
+ * object path and result, it is off by default.
+ */
+
+#define LM_DBUS_TRACE_PATH_MAX      96
+
+typedef struct {
+    gint64 start_us;                    /* g_get_monotonic_time() when issued */
+    guint64 duration_us;
+    const gchar *method;                /* "interface.method", valid for the process lifetime */
+    gchar path[LM_DBUS_TRACE_PATH_MAX]; /* object path, truncated */
+    gboolean sync;
+    gint error_code;                    /* 0 on success, else GError code */
+} lm_dbus_trace_entry_t;
+
+/* Keep the last capacity calls, replaces an enabled ring */
+lm_status_t lm_dbus_trace_enable(guint capacity);
+
+void lm_dbus_trace_disable(void);
+
+/* Copy up to max entries, oldest first, returns the number copied */
+guint lm_dbus_trace_get(lm_dbus_trace_entry_t *entries, guint max);
+
+/* Log the ring at info level */
+void lm_dbus_trace_dump(void);
+
+/* Log a warning for each call slower than threshold_us, 0 disables */
+void lm_dbus_set_slow_call_threshold(guint64 threshold_us);
+
+/*
+ * Capture every incoming signal and every method reply of the library into
+ * filename, with timestamps. Strings are written once and referenced by id
+ * afterwards, bodies are serialized GVariants in host byte order.
+ */
+lm_status_t lm_dbus_record_start(const gchar *filename);
+
+void lm_dbus_record_stop(void);
+
+typedef enum {
+    LM_DBUS_REPLAY_AS_FAST_AS_POSSIBLE = 0,
+    LM_DBUS_REPLAY_REAL_TIME
+} lm_dbus_replay_speed_t;
+
+typedef struct {
+    guint signals;          /* signals in the capture */
+    guint replies;          /* replies and errors in the capture */
+    guint dispatched;       /* handler invocations */
+    guint64 elapsed_us;     /* first dispatch until every handler returned */
+} lm_dbus_replay_stats_t;
+
+/*
+ * Feed a capture back into the library's signal subscriptions, on each
+ * subscriber's context and in capture order. A record is matched once every
+ * handler of the previous one returned, so subscriptions made by handlers see
+ * the following records. While it runs method calls are answered from the
+ * capture, per method and path in order, and never reach the bus; fds are not
+ * captured. Blocks until every handler ran, so the subscriber contexts must be
+ * running on other threads.
+ */
+lm_status_t lm_dbus_replay(const gchar *filename, lm_dbus_replay_speed_t speed, lm_dbus_replay_stats_t *stats);
+
+#endif //__LM_DBUS_H__
@@ -69,6 +69,35 @@ typedef struct {
 } lm_device_conn_state_change_ind_t;
 #define LM_DEVICE_CONN_STATE_CHANGE_IND  (LM_MODULE_DEVICE | 0x0007)
 
+typedef enum {
+    LM_DEVICE_RSSI_BELOW = 0,
+    LM_DEVICE_RSSI_ABOVE
+} lm_device_rssi_level_t;
+
+/* The smoothed RSSI reached the high threshold or dropped to the low one */
+typedef struct {
+    lm_adapter_t *adapter;
+    lm_device_t *device;
+    lm_device_rssi_level_t level;
+    gint16 smoothed_rssi;
+} lm_device_rssi_threshold_ind_t;
+#define LM_DEVICE_RSSI_THRESHOLD_IND     (LM_MODULE_DEVICE | 0x0008)
+
+#define LM_DEVICE_RSSI_HISTORY_LEN      16
+
+/* Over the last LM_DEVICE_RSSI_HISTORY_LEN samples, smoothed is an EWMA with alpha 1/4 */
+typedef struct {
+    gint16 last;
+    gint16 smoothed;
+    gint16 min;
+    gint16 max;
+    gdouble mean;
+    gdouble variance;
+    gdouble trend;              /* dBm per second, oldest to newest sample */
+    guint samples;
+    gint64 last_time_us;        /* monotonic */
+} lm_device_rssi_stats_t;
+
 lm_device_t *lm_device_lookup_by_bdaddr(lm_adapter_t *adapter, const bdaddr_t *addr);
 
 lm_device_t *lm_device_lookup_by_path(lm_adapter_t *adapter, const gchar *path);
@@ -83,10 +112,30 @@ lm_device_bonding_state_t lm_device_get_bonding_state(const lm_device_t *device)
 
 gint16 lm_device_get_rssi(const lm_device_t *device);
 
+/* G_MININT16 before the first RSSI */
+gint16 lm_device_get_smoothed_rssi(const lm_device_t *device);
+
+/* LM_STATUS_FAIL before the first RSSI */
+lm_status_t lm_device_get_rssi_stats(const lm_device_t *device, lm_device_rssi_stats_t *stats);
+
+/* Copies up to max samples, oldest first, time_us may be NULL. Returns the number copied */
+guint lm_device_get_rssi_history(const lm_device_t *device, gint16 *rssi, gint64 *time_us, guint max);
+
+/*
+ * LM_DEVICE_RSSI_THRESHOLD_IND is sent when the smoothed RSSI reaches high or
+ * drops to low, nothing is sent while it stays between them.
+ */
+lm_status_t lm_device_set_rssi_thresholds(lm_device_t *device, gint16 low, gint16 high);
+
+void lm_device_clear_rssi_thresholds(lm_device_t *device);
+
 gboolean lm_device_has_service(const lm_device_t *device, const gchar *service_uuid);
 
 GHashTable *lm_device_get_service_data(const lm_device_t *device);
 
+/* company id (gint *) -> GByteArray */
+GHashTable *lm_device_get_manufacturer_data(const lm_device_t *device);
+
 const gchar *lm_device_get_path(lm_device_t *device);
 
 GList *lm_device_get_uuids(lm_device_t *device);
@@ -112,6 +161,7 @@ lm_status_t lm_device_connect_sync(lm_device_t *device);
 lm_status_t lm_device_start_sync_broadcast(lm_device_t *device,
     lm_transport_audio_location_t location);
 
+/* LM_STATUS_PENDING on success, the device removal completes with LM_ADAPTER_REMOVE_DEVICE_CNF */
 lm_status_t lm_device_stop_sync_broadcast(lm_device_t *device);
 
 GPtrArray *lm_device_get_transports(lm_device_t *device, lm_transport_profile_t profile);
@@ -0,0 +1,61 @@
+#ifndef __LM_ENDPOINT_H__
+#define __LM_ENDPOINT_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "lm_forward_decl.h"
+#include "lm_type.h"
+
+typedef struct {
+    const gchar *uuid;              /* e.g. AUDIO_SINK_SERVICE_UUID, SINK_PAC_SERVICE_UUID */
+    guint8 codec;
+    guint32 vendor;                 /* vendor codec id, 0 for none */
+    const guint8 *capabilities;
+    gsize capabilities_size;
+    gboolean delay_reporting;
+} lm_endpoint_config_t;
+
+/*
+ * Called on a SelectConfiguration cache miss. Append the chosen configuration
+ * to configuration and return LM_STATUS_SUCCESS, the answer is then cached for
+ * this capabilities blob.
+ */
+typedef lm_status_t (*lm_endpoint_select_callback_t)(lm_endpoint_t *endpoint,
+                const guint8 *capabilities, gsize capabilities_size,
+                GByteArray *configuration, gpointer user_data);
+
+typedef struct {
+    lm_endpoint_t *endpoint;
+    const gchar *transport_path;
+    GVariant *properties;           /* a{sv} as passed by bluez */
+} lm_endpoint_set_configuration_ind_t;
+#define LM_ENDPOINT_SET_CONFIGURATION_IND       (LM_MODULE_ENDPOINT | 0x0001)
+
+typedef struct {
+    lm_endpoint_t *endpoint;
+    const gchar *transport_path;
+} lm_endpoint_clear_configuration_ind_t;
+#define LM_ENDPOINT_CLEAR_CONFIGURATION_IND     (LM_MODULE_ENDPOINT | 0x0002)
+
+typedef struct {
+    lm_endpoint_t *endpoint;
+} lm_endpoint_released_ind_t;
+#define LM_ENDPOINT_RELEASED_IND                (LM_MODULE_ENDPOINT | 0x0003)
+
+lm_endpoint_t *lm_endpoint_register(lm_adapter_t *adapter, const lm_endpoint_config_t *config,
+                lm_endpoint_select_callback_t select_callback, gpointer user_data);
+
+void lm_endpoint_unregister(lm_endpoint_t *endpoint);
+
+/* Precompute the answer for a capabilities blob, replaces an existing entry */
+lm_status_t lm_endpoint_add_configuration(lm_endpoint_t *endpoint,
+                const guint8 *capabilities, gsize capabilities_size,
+                const guint8 *configuration, gsize configuration_size);
+
+void lm_endpoint_clear_configurations(lm_endpoint_t *endpoint);
+
+const gchar *lm_endpoint_get_path(const lm_endpoint_t *endpoint);
+
+void lm_endpoint_get_cache_stats(lm_endpoint_t *endpoint, guint *hits, guint *misses);
+
+#endif //__LM_ENDPOINT_H__
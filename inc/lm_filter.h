@@ -0,0 +1,41 @@
+#ifndef __LM_FILTER_H__
+#define __LM_FILTER_H__
+
+#include <glib.h>
+#include "lm_forward_decl.h"
+
+/*
+ * Compiled set of discovery rules, a device matches when any rule does.
+ * Name and address prefixes go into tries, manufacturer and service data
+ * rules into hash tables and SIG 16 bit service UUIDs into a bitset, so a
+ * device is checked in one pass whatever the number of rules.
+ */
+
+typedef enum {
+    LM_FILTER_RULE_NAME_PREFIX = 0,         /* ASCII case insensitive */
+    LM_FILTER_RULE_ADDRESS_PREFIX,      /* e.g. an OUI "00:1A:7D", case insensitive */
+    LM_FILTER_RULE_MANUFACTURER,
+    LM_FILTER_RULE_SERVICE_UUID,
+    LM_FILTER_RULE_SERVICE_DATA
+} lm_filter_rule_type_t;
+
+typedef struct {
+    lm_filter_rule_type_t type;
+    const gchar *string;        /* prefix, or the service UUID of SERVICE_UUID and SERVICE_DATA */
+    guint16 company_id;         /* MANUFACTURER only */
+    const guint8 *data;         /* MANUFACTURER and SERVICE_DATA, NULL matches any data */
+    const guint8 *mask;         /* NULL compares every bit of data */
+    guint data_len;
+} lm_filter_rule_t;
+
+/* rules are copied, returns NULL when a rule is invalid */
+lm_filter_t *lm_filter_compile(const lm_filter_rule_t *rules, guint n_rules);
+
+void lm_filter_destroy(lm_filter_t *filter);
+
+/* rule_index, when not NULL, receives the index of a matching rule or -1 */
+gboolean lm_filter_match(const lm_filter_t *filter, lm_device_t *device, gint *rule_index);
+
+guint lm_filter_get_rule_count(const lm_filter_t *filter);
+
+#endif //__LM_FILTER_H__
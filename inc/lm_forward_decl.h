@@ -4,8 +4,18 @@
 typedef struct lm_adapter lm_adapter_t;
 typedef struct lm_device lm_device_t;
 typedef struct lm_adv lm_adv_t;
+typedef struct lm_adv_manager lm_adv_manager_t;
 typedef struct lm_agent lm_agent_t;
 typedef struct lm_player lm_player_t;
 typedef struct lm_transport lm_transport_t;
+typedef struct lm_histogram lm_histogram_t;
+typedef struct lm_gatt_notify lm_gatt_notify_t;
+typedef struct lm_gatt_write_stream lm_gatt_write_stream_t;
+typedef struct lm_profile lm_profile_t;
+typedef struct lm_profile_conn lm_profile_conn_t;
+typedef struct lm_endpoint lm_endpoint_t;
+typedef struct lm_pairing lm_pairing_t;
+typedef struct lm_filter lm_filter_t;
+typedef struct lm_scan_feed lm_scan_feed_t;
 
 #endif //LM_FORWARD_DECL_H
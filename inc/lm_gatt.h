@@ -0,0 +1,70 @@
+#ifndef __LM_GATT_H__
+#define __LM_GATT_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "lm_forward_decl.h"
+#include "lm_type.h"
+
+/*
+ * data is only valid during the callback. With an acquired fd the callback
+ * runs on the lea manager io thread, with the StartNotify fallback it runs
+ * on the dbus thread.
+ */
+typedef void (*lm_gatt_notify_callback_t)(lm_gatt_notify_t *notify, const guint8 *data, gsize len,
+                gpointer user_data);
+
+typedef struct {
+    lm_gatt_notify_t *notify;
+} lm_gatt_notify_stopped_ind_t;
+#define LM_GATT_NOTIFY_STOPPED_IND          (LM_MODULE_GATT | 0x0001)
+
+typedef struct {
+    lm_gatt_write_stream_t *stream;
+} lm_gatt_write_stream_closed_ind_t;
+#define LM_GATT_WRITE_STREAM_CLOSED_IND     (LM_MODULE_GATT | 0x0002)
+
+typedef struct {
+    guint64 bytes_written;      /* handed to the socket since open */
+    gsize   bytes_pending;      /* still queued */
+    gint64  elapsed_us;         /* since the first write */
+    guint64 bytes_per_sec;      /* average throughput */
+} lm_gatt_write_progress_t;
+
+/* Called on the io thread each time queued data went out, writing more from here is allowed */
+typedef void (*lm_gatt_write_progress_callback_t)(lm_gatt_write_stream_t *stream,
+                const lm_gatt_write_progress_t *progress, gpointer user_data);
+
+lm_gatt_notify_t *lm_gatt_notify_start(lm_device_t *device, const gchar *char_uuid,
+                lm_gatt_notify_callback_t callback, gpointer user_data);
+
+void lm_gatt_notify_stop(lm_gatt_notify_t *notify);
+
+lm_device_t *lm_gatt_notify_get_device(const lm_gatt_notify_t *notify);
+
+const gchar *lm_gatt_notify_get_path(const lm_gatt_notify_t *notify);
+
+/* TRUE when notifications arrive through AcquireNotify fd */
+gboolean lm_gatt_notify_is_acquired(const lm_gatt_notify_t *notify);
+
+guint16 lm_gatt_notify_get_mtu(const lm_gatt_notify_t *notify);
+
+lm_gatt_write_stream_t *lm_gatt_write_stream_open(lm_device_t *device, const gchar *char_uuid,
+                lm_gatt_write_progress_callback_t callback, gpointer user_data);
+
+/*
+ * Data is copied and split into MTU sized writes. LM_STATUS_BUSY when the
+ * queue is full, a write of any size is accepted while the queue is empty.
+ */
+lm_status_t lm_gatt_write_stream_write(lm_gatt_write_stream_t *stream, const guint8 *data, gsize len);
+
+/* Queued data not yet written is dropped */
+void lm_gatt_write_stream_close(lm_gatt_write_stream_t *stream);
+
+gsize lm_gatt_write_stream_get_pending(lm_gatt_write_stream_t *stream);
+
+void lm_gatt_write_stream_get_progress(lm_gatt_write_stream_t *stream, lm_gatt_write_progress_t *progress);
+
+guint16 lm_gatt_write_stream_get_mtu(const lm_gatt_write_stream_t *stream);
+
+#endif //__LM_GATT_H__
@@ -0,0 +1,40 @@
+#ifndef __LM_HISTOGRAM_H__
+#define __LM_HISTOGRAM_H__
+
+#include <glib.h>
+#include "lm_forward_decl.h"
+
+/*
+ * Log-linear (HDR style) histogram: 16 linear sub-buckets per power of two,
+ * so any recorded value is reported with at most ~6% relative error.
+ * Recording is lock-free and may run concurrently with the getters.
+ */
+
+lm_histogram_t *lm_histogram_create(const gchar *name, guint64 highest_value);
+
+void lm_histogram_destroy(lm_histogram_t *histogram);
+
+void lm_histogram_record(lm_histogram_t *histogram, guint64 value);
+
+void lm_histogram_reset(lm_histogram_t *histogram);
+
+const gchar *lm_histogram_get_name(const lm_histogram_t *histogram);
+
+/* Bytes held by the histogram, buckets included */
+gsize lm_histogram_get_memory_size(const lm_histogram_t *histogram);
+
+guint64 lm_histogram_get_count(const lm_histogram_t *histogram);
+
+guint64 lm_histogram_get_min(const lm_histogram_t *histogram);
+
+guint64 lm_histogram_get_max(const lm_histogram_t *histogram);
+
+gdouble lm_histogram_get_mean(const lm_histogram_t *histogram);
+
+/* percentile in range [0.0, 100.0] */
+guint64 lm_histogram_get_percentile(const lm_histogram_t *histogram, gdouble percentile);
+
+/* Log count/min/mean/p50/p90/p99/max at info level */
+void lm_histogram_dump(const lm_histogram_t *histogram, const gchar *tag);
+
+#endif //__LM_HISTOGRAM_H__
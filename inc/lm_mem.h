@@ -0,0 +1,65 @@
+#ifndef __LM_MEM_H__
+#define __LM_MEM_H__
+
+#include <glib.h>
+
+/*
+ * Memory accounting per subsystem. Modules charge the objects they allocate
+ * together with the strings and containers those objects own, so the numbers
+ * are what the library keeps alive, not what glib or libc add on top.
+ * Container bookkeeping is estimated by the lm_mem_*_size() helpers.
+ * Updating and reading take no lock.
+ */
+
+typedef enum {
+    LM_MEM_ADAPTER = 0,             /* adapters, device cache keys, RSSI index */
+    LM_MEM_DEVICE,                  /* cached devices and their properties */
+    LM_MEM_TRANSPORT,
+    LM_MEM_PLAYER,
+    LM_MEM_ADV,
+    LM_MEM_AGENT,
+    LM_MEM_VARIANT,                 /* GVariant bodies kept by the library, e.g. a loaded capture */
+    LM_MEM_MODULE_MAX
+} lm_mem_module_t;
+
+typedef struct {
+    const gchar *name;
+    guint64 live_bytes;
+    guint64 peak_bytes;
+    guint64 objects;                /* live objects, strings and containers are not counted */
+    guint64 peak_objects;
+} lm_mem_usage_t;
+
+void lm_mem_charge(lm_mem_module_t module, gsize bytes);
+
+void lm_mem_uncharge(lm_mem_module_t module, gsize bytes);
+
+/* charge and count one object of bytes, strings it owns may be included */
+void lm_mem_object_new(lm_mem_module_t module, gsize bytes);
+
+void lm_mem_object_free(lm_mem_module_t module, gsize bytes);
+
+/* Moves a running charge from old_bytes to new_bytes, for objects that recompute their footprint */
+void lm_mem_recharge(lm_mem_module_t module, gsize old_bytes, gsize new_bytes);
+
+void lm_mem_get_usage(lm_mem_module_t module, lm_mem_usage_t *usage);
+
+/* Sum of live bytes over all modules */
+guint64 lm_mem_get_live_bytes(void);
+
+/* Peaks restart from the current values */
+void lm_mem_reset_peak(void);
+
+/* Log every module at info level */
+void lm_mem_dump(void);
+
+/* Footprint estimates, each accepts NULL */
+gsize lm_mem_string_size(const gchar *string);
+
+gsize lm_mem_list_size(GList *list);
+
+gsize lm_mem_hash_table_size(GHashTable *table);
+
+gsize lm_mem_byte_array_size(GByteArray *array);
+
+#endif //__LM_MEM_H__
@@ -0,0 +1,75 @@
+#ifndef __LM_PAIRING_H__
+#define __LM_PAIRING_H__
+
+#include <glib.h>
+#include "lm_type.h"
+#include "lm_agent.h"
+#include "lm_forward_decl.h"
+
+/*
+ * Pairs, trusts and connects a batch of devices, several at a time. The
+ * batch registers its own default agent that answers passkey and
+ * confirmation requests from the policy table, so no application
+ * interaction is needed. The agent is released once the batch completes.
+ */
+
+#define LM_PAIRING_DEFAULT_MAX_PARALLEL     4
+
+typedef enum {
+    LM_PAIRING_STAGE_PAIR = 0,
+    LM_PAIRING_STAGE_TRUST,
+    LM_PAIRING_STAGE_CONNECT,
+    LM_PAIRING_STAGE_COUNT
+} lm_pairing_stage_t;
+
+typedef struct {
+    const gchar *address;       /* NULL matches every device */
+    guint32 passkey;            /* answer to RequestPasskey */
+    gboolean reject;            /* reject passkey and confirmation requests */
+} lm_pairing_policy_t;
+
+typedef struct {
+    lm_agent_io_capability_t io_capability;
+    const lm_pairing_policy_t *policies;    /* first match wins, copied */
+    guint n_policies;
+    guint max_parallel;         /* 0 uses LM_PAIRING_DEFAULT_MAX_PARALLEL */
+    gboolean connect;           /* run the connect stage */
+} lm_pairing_config_t;
+
+/*
+ * One device finished, status LM_STATUS_SUCCESS, LM_STATUS_FAIL,
+ * LM_STATUS_TIMEOUT or LM_STATUS_CANCELLED. Skipped stages report 0 us.
+ * LM_STATUS_FAIL also reports a device bluez removed during the batch.
+ */
+typedef struct {
+    lm_pairing_t *pairing;
+    const gchar *path;                  /* object path of the device */
+    lm_device_t *device;                /* looked up for this event, NULL once removed */
+    lm_pairing_stage_t failed_stage;    /* valid unless status is LM_STATUS_SUCCESS */
+    guint64 stage_us[LM_PAIRING_STAGE_COUNT];
+} lm_pairing_device_done_ind_t;
+#define LM_PAIRING_DEVICE_DONE_IND      (LM_MODULE_PAIRING | 0x0001)
+
+/* The whole batch finished, sent once after the last LM_PAIRING_DEVICE_DONE_IND */
+typedef struct {
+    lm_pairing_t *pairing;
+    guint succeeded;
+    guint failed;
+    guint64 elapsed_us;
+    gdouble devices_per_minute;
+} lm_pairing_complete_ind_t;
+#define LM_PAIRING_COMPLETE_IND         (LM_MODULE_PAIRING | 0x0002)
+
+/*
+ * devices is copied, the devices themselves are borrowed from the adapter.
+ * Devices already paired, trusted and connected complete before this returns.
+ */
+lm_pairing_t *lm_pairing_start(lm_adapter_t *adapter, const GPtrArray *devices, const lm_pairing_config_t *config);
+
+/* Devices not finished yet complete with LM_STATUS_CANCELLED */
+void lm_pairing_cancel(lm_pairing_t *pairing);
+
+/* Cancels a running batch, no events are delivered afterwards */
+void lm_pairing_destroy(lm_pairing_t *pairing);
+
+#endif //__LM_PAIRING_H__
@@ -21,6 +21,7 @@ typedef enum {
     LM_PLAYER_PROFILE_MCP
 } lm_player_profile_t;
 
+/* Strings are owned by the player and change in place with the next track update */
 typedef struct {
     gchar *title;
     gchar *artist;
@@ -49,15 +50,37 @@ typedef struct {
 } lm_player_status_change_ind_t;
 #define LM_PLAYER_STATUS_CHANGE_IND        (LM_MODULE_PLAYER | 0x0004)
 
+typedef enum {
+    LM_PLAYER_TRACK_TITLE               = (1 << 0),
+    LM_PLAYER_TRACK_ARTIST              = (1 << 1),
+    LM_PLAYER_TRACK_ALBUM               = (1 << 2),
+    LM_PLAYER_TRACK_GENRE               = (1 << 3),
+    LM_PLAYER_TRACK_NUMBER_OF_TRACKS    = (1 << 4),
+    LM_PLAYER_TRACK_TRACK_NUMBER        = (1 << 5),
+    LM_PLAYER_TRACK_DURATION            = (1 << 6),
+    LM_PLAYER_TRACK_IMAGE_HANDLE        = (1 << 7)
+} lm_player_track_field_t;
+
+/* Only sent when at least one field changed */
 typedef struct {
     lm_player_t *player;
+    guint32 changed_mask;   /* lm_player_track_field_t bits */
 } lm_player_track_update_ind_t;
 #define LM_PLAYER_TRACK_UPDATE_IND         (LM_MODULE_PLAYER | 0x0005)
 
 lm_player_status_t lm_player_get_status(lm_player_t *player);
 
+/*
+ * Position in ms. While playing it is extrapolated from the last Position or
+ * Status update with the monotonic clock, so it can be read at any rate
+ * without waiting for Position signals, from any thread. Clamped to the track
+ * duration.
+ */
 guint32 lm_player_get_position(lm_player_t *player);
 
+/* The last Position value reported by bluez, without extrapolation */
+guint32 lm_player_get_reported_position(lm_player_t *player);
+
 gchar *lm_player_get_name(lm_player_t *player);
 
 gchar *lm_player_get_type(lm_player_t *player);
@@ -0,0 +1,58 @@
+#ifndef __LM_PROFILE_H__
+#define __LM_PROFILE_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "lm_forward_decl.h"
+#include "lm_type.h"
+
+typedef enum {
+    LM_PROFILE_ROLE_DEFAULT = 0,
+    LM_PROFILE_ROLE_CLIENT,
+    LM_PROFILE_ROLE_SERVER
+} lm_profile_role_t;
+
+typedef struct {
+    const gchar *uuid;
+    const gchar *name;                  /* NULL for none */
+    lm_profile_role_t role;
+    guint16 channel;                    /* RFCOMM channel, 0 for any */
+    guint16 psm;                        /* L2CAP PSM, 0 for any */
+    gboolean require_authentication;
+    gboolean require_authorization;
+    gboolean auto_connect;
+    gsize rx_buffer_size;               /* per connection, 0 for default */
+    gsize tx_buffer_size;               /* per connection, 0 for default */
+} lm_profile_config_t;
+
+/*
+ * connected runs on the dbus thread before any data is delivered, data runs
+ * on the lea manager io thread, disconnected runs on either. data is only
+ * valid during the callback. The connection is freed after disconnected.
+ */
+typedef struct {
+    void (*connected)(lm_profile_t *profile, lm_profile_conn_t *conn, gpointer user_data);
+    void (*data)(lm_profile_t *profile, lm_profile_conn_t *conn, const guint8 *data, gsize len,
+                 gpointer user_data);
+    void (*disconnected)(lm_profile_t *profile, lm_profile_conn_t *conn, gpointer user_data);
+} lm_profile_callbacks_t;
+
+lm_profile_t *lm_profile_register(lm_adapter_t *adapter, const lm_profile_config_t *config,
+                const lm_profile_callbacks_t *callbacks, gpointer user_data);
+
+void lm_profile_unregister(lm_profile_t *profile);
+
+const gchar *lm_profile_get_path(const lm_profile_t *profile);
+
+guint lm_profile_get_connection_count(lm_profile_t *profile);
+
+/* Data is copied into the connection tx buffer. LM_STATUS_BUSY when it does not fit */
+lm_status_t lm_profile_send(lm_profile_conn_t *conn, const guint8 *data, gsize len);
+
+void lm_profile_disconnect(lm_profile_conn_t *conn);
+
+lm_device_t *lm_profile_conn_get_device(const lm_profile_conn_t *conn);
+
+const gchar *lm_profile_conn_get_device_path(const lm_profile_conn_t *conn);
+
+#endif //__LM_PROFILE_H__
@@ -0,0 +1,32 @@
+#ifndef __LM_SCAN_FEED_H__
+#define __LM_SCAN_FEED_H__
+
+#include <glib.h>
+#include "lm_type.h"
+#include "lm_forward_decl.h"
+#include "lm_scan_record.h"
+
+/*
+ * Publishes discovery results into a POSIX shared memory ring so other
+ * processes can follow the scan without their own D-Bus client, see
+ * lm_scan_reader.h. Single producer: attach a feed to one adapter only.
+ * Slow readers are overrun, the writer never waits.
+ */
+
+#define LM_SCAN_FEED_DEFAULT_CAPACITY   1024
+
+/*
+ * name as for shm_open(), e.g. "/lm_scan_hci0". capacity is rounded up to a
+ * power of two, 0 uses the default. An existing segment of that name is
+ * unlinked, not reused; readers of it stop seeing updates and must reopen.
+ */
+lm_scan_feed_t *lm_scan_feed_create(const gchar *name, guint capacity);
+
+/* Unlinks the segment, readers keep their mapping but see no new records */
+void lm_scan_feed_destroy(lm_scan_feed_t *feed);
+
+void lm_scan_feed_publish(lm_scan_feed_t *feed, lm_device_t *device);
+
+guint64 lm_scan_feed_get_published(lm_scan_feed_t *feed);
+
+#endif //__LM_SCAN_FEED_H__
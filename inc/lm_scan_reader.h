@@ -0,0 +1,29 @@
+#ifndef __LM_SCAN_READER_H__
+#define __LM_SCAN_READER_H__
+
+#include <stdint.h>
+#include "lm_scan_record.h"
+
+/*
+ * Reader side of the shared memory scan feed, plain C without glib so it can
+ * be linked into any consumer (liblm_scan_reader.a). Readers never write to
+ * the segment, any number of them may follow the same feed.
+ */
+
+typedef struct lm_scan_reader lm_scan_reader_t;
+
+/* Starts after the newest published record, returns NULL with errno set on failure */
+lm_scan_reader_t *lm_scan_reader_open(const char *name);
+
+void lm_scan_reader_close(lm_scan_reader_t *reader);
+
+/*
+ * Copies the next record into record. Returns 1 when a record was read and 0
+ * when the reader caught up with the writer. Records overwritten before they
+ * were read are skipped and counted in lm_scan_reader_get_dropped().
+ */
+int lm_scan_reader_next(lm_scan_reader_t *reader, lm_scan_record_t *record);
+
+uint64_t lm_scan_reader_get_dropped(const lm_scan_reader_t *reader);
+
+#endif //__LM_SCAN_READER_H__
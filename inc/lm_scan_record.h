@@ -0,0 +1,42 @@
+#ifndef __LM_SCAN_RECORD_H__
+#define __LM_SCAN_RECORD_H__
+
+#include <stdint.h>
+
+/*
+ * Layout of the shared memory scan feed, shared by lm_scan_feed (writer) and
+ * lm_scan_reader. A header followed by a power of two ring of records. Each
+ * record is a seqlock: seq is 2n+1 while record n is written and 2n+2 once
+ * it is complete, readers copy the record and drop it when seq moved meanwhile.
+ * Records returned by lm_scan_reader_next() carry the record number n in seq.
+ */
+
+#define LM_SCAN_FEED_MAGIC          0x464d534cu     /* "LSMF" */
+#define LM_SCAN_FEED_VERSION        1
+#define LM_SCAN_RECORD_AD_MAX       31              /* legacy advertising payload size */
+
+#define LM_SCAN_RECORD_FLAG_RANDOM_ADDRESS      (1 << 0)
+#define LM_SCAN_RECORD_FLAG_PAIRED              (1 << 1)
+#define LM_SCAN_RECORD_FLAG_AD_TRUNCATED        (1 << 2)   /* data did not fit in ad[] */
+
+typedef struct {
+    uint64_t seq;
+    uint64_t timestamp_us;      /* CLOCK_MONOTONIC */
+    uint8_t bdaddr[6];          /* bdaddr_t byte order, least significant byte first */
+    int8_t rssi;
+    uint8_t flags;
+    uint8_t ad_len;
+    uint8_t ad[LM_SCAN_RECORD_AD_MAX];  /* AD structures rebuilt from name, manufacturer and service data */
+} lm_scan_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;          /* records in the ring, power of two */
+    uint32_t record_size;       /* sizeof(lm_scan_record_t) of the writer */
+    uint8_t reserved[48];
+    uint64_t head;              /* records published so far, on its own cache line */
+    uint8_t reserved_head[56];
+} lm_scan_feed_header_t;
+
+#endif //__LM_SCAN_RECORD_H__
@@ -0,0 +1,77 @@
+#ifndef __LM_STATS_H__
+#define __LM_STATS_H__
+
+#include <glib.h>
+#include "lm_forward_decl.h"
+#include "lm_type.h"
+
+/*
+ * Library wide counters and latency histograms. Entries are created on first
+ * use and never removed, so names returned in a snapshot stay valid for the
+ * lifetime of the process. Updating and reading take no lock.
+ */
+
+typedef enum {
+    LM_STATS_SIGNAL = 0,            /* D-Bus signals received, "interface.member" */
+    LM_STATS_PROPERTY,              /* property updates, property name */
+    LM_STATS_EVENT,                 /* events dispatched, lm_msg_type_t as "0x%08x" */
+    LM_STATS_GAUGE,                 /* last value set, e.g. "device_cache /org/bluez/hci0" */
+    LM_STATS_COUNTER_MAX
+} lm_stats_counter_kind_t;
+
+typedef enum {
+    LM_STATS_HISTOGRAM_CALLBACK = 0,    /* app event dispatch time over all callbacks in us, "dispatch" */
+    LM_STATS_HISTOGRAM_METHOD,          /* D-Bus method round trip in us, "interface.member" */
+    LM_STATS_HISTOGRAM_MAX
+} lm_stats_histogram_kind_t;
+
+typedef struct {
+    const gchar *name;
+    guint64 value;
+} lm_stats_counter_t;
+
+typedef struct {
+    const gchar *name;
+    guint64 count;
+    guint64 min;
+    guint64 p50;
+    guint64 p90;
+    guint64 p99;
+    guint64 max;
+    gdouble mean;
+} lm_stats_histogram_summary_t;
+
+typedef struct {
+    gint64 timestamp_us;            /* g_get_real_time() when taken */
+    GArray *counters[LM_STATS_COUNTER_MAX];         /* lm_stats_counter_t */
+    GArray *histograms[LM_STATS_HISTOGRAM_MAX];     /* lm_stats_histogram_summary_t */
+    guint overflow;                 /* updates lost because a table was full */
+} lm_stats_snapshot_t;
+
+void lm_stats_count(lm_stats_counter_kind_t kind, const gchar *name);
+
+void lm_stats_add(lm_stats_counter_kind_t kind, const gchar *name, guint64 delta);
+
+void lm_stats_set(lm_stats_counter_kind_t kind, const gchar *name, guint64 value);
+
+void lm_stats_record(lm_stats_histogram_kind_t kind, const gchar *name, guint64 value);
+
+/* Look the histogram up once and record into it directly on hot paths, NULL when the table is full */
+lm_histogram_t *lm_stats_get_histogram(lm_stats_histogram_kind_t kind, const gchar *name);
+
+lm_stats_snapshot_t *lm_stats_snapshot(void);
+
+void lm_stats_snapshot_free(lm_stats_snapshot_t *snapshot);
+
+/* Zero all counters and histograms, entries are kept */
+void lm_stats_reset(void);
+
+/* Append a snapshot to file_path, or log it at info level when file_path is NULL */
+lm_status_t lm_stats_dump(const gchar *file_path);
+
+/* Dump every interval_sec seconds from the lea manager dbus thread, replaces a running dump */
+lm_status_t lm_stats_start_periodic_dump(guint interval_sec, const gchar *file_path);
+
+void lm_stats_stop_periodic_dump(void);
+
+#endif //__LM_STATS_H__
@@ -5,6 +5,7 @@
 #include <gio/gio.h>
 #include "lm_forward_decl.h"
 #include "lm_type.h"
+#include "lm_histogram.h"
 
 typedef struct {
     guint8  big;
@@ -53,6 +54,16 @@ typedef enum {
     LM_TRANSPORT_AUDIO_LOCATION_STEREO
 } lm_transport_audio_location_t;
 
+/* Histogram values are in microseconds */
+typedef enum {
+    LM_TRANSPORT_METRIC_SELECT_TO_ACTIVE = 0,       /* Select() call until state "active" */
+    LM_TRANSPORT_METRIC_DISCOVERED_TO_STREAMING,    /* LM_ADAPTER_BCAST_DISCOVERED_IND until "broadcasting"/"active" */
+    LM_TRANSPORT_METRIC_PENDING_TO_ACTIVE,          /* state "pending" until "active" */
+    LM_TRANSPORT_METRIC_DELAY,                      /* A2DP delay report */
+    LM_TRANSPORT_METRIC_DELAY_JITTER,               /* change between consecutive delay reports */
+    LM_TRANSPORT_METRIC_MAX
+} lm_transport_metric_t;
+
 typedef struct {
     lm_transport_t *transport;
 } lm_transport_added_ind_t;
@@ -99,4 +110,13 @@ lm_transport_profile_t lm_transport_get_profile(lm_transport_t *transport);
 const gchar *lm_transport_get_profile_name(lm_transport_t *transport);
 
 lm_transport_qos_t *lm_transport_get_qos(lm_transport_t *transport);
+
+/* Monotonic time (us) of the last transition into state, 0 if never entered */
+gint64 lm_transport_get_state_timestamp(lm_transport_t *transport, lm_transport_state_t state);
+
+const lm_histogram_t *lm_transport_get_histogram(lm_transport_t *transport, lm_transport_metric_t metric);
+
+void lm_transport_reset_metrics(lm_transport_t *transport);
+
+void lm_transport_dump_metrics(lm_transport_t *transport);
 #endif //__LM_TRANSPORT_H__
\ No newline at end of file
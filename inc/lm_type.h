@@ -15,6 +15,7 @@
 #define LM_MODULE_TRANSPORT                     (0x06 << LM_MODULE_OFFSET)
 #define LM_MODULE_ENDPOINT                      (0x07 << LM_MODULE_OFFSET)
 #define LM_MODULE_GATT                          (0x08 << LM_MODULE_OFFSET)
+#define LM_MODULE_PAIRING                       (0x09 << LM_MODULE_OFFSET)
 #define LM_MODULE_MAX                           (0x1F << LM_MODULE_OFFSET)
 
 #define LM_STATUS_SUCCESS                       (LM_MODULE_GENERAL | (0))
@@ -24,6 +25,7 @@
 #define LM_STATUS_BUSY                          (LM_MODULE_GENERAL | (1 << 3))
 #define LM_STATUS_TIMEOUT                       (LM_MODULE_GENERAL | (1 << 4))
 #define LM_STATUS_NOT_READY                     (LM_MODULE_GENERAL | (1 << 5))
+#define LM_STATUS_CANCELLED                     (LM_MODULE_GENERAL | (1 << 6))
 
 typedef guint32 lm_status_t;
 
@@ -5,12 +5,15 @@
 #include "lm_device.h"
 #include "lm_agent.h"
 #include "lm_uuids.h"
+#include <string.h>
+#include <unistd.h>
 #define TAG "main"
 
 static GMainLoop *loop = NULL;
 static lm_adapter_t *default_adapter = NULL;
 static lm_adv_t *adv = NULL;
 static lm_agent_t *agent = NULL;
+static gint passkey_request_id = 0;
 
 static lm_status_t lm_adapter_callback(lm_msg_type_t msg,
                                        __attribute__((unused)) lm_status_t status,
@@ -44,6 +47,21 @@ static lm_status_t lm_adapter_callback(lm_msg_type_t msg,
     return LM_STATUS_SUCCESS;
 }
 
+static void update_ascs_announcement(gboolean available)
+{
+    GByteArray *ascs_data_array = g_byte_array_new();
+    // 0x00:Announcement Type
+    // 0xFF,0x0F:Available sink contexts
+    // 0x43,0x02:Available source context
+    guint8 ascs_data[] = {0x00, 0xFF, 0x0F, 0x43, 0x02, 0x00};
+    if (!available)
+        memset(&ascs_data[1], 0, 4);
+    g_byte_array_append(ascs_data_array, ascs_data, sizeof(ascs_data));
+    lm_adv_set_service_data(adv,
+            AUDIO_STREAM_CONTROL_SERVICE_UUID, ascs_data_array);
+    g_byte_array_free(ascs_data_array, TRUE);
+}
+
 static lm_status_t lm_device_callback(lm_msg_type_t msg,
                                       __attribute__((unused)) lm_status_t status,
                                       void *buf)
@@ -54,7 +72,7 @@ static lm_status_t lm_device_callback(lm_msg_type_t msg,
             lm_log_debug(TAG, "device '%s %s' connected, bearer '%s'",
                 lm_device_get_name(ind->device), lm_device_get_path(ind->device), ind->bearer);
             if (g_str_equal(ind->bearer, "le"))
-                lm_adapter_stop_adv(ind->adapter, adv);
+                update_ascs_announcement(FALSE);
             break;
         }
         case LM_DEVICE_DISCONNECTED_IND: {
@@ -65,7 +83,7 @@ static lm_status_t lm_device_callback(lm_msg_type_t msg,
                 ind->bearer,
                 ind->reason);
             if (g_str_equal(ind->bearer, "le"))
-                lm_adapter_start_adv(ind->adapter, adv);
+                update_ascs_announcement(TRUE);
             break;
         }
         default:
@@ -76,7 +94,7 @@ static lm_status_t lm_device_callback(lm_msg_type_t msg,
 }
 
 static lm_status_t lm_agent_callback(lm_msg_type_t msg,
-                                     __attribute__((unused))lm_status_t status,
+                                     lm_status_t status,
                                      void *buf)
 {
     switch (msg) {
@@ -84,10 +102,14 @@ static lm_status_t lm_agent_callback(lm_msg_type_t msg,
             lm_agent_req_passkey_ind_t *ind = (lm_agent_req_passkey_ind_t *)buf;
             lm_log_debug(TAG, "requesting passkey for '%s", lm_device_get_name(ind->device));
             lm_log_debug(TAG, "Enter 6 digit pin code: ");
-            int result = fscanf(stdin, "%d", &ind->passkey);
-            if (result != 1) {
-                lm_log_error(TAG, "didn't read a pin code");
-            }
+            // answered from stdin_callback(), the dbus thread keeps running meanwhile
+            g_atomic_int_set(&passkey_request_id, (gint) ind->request_id);
+            break;
+        }
+        case LM_AGENT_REQ_CANCELLED_IND: {
+            lm_agent_req_cancelled_ind_t *ind = (lm_agent_req_cancelled_ind_t *)buf;
+            lm_log_debug(TAG, "passkey request %u ended, status %d", ind->request_id, status);
+            g_atomic_int_compare_and_exchange(&passkey_request_id, (gint) ind->request_id, 0);
             break;
         }
         default:
@@ -97,6 +119,27 @@ static lm_status_t lm_agent_callback(lm_msg_type_t msg,
     return LM_STATUS_SUCCESS;
 }
 
+static gboolean stdin_callback(GIOChannel *channel,
+                               __attribute__((unused)) GIOCondition condition,
+                               __attribute__((unused)) gpointer data)
+{
+    gchar *line = NULL;
+    if (g_io_channel_read_line(channel, &line, NULL, NULL, NULL) != G_IO_STATUS_NORMAL)
+        return G_SOURCE_REMOVE;
+
+    gint request_id = g_atomic_int_get(&passkey_request_id);
+    if (request_id && agent && g_atomic_int_compare_and_exchange(&passkey_request_id, request_id, 0)) {
+        guint64 passkey = 0;
+        if (g_ascii_string_to_unsigned(g_strstrip(line), 10, 0, 999999, &passkey, NULL))
+            lm_agent_reply_passkey(agent, request_id, (guint32) passkey);
+        else
+            lm_agent_reject(agent, request_id);
+    }
+    g_free(line);
+
+    return G_SOURCE_CONTINUE;
+}
+
 static gboolean callback(gpointer data) {
 
     if (adv) {
@@ -160,6 +203,10 @@ int main(__attribute__((unused)) int argc, __attribute__((unused)) char *argv[])
 
     agent = lm_agent_create(default_adapter, LM_AGENT_IO_CAPA_DISPLAY_YES_NO);
 
+    GIOChannel *stdin_channel = g_io_channel_unix_new(STDIN_FILENO);
+    g_io_add_watch(stdin_channel, G_IO_IN, stdin_callback, NULL);
+    g_io_channel_unref(stdin_channel);
+
     adv = lm_adv_create();
 
     lm_adv_set_type(adv, LM_ADV_PERIPHERAL);
@@ -177,15 +224,7 @@ int main(__attribute__((unused)) int argc, __attribute__((unused)) char *argv[])
     lm_adv_set_services(adv, adv_service_uuids);
     g_ptr_array_free(adv_service_uuids, TRUE);
 
-    GByteArray *ascs_data_array = g_byte_array_new();
-    // 0x00:Announcement Type
-    // 0xFF,0x0F:Available sink contexts
-    // 0x43,0x02:Available source context
-    guint8 ascs_data[] = {0x00, 0xFF, 0x0F, 0x43, 0x02, 0x00};
-    g_byte_array_append(ascs_data_array, ascs_data, sizeof(ascs_data));
-    lm_adv_set_service_data(adv,
-            AUDIO_STREAM_CONTROL_SERVICE_UUID, ascs_data_array);
-    g_byte_array_free(ascs_data_array, TRUE);
+    update_ascs_announcement(TRUE);
 
     GByteArray *tmas_data_array = g_byte_array_new();
     //0x2A: call terminal, unicast media receiver, broadcast media receiver
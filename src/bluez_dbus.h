@@ -2,6 +2,8 @@
 #define __BLUEZ_DBUS_H__
 
 #define BLUEZ_DBUS                                  "org.bluez"
+#define DBUS_SERVICE                                "org.freedesktop.DBus"
+#define DBUS_PATH                                   "/org/freedesktop/DBus"
 
 #define INTERFACE_ADAPTER                           "org.bluez.Adapter1"
 #define INTERFACE_AGENT                             "org.bluez.Agent1"
@@ -13,12 +15,19 @@
 #define INTERFACE_CHARACTERISTIC                    "org.bluez.GattCharacteristic1"
 #define INTERFACE_DESCRIPTOR                        "org.bluez.GattDescriptor1"
 #define INTERFACE_SERVICE                           "org.bluez.GattService1"
+#define INTERFACE_MEDIA                             "org.bluez.Media1"
 #define INTERFACE_MEDIA_ENDPOINT                    "org.bluez.MediaEndpoint1"
 #define INTERFACE_MEDIA_PLAYER                      "org.bluez.MediaPlayer1"
 #define INTERFACE_MEDIA_CONTROL                     "org.bluez.MediaControl1"
 #define INTERFACE_MEDIA_TRANSPORT                   "org.bluez.MediaTransport1"
+#define INTERFACE_PROFILE                           "org.bluez.Profile1"
+#define INTERFACE_PROFILE_MANAGER                   "org.bluez.ProfileManager1"
 #define INTERFACE_OBJECT_MANAGER                    "org.freedesktop.DBus.ObjectManager"
 #define INTERFACE_PROPERTIES                        "org.freedesktop.DBus.Properties"
+#define INTERFACE_DBUS                              "org.freedesktop.DBus"
+
+#define DBUS_METHOD_ADD_MATCH                       "AddMatch"
+#define DBUS_METHOD_REMOVE_MATCH                    "RemoveMatch"
 
 #define ADAPTER_METHOD_START_DISCOVERY              "StartDiscovery"
 #define ADAPTER_METHOD_STOP_DISCOVERY               "StopDiscovery"
@@ -46,6 +55,16 @@
 #define AGENT_METHOD_AUTHORIZESERVICE               "AuthorizeService"
 #define AGENT_METHOD_CANCEL                         "Cancel"
 
+#define BLUEZ_ERROR_REJECTED                        "org.bluez.Error.Rejected"
+#define BLUEZ_ERROR_CANCELED                        "org.bluez.Error.Canceled"
+
+#define PROFILE_MANAGER_METHOD_REGISTER             "RegisterProfile"
+#define PROFILE_MANAGER_METHOD_UNREGISTER           "UnregisterProfile"
+
+#define PROFILE_METHOD_NEW_CONNECTION               "NewConnection"
+#define PROFILE_METHOD_REQUEST_DISCONNECTION        "RequestDisconnection"
+#define PROFILE_METHOD_RELEASE                      "Release"
+
 #define ADV_MANAGER_METHOD_REGISTER                 "RegisterAdvertisement"
 #define ADV_MANAGER_METHOD_UNREGISTER               "UnregisterAdvertisement"
 #define ADV_MANAGER_PROPERTY_ACTIVE_INSTANCES       "ActiveInstances"
@@ -96,10 +115,27 @@
 #define CHARACTERISTIC_PROPERTY_NOTIFYING           "Notifying"
 #define CHARACTERISTIC_PROPERTY_VALUE               "Value"
 #define CHARACTERISTIC_METHOD_CONFIRM               "Confirm"
+#define CHARACTERISTIC_METHOD_ACQUIRE_WRITE         "AcquireWrite"
+#define CHARACTERISTIC_METHOD_ACQUIRE_NOTIFY        "AcquireNotify"
+#define CHARACTERISTIC_PROPERTY_UUID                "UUID"
+#define CHARACTERISTIC_PROPERTY_FLAGS               "Flags"
 
 #define DESCRIPTOR_METHOD_READ_VALUE                "ReadValue"
 #define DESCRIPTOR_METHOD_WRITE_VALUE               "WriteValue"
 
+#define MEDIA_METHOD_REGISTER_ENDPOINT              "RegisterEndpoint"
+#define MEDIA_METHOD_UNREGISTER_ENDPOINT            "UnregisterEndpoint"
+
+#define MEDIA_ENDPOINT_METHOD_SELECT_CONFIGURATION  "SelectConfiguration"
+#define MEDIA_ENDPOINT_METHOD_SET_CONFIGURATION     "SetConfiguration"
+#define MEDIA_ENDPOINT_METHOD_CLEAR_CONFIGURATION   "ClearConfiguration"
+#define MEDIA_ENDPOINT_METHOD_RELEASE               "Release"
+#define MEDIA_ENDPOINT_PROPERTY_UUID                "UUID"
+#define MEDIA_ENDPOINT_PROPERTY_CODEC               "Codec"
+#define MEDIA_ENDPOINT_PROPERTY_VENDOR              "Vendor"
+#define MEDIA_ENDPOINT_PROPERTY_CAPABILITIES        "Capabilities"
+#define MEDIA_ENDPOINT_PROPERTY_DELAY_REPORTING     "DelayReporting"
+
 #define MEDIA_PLAYER_METHOD_PLAY                    "Play"
 #define MEDIA_PLAYER_METHOD_PAUSE                   "Pause"
 #define MEDIA_PLAYER_METHOD_STOP                    "Stop"
@@ -1,11 +1,18 @@
 #include "lm.h"
 #include "lm_log.h"
 #include "lm_transport.h"
+#include "lm_stats.h"
+#include "lm_stats_priv.h"
+#include "lm_histogram.h"
 #include <glib.h>
 
 #define LM_APP_CALLBACK_MAX     20
 #define TAG                     "lm"
 
+/* event counters are cached per module for the first ids, the others are looked up by name */
+#define LM_EVENT_MODULE_COUNT   (1 << (32 - LM_MODULE_OFFSET))
+#define LM_EVENT_ID_CACHED      16
+
 typedef struct {
     gboolean in_use;
     guint32 mask;
@@ -28,12 +35,16 @@ typedef struct {
     GDBusConnection *gdbus_conn;
     GMainLoop *main_loop;
     pthread_t thread_id;
+    guint stats_filter_id;
     lm_state_t state;
 } lm_context_t;
 
 static lm_app_callback_block_t app_callback_table[LM_APP_CALLBACK_MAX] = {0};
 static lm_usr_callback_block_t usr_callback_table[LM_CALLBACK_TYPE_MAX - 1];
 static lm_context_t lm_context = {0};
+/* Borrowed, entries of lm_stats are never freed */
+static guint64 *event_counters[LM_EVENT_MODULE_COUNT][LM_EVENT_ID_CACHED];
+static lm_histogram_t *dispatch_time;
 
 static void *lm_dbus_thread(void *user_data)
 {
@@ -64,6 +75,9 @@ lm_status_t lm_init(void)
         goto FAIL;
     }
 
+    lm_context.stats_filter_id = g_dbus_connection_add_filter(lm_context.gdbus_conn,
+                                                              lm_stats_dbus_filter, NULL, NULL);
+
     if (!lm_context.main_loop)
         lm_context.main_loop = g_main_loop_new(NULL, FALSE);
 
@@ -90,6 +104,8 @@ FAIL:
     }
 
     if (lm_context.gdbus_conn) {
+        g_dbus_connection_remove_filter(lm_context.gdbus_conn, lm_context.stats_filter_id);
+        lm_context.stats_filter_id = 0;
         g_dbus_connection_close_sync(lm_context.gdbus_conn, NULL, NULL);
         g_object_unref(lm_context.gdbus_conn);
         lm_context.gdbus_conn = NULL;
@@ -106,6 +122,8 @@ lm_status_t lm_deinit(void)
         return LM_STATUS_FAIL;
     }
 
+    lm_stats_stop_periodic_dump();
+
     if (lm_context.main_loop) {
         g_main_loop_quit(lm_context.main_loop);
     }
@@ -121,6 +139,8 @@ lm_status_t lm_deinit(void)
     }
 
     if (lm_context.gdbus_conn) {
+        g_dbus_connection_remove_filter(lm_context.gdbus_conn, lm_context.stats_filter_id);
+        lm_context.stats_filter_id = 0;
         g_dbus_connection_close_sync(lm_context.gdbus_conn, NULL, NULL);
         g_object_unref(lm_context.gdbus_conn);
         lm_context.gdbus_conn = NULL;
@@ -202,17 +222,58 @@ lm_status_t lm_unregister_callback(lm_callback_type_t type,
 
 }
 
+/* Looked up by name once per msg, racing threads find the same entry */
+static guint64 *lm_event_counter(lm_msg_type_t msg)
+{
+    guint32 module = (guint32)msg >> LM_MODULE_OFFSET;
+    guint32 id = (guint32)msg & ((1u << LM_MODULE_OFFSET) - 1);
+    guint64 **slot = id < LM_EVENT_ID_CACHED ? &event_counters[module][id] : NULL;
+    guint64 *counter = slot ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+
+    if (!counter) {
+        gchar name[16];
+        g_snprintf(name, sizeof(name), "0x%08x", msg);
+        counter = lm_stats_get_counter(LM_STATS_EVENT, name);
+        if (slot)
+            __atomic_store_n(slot, counter, __ATOMIC_RELEASE);
+    }
+    return counter;
+}
+
+static lm_histogram_t *lm_dispatch_time(void)
+{
+    lm_histogram_t *histogram = __atomic_load_n(&dispatch_time, __ATOMIC_ACQUIRE);
+
+    if (!histogram) {
+        histogram = lm_stats_get_histogram(LM_STATS_HISTOGRAM_CALLBACK, "dispatch");
+        __atomic_store_n(&dispatch_time, histogram, __ATOMIC_RELEASE);
+    }
+    return histogram;
+}
+
 void lm_app_event_callback(lm_msg_type_t msg, lm_status_t status, void *buf)
 {
     guint32 i = 0;
     guint32 module_mask = LM_MODULE_MASK(msg);
+    gboolean dispatched = FALSE;
 
     lm_log_debug(TAG, "app event callback, msg:0x%08x, module mask:0x%08x", msg, module_mask);
+
+    guint64 *counter = lm_event_counter(msg);
+    if (counter)
+        __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+
+    gint64 start = g_get_monotonic_time();
     for (i = 0; i < LM_APP_CALLBACK_MAX; i++) {
         if (app_callback_table[i].in_use && app_callback_table[i].cb && app_callback_table[i].mask & module_mask) {
             app_callback_table[i].cb(msg, status, buf);
+            dispatched = TRUE;
         }
     }
+
+    lm_histogram_t *histogram = dispatched ? lm_dispatch_time() : NULL;
+    if (histogram)
+        lm_histogram_record(histogram, (guint64)(g_get_monotonic_time() - start));
 }
 
 lm_status_t lm_get_audio_location_config(lm_transport_profile_t profile,
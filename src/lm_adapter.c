@@ -1,22 +1,51 @@
 #include "lm_adapter.h"
+#include "lm_adapter_priv.h"
 #include "lm_device.h"
 #include "lm_device_priv.h"
 #include "lm_adv.h"
 #include "bluez_dbus.h"
 #include "lm_log.h"
+#include "lm_dbus_priv.h"
+#include "lm_stats.h"
+#include "lm_mem.h"
 #include "lm.h"
 #include "lm_utils.h"
 #include "lm_uuids.h"
 #include "lm_transport.h"
 #include "lm_transport_priv.h"
+#include "lm_filter.h"
+#include "lm_scan_feed.h"
 #include <glib.h>
 #include <gio/gio.h>
 #include <bluetooth/bluetooth.h>
 #include <bluetooth/hci.h>
 #include <bluetooth/hci_lib.h>
+#include <pthread.h>
 
 #define TAG "lm_adapter"
 
+typedef enum {
+    LM_ADAPTER_REQUEST_SET_DISCOVERY_FILTER = 0,
+    LM_ADAPTER_REQUEST_REMOVE_DEVICE,
+} lm_adapter_request_type_t;
+
+/* One in-flight adapter method call, freed by its completion */
+typedef struct {
+    guint id;
+    lm_adapter_request_type_t type;
+    lm_adapter_t *adapter; // Borrowed, NULL once the adapter is destroyed
+    gboolean detached; // the adapter is being destroyed, no CNF is sent
+    const gchar *method;
+    gchar *device_path; // Owned, LM_ADAPTER_REQUEST_REMOVE_DEVICE only
+    GCancellable *cancellable; // Owned
+} lm_adapter_request_t;
+
+typedef struct {
+    lm_device_t *device; // Borrowed, removed with the device from device_cache
+    gint16 smoothed; // lm_device_get_smoothed_rssi() when last indexed
+    gint64 updated; // monotonic time of the last RSSI
+} lm_adapter_rssi_entry_t;
+
 typedef struct {
     gint16 rssi;
     GPtrArray *services;
@@ -37,11 +66,15 @@ struct lm_adapter {
     gboolean connectable;
     gboolean discovering;
     gboolean advertising; //Owned
-    const gchar *calling_method; // method in calling
+    GHashTable *requests; // Owned, request id -> lm_adapter_request_t, guarded by request_mutex
 
     lm_adapter_power_state_t power_state;
     lm_adapter_discovery_state_t discovery_state;
-    lm_adapter_discovery_filter_t *discovery_filter;
+    /* swapped by the application, read by the dispatching thread, guarded by filter_mutex */
+    GMutex filter_mutex;
+    lm_adapter_discovery_filter_t *discovery_filter; // Owned
+    const lm_filter_t *discovery_rules; // Borrowed
+    lm_scan_feed_t *scan_feed; // Borrowed
     guint discovery_timer_id;
     guint discovery_devices_found;
 
@@ -51,9 +84,20 @@ struct lm_adapter {
     guint iface_removed;
     guint device_connected;
     guint device_disconnected;
+    GPtrArray *match_rules; // Owned, AddMatch rules installed for the subscriptions above
+    gint signals_received;
+    gint signals_dropped; // received but not for this adapter
 
     void *user_data; // Borrowed
-    GHashTable *device_cache; // Owned
+    GHashTable *device_cache; // Owned, keyed by the path of the device itself
+    gchar *device_cache_stats_name; // Owned
+    gsize mem_size; // charged to LM_MEM_ADAPTER, without the RSSI index
+
+    /* devices with a known RSSI, strongest smoothed RSSI first, guarded by rssi_mutex */
+    GMutex rssi_mutex;
+    GSequence *rssi_index; // Owned, lm_adapter_rssi_entry_t
+    GHashTable *rssi_entries; // Owned, device -> GSequenceIter of rssi_index
+    guint rssi_max_age_ms;
 
     lm_adv_t *adv; // Borrowed
 
@@ -61,10 +105,19 @@ struct lm_adapter {
     guint bis_src_transport_prop_changed;
     //lm_agent_t *agent;
 
+    /* LM_ADAPTER_CONTEXT_DEDICATED only, NULL when dispatched on the lea manager dbus thread */
+    GMainContext *context; // Owned
+    GMainLoop *main_loop; // Owned
+    pthread_t thread_id;
+
     /* memory self-management */
     gint ref_count;
 };
 
+/* Global so a completion can tell a destroyed adapter without touching it */
+static GMutex request_mutex;
+static gint request_id_counter;
+
 static const gchar *g_power_state_name[] = {
     "on",
     "off",
@@ -91,6 +144,8 @@ static void on_bis_src_transport_prop_changed(__attribute__((unused)) GDBusConne
                                           GVariant *parameters,
                                           void *user_data);
 
+static void lm_adapter_cancel_all_requests(lm_adapter_t *adapter);
+
 static lm_adapter_power_state_t lm_adapter_get_power_state_from_name(const gchar *power_state) {
     for (guint i = 0; i < G_N_ELEMENTS(g_power_state_name); i++) {
         if (g_strcmp0(power_state, g_power_state_name[i]) == 0) {
@@ -118,6 +173,122 @@ static void lm_adapter_free_discovery_filter(lm_adapter_t *adapter) {
         g_free((gchar *) adapter->discovery_filter->pattern);
         adapter->discovery_filter->pattern = NULL;
     }
+    g_free(adapter->discovery_filter);
+    adapter->discovery_filter = NULL;
+}
+
+/* strict descendant, "/org/bluez/hci1" must not claim "/org/bluez/hci10/dev_..." */
+static gboolean lm_adapter_owns_path(lm_adapter_t *adapter, const gchar *path)
+{
+    gsize len = strlen(adapter->path);
+    return strncmp(path, adapter->path, len) == 0 && path[len] == '/';
+}
+
+static gint lm_adapter_rssi_entry_compare(gconstpointer a, gconstpointer b,
+                                          __attribute__((unused)) gpointer user_data)
+{
+    const lm_adapter_rssi_entry_t *entry_a = a;
+    const lm_adapter_rssi_entry_t *entry_b = b;
+
+    if (entry_a->smoothed != entry_b->smoothed)
+        return entry_a->smoothed > entry_b->smoothed ? -1 : 1;
+    if (entry_a->device != entry_b->device)
+        return entry_a->device < entry_b->device ? -1 : 1;
+    return 0;
+}
+
+/* Called with rssi_mutex held */
+static void lm_adapter_rssi_index_remove_locked(lm_adapter_t *adapter, lm_device_t *device)
+{
+    GSequenceIter *iter = g_hash_table_lookup(adapter->rssi_entries, device);
+    if (!iter)
+        return;
+
+    g_sequence_remove(iter);
+    g_hash_table_remove(adapter->rssi_entries, device);
+    lm_mem_uncharge(LM_MEM_ADAPTER, sizeof(lm_adapter_rssi_entry_t));
+}
+
+static void lm_adapter_rssi_index_update(lm_adapter_t *adapter, lm_device_t *device)
+{
+    gint16 smoothed = lm_device_get_smoothed_rssi(device);
+
+    g_mutex_lock(&adapter->rssi_mutex);
+    GSequenceIter *iter = g_hash_table_lookup(adapter->rssi_entries, device);
+    if (iter) {
+        lm_adapter_rssi_entry_t *entry = g_sequence_get(iter);
+        entry->smoothed = smoothed;
+        entry->updated = g_get_monotonic_time();
+        g_sequence_sort_changed(iter, lm_adapter_rssi_entry_compare, NULL);
+    } else {
+        lm_adapter_rssi_entry_t *entry = g_new0(lm_adapter_rssi_entry_t, 1);
+        entry->device = device;
+        entry->smoothed = smoothed;
+        entry->updated = g_get_monotonic_time();
+        iter = g_sequence_insert_sorted(adapter->rssi_index, entry, lm_adapter_rssi_entry_compare, NULL);
+        g_hash_table_insert(adapter->rssi_entries, device, iter);
+        lm_mem_charge(LM_MEM_ADAPTER, sizeof(lm_adapter_rssi_entry_t));
+    }
+    g_mutex_unlock(&adapter->rssi_mutex);
+}
+
+static void lm_adapter_rssi_index_remove(lm_adapter_t *adapter, lm_device_t *device)
+{
+    g_mutex_lock(&adapter->rssi_mutex);
+    lm_adapter_rssi_index_remove_locked(adapter, device);
+    g_mutex_unlock(&adapter->rssi_mutex);
+}
+
+static gsize lm_adapter_mem_size(lm_adapter_t *adapter)
+{
+    gsize size = sizeof(lm_adapter_t);
+
+    size += lm_mem_string_size(adapter->path);
+    size += lm_mem_string_size(adapter->address);
+    size += lm_mem_string_size(adapter->alias);
+    size += lm_mem_string_size(adapter->device_cache_stats_name);
+    size += lm_mem_hash_table_size(adapter->device_cache);
+    return size;
+}
+
+static void lm_adapter_mem_update(lm_adapter_t *adapter)
+{
+    gsize size = lm_adapter_mem_size(adapter);
+
+    lm_mem_recharge(LM_MEM_ADAPTER, adapter->mem_size, size);
+    adapter->mem_size = size;
+}
+
+static void lm_adapter_device_cache_insert(lm_adapter_t *adapter, lm_device_t *device)
+{
+    /* replace, not insert: the key must always belong to the device stored with it */
+    lm_device_t *old = g_hash_table_lookup(adapter->device_cache, lm_device_get_path(device));
+    if (old && old != device)
+        lm_adapter_rssi_index_remove(adapter, old);
+    g_hash_table_replace(adapter->device_cache, (gpointer)lm_device_get_path(device), device);
+    lm_stats_set(LM_STATS_GAUGE, adapter->device_cache_stats_name, g_hash_table_size(adapter->device_cache));
+    lm_adapter_mem_update(adapter);
+}
+
+static void lm_adapter_device_cache_remove(lm_adapter_t *adapter, const gchar *path)
+{
+    lm_device_t *device = g_hash_table_lookup(adapter->device_cache, path);
+    if (device)
+        lm_adapter_rssi_index_remove(adapter, device);
+    g_hash_table_remove(adapter->device_cache, path);
+    lm_stats_set(LM_STATS_GAUGE, adapter->device_cache_stats_name, g_hash_table_size(adapter->device_cache));
+    lm_adapter_mem_update(adapter);
+}
+
+/* Count a signal that reached us, returns FALSE when it is not for this adapter */
+static gboolean lm_adapter_accept_signal(lm_adapter_t *adapter, const gchar *path)
+{
+    g_atomic_int_inc(&adapter->signals_received);
+    if (lm_adapter_owns_path(adapter, path))
+        return TRUE;
+
+    g_atomic_int_inc(&adapter->signals_dropped);
+    return FALSE;
 }
 
 static void lm_adapter_update_property(lm_adapter_t *adapter,
@@ -129,11 +300,13 @@ static void lm_adapter_update_property(lm_adapter_t *adapter,
     g_assert(property_value);
 
     lm_log_debug(TAG, "%s property_name:%s",  __func__, property_name);
+    lm_stats_count(LM_STATS_PROPERTY, property_name);
 
     if (g_str_equal(property_name, ADAPTER_PROPERTY_ADDRESS)) {
         if (adapter->address)
             g_free((void *)adapter->address);
         adapter->address = g_strdup(g_variant_get_string(property_value, NULL));
+        lm_adapter_mem_update(adapter);
     } else if (g_str_equal(property_name, ADAPTER_PROPERTY_POWERED)) {
         adapter->powered = g_variant_get_boolean(property_value);
     } else if(g_str_equal(property_name, ADAPTER_PROPERTY_POWER_STATE)) {
@@ -162,44 +335,51 @@ static void lm_adapter_update_property(lm_adapter_t *adapter,
         if (adapter->alias)
             g_free((void *)adapter->alias);
         adapter->alias = g_strdup(g_variant_get_string(property_value, NULL));
+        lm_adapter_mem_update(adapter);
     }
 }
 
+/*
+ * SetDiscoveryFilter only cuts the traffic: BlueZ reports what any of its
+ * clients asked for, and PropertiesChanged on known devices bypasses it.
+ * Called with filter_mutex held.
+ */
 static gboolean matches_discovery_filter(lm_adapter_t *adapter, lm_device_t *device)
 {
     g_assert(adapter != NULL);
     g_assert(device != NULL);
 
-    if (!adapter->discovery_filter)
+    if (adapter->discovery_rules && !lm_filter_match(adapter->discovery_rules, device, NULL)) {
+        lm_log_debug(TAG, "device '%s' rejected (no matching rule)", lm_device_get_path(device));
+        return FALSE;
+    }
+
+    lm_adapter_discovery_filter_t *filter = adapter->discovery_filter;
+    if (!filter)
         return TRUE;
 
-    if (lm_device_get_rssi(device) < adapter->discovery_filter->rssi) {
-        lm_log_error(TAG, "device '%s' rejected (RSSI: %d)", lm_device_get_path(device), lm_device_get_rssi(device));
+    if (lm_device_get_rssi(device) < filter->rssi) {
+        lm_log_debug(TAG, "device '%s' rejected (RSSI: %d)", lm_device_get_path(device), lm_device_get_rssi(device));
         return FALSE;
     }
 
-    const char *pattern = adapter->discovery_filter->pattern;
-    if (pattern != NULL && lm_device_get_name(device) != NULL) {
-        if (!(g_str_has_prefix(lm_device_get_name(device), pattern) ||
-              g_str_has_prefix(lm_device_get_address(device), pattern))) {
-            lm_log_error(TAG, "device '%s' rejected (Name/Address does not match pattern '%s')",
-                         lm_device_get_path(device), pattern);
+    /* a device without a name can only match on its address */
+    if (filter->pattern != NULL) {
+        const gchar *name = lm_device_get_name(device);
+        if (!((name != NULL && g_str_has_prefix(name, filter->pattern)) ||
+              g_str_has_prefix(lm_device_get_address(device), filter->pattern))) {
+            lm_log_debug(TAG, "device '%s' rejected (Name/Address does not match pattern '%s')",
+                         lm_device_get_path(device), filter->pattern);
             return FALSE;
         }
     }
 
-    GPtrArray *services_filter = adapter->discovery_filter->services;
-    if (services_filter != NULL) {
-        guint count = services_filter->len;
-        if (count == 0)
-            return TRUE;
-
-        for (guint i = 0; i < count; i++) {
-            const char *uuid_filter = g_ptr_array_index(services_filter, i);
-            if (lm_device_has_service(device, uuid_filter)) {
+    if (filter->services->len > 0) {
+        for (guint i = 0; i < filter->services->len; i++) {
+            if (lm_device_has_service(device, g_ptr_array_index(filter->services, i)))
                 return TRUE;
-            }
         }
+        lm_log_debug(TAG, "device '%s' rejected (no matching service)", lm_device_get_path(device));
         return FALSE;
     }
     return TRUE;
@@ -210,8 +390,15 @@ static void deliver_discovery_result(lm_adapter_t *adapter, lm_device_t *device)
     g_assert(device != NULL);
 
     if (lm_device_get_connection_state(device) == LM_DEVICE_DISCONNECTED) {
-        // Double check if the device matches the discovery filter
-        if (!matches_discovery_filter(adapter, device))
+        g_mutex_lock(&adapter->filter_mutex);
+        gboolean matches = matches_discovery_filter(adapter, device);
+        guint max_devices = adapter->discovery_filter ? adapter->discovery_filter->max_devices : 0;
+        /* the feed may be destroyed as soon as it is replaced, publish before unlocking */
+        lm_scan_feed_t *feed = matches ? adapter->scan_feed : NULL;
+        if (feed)
+            lm_scan_feed_publish(feed, device);
+        g_mutex_unlock(&adapter->filter_mutex);
+        if (!matches)
             return;
 
         lm_adapter_discovery_result_ind_t ind = {
@@ -219,9 +406,9 @@ static void deliver_discovery_result(lm_adapter_t *adapter, lm_device_t *device)
             .device = device
         };
         lm_app_event_callback(LM_ADAPTER_DISCOVERY_RESULT_IND, LM_STATUS_SUCCESS, &ind);
-        if (adapter->discovery_filter && adapter->discovery_filter->max_devices) {
+        if (max_devices) {
             adapter->discovery_devices_found++;
-            if (adapter->discovery_devices_found >= adapter->discovery_filter->max_devices) {
+            if (adapter->discovery_devices_found >= max_devices) {
                 lm_log_info(TAG, "Max devices found(%d), stopping discovery",
                     adapter->discovery_devices_found);
 
@@ -255,6 +442,11 @@ static void on_interface_disappeared(__attribute__((unused)) GDBusConnection *co
     g_assert(g_str_equal(g_variant_get_type_string(parameters), "(oas)"));
     g_variant_get(parameters, "(&oas)", &object, &interfaces);
 
+    if (!lm_adapter_accept_signal(adapter, object)) {
+        g_variant_iter_free(interfaces);
+        return;
+    }
+
     lm_log_debug(TAG, "on_interface_disappeared, sender:%s, path:%s, interface:%s, signal:%s",
                sender_name, object, interface, signal_name);
 
@@ -268,11 +460,9 @@ static void on_interface_disappeared(__attribute__((unused)) GDBusConnection *co
                     .device = device
                 };
                 lm_app_event_callback(LM_DEVICE_REMOVED_IND, LM_STATUS_SUCCESS, &ind);
-                g_hash_table_remove(adapter->device_cache, object);
+                lm_adapter_device_cache_remove(adapter, object);
             }
         } else if (g_str_equal(interface_name, INTERFACE_MEDIA_TRANSPORT)) {
-            if (!g_str_has_prefix(object, adapter->path))
-                continue;
             if (adapter->bis_src_transport &&
                 g_str_equal(object, lm_transport_get_path(adapter->bis_src_transport))) {
                 lm_log_info(TAG, "bis source transport '%s' removed", object);
@@ -306,38 +496,38 @@ static void on_interface_appeared(__attribute__((unused)) GDBusConnection *conn,
     g_assert(g_str_equal(g_variant_get_type_string(parameters), "(oa{sa{sv}})"));
     g_variant_get(parameters, "(&oa{sa{sv}})", &object, &interfaces);
 
+    if (!lm_adapter_accept_signal(adapter, object)) {
+        g_variant_iter_free(interfaces);
+        return;
+    }
+
     lm_log_debug(TAG, "on_interface_appeared, sender:%s, path:%s, interface:%s, signal:%s",
                sender_name, object, interface, signal_name);
 
     while (g_variant_iter_loop(interfaces, "{&s@a{sv}}", &interface_name, &properties)) {
         if (g_str_equal(interface_name, INTERFACE_DEVICE)) {
-
-            // Skip this device if it is not for this adapter
-            if (!g_str_has_prefix(object, adapter->path))
-                continue;
-
             if (g_hash_table_contains(adapter->device_cache, object))
                 continue;
 
             lm_device_t *device = lm_device_create_with_path(adapter, object);
 
+            gboolean has_rssi = FALSE;
             g_variant_iter_init(&iter, properties);
             while (g_variant_iter_loop(&iter, "{&sv}", &property_name, &property_value)) {
                 lm_device_update_property(device, property_name, property_value);
+                if (g_str_equal(property_name, DEVICE_PROPERTY_RSSI))
+                    has_rssi = TRUE;
             }
 
-            g_hash_table_insert(adapter->device_cache,
-                                g_strdup(lm_device_get_path(device)),
-                                device);
+            lm_adapter_device_cache_insert(adapter, device);
+            if (has_rssi)
+                lm_adapter_rssi_index_update(adapter, device);
 
             if (adapter->discovery_state == LM_ADAPTER_DISCOVERY_STARTED && lm_device_get_connection_state(device) == LM_DEVICE_DISCONNECTED) {
                 deliver_discovery_result(adapter, device);
             }
 
         } else if (g_str_equal(interface_name, INTERFACE_MEDIA_TRANSPORT)) {
-            // Skip this transport if it is not for this adapter
-            if (!g_str_has_prefix(object, adapter->path))
-                continue;
             if (adapter->bis_src_transport)
                 continue;
 
@@ -377,17 +567,18 @@ static void on_device_prop_changed(__attribute__((unused)) GDBusConnection *conn
     lm_adapter_t *adapter = (lm_adapter_t *) user_data;
     g_assert(adapter);
 
+    if (!lm_adapter_accept_signal(adapter, path))
+        return;
+
     lm_log_debug(TAG, "on_device_prop_changed, sender:%s, path:%s, interface:%s, signal:%s",
                sender, path, interface, signal);
 
     lm_device_t *device = lm_device_lookup_by_path(adapter, path);
     if (device == NULL) {
-        if (g_str_has_prefix(path, adapter->path)) {
-            device = lm_device_create_with_path(adapter, path);
-            g_hash_table_insert(adapter->device_cache, g_strdup(lm_device_get_path(device)), device);
-            lm_log_warn(TAG, "new added device with path '%s'", path);
-            lm_device_load_properties(device);
-        }
+        device = lm_device_create_with_path(adapter, path);
+        lm_adapter_device_cache_insert(adapter, device);
+        lm_log_warn(TAG, "new added device with path '%s'", path);
+        lm_device_load_properties(device);
     } else {
         gboolean is_dis_result = FALSE;
         lm_log_debug(TAG, "device prop change with path '%s'", path);
@@ -395,12 +586,19 @@ static void on_device_prop_changed(__attribute__((unused)) GDBusConnection *conn
         g_variant_get(parameters, "(&sa{sv}as)", &iface, &properties_changed, &properties_invalidated);
         while (g_variant_iter_loop(properties_changed, "{&sv}", &property_name, &property_value)) {
             lm_device_update_property(device, property_name, property_value);
+            if (g_str_equal(property_name, DEVICE_PROPERTY_RSSI))
+                lm_adapter_rssi_index_update(adapter, device);
             if (g_str_equal(property_name, DEVICE_PROPERTY_RSSI) ||
                 g_str_equal(property_name, DEVICE_PROPERTY_MANUFACTURER_DATA) ||
                 g_str_equal(property_name, DEVICE_PROPERTY_SERVICE_DATA)) {
                 is_dis_result = TRUE;
             }
         }
+        /* bluez drops RSSI once the device is out of range */
+        while (g_variant_iter_loop(properties_invalidated, "&s", &property_name)) {
+            if (g_str_equal(property_name, DEVICE_PROPERTY_RSSI))
+                lm_adapter_rssi_index_remove(adapter, device);
+        }
         if (adapter->discovery_state == LM_ADAPTER_DISCOVERY_STARTED && is_dis_result) {
             deliver_discovery_result(adapter, device);
         }
@@ -431,6 +629,9 @@ static void on_adapter_prop_changed(__attribute__((unused)) GDBusConnection *con
     lm_adapter_t *adapter = (lm_adapter_t *) user_data;
     g_assert(adapter);
 
+    /* subscribed on the exact adapter path */
+    g_atomic_int_inc(&adapter->signals_received);
+
     g_assert(g_str_equal(g_variant_get_type_string(parameters), "(sa{sv}as)"));
     g_variant_get(parameters, "(&sa{sv}as)", &iface, &properties_changed, &properties_invalidated);
 
@@ -465,19 +666,19 @@ static void on_bis_src_transport_prop_changed(__attribute__((unused)) GDBusConne
     lm_adapter_t *adapter = (lm_adapter_t *) user_data;
     g_assert(adapter);
 
-    g_assert(g_str_equal(g_variant_get_type_string(parameters), "(sa{sv}as)"));
-    g_variant_get(parameters, "(&sa{sv}as)", &iface, &properties_changed, &properties_invalidated);
-
-    lm_log_debug(TAG, "on_bis_src_transport_prop_changed %s sender:%s, path:%s, interface:%s, signal:%s",
-        __func__, sender, path, interface, signal);
-
-    if (!g_str_has_prefix(path, adapter->path))
+    if (!lm_adapter_accept_signal(adapter, path))
         return;
     if (!adapter->bis_src_transport)
         return;
     if (!g_str_equal(lm_transport_get_path(adapter->bis_src_transport), path))
         return;
 
+    g_assert(g_str_equal(g_variant_get_type_string(parameters), "(sa{sv}as)"));
+    g_variant_get(parameters, "(&sa{sv}as)", &iface, &properties_changed, &properties_invalidated);
+
+    lm_log_debug(TAG, "on_bis_src_transport_prop_changed %s sender:%s, path:%s, interface:%s, signal:%s",
+        __func__, sender, path, interface, signal);
+
     while (g_variant_iter_loop(properties_changed, "{&sv}", &property_name, &property_value)) {
         lm_transport_update_property(adapter->bis_src_transport, property_name, property_value);
         if (g_str_equal(property_name, MEDIA_TRANSPORT_PROPERTY_STATE)) {
@@ -513,6 +714,9 @@ static void on_device_connected(__attribute__((unused)) GDBusConnection *conn,
     lm_adapter_t *adapter = (lm_adapter_t *)user_data;
     g_assert(adapter);
 
+    if (!lm_adapter_accept_signal(adapter, object_path))
+        return;
+
     lm_log_debug(TAG, "on_device_connected sender:%s, path:%s, interface:%s, signal:%s",
             sender_name, object_path, interface_name, signal_name);
 
@@ -535,8 +739,7 @@ static void on_device_connected(__attribute__((unused)) GDBusConnection *conn,
             lm_log_error("Failed to create device for path: %s", object_path);
             return;
         }
-        g_hash_table_insert(adapter->device_cache,
-                            g_strdup(lm_device_get_path(device)), device);
+        lm_adapter_device_cache_insert(adapter, device);
     }
 
     if (lm_device_is_special_device(device)) {
@@ -582,6 +785,9 @@ static void on_device_disconnected(__attribute__((unused)) GDBusConnection *conn
     lm_adapter_t *adapter = (lm_adapter_t *)user_data;
     g_assert(adapter);
 
+    if (!lm_adapter_accept_signal(adapter, object_path))
+        return;
+
     lm_log_debug(TAG, "on_device_disconnected sender:%s, path:%s, interface:%s, signal:%s",
             sender_name, object_path, interface_name, signal_name);
 
@@ -606,7 +812,7 @@ static void on_device_disconnected(__attribute__((unused)) GDBusConnection *conn
             lm_log_error("Failed to create device for path: %s", object_path);
             return;
         }
-        g_hash_table_insert(adapter->device_cache, g_strdup(lm_device_get_path(device)), device);
+        lm_adapter_device_cache_insert(adapter, device);
     }
 
     if (lm_device_is_special_device(device)) {
@@ -636,13 +842,79 @@ static void on_device_disconnected(__attribute__((unused)) GDBusConnection *conn
     lm_app_event_callback(LM_DEVICE_DISCONNECTED_IND, LM_STATUS_SUCCESS, &ind);
 }
 
+static void lm_adapter_add_match(lm_adapter_t *adapter, const gchar *method, const gchar *rule)
+{
+    GError *error = NULL;
+
+    GVariant *result = lm_dbus_call_sync(adapter->dbus_conn,
+                                         DBUS_SERVICE,
+                                         DBUS_PATH,
+                                         INTERFACE_DBUS,
+                                         method,
+                                         g_variant_new("(s)", rule),
+                                         NULL,
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                                         NULL,
+                                         &error);
+    if (result)
+        g_variant_unref(result);
+
+    if (error) {
+        lm_log_error(TAG, "%s \"%s\" failed: %s", method, rule, error->message);
+        g_clear_error(&error);
+    }
+}
+
+/*
+ * lm_dbus_signal_subscribe() can only match one exact object path,
+ * so install a path_namespace rule ourselves and let GDBus just dispatch.
+ * dbus-daemon then drops signals of other adapters before they reach us.
+ */
+static guint lm_adapter_subscribe_namespace(lm_adapter_t *adapter,
+                                            const gchar *interface,
+                                            const gchar *member,
+                                            const gchar *arg0,
+                                            GDBusSignalCallback callback)
+{
+    gchar *rule;
+
+    if (arg0)
+        rule = g_strdup_printf("type='signal',sender='%s',interface='%s',member='%s',"
+                               "path_namespace='%s',arg0='%s'",
+                               BLUEZ_DBUS, interface, member, adapter->path, arg0);
+    else
+        rule = g_strdup_printf("type='signal',sender='%s',interface='%s',member='%s',"
+                               "path_namespace='%s'",
+                               BLUEZ_DBUS, interface, member, adapter->path);
+
+    lm_adapter_add_match(adapter, DBUS_METHOD_ADD_MATCH, rule);
+    g_ptr_array_add(adapter->match_rules, rule);
+
+    return lm_dbus_signal_subscribe(adapter->dbus_conn,
+                                              BLUEZ_DBUS,
+                                              interface,
+                                              member,
+                                              NULL,
+                                              arg0,
+                                              G_DBUS_SIGNAL_FLAGS_NO_MATCH_RULE,
+                                              callback,
+                                              adapter);
+}
+
 static void lm_adapter_subscribe_signal(lm_adapter_t *adapter)
 {
     g_assert(adapter);
     g_assert(adapter->dbus_conn);
     g_assert(adapter->path);
 
-    adapter->adapter_prop_changed = g_dbus_connection_signal_subscribe(adapter->dbus_conn,
+    /* arg0path only matches below the adapter with the trailing '/' */
+    gchar *object_namespace = g_strconcat(adapter->path, "/", NULL);
+
+    /* callbacks are dispatched in the thread-default context at subscribe time */
+    lm_adapter_push_context(adapter);
+
+    adapter->adapter_prop_changed = lm_dbus_signal_subscribe(adapter->dbus_conn,
                                                             BLUEZ_DBUS,
                                                             INTERFACE_PROPERTIES,
                                                             PROPERTIES_SIGNAL_CHANGED,
@@ -650,93 +922,79 @@ static void lm_adapter_subscribe_signal(lm_adapter_t *adapter)
                                                             INTERFACE_ADAPTER,
                                                             G_DBUS_SIGNAL_FLAGS_NONE,
                                                             on_adapter_prop_changed,
-                                                            adapter,
-                                                            NULL);
+                                                            adapter);
 
-    adapter->iface_added = g_dbus_connection_signal_subscribe(adapter->dbus_conn,
+    adapter->iface_added = lm_dbus_signal_subscribe(adapter->dbus_conn,
                                                               BLUEZ_DBUS,
                                                               INTERFACE_OBJECT_MANAGER,
                                                               OBJECT_MANAGER_SIGNAL_INTERFACE_ADDED,
                                                               NULL,
-                                                              NULL,
-                                                              G_DBUS_SIGNAL_FLAGS_NONE,
+                                                              object_namespace,
+                                                              G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH,
                                                               on_interface_appeared,
-                                                              adapter,
-                                                              NULL);
+                                                              adapter);
 
-    adapter->iface_removed = g_dbus_connection_signal_subscribe(adapter->dbus_conn,
+    adapter->iface_removed = lm_dbus_signal_subscribe(adapter->dbus_conn,
                                                             BLUEZ_DBUS,
                                                             INTERFACE_OBJECT_MANAGER,
                                                             OBJECT_MANAGER_SIGNAL_INTERFACE_REMOVED,
                                                             NULL,
-                                                            NULL,
-                                                            G_DBUS_SIGNAL_FLAGS_NONE,
+                                                            object_namespace,
+                                                            G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH,
                                                             on_interface_disappeared,
-                                                            adapter,
-                                                            NULL);
+                                                            adapter);
 
-    adapter->device_prop_changed = g_dbus_connection_signal_subscribe(adapter->dbus_conn,
-                                                            BLUEZ_DBUS,
+    adapter->device_prop_changed = lm_adapter_subscribe_namespace(adapter,
                                                             INTERFACE_PROPERTIES,
                                                             PROPERTIES_SIGNAL_CHANGED,
-                                                            NULL,
                                                             INTERFACE_DEVICE,
-                                                            G_DBUS_SIGNAL_FLAGS_NONE,
-                                                            on_device_prop_changed,
-                                                            adapter,
-                                                            NULL);
+                                                            on_device_prop_changed);
 
-    adapter->device_connected = g_dbus_connection_signal_subscribe(adapter->dbus_conn,
-                                                            BLUEZ_DBUS,
+    adapter->device_connected = lm_adapter_subscribe_namespace(adapter,
                                                             INTERFACE_DEVICE,
                                                             DEVICE_SIGNAL_CONNECTED,
                                                             NULL,
-                                                            NULL,
-                                                            G_DBUS_SIGNAL_FLAGS_NONE,
-                                                            on_device_connected,
-                                                            adapter,
-                                                            NULL);
-    adapter->device_disconnected = g_dbus_connection_signal_subscribe( adapter->dbus_conn,
-                                                            BLUEZ_DBUS,
+                                                            on_device_connected);
+
+    adapter->device_disconnected = lm_adapter_subscribe_namespace(adapter,
                                                             INTERFACE_DEVICE,
                                                             DEVICE_SIGNAL_DISCONNECTED,
                                                             NULL,
-                                                            NULL,
-                                                            G_DBUS_SIGNAL_FLAGS_NONE,
-                                                            on_device_disconnected,
-                                                            adapter,
-                                                            NULL);
-    adapter->bis_src_transport_prop_changed = g_dbus_connection_signal_subscribe(
-                                                            adapter->dbus_conn,
-                                                            BLUEZ_DBUS,
+                                                            on_device_disconnected);
+
+    adapter->bis_src_transport_prop_changed = lm_adapter_subscribe_namespace(adapter,
                                                             INTERFACE_PROPERTIES,
                                                             PROPERTIES_SIGNAL_CHANGED,
-                                                            NULL,
                                                             INTERFACE_MEDIA_TRANSPORT,
-                                                            G_DBUS_SIGNAL_FLAGS_NONE,
-                                                            on_bis_src_transport_prop_changed,
-                                                            adapter,
-                                                            NULL);
+                                                            on_bis_src_transport_prop_changed);
+
+    lm_adapter_pop_context(adapter);
+
+    g_free(object_namespace);
 }
 
 static void lm_adapter_unsubscribe_signal(lm_adapter_t *adapter)
 {
     g_assert(adapter);
 
-    g_dbus_connection_signal_unsubscribe(adapter->dbus_conn, adapter->device_prop_changed);
+    lm_dbus_signal_unsubscribe(adapter->dbus_conn, adapter->device_prop_changed);
     adapter->device_prop_changed = 0;
-    g_dbus_connection_signal_unsubscribe(adapter->dbus_conn, adapter->adapter_prop_changed);
+    lm_dbus_signal_unsubscribe(adapter->dbus_conn, adapter->adapter_prop_changed);
     adapter->adapter_prop_changed = 0;
-    g_dbus_connection_signal_unsubscribe(adapter->dbus_conn, adapter->device_connected);
+    lm_dbus_signal_unsubscribe(adapter->dbus_conn, adapter->device_connected);
     adapter->device_connected = 0;
-    g_dbus_connection_signal_unsubscribe(adapter->dbus_conn, adapter->device_disconnected);
+    lm_dbus_signal_unsubscribe(adapter->dbus_conn, adapter->device_disconnected);
     adapter->device_disconnected = 0;
-    g_dbus_connection_signal_unsubscribe(adapter->dbus_conn, adapter->iface_added);
+    lm_dbus_signal_unsubscribe(adapter->dbus_conn, adapter->iface_added);
     adapter->iface_added = 0;
-    g_dbus_connection_signal_unsubscribe(adapter->dbus_conn, adapter->iface_removed);
+    lm_dbus_signal_unsubscribe(adapter->dbus_conn, adapter->iface_removed);
     adapter->iface_removed = 0;
-    g_dbus_connection_signal_unsubscribe(adapter->dbus_conn, adapter->bis_src_transport_prop_changed);
+    lm_dbus_signal_unsubscribe(adapter->dbus_conn, adapter->bis_src_transport_prop_changed);
     adapter->bis_src_transport_prop_changed = 0;
+
+    for (guint i = 0; i < adapter->match_rules->len; i++)
+        lm_adapter_add_match(adapter, DBUS_METHOD_REMOVE_MATCH, g_ptr_array_index(adapter->match_rules, i));
+    g_ptr_array_set_size(adapter->match_rules, 0);
 }
 
 static lm_adapter_t *lm_adapter_get_adapter_by_path(GPtrArray *adapters, const char *path) {
@@ -746,15 +1004,71 @@ static lm_adapter_t *lm_adapter_get_adapter_by_path(GPtrArray *adapters, const c
 
     for (guint i = 0; i < adapters->len; i++) {
         lm_adapter_t *adapter = g_ptr_array_index(adapters, i);
-        const char *adapter_path = lm_adapter_get_path(adapter);
-        if (g_str_has_prefix(path, adapter_path)) {
+        if (lm_adapter_owns_path(adapter, path)) {
             return adapter;
         }
     }
     return NULL;
 }
 
-static lm_adapter_t *lm_adapter_create(GDBusConnection *connection, const gchar *path) {
+static void *lm_adapter_thread(void *user_data)
+{
+    lm_adapter_t *adapter = (lm_adapter_t *)user_data;
+
+    lm_log_info(TAG, "enter adapter '%s' thread", adapter->path);
+    g_main_context_push_thread_default(adapter->context);
+    g_main_loop_run(adapter->main_loop);
+    g_main_context_pop_thread_default(adapter->context);
+    lm_log_info(TAG, "exit adapter '%s' thread", adapter->path);
+
+    return NULL;
+}
+
+static gboolean lm_adapter_quit_thread_cb(gpointer user_data)
+{
+    g_main_loop_quit((GMainLoop *)user_data);
+    return FALSE;
+}
+
+static lm_status_t lm_adapter_start_thread(lm_adapter_t *adapter)
+{
+    g_assert(adapter);
+    g_assert(adapter->main_loop);
+
+    if (pthread_create(&adapter->thread_id, NULL, lm_adapter_thread, adapter)) {
+        lm_log_error(TAG, "adapter '%s' thread create failed", adapter->path);
+        adapter->thread_id = 0;
+        return LM_STATUS_FAIL;
+    }
+
+    return LM_STATUS_SUCCESS;
+}
+
+static void lm_adapter_stop_thread(lm_adapter_t *adapter)
+{
+    g_assert(adapter);
+
+    if (!adapter->thread_id)
+        return;
+
+    /* joining ourselves would never return */
+    g_assert(!pthread_equal(adapter->thread_id, pthread_self()));
+
+    /*
+     * Quit from inside the loop, g_main_loop_quit() before the thread got to
+     * g_main_loop_run() would be lost.
+     */
+    GSource *source = g_idle_source_new();
+    g_source_set_callback(source, lm_adapter_quit_thread_cb, adapter->main_loop, NULL);
+    g_source_attach(source, adapter->context);
+    g_source_unref(source);
+
+    pthread_join(adapter->thread_id, NULL);
+    adapter->thread_id = 0;
+}
+
+static lm_adapter_t *lm_adapter_create(GDBusConnection *connection, const gchar *path,
+                                       lm_adapter_context_mode_t mode) {
     g_assert(connection);
     g_assert(path);
     g_assert(strlen(path) > 0);
@@ -768,8 +1082,22 @@ static lm_adapter_t *lm_adapter_create(GDBusConnection *connection, const gchar
     adapter->discovery_state = LM_ADAPTER_DISCOVERY_STOPPED;
     adapter->discovery_filter = NULL;
     adapter->device_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
-                                                  g_free, (GDestroyNotify) lm_device_destroy);
+                                                  NULL, (GDestroyNotify) lm_device_destroy);
     adapter->user_data = NULL;
+    adapter->match_rules = g_ptr_array_new_with_free_func(g_free);
+    adapter->requests = g_hash_table_new(g_direct_hash, g_direct_equal);
+    adapter->device_cache_stats_name = g_strdup_printf("device_cache %s", path);
+    g_mutex_init(&adapter->rssi_mutex);
+    g_mutex_init(&adapter->filter_mutex);
+    adapter->rssi_index = g_sequence_new(g_free);
+    adapter->rssi_entries = g_hash_table_new(g_direct_hash, g_direct_equal);
+    adapter->rssi_max_age_ms = LM_ADAPTER_DEFAULT_RSSI_MAX_AGE_MS;
+
+    if (mode == LM_ADAPTER_CONTEXT_DEDICATED) {
+        /* the thread is started once the initial object tree is loaded */
+        adapter->context = g_main_context_new();
+        adapter->main_loop = g_main_loop_new(adapter->context, FALSE);
+    }
 
     int dev_id = lm_utils_dbus_bluez_object_path_to_hci_dev_id(path);
     if (hci_devinfo(dev_id, &adapter->dev_info) < 0) {
@@ -778,6 +1106,9 @@ static lm_adapter_t *lm_adapter_create(GDBusConnection *connection, const gchar
         adapter->dev_info.dev_id = dev_id;
     }
 
+    adapter->mem_size = lm_adapter_mem_size(adapter);
+    lm_mem_object_new(LM_MEM_ADAPTER, adapter->mem_size);
+
     lm_adapter_subscribe_signal(adapter);
     return adapter;
 }
@@ -788,7 +1119,17 @@ void lm_adapter_destroy(lm_adapter_t *adapter)
 
     lm_log_info(TAG, "destroy adapter '%s'", adapter->path);
 
+    /*
+     * Nothing may be dispatched for this adapter while it is torn down, the
+     * requests are drained on this thread once the adapter thread is gone.
+     */
+    lm_adapter_stop_thread(adapter);
     lm_adapter_unsubscribe_signal(adapter);
+    lm_adapter_cancel_all_requests(adapter);
+    if (adapter->discovery_timer_id) {
+        lm_adapter_source_remove(adapter, adapter->discovery_timer_id);
+        adapter->discovery_timer_id = 0;
+    }
 
     if (adapter->bis_src_transport)
         lm_transport_destroy(adapter->bis_src_transport);
@@ -800,28 +1141,42 @@ void lm_adapter_destroy(lm_adapter_t *adapter)
         g_free((void *)adapter->address);
     if (adapter->alias)
         g_free((void *)adapter->alias);
+    lm_mem_uncharge(LM_MEM_ADAPTER, g_hash_table_size(adapter->rssi_entries) * sizeof(lm_adapter_rssi_entry_t));
+    g_hash_table_destroy(adapter->rssi_entries);
+    g_sequence_free(adapter->rssi_index);
+    g_mutex_clear(&adapter->rssi_mutex);
+    g_mutex_clear(&adapter->filter_mutex);
     g_hash_table_destroy(adapter->device_cache);
+    g_ptr_array_free(adapter->match_rules, TRUE);
+    g_hash_table_destroy(adapter->requests);
+    lm_stats_set(LM_STATS_GAUGE, adapter->device_cache_stats_name, 0);
+    g_free(adapter->device_cache_stats_name);
+    if (adapter->main_loop)
+        g_main_loop_unref(adapter->main_loop);
+    if (adapter->context)
+        g_main_context_unref(adapter->context);
+    lm_mem_object_free(LM_MEM_ADAPTER, adapter->mem_size);
     g_free(adapter);
 }
 
-static GPtrArray *lm_adapter_find_all(GDBusConnection *dbus_conn) {
+static GPtrArray *lm_adapter_find_all(GDBusConnection *dbus_conn, lm_adapter_context_mode_t mode) {
     g_assert(dbus_conn);
 
     GPtrArray *adapter_array = g_ptr_array_new();
     lm_log_info(TAG, "finding adapter");
 
     GError *error = NULL;
-    GVariant *result = g_dbus_connection_call_sync(dbus_conn,
-                                                   BLUEZ_DBUS,
-                                                   "/",
-                                                   INTERFACE_OBJECT_MANAGER,
-                                                   OBJECT_MANAGER_METHOD_GET_MANAGED_OBJECTS,
-                                                   NULL,
-                                                   G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
-                                                   G_DBUS_CALL_FLAGS_NONE,
-                                                   BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                                                   NULL,
-                                                   &error);
+    GVariant *result = lm_dbus_call_sync(dbus_conn,
+                                         BLUEZ_DBUS,
+                                         "/",
+                                         INTERFACE_OBJECT_MANAGER,
+                                         OBJECT_MANAGER_METHOD_GET_MANAGED_OBJECTS,
+                                         NULL,
+                                         G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                                         NULL,
+                                         &error);
 
     if (result) {
         GVariantIter *iter;
@@ -838,7 +1193,7 @@ static GPtrArray *lm_adapter_find_all(GDBusConnection *dbus_conn) {
             g_variant_iter_init(&iter2, ifaces_and_properties);
             while (g_variant_iter_loop(&iter2, "{&s@a{sv}}", &interface_name, &properties)) {
                 if (g_str_equal(interface_name, INTERFACE_ADAPTER)) {
-                    lm_adapter_t *adapter = lm_adapter_create(dbus_conn, object_path);
+                    lm_adapter_t *adapter = lm_adapter_create(dbus_conn, object_path, mode);
                     lm_log_info(TAG, "found adapter '%s'", object_path);
 
                     gchar *property_name;
@@ -852,7 +1207,7 @@ static GPtrArray *lm_adapter_find_all(GDBusConnection *dbus_conn) {
                 } else if (g_str_equal(interface_name, INTERFACE_DEVICE)) {
                     lm_adapter_t *adapter = lm_adapter_get_adapter_by_path(adapter_array, object_path);
                     lm_device_t *device = lm_device_create_with_path(adapter, object_path);
-                    g_hash_table_insert(adapter->device_cache, g_strdup(lm_device_get_path(device)), device);
+                    lm_adapter_device_cache_insert(adapter, device);
 
                     gchar *property_name;
                     GVariantIter iter4;
@@ -894,6 +1249,16 @@ static GPtrArray *lm_adapter_find_all(GDBusConnection *dbus_conn) {
         g_clear_error(&error);
     }
 
+    for (guint i = 0; i < adapter_array->len; ) {
+        lm_adapter_t *adapter = g_ptr_array_index(adapter_array, i);
+        if (adapter->main_loop && lm_adapter_start_thread(adapter) != LM_STATUS_SUCCESS) {
+            lm_adapter_destroy(adapter);
+            g_ptr_array_remove_index(adapter_array, i);
+            continue;
+        }
+        i++;
+    }
+
     lm_log_info(TAG, "found %d adapter", adapter_array->len);
 
     return adapter_array;
@@ -907,18 +1272,104 @@ lm_adapter_t *lm_adapter_get_default(void)
         lm_log_error(TAG, "no dbus connection, please call lm_init() first!");
         return NULL;
     }
-    GPtrArray *adapters = lm_adapter_find_all(dbus_conn);
+    GPtrArray *adapters = lm_adapter_find_all(dbus_conn, LM_ADAPTER_CONTEXT_SHARED);
     if (adapters && adapters->len > 0) {
         adapter = g_ptr_array_index(adapters, 0);
         for (guint i = 1; i < adapters->len; i++) {
             lm_adapter_destroy(g_ptr_array_index(adapters, i));
         }
-        g_ptr_array_free(adapters, TRUE);
     }
+    if (adapters)
+        g_ptr_array_free(adapters, TRUE);
 
     return adapter;
 }
 
+GPtrArray *lm_adapter_get_all(lm_adapter_context_mode_t mode)
+{
+    GDBusConnection *dbus_conn = lm_get_gdbus_connection();
+    if (!dbus_conn) {
+        lm_log_error(TAG, "no dbus connection, please call lm_init() first!");
+        return NULL;
+    }
+
+    return lm_adapter_find_all(dbus_conn, mode);
+}
+
+void lm_adapter_get_signal_stats(lm_adapter_t *adapter, guint *received, guint *dropped)
+{
+    g_assert(adapter);
+
+    if (received)
+        *received = (guint)g_atomic_int_get(&adapter->signals_received);
+    if (dropped)
+        *dropped = (guint)g_atomic_int_get(&adapter->signals_dropped);
+}
+
+GMainContext *lm_adapter_get_context(lm_adapter_t *adapter)
+{
+    g_assert(adapter);
+    return adapter->context ? adapter->context : g_main_context_default();
+}
+
+void lm_adapter_push_context(lm_adapter_t *adapter)
+{
+    g_assert(adapter);
+
+    /* shared adapters keep whatever context the caller runs in, as before */
+    if (adapter->context)
+        g_main_context_push_thread_default(adapter->context);
+}
+
+void lm_adapter_pop_context(lm_adapter_t *adapter)
+{
+    g_assert(adapter);
+
+    if (adapter->context)
+        g_main_context_pop_thread_default(adapter->context);
+}
+
+static guint lm_adapter_attach_source(lm_adapter_t *adapter, GSource *source,
+                                      GSourceFunc function, gpointer data, GDestroyNotify notify)
+{
+    g_source_set_callback(source, function, data, notify);
+    guint id = g_source_attach(source, adapter->context);
+    g_source_unref(source);
+    return id;
+}
+
+guint lm_adapter_timeout_add(lm_adapter_t *adapter, guint interval, GSourceFunc function, gpointer data)
+{
+    g_assert(adapter);
+    g_assert(function);
+    return lm_adapter_attach_source(adapter, g_timeout_source_new(interval), function, data, NULL);
+}
+
+guint lm_adapter_timeout_add_full(lm_adapter_t *adapter, guint interval, GSourceFunc function,
+                                  gpointer data, GDestroyNotify notify)
+{
+    g_assert(adapter);
+    g_assert(function);
+    return lm_adapter_attach_source(adapter, g_timeout_source_new(interval), function, data, notify);
+}
+
+guint lm_adapter_timeout_add_seconds(lm_adapter_t *adapter, guint interval, GSourceFunc function,
+                                     gpointer data)
+{
+    g_assert(adapter);
+    g_assert(function);
+    return lm_adapter_attach_source(adapter, g_timeout_source_new_seconds(interval), function, data, NULL);
+}
+
+void lm_adapter_source_remove(lm_adapter_t *adapter, guint id)
+{
+    g_assert(adapter);
+
+    GSource *source = g_main_context_find_source_by_id(adapter->context, id);
+    if (source)
+        g_source_destroy(source);
+}
+
 static void lm_adapter_set_property_async_cb(__attribute__((unused)) GObject *source_object,
                                         GAsyncResult *res,
                                         gpointer user_data) {
@@ -926,7 +1377,7 @@ static void lm_adapter_set_property_async_cb(__attribute__((unused)) GObject *so
     g_assert(adapter);
 
     GError *error = NULL;
-    GVariant *value = g_dbus_connection_call_finish(adapter->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
     if (value) {
         g_variant_unref(value);
     }
@@ -942,18 +1393,20 @@ static void lm_adapter_set_property_async(lm_adapter_t *adapter, const gchar *pr
     g_assert(property);
     g_assert(value);
 
-    g_dbus_connection_call(adapter->dbus_conn,
-                           BLUEZ_DBUS,
-                           adapter->path,
-                           INTERFACE_PROPERTIES,
-                           PROPERTIES_METHOD_SET,
-                           g_variant_new("(ssv)", INTERFACE_ADAPTER, property, value),
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                           NULL,
-                           (GAsyncReadyCallback) lm_adapter_set_property_async_cb,
-                           adapter);
+    lm_adapter_push_context(adapter);
+    lm_dbus_call(adapter->dbus_conn,
+                 BLUEZ_DBUS,
+                 adapter->path,
+                 INTERFACE_PROPERTIES,
+                 PROPERTIES_METHOD_SET,
+                 g_variant_new("(ssv)", INTERFACE_ADAPTER, property, value),
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 NULL,
+                 (GAsyncReadyCallback) lm_adapter_set_property_async_cb,
+                 adapter);
+    lm_adapter_pop_context(adapter);
 }
 
 static lm_status_t lm_adapter_set_property_sync(lm_adapter_t *adapter, const gchar *property, GVariant *value) {
@@ -963,7 +1416,7 @@ static lm_status_t lm_adapter_set_property_sync(lm_adapter_t *adapter, const gch
     g_assert(value);
 
     GVariant *value_param = g_variant_new("(ssv)", INTERFACE_ADAPTER, property, value);
-    g_dbus_connection_call_sync(adapter->dbus_conn,
+    lm_dbus_call_sync(adapter->dbus_conn,
                            BLUEZ_DBUS,
                            adapter->path,
                            INTERFACE_PROPERTIES,
@@ -1031,8 +1484,7 @@ static gboolean lm_adapter_discovery_timeout_cb(gpointer user_data)
     lm_adapter_t *adapter = (lm_adapter_t *)user_data;
     g_assert(adapter != NULL);
 
-    lm_log_info(TAG, "adapter '%s' discovery timeout reached(%d s)",
-            adapter->path, adapter->discovery_filter->timeout);
+    lm_log_info(TAG, "adapter '%s' discovery timeout reached", adapter->path);
 
     lm_adapter_stop_discovery(adapter);
 
@@ -1072,20 +1524,23 @@ static void lm_adapter_set_discovery_state(lm_adapter_t *adapter,
     switch (discovery_state) {
         case LM_ADAPTER_DISCOVERY_STARTING:
             break;
-        case LM_ADAPTER_DISCOVERY_STARTED:
-            if (!adapter->discovery_timer_id && adapter->discovery_filter &&
-                adapter->discovery_filter->timeout > 0) {
-                adapter->discovery_timer_id = g_timeout_add_seconds(
-                    adapter->discovery_filter->timeout,
+        case LM_ADAPTER_DISCOVERY_STARTED: {
+            g_mutex_lock(&adapter->filter_mutex);
+            guint timeout = adapter->discovery_filter ? adapter->discovery_filter->timeout : 0;
+            g_mutex_unlock(&adapter->filter_mutex);
+            if (!adapter->discovery_timer_id && timeout > 0) {
+                adapter->discovery_timer_id = lm_adapter_timeout_add_seconds(adapter,
+                    timeout,
                     lm_adapter_discovery_timeout_cb,
                     adapter);
             }
             break;
+        }
         case LM_ADAPTER_DISCOVERY_STOPPING:
             break;
         case LM_ADAPTER_DISCOVERY_STOPPED:
             if (adapter->discovery_timer_id) {
-                g_source_remove(adapter->discovery_timer_id);
+                lm_adapter_source_remove(adapter, adapter->discovery_timer_id);
                 adapter->discovery_timer_id = 0;
             }
             adapter->discovery_devices_found = 0;
@@ -1105,7 +1560,7 @@ static void lm_adapter_start_discovery_cb(__attribute__((unused)) GObject *sourc
     GError *error = NULL;
 
     lm_log_debug(TAG, "%s", __func__);
-    GVariant *value = g_dbus_connection_call_finish(adapter->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
 
     if (error != NULL) {
         lm_log_error(TAG, "failed to call '%s' (error %d: %s)", ADAPTER_METHOD_START_DISCOVERY, error->code, error->message);
@@ -1137,18 +1592,20 @@ lm_status_t lm_adapter_start_discovery(lm_adapter_t *adapter)
     }
 
     lm_adapter_set_discovery_state(adapter, LM_ADAPTER_DISCOVERY_STARTING);
-    g_dbus_connection_call(adapter->dbus_conn,
-                            BLUEZ_DBUS,
-                            adapter->path,
-                            INTERFACE_ADAPTER,
-                            ADAPTER_METHOD_START_DISCOVERY,
-                            NULL,
-                            NULL,
-                            G_DBUS_CALL_FLAGS_NONE,
-                            BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                            NULL,
-                            (GAsyncReadyCallback) lm_adapter_start_discovery_cb,
-                            adapter);
+    lm_adapter_push_context(adapter);
+    lm_dbus_call(adapter->dbus_conn,
+                  BLUEZ_DBUS,
+                  adapter->path,
+                  INTERFACE_ADAPTER,
+                  ADAPTER_METHOD_START_DISCOVERY,
+                  NULL,
+                  NULL,
+                  G_DBUS_CALL_FLAGS_NONE,
+                  BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                  NULL,
+                  (GAsyncReadyCallback) lm_adapter_start_discovery_cb,
+                  adapter);
+    lm_adapter_pop_context(adapter);
 
     return LM_STATUS_SUCCESS;
 }
@@ -1160,7 +1617,7 @@ static void lm_adapter_stop_discovery_cb(__attribute__((unused)) GObject *source
     g_assert(adapter != NULL);
 
     GError *error = NULL;
-    GVariant *value = g_dbus_connection_call_finish(adapter->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
 
     if (error != NULL) {
         lm_log_error(TAG, "failed to call '%s' (error %d: %s)", ADAPTER_METHOD_STOP_DISCOVERY, error->code, error->message);
@@ -1190,68 +1647,206 @@ lm_status_t lm_adapter_stop_discovery(lm_adapter_t *adapter)
         return LM_STATUS_FAIL;
     }
     lm_adapter_set_discovery_state(adapter, LM_ADAPTER_DISCOVERY_STOPPING);
-    g_dbus_connection_call(adapter->dbus_conn,
-                            BLUEZ_DBUS,
-                            adapter->path,
-                            INTERFACE_ADAPTER,
-                            ADAPTER_METHOD_STOP_DISCOVERY,
-                            NULL,
-                            NULL,
-                            G_DBUS_CALL_FLAGS_NONE,
-                            BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                            NULL,
-                            (GAsyncReadyCallback) lm_adapter_stop_discovery_cb,
-                            adapter);
+    lm_adapter_push_context(adapter);
+    lm_dbus_call(adapter->dbus_conn,
+                  BLUEZ_DBUS,
+                  adapter->path,
+                  INTERFACE_ADAPTER,
+                  ADAPTER_METHOD_STOP_DISCOVERY,
+                  NULL,
+                  NULL,
+                  G_DBUS_CALL_FLAGS_NONE,
+                  BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                  NULL,
+                  (GAsyncReadyCallback) lm_adapter_stop_discovery_cb,
+                  adapter);
+    lm_adapter_pop_context(adapter);
     return LM_STATUS_SUCCESS;
 }
 
-static void lm_adapter_call_method_cb(__attribute__((unused)) GObject *source_object,
-                                        GAsyncResult *res,
-                                        gpointer user_data)
+static void lm_adapter_request_free(lm_adapter_request_t *request)
 {
-    lm_adapter_t *adapter = (lm_adapter_t *) user_data;
-    g_assert(adapter != NULL);
+    g_free(request->device_path);
+    g_object_unref(request->cancellable);
+    g_free(request);
+}
+
+static void lm_adapter_request_complete(lm_adapter_t *adapter, lm_adapter_request_t *request,
+                                        lm_status_t status)
+{
+    switch (request->type) {
+        case LM_ADAPTER_REQUEST_SET_DISCOVERY_FILTER: {
+            lm_adapter_set_discovery_filter_cnf_t cnf = {
+                .adapter = adapter,
+                .request_id = request->id
+            };
+            lm_app_event_callback(LM_ADAPTER_SET_DISCOVERY_FILTER_CNF, status, &cnf);
+            break;
+        }
+        case LM_ADAPTER_REQUEST_REMOVE_DEVICE: {
+            lm_adapter_remove_device_cnf_t cnf = {
+                .adapter = adapter,
+                .request_id = request->id,
+                .device_path = request->device_path
+            };
+            lm_app_event_callback(LM_ADAPTER_REMOVE_DEVICE_CNF, status, &cnf);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static void lm_adapter_request_cb(__attribute__((unused)) GObject *source_object,
+                                  GAsyncResult *res,
+                                  gpointer user_data)
+{
+    lm_adapter_request_t *request = (lm_adapter_request_t *) user_data;
+    lm_status_t status = LM_STATUS_SUCCESS;
+    g_assert(request != NULL);
 
     GError *error = NULL;
-    GVariant *value = g_dbus_connection_call_finish(adapter->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
     if (value != NULL) {
         g_variant_unref(value);
     }
 
     if (error != NULL) {
-        lm_log_error(TAG, "failed to call adapter method '%s', error '%s'", adapter->calling_method, error->message);
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            status = LM_STATUS_CANCELLED;
+        } else if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+                   g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NO_REPLY) ||
+                   g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_TIMED_OUT)) {
+            status = LM_STATUS_TIMEOUT;
+        } else {
+            status = LM_STATUS_FAIL;
+        }
+        if (status == LM_STATUS_CANCELLED)
+            lm_log_debug(TAG, "request %u, adapter method '%s' cancelled", request->id, request->method);
+        else
+            lm_log_error(TAG, "request %u, adapter method '%s' failed, error '%s'",
+                         request->id, request->method, error->message);
         g_clear_error(&error);
     }
-    g_free((gpointer)adapter->calling_method);
-    adapter->calling_method = NULL;
+
+    g_mutex_lock(&request_mutex);
+    lm_adapter_t *adapter = request->adapter;
+    if (adapter)
+        g_hash_table_remove(adapter->requests, GUINT_TO_POINTER(request->id));
+    gboolean detached = request->detached;
+    g_mutex_unlock(&request_mutex);
+
+    if (adapter && !detached)
+        lm_adapter_request_complete(adapter, request, status);
+
+    lm_adapter_request_free(request);
 }
 
-static void lm_adapter_call_method(lm_adapter_t *adapter, const gchar *method, GVariant *parameters)
+/* Returns the request id, the outcome arrives as the CNF event of the request type */
+static guint lm_adapter_request_submit(lm_adapter_t *adapter, lm_adapter_request_type_t type,
+                                       const gchar *method, GVariant *parameters,
+                                       const gchar *device_path)
 {
     g_assert(adapter != NULL);
     g_assert(method != NULL);
 
-    if (adapter->calling_method) {
-        g_free((gpointer)adapter->calling_method);
-        adapter->calling_method = NULL;
+    lm_adapter_request_t *request = g_new0(lm_adapter_request_t, 1);
+    request->type = type;
+    request->adapter = adapter;
+    request->method = method;
+    request->device_path = g_strdup(device_path);
+    request->cancellable = g_cancellable_new();
+
+    /* 0 is never handed out */
+    guint id;
+    do {
+        id = (guint)g_atomic_int_add(&request_id_counter, 1) + 1;
+    } while (id == 0);
+    request->id = id;
+
+    g_mutex_lock(&request_mutex);
+    g_hash_table_insert(adapter->requests, GUINT_TO_POINTER(request->id), request);
+    g_mutex_unlock(&request_mutex);
+
+    lm_log_debug(TAG, "request %u, adapter method '%s'", request->id, method);
+
+    lm_adapter_push_context(adapter);
+    lm_dbus_call(adapter->dbus_conn,
+                 BLUEZ_DBUS,
+                 adapter->path,
+                 INTERFACE_ADAPTER,
+                 method,
+                 parameters,
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 request->cancellable,
+                 (GAsyncReadyCallback) lm_adapter_request_cb,
+                 request);
+    lm_adapter_pop_context(adapter);
+
+    /* the completion may already have freed the request */
+    return id;
+}
+
+lm_status_t lm_adapter_cancel_request(lm_adapter_t *adapter, guint request_id)
+{
+    g_assert(adapter);
+
+    g_mutex_lock(&request_mutex);
+    lm_adapter_request_t *request = g_hash_table_lookup(adapter->requests, GUINT_TO_POINTER(request_id));
+    if (request)
+        g_cancellable_cancel(request->cancellable);
+    g_mutex_unlock(&request_mutex);
+
+    return request ? LM_STATUS_SUCCESS : LM_STATUS_INVALID_ARGS;
+}
+
+guint lm_adapter_get_pending_request_count(lm_adapter_t *adapter)
+{
+    g_assert(adapter);
+
+    g_mutex_lock(&request_mutex);
+    guint count = g_hash_table_size(adapter->requests);
+    g_mutex_unlock(&request_mutex);
+
+    return count;
+}
+
+/*
+ * Completions still arrive later but no longer reach the adapter, the
+ * completion frees the request. A dedicated context has no thread left to
+ * dispatch them, so it is iterated here until every request completed.
+ */
+static void lm_adapter_cancel_all_requests(lm_adapter_t *adapter)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_mutex_lock(&request_mutex);
+    g_hash_table_iter_init(&iter, adapter->requests);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        lm_adapter_request_t *request = (lm_adapter_request_t *)value;
+        request->detached = TRUE;
+        if (!adapter->context) {
+            request->adapter = NULL;
+            g_hash_table_iter_remove(&iter);
+        }
+        g_cancellable_cancel(request->cancellable);
     }
-    adapter->calling_method = g_strdup(method);
+    g_mutex_unlock(&request_mutex);
 
-    g_dbus_connection_call(adapter->dbus_conn,
-                           BLUEZ_DBUS,
-                           adapter->path,
-                           INTERFACE_ADAPTER,
-                           method,
-                           parameters,
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                           NULL,
-                           (GAsyncReadyCallback) lm_adapter_call_method_cb,
-                           adapter);
+    if (!adapter->context)
+        return;
+
+    g_assert(!adapter->thread_id);
+    g_main_context_push_thread_default(adapter->context);
+    while (lm_adapter_get_pending_request_count(adapter) > 0)
+        g_main_context_iteration(adapter->context, TRUE);
+    g_main_context_pop_thread_default(adapter->context);
 }
 
-void lm_adapter_set_discovery_filter(lm_adapter_t *adapter,
+guint lm_adapter_set_discovery_filter(lm_adapter_t *adapter,
                                             gint16 rssi_threshold,
                                             const GPtrArray *service_uuids,
                                             const gchar *pattern,
@@ -1262,16 +1857,12 @@ void lm_adapter_set_discovery_filter(lm_adapter_t *adapter,
     g_assert(rssi_threshold >= -127);
     g_assert(rssi_threshold <= 20);
 
-    if (adapter->discovery_filter) {
-        lm_adapter_free_discovery_filter(adapter);
-    }
-    adapter->discovery_filter = g_new0(lm_adapter_discovery_filter_t, 1);
-    g_assert(adapter->discovery_filter != NULL);
-    adapter->discovery_filter->services = g_ptr_array_new();
-    adapter->discovery_filter->rssi = rssi_threshold;
-    adapter->discovery_filter->pattern = g_strdup(pattern);
-    adapter->discovery_filter->max_devices = max_devices;
-    adapter->discovery_filter->timeout = timeout;
+    lm_adapter_discovery_filter_t *filter = g_new0(lm_adapter_discovery_filter_t, 1);
+    filter->services = g_ptr_array_new();
+    filter->rssi = rssi_threshold;
+    filter->pattern = g_strdup(pattern);
+    filter->max_devices = max_devices;
+    filter->timeout = timeout;
 
     GVariantBuilder *arguments = g_variant_builder_new(G_VARIANT_TYPE_VARDICT);
     g_variant_builder_add(arguments, "{sv}", "Transport", g_variant_new_string("le"));
@@ -1289,27 +1880,58 @@ void lm_adapter_set_discovery_filter(lm_adapter_t *adapter,
             gchar *uuid = g_ptr_array_index(service_uuids, i);
             g_assert(g_uuid_string_is_valid(uuid));
             g_variant_builder_add(uuids, "s", uuid);
-            g_ptr_array_add(adapter->discovery_filter->services, g_strdup(uuid));
+            g_ptr_array_add(filter->services, g_strdup(uuid));
         }
         g_variant_builder_add(arguments, "{sv}", DEVICE_PROPERTY_UUIDS, g_variant_builder_end(uuids));
         g_variant_builder_unref(uuids);
     }
 
-    GVariant *filter = g_variant_builder_end(arguments);
+    /* filled before it is published, the dispatching thread may match right away */
+    g_mutex_lock(&adapter->filter_mutex);
+    lm_adapter_free_discovery_filter(adapter);
+    adapter->discovery_filter = filter;
+    g_mutex_unlock(&adapter->filter_mutex);
+
+    GVariant *parameters = g_variant_builder_end(arguments);
     g_variant_builder_unref(arguments);
-    lm_adapter_call_method(adapter,
-                            ADAPTER_METHOD_SET_DISCOVERY_FILTER,
-                            g_variant_new_tuple(&filter, 1));
+    return lm_adapter_request_submit(adapter,
+                                     LM_ADAPTER_REQUEST_SET_DISCOVERY_FILTER,
+                                     ADAPTER_METHOD_SET_DISCOVERY_FILTER,
+                                     g_variant_new_tuple(&parameters, 1),
+                                     NULL);
 }
 
-void lm_adapter_clear_discovery_filter(lm_adapter_t *adapter)
+guint lm_adapter_clear_discovery_filter(lm_adapter_t *adapter)
 {
     g_assert(adapter);
-    if (adapter->discovery_filter) {
-        lm_adapter_free_discovery_filter(adapter);
-        adapter->discovery_filter = NULL;
-    }
-    lm_adapter_call_method(adapter, ADAPTER_METHOD_SET_DISCOVERY_FILTER, NULL);
+    g_mutex_lock(&adapter->filter_mutex);
+    lm_adapter_free_discovery_filter(adapter);
+    g_mutex_unlock(&adapter->filter_mutex);
+    return lm_adapter_request_submit(adapter,
+                                     LM_ADAPTER_REQUEST_SET_DISCOVERY_FILTER,
+                                     ADAPTER_METHOD_SET_DISCOVERY_FILTER,
+                                     NULL,
+                                     NULL);
+}
+
+void lm_adapter_set_discovery_rules(lm_adapter_t *adapter, const lm_filter_t *rules)
+{
+    g_assert(adapter);
+
+    /* no match is running on the old rules once this returns */
+    g_mutex_lock(&adapter->filter_mutex);
+    adapter->discovery_rules = rules;
+    g_mutex_unlock(&adapter->filter_mutex);
+}
+
+void lm_adapter_set_scan_feed(lm_adapter_t *adapter, lm_scan_feed_t *feed)
+{
+    g_assert(adapter);
+
+    /* nothing is published to the old feed once this returns */
+    g_mutex_lock(&adapter->filter_mutex);
+    adapter->scan_feed = feed;
+    g_mutex_unlock(&adapter->filter_mutex);
 }
 
 lm_status_t lm_adapter_discoverable_on(lm_adapter_t *adapter)
@@ -1405,6 +2027,41 @@ GHashTable *lm_adapter_get_device_cache(lm_adapter_t *adapter)
     return adapter->device_cache;
 }
 
+GPtrArray *lm_adapter_get_top_rssi(lm_adapter_t *adapter, guint k)
+{
+    g_assert(adapter);
+
+    GPtrArray *paths = g_ptr_array_new_full(k, g_free);
+    gint64 oldest = g_get_monotonic_time() - (gint64)adapter->rssi_max_age_ms * 1000;
+
+    g_mutex_lock(&adapter->rssi_mutex);
+    GSequenceIter *iter = g_sequence_get_begin_iter(adapter->rssi_index);
+    while (paths->len < k && !g_sequence_iter_is_end(iter)) {
+        lm_adapter_rssi_entry_t *entry = g_sequence_get(iter);
+        iter = g_sequence_iter_next(iter);
+
+        /* aged out entries are dropped on the way, they come back with the next RSSI */
+        if (adapter->rssi_max_age_ms && entry->updated < oldest) {
+            lm_adapter_rssi_index_remove_locked(adapter, entry->device);
+            continue;
+        }
+        /* copied under the lock, the dispatching thread may evict the device right after */
+        g_ptr_array_add(paths, g_strdup(lm_device_get_path(entry->device)));
+    }
+    g_mutex_unlock(&adapter->rssi_mutex);
+
+    return paths;
+}
+
+void lm_adapter_set_rssi_max_age(lm_adapter_t *adapter, guint max_age_ms)
+{
+    g_assert(adapter);
+
+    g_mutex_lock(&adapter->rssi_mutex);
+    adapter->rssi_max_age_ms = max_age_ms;
+    g_mutex_unlock(&adapter->rssi_mutex);
+}
+
 GList *lm_adapter_get_connected_devices(lm_adapter_t *adapter)
 {
     g_assert (adapter != NULL);
@@ -1439,7 +2096,7 @@ static void lm_start_adv_cb(__attribute__((unused)) GObject *source_object,
     g_assert(adapter != NULL);
 
     GError *error = NULL;
-    GVariant *value = g_dbus_connection_call_finish(adapter->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
     if (value != NULL) {
         g_variant_unref(value);
     }
@@ -1471,7 +2128,8 @@ lm_status_t lm_adapter_start_adv(lm_adapter_t *adapter, lm_adv_t *adv)
 
     adapter->adv = adv;
 
-    g_dbus_connection_call(adapter->dbus_conn,
+    lm_adapter_push_context(adapter);
+    lm_dbus_call(adapter->dbus_conn,
                         BLUEZ_DBUS,
                         adapter->path,
                         INTERFACE_ADV_MANAGER,
@@ -1483,6 +2141,7 @@ lm_status_t lm_adapter_start_adv(lm_adapter_t *adapter, lm_adv_t *adv)
                         NULL,
                         (GAsyncReadyCallback) lm_start_adv_cb,
                         adapter);
+    lm_adapter_pop_context(adapter);
 
     return LM_STATUS_SUCCESS;
 }
@@ -1494,7 +2153,7 @@ static void lm_stop_adv_cb(__attribute__((unused)) GObject *source_object,
     g_assert(adapter != NULL);
 
     GError *error = NULL;
-    GVariant *value = g_dbus_connection_call_finish(adapter->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
     if (value != NULL) {
         g_variant_unref(value);
     }
@@ -1520,7 +2179,8 @@ lm_status_t lm_adapter_stop_adv(lm_adapter_t *adapter, lm_adv_t *adv)
         return LM_STATUS_FAIL;
     }
 
-    g_dbus_connection_call(adapter->dbus_conn,
+    lm_adapter_push_context(adapter);
+    lm_dbus_call(adapter->dbus_conn,
                         BLUEZ_DBUS,
                         adapter->path,
                         INTERFACE_ADV_MANAGER,
@@ -1532,6 +2192,7 @@ lm_status_t lm_adapter_stop_adv(lm_adapter_t *adapter, lm_adv_t *adv)
                         NULL,
                         (GAsyncReadyCallback) lm_stop_adv_cb,
                         adapter);
+    lm_adapter_pop_context(adapter);
 
     return LM_STATUS_SUCCESS;
 }
@@ -1542,13 +2203,15 @@ gboolean lm_adapter_is_advertising(lm_adapter_t *adapter)
     return adapter->advertising;
 }
 
-lm_status_t lm_adapter_remove_device(lm_adapter_t *adapter, lm_device_t *device)
+guint lm_adapter_remove_device(lm_adapter_t *adapter, lm_device_t *device)
 {
     g_assert(device);
     g_assert (adapter);
 
     lm_log_debug(TAG, "removing '%s' '%s'", lm_device_get_name(device), lm_device_get_address(device));
-    lm_adapter_call_method(adapter, ADAPTER_METHOD_REMOVE_DEVICE,
-                                      g_variant_new("(o)", lm_device_get_path(device)));
-    return LM_STATUS_SUCCESS;
+    return lm_adapter_request_submit(adapter,
+                                     LM_ADAPTER_REQUEST_REMOVE_DEVICE,
+                                     ADAPTER_METHOD_REMOVE_DEVICE,
+                                     g_variant_new("(o)", lm_device_get_path(device)),
+                                     lm_device_get_path(device));
 }
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef __LM_ADAPTER_PRIV_H__
+#define __LM_ADAPTER_PRIV_H__
+#include "lm_type.h"
+#include <glib.h>
+#include <gio/gio.h>
+#include "lm_forward_decl.h"
+#include "lm_adapter.h"
+
+/*
+ * Make the adapter context thread-default around signal subscriptions and
+ * async calls so their callbacks land on the adapter thread. No-op for
+ * adapters sharing the lea manager dbus thread.
+ */
+void lm_adapter_push_context(lm_adapter_t *adapter);
+
+void lm_adapter_pop_context(lm_adapter_t *adapter);
+
+/* g_timeout_add() and friends on the adapter context, interval in milliseconds */
+guint lm_adapter_timeout_add(lm_adapter_t *adapter, guint interval, GSourceFunc function, gpointer data);
+
+/* notify runs once the source is gone, also when the adapter context goes away first */
+guint lm_adapter_timeout_add_full(lm_adapter_t *adapter, guint interval, GSourceFunc function,
+                                  gpointer data, GDestroyNotify notify);
+
+guint lm_adapter_timeout_add_seconds(lm_adapter_t *adapter, guint interval, GSourceFunc function,
+                                     gpointer data);
+
+void lm_adapter_source_remove(lm_adapter_t *adapter, guint id);
+
+#endif //__LM_ADAPTER_PRIV_H__
@@ -2,6 +2,7 @@
 #include "lm_adv.h"
 #include "lm_log.h"
 #include "lm_utils.h"
+#include "lm_mem.h"
 #include "lm.h"
 #include "bluez_iface.h"
 #include <glib.h>
@@ -13,6 +14,22 @@
 
 #define TAG "lm_adv"
 
+typedef enum {
+    LM_ADV_PROPERTY_TYPE = 0,
+    LM_ADV_PROPERTY_LOCAL_NAME,
+    LM_ADV_PROPERTY_SERVICE_UUIDS,
+    LM_ADV_PROPERTY_MANUFACTURER_DATA,
+    LM_ADV_PROPERTY_SERVICE_DATA,
+    LM_ADV_PROPERTY_MIN_INTERVAL,
+    LM_ADV_PROPERTY_MAX_INTERVAL,
+    LM_ADV_PROPERTY_APPEARANCE,
+    LM_ADV_PROPERTY_DISCOVERABLE,
+    LM_ADV_PROPERTY_TX_POWER,
+    LM_ADV_PROPERTY_INCLUDES,
+    LM_ADV_PROPERTY_SECONDARY_CHANNEL,
+    LM_ADV_PROPERTY_COUNT
+} lm_adv_property_t;
+
 struct lm_adv {
     GDBusConnection *dbus_conn;  // Borrowed
     gchar *path; // Owned
@@ -30,14 +47,14 @@ struct lm_adv {
     lm_adv_type_t type;
     GPtrArray *includes; // owned
     lm_adv_secondary_channel_t secondary_channel;
+    GMutex lock; // guards the fields above against the GDBus thread
+    GVariant *properties[LM_ADV_PROPERTY_COUNT]; // Owned, built on first read
+    GVariant *all_properties; // Owned, GetAll reply
+    gsize mem_size; // charged to LM_MEM_ADV, the cached variants go to LM_MEM_VARIANT
 };
 
-typedef struct {
-    guint8 active_instances;
-    guint8 supported_instances;
-    GPtrArray *supported_secondary_channels;
-    GPtrArray *supported_includes;
-} lm_adv_manager_info_t;
+/* every adv gets its own object path, several may be exported at once */
+static gint adv_path_counter;
 
 static gchar *secondary_channel_str[] = {
     "1M",
@@ -50,6 +67,21 @@ static gchar *adv_type_str[] = {
     "broadcast"
 };
 
+static const gchar *adv_property_str[LM_ADV_PROPERTY_COUNT] = {
+    [LM_ADV_PROPERTY_TYPE] = ADV_PROPERTY_TYPE,
+    [LM_ADV_PROPERTY_LOCAL_NAME] = ADV_PROPERTY_LOCAL_NAME,
+    [LM_ADV_PROPERTY_SERVICE_UUIDS] = ADV_PROPERTY_SERVICE_UUIDS,
+    [LM_ADV_PROPERTY_MANUFACTURER_DATA] = ADV_PROPERTY_MANUFACTURE_DATA,
+    [LM_ADV_PROPERTY_SERVICE_DATA] = ADV_PROPERTY_SERVICE_DATA,
+    [LM_ADV_PROPERTY_MIN_INTERVAL] = ADV_PROPERTY_MIN_INTERVAL,
+    [LM_ADV_PROPERTY_MAX_INTERVAL] = ADV_PROPERTY_MAX_INTERVAL,
+    [LM_ADV_PROPERTY_APPEARANCE] = ADV_PROPERTY_APPEARANCE,
+    [LM_ADV_PROPERTY_DISCOVERABLE] = ADV_PROPERTY_DISCOVERABLE,
+    [LM_ADV_PROPERTY_TX_POWER] = ADV_PROPERTY_TX_POWER,
+    [LM_ADV_PROPERTY_INCLUDES] = ADV_PROPERTY_INCLUDES,
+    [LM_ADV_PROPERTY_SECONDARY_CHANNEL] = ADV_PROPERTY_SECONDARY_CHANNEL,
+};
+
 static void add_manufacturer_data(gpointer key, gpointer value, gpointer userdata) {
     GByteArray *byteArray = (GByteArray *) value;
     GVariant *byteArrayVariant = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, byteArray->data,
@@ -65,141 +97,181 @@ static void add_service_data(gpointer key, gpointer value, gpointer userdata) {
     g_variant_builder_add((GVariantBuilder *) userdata, "{sv}", (char *) key, byteArrayVariant);
 }
 
-static lm_adv_manager_info_t * lm_adv_manager_info_create(void)
+static GVariant *lm_adv_build_string_array(const GPtrArray *array)
 {
-    lm_adv_manager_info_t *info = g_new0(lm_adv_manager_info_t, 1);
-    info->supported_secondary_channels = g_ptr_array_new_with_free_func(g_free);
-    info->supported_includes = g_ptr_array_new_with_free_func(g_free);
-    return info;
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
+    if (array != NULL) {
+        for (guint i = 0; i < array->len; i++)
+            g_variant_builder_add(&builder, "s", (const gchar *) g_ptr_array_index(array, i));
+    }
+    return g_variant_builder_end(&builder);
 }
 
-static void lm_adv_manager_info_destroy(lm_adv_manager_info_t *info)
+static GVariant *lm_adv_build_property(lm_adv_t *adv, lm_adv_property_t property)
 {
-    if (!info)
-        return;
-
-    if (info->supported_secondary_channels)
-        g_ptr_array_free(info->supported_secondary_channels, TRUE);
-
-    if (info->supported_includes)
-        g_ptr_array_free(info->supported_includes, TRUE);
+    GVariant *ret = NULL;
+    GVariantBuilder builder;
+
+    switch (property) {
+        case LM_ADV_PROPERTY_TYPE:
+            ret = g_variant_new_string(adv_type_str[adv->type]);
+            break;
+        case LM_ADV_PROPERTY_LOCAL_NAME:
+            ret = adv->local_name ? g_variant_new_string(adv->local_name) : NULL;
+            break;
+        case LM_ADV_PROPERTY_SERVICE_UUIDS:
+            ret = lm_adv_build_string_array(adv->services);
+            break;
+        case LM_ADV_PROPERTY_MANUFACTURER_DATA:
+            g_variant_builder_init(&builder, G_VARIANT_TYPE("a{qv}"));
+            g_hash_table_foreach(adv->manufacturer_data, add_manufacturer_data, &builder);
+            ret = g_variant_builder_end(&builder);
+            break;
+        case LM_ADV_PROPERTY_SERVICE_DATA:
+            g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+            g_hash_table_foreach(adv->service_data, add_service_data, &builder);
+            ret = g_variant_builder_end(&builder);
+            break;
+        case LM_ADV_PROPERTY_MIN_INTERVAL:
+            lm_log_debug(TAG, "setting advertising MinInterval to %dms (requires experimental if version < v5.77)", adv->min_interval);
+            ret = g_variant_new_uint32(adv->min_interval);
+            break;
+        case LM_ADV_PROPERTY_MAX_INTERVAL:
+            lm_log_debug(TAG, "setting advertising MaxInterval to %dms (requires experimental if version < v5.77)", adv->max_interval);
+            ret = g_variant_new_uint32(adv->max_interval);
+            break;
+        case LM_ADV_PROPERTY_APPEARANCE:
+            ret = g_variant_new_uint16(adv->appearance);
+            break;
+        case LM_ADV_PROPERTY_DISCOVERABLE:
+            ret = g_variant_new_boolean(adv->discoverable);
+            break;
+        case LM_ADV_PROPERTY_TX_POWER:
+            ret = g_variant_new_int16(adv->tx_power);
+            break;
+        case LM_ADV_PROPERTY_INCLUDES:
+            ret = lm_adv_build_string_array(adv->includes);
+            break;
+        case LM_ADV_PROPERTY_SECONDARY_CHANNEL:
+            ret = g_variant_new_string(secondary_channel_str[adv->secondary_channel]);
+            break;
+        default:
+            break;
+    }
 
-    g_free((void *)info);
+    return ret ? g_variant_ref_sink(ret) : NULL;
 }
 
-static lm_status_t lm_adv_manager_get_info(GDBusConnection *dbus_conn, lm_adv_manager_info_t *info)
+/* Only what the exported interface declares is readable, as with the generated property getter */
+static gboolean lm_adv_property_exported(lm_adv_property_t property)
 {
-    g_assert(dbus_conn && info);
-    lm_log_debug(TAG, "Getting advertising manager information");
-
-    GError *error = NULL;
-    GVariant *result = g_dbus_connection_call_sync(
-                                            dbus_conn,
-                                            BLUEZ_DBUS,
-                                            "/",
-                                            INTERFACE_OBJECT_MANAGER,
-                                            OBJECT_MANAGER_METHOD_GET_MANAGED_OBJECTS,
-                                            NULL,
-                                            G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
-                                            G_DBUS_CALL_FLAGS_NONE,
-                                            BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                                            NULL,
-                                            &error
-    );
+    return g_dbus_interface_info_lookup_property((GDBusInterfaceInfo *)&bluez_leadvertisement1_interface,
+                                                 adv_property_str[property]) != NULL;
+}
 
-    if (!result) {
-        lm_log_error(TAG, "Error GetManagedObjects: %s", error->message);
-        g_clear_error(&error);
-        return LM_STATUS_FAIL;
+static lm_adv_property_t lm_adv_property_lookup(const gchar *property_name)
+{
+    for (guint i = 0; i < LM_ADV_PROPERTY_COUNT; i++) {
+        if (g_str_equal(adv_property_str[i], property_name))
+            return i;
     }
+    return LM_ADV_PROPERTY_COUNT;
+}
 
-    GVariantIter *iter = NULL;
-    g_variant_get(result, "(a{oa{sa{sv}}})", &iter);
+/* Cached variants are charged to LM_MEM_VARIANT while the adv holds them */
+static void lm_adv_variant_cache(GVariant **slot, GVariant *value)
+{
+    *slot = value;
+    if (value)
+        lm_mem_charge(LM_MEM_VARIANT, g_variant_get_size(value));
+}
 
-    const gchar *object_path;
-    GVariant *ifaces_and_properties;
+static void lm_adv_variant_clear(GVariant **slot)
+{
+    if (*slot)
+        lm_mem_uncharge(LM_MEM_VARIANT, g_variant_get_size(*slot));
+    g_clear_pointer(slot, g_variant_unref);
+}
 
-    while (g_variant_iter_loop(iter, "{&o@a{sa{sv}}}", &object_path, &ifaces_and_properties)) {
-        GVariantIter iter2;
-        const gchar *interface_name;
-        GVariant *properties;
+/* Borrowed, valid while adv->lock is held */
+static GVariant *lm_adv_lookup_property(lm_adv_t *adv, lm_adv_property_t property)
+{
+    if (adv->properties[property] == NULL)
+        lm_adv_variant_cache(&adv->properties[property], lm_adv_build_property(adv, property));
+    return adv->properties[property];
+}
 
-        g_variant_iter_init(&iter2, ifaces_and_properties);
-        while (g_variant_iter_loop(&iter2, "{&s@a{sv}}", &interface_name, &properties)) {
-            if (!g_str_equal(interface_name, INTERFACE_ADV_MANAGER)) {
-                //g_variant_unref(properties);
+/* Borrowed, valid while adv->lock is held */
+static GVariant *lm_adv_lookup_all_properties(lm_adv_t *adv)
+{
+    if (adv->all_properties == NULL) {
+        GVariantBuilder builder;
+        g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+        for (guint i = 0; i < LM_ADV_PROPERTY_COUNT; i++) {
+            if (!lm_adv_property_exported(i))
                 continue;
-            }
-
-            GVariantIter iter3;
-            gchar *property_name;
-            GVariant *property_value;
-
-            g_variant_iter_init(&iter3, properties);
-            while (g_variant_iter_loop(&iter3, "{&sv}", &property_name, &property_value)) {
-                if (g_str_equal(property_name, ADV_MANAGER_PROPERTY_ACTIVE_INSTANCES)) {
-                    info->active_instances = g_variant_get_byte(property_value);
-                } else if (g_str_equal(property_name, ADV_MANAGER_PROPERTY_SUPPORTED_INSTANCES)) {
-                    info->supported_instances = g_variant_get_byte(property_value);
-                } else if (g_str_equal(property_name, ADV_MANAGER_PROPERTY_SUPPORTED_SECONDARY_CHANNELS)) {
-                    GVariantIter *array_iter;
-                    gchar *value;
-                    g_variant_get(property_value, "as", &array_iter);
-                    while (g_variant_iter_loop(array_iter, "s", &value)) {
-                        g_ptr_array_add(info->supported_secondary_channels, g_strdup(value));
-                    }
-                    g_variant_iter_free(array_iter);
-                } else if (g_str_equal(property_name, ADV_MANAGER_PROPERTY_SUPPORTED_INCLUDES)) {
-                    GVariantIter *array_iter;
-                    gchar *value;
-                    g_variant_get(property_value, "as", &array_iter);
-                    while (g_variant_iter_loop(array_iter, "s", &value)) {
-                        g_ptr_array_add(info->supported_includes, g_strdup(value));
-                    }
-                    g_variant_iter_free(array_iter);
-                }
-            }
-            //g_variant_unref(properties);
+            GVariant *value = lm_adv_lookup_property(adv, i);
+            if (value)
+                g_variant_builder_add(&builder, "{sv}", adv_property_str[i], value);
         }
-        //g_variant_unref(ifaces_and_properties);
+        lm_adv_variant_cache(&adv->all_properties, g_variant_ref_sink(g_variant_builder_end(&builder)));
     }
+    return adv->all_properties;
+}
 
-    g_variant_iter_free(iter);
-    g_variant_unref(result);
+static void lm_adv_invalidate(lm_adv_t *adv, lm_adv_property_t property)
+{
+    lm_adv_variant_clear(&adv->properties[property]);
+    lm_adv_variant_clear(&adv->all_properties);
+}
 
-    return LM_STATUS_SUCCESS;
+/* Tell bluetoothd about a changed property so it updates the running set in place */
+static void lm_adv_properties_changed(lm_adv_t *adv, lm_adv_property_t property)
+{
+    if (adv->registration_id == 0 || !lm_adv_property_exported(property))
+        return;
+
+    GVariantBuilder changed;
+    GVariantBuilder invalidated;
+    g_variant_builder_init(&changed, G_VARIANT_TYPE("a{sv}"));
+    g_variant_builder_init(&invalidated, G_VARIANT_TYPE("as"));
+
+    g_mutex_lock(&adv->lock);
+    GVariant *value = lm_adv_lookup_property(adv, property);
+    if (value)
+        g_variant_builder_add(&changed, "{sv}", adv_property_str[property], value);
+    else
+        g_variant_builder_add(&invalidated, "s", adv_property_str[property]);
+    g_mutex_unlock(&adv->lock);
+
+    GError *error = NULL;
+    g_dbus_connection_emit_signal(adv->dbus_conn,
+                                  NULL,
+                                  adv->path,
+                                  INTERFACE_PROPERTIES,
+                                  PROPERTIES_SIGNAL_CHANGED,
+                                  g_variant_new("(sa{sv}as)", INTERFACE_ADV, &changed, &invalidated),
+                                  &error);
+    if (error != NULL) {
+        lm_log_error(TAG, "failed to emit %s change of '%s': %s", adv_property_str[property], adv->path,
+                     error->message);
+        g_clear_error(&error);
+    }
 }
 
 lm_adv_t *lm_adv_create(void)
 {
-    lm_adv_t *adv = NULL;
-    lm_adv_manager_info_t *info = NULL;
     GDBusConnection *dbus_conn = lm_get_gdbus_connection();
     if (!dbus_conn) {
         lm_log_error(TAG, "no dbus connection, please call lm_init() first!");
-        goto EXIT;
-    }
-
-    info = lm_adv_manager_info_create();
-
-    if (LM_STATUS_SUCCESS != lm_adv_manager_get_info(dbus_conn, info)) {
-        lm_log_error(TAG, "can not get adv manager info!");
-        goto EXIT;
+        return NULL;
     }
 
-    lm_log_debug(TAG, "active_instances:%d, supported_instances:%d",
-                    info->active_instances,
-                    info->supported_instances);
-    if (!info->supported_instances) {
-        lm_log_error(TAG, "no available adv instance, active:%d, supported:%d",
-                    info->active_instances, info->supported_instances);
-        goto EXIT;
-    }
-
-    adv = g_new0(lm_adv_t, 1);
+    lm_adv_t *adv = g_new0(lm_adv_t, 1);
     adv->dbus_conn = dbus_conn;
 
-    adv->path = g_strdup_printf("/org/bluez/lmadv_instance%d", info->active_instances);
+    adv->path = g_strdup_printf("/org/bluez/lmadv_instance%u", (guint) g_atomic_int_add(&adv_path_counter, 1));
     adv->manufacturer_data = g_hash_table_new_full(g_int_hash, g_int_equal, g_free,
                                                              (GDestroyNotify) lm_utils_byte_array_free);
     adv->service_data = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
@@ -210,17 +282,21 @@ lm_adv_t *lm_adv_create(void)
     adv->type = LM_ADV_PERIPHERAL;
     adv->includes = g_ptr_array_new();
     adv->secondary_channel = LM_ADV_SC_1M;
+    g_mutex_init(&adv->lock);
+    adv->mem_size = sizeof(lm_adv_t) + lm_mem_string_size(adv->path);
+    lm_mem_object_new(LM_MEM_ADV, adv->mem_size);
 
-EXIT:
-    if (info)
-        lm_adv_manager_info_destroy(info);
     return adv;
 }
 
 void lm_adv_set_type(lm_adv_t *adv, lm_adv_type_t type)
 {
     g_assert(adv);
+    g_mutex_lock(&adv->lock);
     adv->type = type;
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_TYPE);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_TYPE);
 }
 
 lm_adv_type_t lm_adv_get_type(lm_adv_t *adv)
@@ -257,16 +333,26 @@ void lm_adv_destroy(lm_adv_t *adv)
         adv->includes = NULL;
     }
 
+    for (guint i = 0; i < LM_ADV_PROPERTY_COUNT; i++)
+        lm_adv_variant_clear(&adv->properties[i]);
+    lm_adv_variant_clear(&adv->all_properties);
+    g_mutex_clear(&adv->lock);
+
+    lm_mem_object_free(LM_MEM_ADV, adv->mem_size);
     g_free(adv);
 }
 
 void lm_adv_set_local_name(lm_adv_t *adv, const gchar *name)
 {
     g_assert(adv && name);
+    g_mutex_lock(&adv->lock);
 
     if (adv->local_name)
         g_free((void *)adv->local_name);
     adv->local_name = g_strdup(name);
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_LOCAL_NAME);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_LOCAL_NAME);
 }
 
 const gchar *lm_adv_get_local_name(lm_adv_t *adv)
@@ -278,6 +364,7 @@ void lm_adv_set_services(lm_adv_t *adv, const GPtrArray * service_uuids)
 {
     g_assert(adv);
     g_assert(service_uuids != NULL);
+    g_mutex_lock(&adv->lock);
     if (adv->services != NULL) {
         g_ptr_array_free(adv->services, TRUE);
     }
@@ -286,6 +373,9 @@ void lm_adv_set_services(lm_adv_t *adv, const GPtrArray * service_uuids)
     for (guint i = 0; i < service_uuids->len; i++) {
         g_ptr_array_add(adv->services, g_strdup(g_ptr_array_index(service_uuids, i)));
     }
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_SERVICE_UUIDS);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_SERVICE_UUIDS);
 }
 
 void lm_adv_set_manufacturer_data(lm_adv_t *adv, guint16 manufacturer_id, const GByteArray *byteArray)
@@ -293,6 +383,7 @@ void lm_adv_set_manufacturer_data(lm_adv_t *adv, guint16 manufacturer_id, const
     g_assert(adv);
     g_assert(adv->manufacturer_data != NULL);
     g_assert(byteArray != NULL);
+    g_mutex_lock(&adv->lock);
 
     int man_id = manufacturer_id;
     g_hash_table_remove(adv->manufacturer_data, &man_id);
@@ -304,6 +395,9 @@ void lm_adv_set_manufacturer_data(lm_adv_t *adv, guint16 manufacturer_id, const
     g_byte_array_append(value, byteArray->data, byteArray->len);
 
     g_hash_table_insert(adv->manufacturer_data, key, value);
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_MANUFACTURER_DATA);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_MANUFACTURER_DATA);
 }
 
 void lm_adv_set_service_data(lm_adv_t *adv, const gchar* service_uuid, const GByteArray *byteArray)
@@ -313,6 +407,7 @@ void lm_adv_set_service_data(lm_adv_t *adv, const gchar* service_uuid, const GBy
     g_assert(service_uuid != NULL);
     g_assert(lm_utils_is_valid_uuid(service_uuid));
     g_assert(byteArray != NULL);
+    g_mutex_lock(&adv->lock);
 
     g_hash_table_remove(adv->service_data, service_uuid);
 
@@ -320,15 +415,24 @@ void lm_adv_set_service_data(lm_adv_t *adv, const gchar* service_uuid, const GBy
     g_byte_array_append(value, byteArray->data, byteArray->len);
 
     g_hash_table_insert(adv->service_data, g_strdup(service_uuid), value);
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_SERVICE_DATA);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_SERVICE_DATA);
 }
 
 void lm_adv_set_interval(lm_adv_t *adv, guint32 min, guint32 max)
 {
     g_assert(adv);
     g_assert(min <= max);
+    g_mutex_lock(&adv->lock);
 
     adv->min_interval = min;
     adv->max_interval = max;
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_MIN_INTERVAL);
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_MAX_INTERVAL);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_MIN_INTERVAL);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_MAX_INTERVAL);
 }
 
 const gchar *lm_adv_get_path(const lm_adv_t *adv)
@@ -340,7 +444,11 @@ const gchar *lm_adv_get_path(const lm_adv_t *adv)
 void lm_adv_set_appearance(lm_adv_t *adv, guint16 appearance)
 {
     g_assert(adv);
+    g_mutex_lock(&adv->lock);
     adv->appearance = appearance;
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_APPEARANCE);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_APPEARANCE);
 }
 
 guint16 lm_adv_get_appearance(lm_adv_t *adv)
@@ -352,7 +460,11 @@ guint16 lm_adv_get_appearance(lm_adv_t *adv)
 void lm_adv_set_discoverable(lm_adv_t *adv, gboolean discoverable)
 {
     g_assert(adv);
+    g_mutex_lock(&adv->lock);
     adv->discoverable = discoverable;
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_DISCOVERABLE);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_DISCOVERABLE);
 }
 
 gboolean lm_adv_is_discoverable(lm_adv_t *adv)
@@ -378,6 +490,7 @@ void lm_adv_set_tx_power(lm_adv_t *adv, gint16 tx_power)
     g_assert(adv);
     g_assert(tx_power >= -127);
     g_assert(tx_power <= 20);
+    g_mutex_lock(&adv->lock);
 
     adv->tx_power = tx_power;
 
@@ -388,6 +501,11 @@ void lm_adv_set_tx_power(lm_adv_t *adv, gint16 tx_power)
     // Try to remove to avoid adding duplicated value
     g_ptr_array_remove(adv->includes, "tx-power");
     g_ptr_array_add(adv->includes, "tx-power");
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_TX_POWER);
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_INCLUDES);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_TX_POWER);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_INCLUDES);
 }
 
 gint16 lm_adv_get_tx_power(lm_adv_t *adv)
@@ -400,8 +518,12 @@ void lm_adv_set_secondary_channel(lm_adv_t *adv, lm_adv_secondary_channel_t seco
 {
     g_assert(adv);
     g_assert(secondary_channel <= LM_ADV_SC_CODED);
+    g_mutex_lock(&adv->lock);
 
     adv->secondary_channel = secondary_channel;
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_SECONDARY_CHANNEL);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_SECONDARY_CHANNEL);
 }
 
 lm_adv_secondary_channel_t lm_adv_get_secondary_channel(lm_adv_t *adv)
@@ -413,6 +535,7 @@ lm_adv_secondary_channel_t lm_adv_get_secondary_channel(lm_adv_t *adv)
 void lm_adv_set_rsi(lm_adv_t *adv)
 {
     g_assert(adv);
+    g_mutex_lock(&adv->lock);
 
     if (adv->includes == NULL) {
         adv->includes = g_ptr_array_new();
@@ -420,90 +543,79 @@ void lm_adv_set_rsi(lm_adv_t *adv)
     // Try to remove to avoid adding duplicated value
     g_ptr_array_remove(adv->includes, "rsi");
     g_ptr_array_add(adv->includes, "rsi");
+    lm_adv_invalidate(adv, LM_ADV_PROPERTY_INCLUDES);
+    g_mutex_unlock(&adv->lock);
+    lm_adv_properties_changed(adv, LM_ADV_PROPERTY_INCLUDES);
 }
 
-static GVariant *lm_adv_get_property(__attribute__((unused)) GDBusConnection *connection,
-                                     __attribute__((unused)) const gchar *sender,
-                                     __attribute__((unused)) const gchar *object_path,
-                                     __attribute__((unused)) const gchar *interface_name,
-                                     const gchar *property_name,
-                                     __attribute__((unused)) GError **error,
-                                     __attribute__((unused)) gpointer user_data) {
-
-    GVariant *ret = NULL;
-    lm_adv_t *adv = user_data;
-    g_assert(adv);
-
-    if (g_str_equal(property_name, ADV_PROPERTY_TYPE)) {
-        ret = g_variant_new_string(adv_type_str[adv->type]);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_LOCAL_NAME)) {
-        ret = adv->local_name ? g_variant_new_string(adv->local_name) : NULL;
-    } else if (g_str_equal(property_name, ADV_PROPERTY_SERVICE_UUIDS)) {
-        GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("as"));
-        if (adv->services != NULL) {
-            for (guint i = 0; i < adv->services->len; i++) {
-                char *service_uuid = g_ptr_array_index(adv->services, i);
-                g_variant_builder_add(builder, "s", service_uuid);
-            }
-        }
-        ret = g_variant_builder_end(builder);
-        g_variant_builder_unref(builder);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_MANUFACTURE_DATA)) {
-        GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a{qv}"));
-        if (adv->manufacturer_data != NULL && g_hash_table_size(adv->manufacturer_data) > 0) {
-            g_hash_table_foreach(adv->manufacturer_data, add_manufacturer_data, builder);
-        }
-        ret = g_variant_builder_end(builder);
-        g_variant_builder_unref(builder);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_SERVICE_DATA)) {
-        GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("a{sv}"));
-        if (adv->service_data != NULL && g_hash_table_size(adv->service_data) > 0) {
-            g_hash_table_foreach(adv->service_data, add_service_data, builder);
-        }
-        ret = g_variant_builder_end(builder);
-        g_variant_builder_unref(builder);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_MIN_INTERVAL)) {
-        lm_log_debug(TAG, "setting advertising MinInterval to %dms (requires experimental if version < v5.77)", adv->min_interval);
-        ret = g_variant_new_uint32(adv->min_interval);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_MAX_INTERVAL)) {
-        lm_log_debug(TAG, "setting advertising MaxInterval to %dms (requires experimental if version < v5.77)", adv->max_interval);
-        ret = g_variant_new_uint32(adv->max_interval);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_APPEARANCE)) {
-        ret = g_variant_new_uint16(adv->appearance);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_DISCOVERABLE)) {
-        ret = g_variant_new_boolean(adv->discoverable);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_TX_POWER)) {
-        ret = g_variant_new_int16(adv->tx_power);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_INCLUDES)) {
-        GVariantBuilder *builder = g_variant_builder_new(G_VARIANT_TYPE("as"));
-        if (adv->includes != NULL) {
-            for (guint i = 0; i < adv->includes->len; i++) {
-                char *element = g_ptr_array_index(adv->includes, i);
-                g_variant_builder_add(builder, "s", element);
-            }
+static void lm_adv_handle_properties(lm_adv_t *adv, const gchar *method, GVariant *params,
+                                     GDBusMethodInvocation *invocation)
+{
+    if (g_str_equal(method, PROPERTIES_METHOD_GET_ALL)) {
+        const gchar *interface_name = NULL;
+        g_variant_get(params, "(&s)", &interface_name);
+
+        g_mutex_lock(&adv->lock);
+        GVariant *reply = g_str_equal(interface_name, INTERFACE_ADV) ?
+                          g_variant_new("(@a{sv})", lm_adv_lookup_all_properties(adv)) :
+                          g_variant_new("(a{sv})", NULL);
+        g_mutex_unlock(&adv->lock);
+
+        g_dbus_method_invocation_return_value(invocation, reply);
+    } else if (g_str_equal(method, PROPERTIES_METHOD_GET)) {
+        const gchar *interface_name = NULL;
+        const gchar *property_name = NULL;
+        g_variant_get(params, "(&s&s)", &interface_name, &property_name);
+
+        lm_adv_property_t property = lm_adv_property_lookup(property_name);
+        GVariant *reply = NULL;
+        if (g_str_equal(interface_name, INTERFACE_ADV) && property < LM_ADV_PROPERTY_COUNT &&
+            lm_adv_property_exported(property)) {
+            g_mutex_lock(&adv->lock);
+            GVariant *value = lm_adv_lookup_property(adv, property);
+            if (value)
+                reply = g_variant_new("(v)", value);
+            g_mutex_unlock(&adv->lock);
         }
-        ret = g_variant_builder_end(builder);
-        g_variant_builder_unref(builder);
-    } else if (g_str_equal(property_name, ADV_PROPERTY_SECONDARY_CHANNEL)) {
-        ret = g_variant_new_string(secondary_channel_str[adv->secondary_channel]);
+
+        if (reply)
+            g_dbus_method_invocation_return_value(invocation, reply);
+        else
+            g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_PROPERTY,
+                                                  "No such property '%s'", property_name);
+    } else {
+        g_dbus_method_invocation_return_error(invocation, G_DBUS_ERROR, G_DBUS_ERROR_PROPERTY_READ_ONLY,
+                                              "Advertisement properties are read-only");
     }
-    return ret;
 }
 
+/*
+ * Without a get_property handler GDBus routes Get and GetAll here, so
+ * bluetoothd is answered from the cached variants instead of one getter
+ * call per property.
+ */
 static void lm_adv_method_call(__attribute__((unused)) GDBusConnection *conn,
                                       __attribute__((unused)) const gchar *sender,
                                       __attribute__((unused)) const gchar *path,
-                                      __attribute__((unused)) const gchar *interface,
-                                      __attribute__((unused)) const gchar *method,
-                                      __attribute__((unused)) GVariant *params,
-                                      __attribute__((unused)) GDBusMethodInvocation *invocation,
-                                      __attribute__((unused)) void *userdata) {
-    lm_log_debug(TAG, "adv method called");
+                                      const gchar *interface,
+                                      const gchar *method,
+                                      GVariant *params,
+                                      GDBusMethodInvocation *invocation,
+                                      void *userdata) {
+    lm_adv_t *adv = (lm_adv_t *) userdata;
+    g_assert(adv);
+
+    if (g_str_equal(interface, INTERFACE_PROPERTIES)) {
+        lm_adv_handle_properties(adv, method, params, invocation);
+        return;
+    }
+
+    lm_log_debug(TAG, "adv method '%s' called", method);
+    g_dbus_method_invocation_return_value(invocation, NULL);
 }
 
 static const GDBusInterfaceVTable lm_adv_method_table = {
         .method_call = lm_adv_method_call,
-        .get_property = lm_adv_get_property
 };
 
 lm_status_t lm_adv_register(lm_adv_t *adv)
@@ -550,6 +662,7 @@ lm_status_t lm_adv_unregister(lm_adv_t *adv)
         lm_log_error(TAG, "failed to unregister adv");
         return LM_STATUS_FAIL;
     }
+    adv->registration_id = 0;
 
     return LM_STATUS_SUCCESS;
 }
@@ -0,0 +1,534 @@
+#include "bluez_dbus.h"
+#include "lm_adv_manager.h"
+#include "lm_adv.h"
+#include "lm_adapter.h"
+#include "lm_adapter_priv.h"
+#include "lm_dbus_priv.h"
+#include "lm_log.h"
+#include <glib.h>
+#include <gio/gio.h>
+
+#define TAG "lm_adv_manager"
+
+typedef enum {
+    LM_ADV_ENTRY_IDLE = 0,
+    LM_ADV_ENTRY_REGISTERING,
+    LM_ADV_ENTRY_ACTIVE,
+    LM_ADV_ENTRY_UNREGISTERING,
+} lm_adv_entry_state_t;
+
+typedef struct {
+    gint ref;
+    lm_adv_t *adv; // Borrowed, NULL once removed
+    gchar *path; // Owned, outlives the adv for late replies
+    gboolean pinned;
+    gboolean removed;
+    gboolean wanted; // selected by the last schedule
+    lm_adv_entry_state_t state;
+    gint64 active_since;
+    guint64 airtime_us;
+    guint activations;
+    guint failures;
+} lm_adv_entry_t;
+
+struct lm_adv_manager {
+    gint ref;
+    lm_adapter_t *adapter; // Borrowed
+    GDBusConnection *dbus_conn; // Borrowed
+    GMutex mutex;
+    GPtrArray *entries; // Owned, round-robin order
+    guint instances;
+    guint used; // instances held by registering, active or unregistering entries
+    guint slot_ms;
+    guint timer_ms; // interval of the running rotation timer
+    guint rotation_timer;
+    guint cursor;
+    guint rotations;
+    gboolean destroyed;
+};
+
+typedef struct {
+    lm_adv_manager_t *manager; // Owned reference
+    lm_adv_entry_t *entry; // Owned reference
+} lm_adv_manager_call_t;
+
+static lm_adv_manager_t *lm_adv_manager_ref(lm_adv_manager_t *manager)
+{
+    g_atomic_int_inc(&manager->ref);
+    return manager;
+}
+
+static void lm_adv_manager_unref(lm_adv_manager_t *manager)
+{
+    if (!g_atomic_int_dec_and_test(&manager->ref))
+        return;
+
+    g_ptr_array_free(manager->entries, TRUE);
+    g_mutex_clear(&manager->mutex);
+    g_free(manager);
+}
+
+static lm_adv_entry_t *lm_adv_entry_ref(lm_adv_entry_t *entry)
+{
+    g_atomic_int_inc(&entry->ref);
+    return entry;
+}
+
+static void lm_adv_entry_unref(gpointer data)
+{
+    lm_adv_entry_t *entry = (lm_adv_entry_t *) data;
+
+    if (!g_atomic_int_dec_and_test(&entry->ref))
+        return;
+
+    g_free(entry->path);
+    g_free(entry);
+}
+
+static lm_adv_manager_call_t *lm_adv_manager_call_new(lm_adv_manager_t *manager, lm_adv_entry_t *entry)
+{
+    lm_adv_manager_call_t *call = g_new0(lm_adv_manager_call_t, 1);
+    call->manager = lm_adv_manager_ref(manager);
+    call->entry = lm_adv_entry_ref(entry);
+    return call;
+}
+
+static void lm_adv_manager_call_free(lm_adv_manager_call_t *call)
+{
+    lm_adv_entry_unref(call->entry);
+    lm_adv_manager_unref(call->manager);
+    g_free(call);
+}
+
+static guint64 lm_adv_entry_airtime(const lm_adv_entry_t *entry, gint64 now)
+{
+    guint64 airtime = entry->airtime_us;
+
+    if (entry->state == LM_ADV_ENTRY_ACTIVE)
+        airtime += (guint64)(now - entry->active_since);
+
+    return airtime;
+}
+
+static lm_adv_entry_t *lm_adv_manager_find_entry(lm_adv_manager_t *manager, lm_adv_t *adv)
+{
+    for (guint i = 0; i < manager->entries->len; i++) {
+        lm_adv_entry_t *entry = g_ptr_array_index(manager->entries, i);
+        if (entry->adv == adv)
+            return entry;
+    }
+    return NULL;
+}
+
+static void lm_adv_manager_schedule(lm_adv_manager_t *manager);
+static void lm_adv_manager_unregister_entry(lm_adv_manager_t *manager, lm_adv_entry_t *entry);
+
+static void lm_adv_manager_register_cb(__attribute__((unused)) GObject *source_object,
+                                       GAsyncResult *res,
+                                       gpointer user_data)
+{
+    lm_adv_manager_call_t *call = (lm_adv_manager_call_t *) user_data;
+    lm_adv_manager_t *manager = call->manager;
+    lm_adv_entry_t *entry = call->entry;
+
+    GError *error = NULL;
+    GVariant *value = lm_dbus_call_finish(res, &error);
+    if (value != NULL) {
+        g_variant_unref(value);
+    }
+
+    g_mutex_lock(&manager->mutex);
+    if (error != NULL) {
+        lm_log_error(TAG, "failed to register '%s' (error %d: %s)", entry->path, error->code, error->message);
+        g_clear_error(&error);
+        entry->state = LM_ADV_ENTRY_IDLE;
+        entry->failures++;
+        manager->used--;
+        /* leave the instance to the next slot instead of retrying right away */
+    } else {
+        entry->state = LM_ADV_ENTRY_ACTIVE;
+        entry->active_since = g_get_monotonic_time();
+        entry->activations++;
+        lm_log_debug(TAG, "'%s' active", entry->path);
+
+        if (entry->removed || manager->destroyed)
+            lm_adv_manager_unregister_entry(manager, entry);
+        else if (!entry->wanted)
+            lm_adv_manager_schedule(manager);
+    }
+    g_mutex_unlock(&manager->mutex);
+
+    lm_adv_manager_call_free(call);
+}
+
+static void lm_adv_manager_register_entry(lm_adv_manager_t *manager, lm_adv_entry_t *entry)
+{
+    entry->state = LM_ADV_ENTRY_REGISTERING;
+    manager->used++;
+
+    lm_adapter_push_context(manager->adapter);
+    lm_dbus_call(manager->dbus_conn,
+                 BLUEZ_DBUS,
+                 lm_adapter_get_path(manager->adapter),
+                 INTERFACE_ADV_MANAGER,
+                 ADV_MANAGER_METHOD_REGISTER,
+                 g_variant_new("(oa{sv})", entry->path, NULL),
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 NULL,
+                 (GAsyncReadyCallback) lm_adv_manager_register_cb,
+                 lm_adv_manager_call_new(manager, entry));
+    lm_adapter_pop_context(manager->adapter);
+}
+
+static void lm_adv_manager_unregister_cb(__attribute__((unused)) GObject *source_object,
+                                         GAsyncResult *res,
+                                         gpointer user_data)
+{
+    lm_adv_manager_call_t *call = (lm_adv_manager_call_t *) user_data;
+    lm_adv_manager_t *manager = call->manager;
+    lm_adv_entry_t *entry = call->entry;
+
+    GError *error = NULL;
+    GVariant *value = lm_dbus_call_finish(res, &error);
+    if (value != NULL) {
+        g_variant_unref(value);
+    }
+
+    if (error != NULL) {
+        /* BlueZ drops the instance anyway when the object is gone */
+        lm_log_warn(TAG, "failed to unregister '%s' (error %d: %s)", entry->path, error->code, error->message);
+        g_clear_error(&error);
+    }
+
+    g_mutex_lock(&manager->mutex);
+    entry->state = LM_ADV_ENTRY_IDLE;
+    manager->used--;
+    if (!manager->destroyed)
+        lm_adv_manager_schedule(manager);
+    g_mutex_unlock(&manager->mutex);
+
+    lm_adv_manager_call_free(call);
+}
+
+static void lm_adv_manager_unregister_entry(lm_adv_manager_t *manager, lm_adv_entry_t *entry)
+{
+    g_assert(entry->state == LM_ADV_ENTRY_ACTIVE);
+
+    entry->airtime_us = lm_adv_entry_airtime(entry, g_get_monotonic_time());
+    entry->state = LM_ADV_ENTRY_UNREGISTERING;
+
+    lm_adapter_push_context(manager->adapter);
+    lm_dbus_call(manager->dbus_conn,
+                 BLUEZ_DBUS,
+                 lm_adapter_get_path(manager->adapter),
+                 INTERFACE_ADV_MANAGER,
+                 ADV_MANAGER_METHOD_UNREGISTER,
+                 g_variant_new("(o)", entry->path),
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 NULL,
+                 (GAsyncReadyCallback) lm_adv_manager_unregister_cb,
+                 lm_adv_manager_call_new(manager, entry));
+    lm_adapter_pop_context(manager->adapter);
+}
+
+static gboolean lm_adv_manager_rotate(gpointer user_data);
+
+/* Instances left to the unpinned advs, and how many of those there are */
+static guint lm_adv_manager_rotating_slots(lm_adv_manager_t *manager, guint *rotating)
+{
+    guint pinned = 0;
+
+    *rotating = 0;
+    for (guint i = 0; i < manager->entries->len; i++) {
+        lm_adv_entry_t *entry = g_ptr_array_index(manager->entries, i);
+        if (entry->pinned)
+            pinned++;
+        else
+            (*rotating)++;
+    }
+
+    return pinned < manager->instances ? manager->instances - pinned : 0;
+}
+
+static void lm_adv_manager_update_timer(lm_adv_manager_t *manager, gboolean needed)
+{
+    if (needed && manager->rotation_timer == 0) {
+        manager->timer_ms = manager->slot_ms;
+        manager->rotation_timer = lm_adapter_timeout_add_full(manager->adapter,
+                                                              manager->timer_ms,
+                                                              lm_adv_manager_rotate,
+                                                              lm_adv_manager_ref(manager),
+                                                              (GDestroyNotify) lm_adv_manager_unref);
+    } else if (!needed && manager->rotation_timer) {
+        lm_adapter_source_remove(manager->adapter, manager->rotation_timer);
+        manager->rotation_timer = 0;
+    }
+}
+
+/*
+ * Pick the advs that should hold an instance during the current slot, then
+ * release the ones that lost it and hand free instances to the chosen ones.
+ * Instances still being unregistered are handed over from the reply.
+ */
+static void lm_adv_manager_schedule(lm_adv_manager_t *manager)
+{
+    guint rotating = 0;
+    guint slots = lm_adv_manager_rotating_slots(manager, &rotating);
+    guint pinned_left = manager->instances - slots;
+    guint rotating_index = 0;
+
+    if (rotating)
+        manager->cursor %= rotating;
+
+    for (guint i = 0; i < manager->entries->len; i++) {
+        lm_adv_entry_t *entry = g_ptr_array_index(manager->entries, i);
+
+        if (entry->pinned) {
+            entry->wanted = pinned_left > 0;
+            if (pinned_left)
+                pinned_left--;
+        } else if (rotating <= slots) {
+            entry->wanted = TRUE;
+        } else {
+            guint offset = (rotating_index + rotating - manager->cursor) % rotating;
+            entry->wanted = offset < slots;
+        }
+
+        if (!entry->pinned)
+            rotating_index++;
+    }
+
+    for (guint i = 0; i < manager->entries->len; i++) {
+        lm_adv_entry_t *entry = g_ptr_array_index(manager->entries, i);
+        if (!entry->wanted && entry->state == LM_ADV_ENTRY_ACTIVE)
+            lm_adv_manager_unregister_entry(manager, entry);
+    }
+
+    for (guint i = 0; i < manager->entries->len && manager->used < manager->instances; i++) {
+        lm_adv_entry_t *entry = g_ptr_array_index(manager->entries, i);
+        if (entry->wanted && entry->state == LM_ADV_ENTRY_IDLE)
+            lm_adv_manager_register_entry(manager, entry);
+    }
+
+    lm_adv_manager_update_timer(manager, rotating > slots && slots > 0);
+}
+
+static gboolean lm_adv_manager_rotate(gpointer user_data)
+{
+    lm_adv_manager_t *manager = (lm_adv_manager_t *) user_data;
+    gboolean result = G_SOURCE_CONTINUE;
+
+    g_mutex_lock(&manager->mutex);
+    if (manager->destroyed) {
+        g_mutex_unlock(&manager->mutex);
+        return G_SOURCE_REMOVE;
+    }
+
+    guint rotating = 0;
+    guint slots = lm_adv_manager_rotating_slots(manager, &rotating);
+    manager->cursor += slots;
+    manager->rotations++;
+
+    if (manager->timer_ms != manager->slot_ms) {
+        /* restarted with the new duration by the schedule below */
+        manager->rotation_timer = 0;
+        result = G_SOURCE_REMOVE;
+    }
+
+    lm_adv_manager_schedule(manager);
+    if (manager->rotation_timer == 0)
+        result = G_SOURCE_REMOVE;
+    g_mutex_unlock(&manager->mutex);
+
+    return result;
+}
+
+static guint lm_adv_manager_query_instances(GDBusConnection *dbus_conn, const gchar *adapter_path)
+{
+    GError *error = NULL;
+    GVariant *result = lm_dbus_call_sync(dbus_conn,
+                                         BLUEZ_DBUS,
+                                         adapter_path,
+                                         INTERFACE_PROPERTIES,
+                                         PROPERTIES_METHOD_GET,
+                                         g_variant_new("(ss)", INTERFACE_ADV_MANAGER,
+                                                       ADV_MANAGER_PROPERTY_SUPPORTED_INSTANCES),
+                                         G_VARIANT_TYPE("(v)"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                                         NULL,
+                                         &error);
+    if (!result) {
+        lm_log_error(TAG, "failed to get %s (error %d: %s)", ADV_MANAGER_PROPERTY_SUPPORTED_INSTANCES,
+                     error->code, error->message);
+        g_clear_error(&error);
+        return 0;
+    }
+
+    GVariant *value = NULL;
+    g_variant_get(result, "(v)", &value);
+    guint instances = g_variant_get_byte(value);
+    g_variant_unref(value);
+    g_variant_unref(result);
+
+    return instances;
+}
+
+lm_adv_manager_t *lm_adv_manager_create(lm_adapter_t *adapter, guint max_instances, guint slot_ms)
+{
+    g_assert(adapter);
+
+    GDBusConnection *dbus_conn = lm_adapter_get_dbus_conn(adapter);
+    guint instances = lm_adv_manager_query_instances(dbus_conn, lm_adapter_get_path(adapter));
+    if (instances == 0) {
+        lm_log_error(TAG, "no free adv instance on '%s'", lm_adapter_get_path(adapter));
+        return NULL;
+    }
+
+    if (max_instances)
+        instances = MIN(instances, max_instances);
+
+    lm_adv_manager_t *manager = g_new0(lm_adv_manager_t, 1);
+    manager->ref = 1;
+    manager->adapter = adapter;
+    manager->dbus_conn = dbus_conn;
+    g_mutex_init(&manager->mutex);
+    manager->entries = g_ptr_array_new_with_free_func(lm_adv_entry_unref);
+    manager->instances = instances;
+    manager->slot_ms = slot_ms ? slot_ms : LM_ADV_MANAGER_DEFAULT_SLOT_MS;
+
+    lm_log_debug(TAG, "'%s' using %u instances, slot %u ms", lm_adapter_get_path(adapter), instances,
+                 manager->slot_ms);
+    return manager;
+}
+
+void lm_adv_manager_destroy(lm_adv_manager_t *manager)
+{
+    g_assert(manager);
+
+    g_mutex_lock(&manager->mutex);
+    manager->destroyed = TRUE;
+    lm_adv_manager_update_timer(manager, FALSE);
+
+    for (guint i = 0; i < manager->entries->len; i++) {
+        lm_adv_entry_t *entry = g_ptr_array_index(manager->entries, i);
+        if (entry->state == LM_ADV_ENTRY_ACTIVE)
+            lm_adv_manager_unregister_entry(manager, entry);
+        lm_adv_unregister(entry->adv);
+        entry->adv = NULL;
+        entry->removed = TRUE;
+    }
+    g_ptr_array_set_size(manager->entries, 0);
+    g_mutex_unlock(&manager->mutex);
+
+    lm_adv_manager_unref(manager);
+}
+
+lm_status_t lm_adv_manager_add(lm_adv_manager_t *manager, lm_adv_t *adv, gboolean pinned)
+{
+    g_assert(manager);
+    g_assert(adv);
+
+    g_mutex_lock(&manager->mutex);
+    if (lm_adv_manager_find_entry(manager, adv)) {
+        g_mutex_unlock(&manager->mutex);
+        return LM_STATUS_BUSY;
+    }
+
+    lm_status_t status = lm_adv_register(adv);
+    if (status != LM_STATUS_SUCCESS) {
+        g_mutex_unlock(&manager->mutex);
+        return status;
+    }
+
+    lm_adv_entry_t *entry = g_new0(lm_adv_entry_t, 1);
+    entry->ref = 1;
+    entry->adv = adv;
+    entry->path = g_strdup(lm_adv_get_path(adv));
+    entry->pinned = pinned;
+    g_ptr_array_add(manager->entries, entry);
+
+    lm_adv_manager_schedule(manager);
+    g_mutex_unlock(&manager->mutex);
+
+    return LM_STATUS_SUCCESS;
+}
+
+lm_status_t lm_adv_manager_remove(lm_adv_manager_t *manager, lm_adv_t *adv)
+{
+    g_assert(manager);
+    g_assert(adv);
+
+    g_mutex_lock(&manager->mutex);
+    lm_adv_entry_t *entry = lm_adv_manager_find_entry(manager, adv);
+    if (!entry) {
+        g_mutex_unlock(&manager->mutex);
+        return LM_STATUS_INVALID_ARGS;
+    }
+
+    /* a pending RegisterAdvertisement is undone from its reply */
+    if (entry->state == LM_ADV_ENTRY_ACTIVE)
+        lm_adv_manager_unregister_entry(manager, entry);
+    lm_adv_unregister(adv);
+    entry->adv = NULL;
+    entry->removed = TRUE;
+    g_ptr_array_remove(manager->entries, entry);
+
+    lm_adv_manager_schedule(manager);
+    g_mutex_unlock(&manager->mutex);
+
+    return LM_STATUS_SUCCESS;
+}
+
+void lm_adv_manager_set_slot_duration(lm_adv_manager_t *manager, guint slot_ms)
+{
+    g_assert(manager);
+    g_assert(slot_ms > 0);
+
+    g_mutex_lock(&manager->mutex);
+    manager->slot_ms = slot_ms;
+    g_mutex_unlock(&manager->mutex);
+}
+
+guint lm_adv_manager_get_instances(lm_adv_manager_t *manager)
+{
+    g_assert(manager);
+    return manager->instances;
+}
+
+guint lm_adv_manager_get_rotations(lm_adv_manager_t *manager)
+{
+    g_assert(manager);
+
+    g_mutex_lock(&manager->mutex);
+    guint rotations = manager->rotations;
+    g_mutex_unlock(&manager->mutex);
+
+    return rotations;
+}
+
+lm_status_t lm_adv_manager_get_stats(lm_adv_manager_t *manager, lm_adv_t *adv, lm_adv_manager_stats_t *stats)
+{
+    g_assert(manager);
+    g_assert(adv);
+    g_assert(stats);
+
+    g_mutex_lock(&manager->mutex);
+    lm_adv_entry_t *entry = lm_adv_manager_find_entry(manager, adv);
+    if (!entry) {
+        g_mutex_unlock(&manager->mutex);
+        return LM_STATUS_INVALID_ARGS;
+    }
+
+    stats->airtime_ms = lm_adv_entry_airtime(entry, g_get_monotonic_time()) / 1000;
+    stats->activations = entry->activations;
+    stats->failures = entry->failures;
+    stats->active = entry->state == LM_ADV_ENTRY_ACTIVE;
+    g_mutex_unlock(&manager->mutex);
+
+    return LM_STATUS_SUCCESS;
+}
@@ -1,10 +1,14 @@
 #include "bluez_dbus.h"
 #include "lm_agent.h"
+#include "lm_agent_priv.h"
 #include "lm_device.h"
 #include "lm_device_priv.h"
 #include "lm_adapter.h"
 #include "lm_log.h"
+#include "lm_dbus_priv.h"
+#include "lm_adapter_priv.h"
 #include "lm_utils.h"
+#include "lm_mem.h"
 #include "lm.h"
 #include "bluez_iface.h"
 #include <glib.h>
@@ -22,8 +26,27 @@ struct lm_agent {
     gchar *path; // Owned
     lm_agent_io_capability_t io_capability;
     guint registration_id;
+    GMutex request_mutex;
+    GHashTable *requests; // Owned, request id -> lm_agent_request_t, guarded by request_mutex
+    guint request_timeout_ms;
+    lm_agent_policy_func_t policy;
+    gpointer policy_data; // Borrowed
+    gsize mem_size; // charged to LM_MEM_AGENT, pending requests are charged separately
 };
 
+/* A RequestPasskey call waiting for the application */
+typedef struct {
+    gint ref;
+    guint id;
+    lm_agent_t *agent; // Borrowed
+    lm_device_t *device; // Borrowed
+    GDBusMethodInvocation *invocation; // Owned until answered
+    guint timeout_id;
+} lm_agent_request_t;
+
+static gint request_id_counter;
+static gint agent_path_counter;
+
 static gchar *agent_io_capa_name[] = {
     "DisplayOnly",
     "DisplayYesNo",
@@ -34,13 +57,28 @@ static gchar *agent_io_capa_name[] = {
 
 static lm_status_t lm_register_agent(lm_agent_t *agent);
 static lm_status_t lm_agentmanager_register_agent(lm_agent_t *agent) ;
+static void lm_agent_cancel_all_requests(lm_agent_t *agent, lm_status_t status);
+static lm_status_t lm_agentmanager_unregister_agent(lm_agent_t *agent);
 
 lm_agent_t *lm_agent_create(lm_adapter_t *adapter, lm_agent_io_capability_t io_capability) {
+    return lm_agent_create_with_policy(adapter, io_capability, NULL, NULL);
+}
+
+lm_agent_t *lm_agent_create_with_policy(lm_adapter_t *adapter, lm_agent_io_capability_t io_capability,
+                                        lm_agent_policy_func_t func, gpointer user_data) {
     lm_agent_t *agent = g_new0(lm_agent_t, 1);
-    agent->path = g_strdup("/org/bluez/lm_agent");
+    gint index = g_atomic_int_add(&agent_path_counter, 1);
+    agent->path = index ? g_strdup_printf("/org/bluez/lm_agent%d", index) : g_strdup("/org/bluez/lm_agent");
     agent->dbus_conn = lm_adapter_get_dbus_conn(adapter);
     agent->adapter = adapter;
     agent->io_capability = io_capability;
+    g_mutex_init(&agent->request_mutex);
+    agent->requests = g_hash_table_new(g_direct_hash, g_direct_equal);
+    agent->request_timeout_ms = LM_AGENT_DEFAULT_REQUEST_TIMEOUT_MS;
+    agent->policy = func;
+    agent->policy_data = user_data;
+    agent->mem_size = sizeof(lm_agent_t) + lm_mem_string_size(agent->path) + lm_mem_hash_table_size(agent->requests);
+    lm_mem_object_new(LM_MEM_AGENT, agent->mem_size);
     lm_register_agent(agent);
     lm_agentmanager_register_agent(agent);
     return agent;
@@ -48,6 +86,11 @@ lm_agent_t *lm_agent_create(lm_adapter_t *adapter, lm_agent_io_capability_t io_c
 
 void lm_agent_destroy(lm_agent_t *agent) {
     g_assert (agent != NULL);
+    lm_agent_cancel_all_requests(agent, LM_STATUS_CANCELLED);
+
+    /* lets bluez fall back to the previous default agent */
+    lm_agentmanager_unregister_agent(agent);
+
     gboolean result = g_dbus_connection_unregister_object(agent->dbus_conn, agent->registration_id);
     if (!result) {
         lm_log_error(TAG, "could not unregister agent");
@@ -59,9 +102,128 @@ void lm_agent_destroy(lm_agent_t *agent) {
     agent->dbus_conn = NULL;
     agent->adapter = NULL;
 
+    g_hash_table_destroy(agent->requests);
+    g_mutex_clear(&agent->request_mutex);
+
+    lm_mem_object_free(LM_MEM_AGENT, agent->mem_size);
     g_free(agent);
 }
 
+static lm_agent_request_t *lm_agent_request_ref(lm_agent_request_t *request)
+{
+    g_atomic_int_inc(&request->ref);
+    return request;
+}
+
+static void lm_agent_request_unref(gpointer data)
+{
+    lm_agent_request_t *request = (lm_agent_request_t *) data;
+
+    if (!g_atomic_int_dec_and_test(&request->ref))
+        return;
+
+    /* answered or failed before it is dropped, bluez must never wait for the D-Bus timeout */
+    g_assert(request->invocation == NULL);
+    lm_mem_uncharge(LM_MEM_AGENT, sizeof(lm_agent_request_t));
+    g_free(request);
+}
+
+/* Whoever takes the request out of the table answers it */
+static lm_agent_request_t *lm_agent_request_steal(lm_agent_t *agent, guint request_id)
+{
+    g_mutex_lock(&agent->request_mutex);
+    lm_agent_request_t *request = g_hash_table_lookup(agent->requests, GUINT_TO_POINTER(request_id));
+    if (request)
+        g_hash_table_remove(agent->requests, GUINT_TO_POINTER(request_id));
+    g_mutex_unlock(&agent->request_mutex);
+
+    if (request && request->timeout_id)
+        lm_adapter_source_remove(agent->adapter, request->timeout_id);
+
+    return request;
+}
+
+static void lm_agent_request_fail(lm_agent_request_t *request, lm_status_t status)
+{
+    g_dbus_method_invocation_return_dbus_error(request->invocation, BLUEZ_ERROR_CANCELED,
+                                               status == LM_STATUS_TIMEOUT ? "Request timed out" :
+                                                                             "Request cancelled");
+    request->invocation = NULL;
+
+    lm_agent_req_cancelled_ind_t ind = {
+        .agent = request->agent,
+        .device = request->device,
+        .request_id = request->id
+    };
+    lm_app_event_callback(LM_AGENT_REQ_CANCELLED_IND, status, &ind);
+}
+
+static gboolean lm_agent_request_timeout(gpointer user_data)
+{
+    lm_agent_request_t *request = (lm_agent_request_t *) user_data;
+
+    lm_agent_request_t *stolen = lm_agent_request_steal(request->agent, request->id);
+    if (stolen) {
+        lm_log_warn(TAG, "passkey request %u timed out", stolen->id);
+        lm_agent_request_fail(stolen, LM_STATUS_TIMEOUT);
+        lm_agent_request_unref(stolen);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static guint lm_agent_request_submit(lm_agent_t *agent, lm_device_t *device, GDBusMethodInvocation *invocation)
+{
+    lm_agent_request_t *request = g_new0(lm_agent_request_t, 1);
+    lm_mem_charge(LM_MEM_AGENT, sizeof(lm_agent_request_t));
+    request->ref = 1;
+    request->agent = agent;
+    request->device = device;
+    request->invocation = invocation;
+
+    g_mutex_lock(&agent->request_mutex);
+    do {
+        request->id = (guint)g_atomic_int_add(&request_id_counter, 1) + 1;
+    } while (request->id == 0 || g_hash_table_contains(agent->requests, GUINT_TO_POINTER(request->id)));
+    g_hash_table_insert(agent->requests, GUINT_TO_POINTER(request->id), request);
+
+    if (agent->request_timeout_ms) {
+        request->timeout_id = lm_adapter_timeout_add_full(agent->adapter,
+                                                          agent->request_timeout_ms,
+                                                          lm_agent_request_timeout,
+                                                          lm_agent_request_ref(request),
+                                                          lm_agent_request_unref);
+    }
+    guint id = request->id;
+    g_mutex_unlock(&agent->request_mutex);
+
+    return id;
+}
+
+static void lm_agent_cancel_all_requests(lm_agent_t *agent, lm_status_t status)
+{
+    GPtrArray *cancelled = g_ptr_array_new();
+
+    g_mutex_lock(&agent->request_mutex);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, agent->requests);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_ptr_array_add(cancelled, value);
+        g_hash_table_iter_remove(&iter);
+    }
+    g_mutex_unlock(&agent->request_mutex);
+
+    for (guint i = 0; i < cancelled->len; i++) {
+        lm_agent_request_t *request = g_ptr_array_index(cancelled, i);
+        if (request->timeout_id)
+            lm_adapter_source_remove(agent->adapter, request->timeout_id);
+        lm_agent_request_fail(request, status);
+        lm_agent_request_unref(request);
+    }
+    g_ptr_array_free(cancelled, TRUE);
+}
+
 static void lm_agent_method_call(__attribute__((unused)) GDBusConnection *conn,
                                 __attribute__((unused)) const gchar *sender,
                                 __attribute__((unused)) const gchar *path,
@@ -107,13 +269,24 @@ static void lm_agent_method_call(__attribute__((unused)) GDBusConnection *conn,
         if (device != NULL) {
             lm_device_set_bonding_state(device, LM_DEVICE_BONDING);
         }
+
+        guint32 passkey = 0;
+        lm_agent_policy_result_t policy = agent->policy ?
+                agent->policy(device, method, &passkey, agent->policy_data) : LM_AGENT_POLICY_DEFER;
+        if (policy == LM_AGENT_POLICY_ACCEPT) {
+            g_dbus_method_invocation_return_value(invocation, g_variant_new("(u)", passkey));
+            return;
+        } else if (policy == LM_AGENT_POLICY_REJECT) {
+            g_dbus_method_invocation_return_dbus_error(invocation, BLUEZ_ERROR_REJECTED, "Passkey rejected");
+            return;
+        }
+
         lm_agent_req_passkey_ind_t ind = {
+            .agent = agent,
             .device = device,
-            .passkey = 0
+            .request_id = lm_agent_request_submit(agent, device, invocation)
         };
         lm_app_event_callback(LM_AGENT_REQ_PASSKEY_IND, LM_STATUS_SUCCESS, &ind);
-        g_dbus_method_invocation_return_value(invocation, g_variant_new("(u)", ind.passkey));
-        //  g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Rejected", "No passkey inputted");
     } else if (g_str_equal(method, AGENT_METHOD_DISPLAY_PASSKEY)) {
         g_variant_get(params, "(ouq)", &object_path, &pass, &entered);
         lm_log_info(TAG, "passkey: %u, entered: %u", pass, entered);
@@ -121,9 +294,13 @@ static void lm_agent_method_call(__attribute__((unused)) GDBusConnection *conn,
         g_dbus_method_invocation_return_value(invocation, NULL);
     } else if (g_str_equal(method, AGENT_METHOD_REQUEST_CONFIRMATION)) {
         g_variant_get(params, "(ou)", &object_path, &pass);
+        lm_device_t *device = lm_device_lookup_by_path(adapter, object_path);
         g_free(object_path);
         lm_log_debug(TAG, "request confirmation for %u", pass);
-        g_dbus_method_invocation_return_value(invocation, NULL);
+        if (agent->policy && agent->policy(device, method, &pass, agent->policy_data) == LM_AGENT_POLICY_REJECT)
+            g_dbus_method_invocation_return_dbus_error(invocation, BLUEZ_ERROR_REJECTED, "Confirmation rejected");
+        else
+            g_dbus_method_invocation_return_value(invocation, NULL);
     } else if (g_str_equal(method, AGENT_METHOD_REQUEST_AUTHORIZATION)) {
         g_variant_get(params, "(o)", &object_path);
         lm_log_debug(TAG, "request for authorization %s", object_path);
@@ -141,9 +318,11 @@ static void lm_agent_method_call(__attribute__((unused)) GDBusConnection *conn,
         g_dbus_method_invocation_return_value(invocation, NULL);
     } else if (g_str_equal(method, AGENT_METHOD_CANCEL)) {
         lm_log_debug(TAG, "cancelling pairing");
+        lm_agent_cancel_all_requests(agent, LM_STATUS_CANCELLED);
         g_dbus_method_invocation_return_value(invocation, NULL);
     } else if (g_str_equal(method, AGENT_METHOD_RELEASE)) {
         lm_log_debug(TAG, "agent released");
+        lm_agent_cancel_all_requests(agent, LM_STATUS_CANCELLED);
         g_dbus_method_invocation_return_value(invocation, NULL);
     } else
         lm_log_error(TAG, "We should not come here, unknown method");
@@ -177,17 +356,17 @@ static lm_status_t lm_agentmanager_call_method(GDBusConnection *dbus_conn, const
     GVariant *result;
     GError *error = NULL;
 
-    result = g_dbus_connection_call_sync(dbus_conn,
-                                         BLUEZ_DBUS,
-                                         "/org/bluez",
-                                         INTERFACE_AGENT_MANAGER,
-                                         method,
-                                         param,
-                                         NULL,
-                                         G_DBUS_CALL_FLAGS_NONE,
-                                         BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                                         NULL,
-                                         &error);
+    result = lm_dbus_call_sync(dbus_conn,
+                               BLUEZ_DBUS,
+                               "/org/bluez",
+                               INTERFACE_AGENT_MANAGER,
+                               method,
+                               param,
+                               NULL,
+                               G_DBUS_CALL_FLAGS_NONE,
+                               BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                               NULL,
+                               &error);
     if (result)
         g_variant_unref(result);
 
@@ -218,6 +397,17 @@ static lm_status_t lm_agentmanager_register_agent(lm_agent_t *agent) {
     return result;
 }
 
+static lm_status_t lm_agentmanager_unregister_agent(lm_agent_t *agent) {
+    g_assert(agent != NULL);
+
+    lm_status_t result = lm_agentmanager_call_method(agent->dbus_conn, AGENT_MANAGER_METHOD_UNREGISTER,
+                                                     g_variant_new("(o)", agent->path));
+    if (result != LM_STATUS_SUCCESS) {
+        lm_log_error(TAG, "failed to unregister agent");
+    }
+    return result;
+}
+
 const gchar *lm_agent_get_path(const lm_agent_t *agent) {
     g_assert(agent != NULL);
     return agent->path;
@@ -227,3 +417,54 @@ lm_adapter_t *lm_agent_get_adapter(const lm_agent_t *agent){
 	g_assert(agent != NULL);
 	return agent->adapter;
 }
+
+lm_status_t lm_agent_reply_passkey(lm_agent_t *agent, guint request_id, guint32 passkey)
+{
+    g_assert(agent != NULL);
+
+    lm_agent_request_t *request = lm_agent_request_steal(agent, request_id);
+    if (!request)
+        return LM_STATUS_INVALID_ARGS;
+
+    g_dbus_method_invocation_return_value(request->invocation, g_variant_new("(u)", passkey));
+    request->invocation = NULL;
+    lm_agent_request_unref(request);
+
+    return LM_STATUS_SUCCESS;
+}
+
+lm_status_t lm_agent_reject(lm_agent_t *agent, guint request_id)
+{
+    g_assert(agent != NULL);
+
+    lm_agent_request_t *request = lm_agent_request_steal(agent, request_id);
+    if (!request)
+        return LM_STATUS_INVALID_ARGS;
+
+    g_dbus_method_invocation_return_dbus_error(request->invocation, BLUEZ_ERROR_REJECTED, "Passkey rejected");
+    request->invocation = NULL;
+    lm_agent_request_unref(request);
+
+    return LM_STATUS_SUCCESS;
+}
+
+void lm_agent_set_request_timeout(lm_agent_t *agent, guint timeout_ms)
+{
+    g_assert(agent != NULL);
+
+    g_mutex_lock(&agent->request_mutex);
+    agent->request_timeout_ms = timeout_ms;
+    g_mutex_unlock(&agent->request_mutex);
+}
+
+guint lm_agent_get_pending_request_count(lm_agent_t *agent)
+{
+    g_assert(agent != NULL);
+
+    g_mutex_lock(&agent->request_mutex);
+    guint count = g_hash_table_size(agent->requests);
+    g_mutex_unlock(&agent->request_mutex);
+
+    return count;
+}
+
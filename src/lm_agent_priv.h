@@ -0,0 +1,26 @@
+#ifndef __LM_AGENT_PRIV_H__
+#define __LM_AGENT_PRIV_H__
+#include "lm_type.h"
+#include <glib.h>
+#include "lm_forward_decl.h"
+#include "lm_agent.h"
+
+typedef enum {
+    LM_AGENT_POLICY_DEFER = 0,      /* hand the request to the application */
+    LM_AGENT_POLICY_ACCEPT,
+    LM_AGENT_POLICY_REJECT
+} lm_agent_policy_result_t;
+
+/*
+ * Consulted before RequestPasskey and RequestConfirmation reach the
+ * application, passkey is only used for RequestPasskey. Runs on the thread
+ * the agent object is dispatched on.
+ */
+typedef lm_agent_policy_result_t (*lm_agent_policy_func_t)(lm_device_t *device, const gchar *method,
+                                                           guint32 *passkey, gpointer user_data);
+
+/* The policy is in place before the agent is registered, no request can miss it */
+lm_agent_t *lm_agent_create_with_policy(lm_adapter_t *adapter, lm_agent_io_capability_t io_capability,
+                                        lm_agent_policy_func_t func, gpointer user_data);
+
+#endif //__LM_AGENT_PRIV_H__
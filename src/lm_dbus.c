@@ -0,0 +1,1004 @@
+#include "lm_dbus.h"
+#include "lm_dbus_priv.h"
+#include "lm_stats.h"
+#include "lm_histogram.h"
+#include "lm_log.h"
+#include "lm_mem.h"
+#include "lm.h"
+#include "bluez_dbus.h"
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TAG "lm_dbus"
+
+#define DBUS_CALL_NAME_MAX      128
+
+/* Capture file: "LMRC", version, then records. Integers and variants in host byte order */
+#define RECORD_MAGIC            "LMRC"
+#define RECORD_VERSION          1
+#define RECORD_STRING_NONE      G_MAXUINT16
+#define RECORD_STRING_MAX       (G_MAXUINT16 - 1)
+
+typedef enum {
+    RECORD_KIND_STRING = 1,     /* u16 id, u16 len, bytes; defines id for later records */
+    RECORD_KIND_SIGNAL,         /* u64 us, u16 path, u16 interface, u16 member, u16 type, u32 len, body */
+    RECORD_KIND_REPLY,          /* u64 us, u16 method, u16 path, u16 type, u32 len, body */
+    RECORD_KIND_ERROR           /* u64 us, u16 method, u16 path, u16 error name, u16 message */
+} lm_dbus_record_kind_t;
+
+typedef struct {
+    gint ref_count;
+    gboolean active; // cleared by lm_dbus_signal_unsubscribe(), guarded by subscription_mutex
+    gchar *interface_name; // Owned
+    gchar *member; // Owned
+    gchar *object_path; // Owned
+    gchar *arg0; // Owned
+    GDBusSignalFlags flags;
+    GDBusSignalCallback callback;
+    gpointer user_data; // Borrowed
+    GMainContext *context; // Owned, thread-default context at subscribe time
+} lm_dbus_subscription_t;
+
+typedef struct {
+    lm_dbus_record_kind_t kind;
+    guint64 time_us;
+    const gchar *path; // Borrowed, from the replay string table
+    const gchar *interface_name; // Borrowed, signals only
+    const gchar *member; // Borrowed, signal name or "interface.method"
+    GVariant *body; // Owned, NULL for errors and empty bodies
+    const gchar *error_name; // Borrowed
+    const gchar *error_message; // Borrowed
+} lm_dbus_replay_record_t;
+
+typedef struct {
+    lm_dbus_subscription_t *subscription; // Owned reference
+    lm_dbus_replay_record_t *record; // Borrowed, the replay waits for the dispatches of a record
+} lm_dbus_replay_dispatch_t;
+
+typedef struct {
+    lm_histogram_t *rtt; // Borrowed, owned by lm_stats
+    gchar *name; // Owned, "interface.method"
+    gchar *path; // Owned
+    gint64 start;
+} lm_dbus_call_t;
+
+static GMutex trace_mutex;
+static lm_dbus_trace_entry_t *trace_ring; // Owned
+static guint trace_capacity;
+static guint trace_next;
+static guint trace_count;
+static gint trace_enabled;
+
+static guint64 slow_call_threshold;
+
+static GMutex subscription_mutex;
+static GHashTable *subscriptions; // Owned, GDBus subscription id -> lm_dbus_subscription_t
+
+static GMutex record_mutex;
+static FILE *record_file; // Owned
+static GHashTable *record_strings; // Owned, string -> id + 1
+static gint64 record_start;
+static GDBusConnection *record_connection; // Borrowed
+static guint record_filter_id;
+
+static GMutex replay_mutex;
+static GCond replay_cond;
+static GHashTable *replay_replies; // Borrowed, "interface.method path" -> GQueue of records, NULL unless replaying
+static gint replay_pending;
+
+static void lm_dbus_record_reply(const gchar *name, const gchar *path, GVariant *reply, const GError *error);
+static gboolean lm_dbus_replay_lookup(const gchar *name, const gchar *path, GVariant **reply, GError **error);
+
+static void lm_dbus_trace_add(const gchar *name, const gchar *path, gint64 start, guint64 duration,
+                              gboolean sync, const GError *error)
+{
+    g_mutex_lock(&trace_mutex);
+    if (trace_ring) {
+        lm_dbus_trace_entry_t *entry = &trace_ring[trace_next];
+        entry->start_us = start;
+        entry->duration_us = duration;
+        entry->method = g_intern_string(name);
+        g_strlcpy(entry->path, path ? path : "", sizeof(entry->path));
+        entry->sync = sync;
+        entry->error_code = error ? error->code : 0;
+
+        trace_next = (trace_next + 1) % trace_capacity;
+        if (trace_count < trace_capacity)
+            trace_count++;
+    }
+    g_mutex_unlock(&trace_mutex);
+}
+
+static void lm_dbus_call_done(lm_histogram_t *rtt, const gchar *name, const gchar *path, gint64 start,
+                              gboolean sync, GVariant *reply, const GError *error)
+{
+    guint64 duration = (guint64)(g_get_monotonic_time() - start);
+
+    if (g_atomic_pointer_get(&record_file))
+        lm_dbus_record_reply(name, path, reply, error);
+
+    if (rtt)
+        lm_histogram_record(rtt, duration);
+
+    if (g_atomic_int_get(&trace_enabled))
+        lm_dbus_trace_add(name, path, start, duration, sync, error);
+
+    guint64 threshold = __atomic_load_n(&slow_call_threshold, __ATOMIC_RELAXED);
+    if (threshold && duration >= threshold)
+        lm_log_warn(TAG, "slow call %s on '%s' took %" G_GUINT64_FORMAT " us (%s)", name, path,
+                    duration, error ? error->message : "ok");
+}
+
+static lm_histogram_t *lm_dbus_call_histogram(const gchar *interface_name, const gchar *method_name,
+                                              gchar *name, gsize name_size)
+{
+    g_snprintf(name, name_size, "%s.%s", interface_name, method_name);
+    return lm_stats_get_histogram(LM_STATS_HISTOGRAM_METHOD, name);
+}
+
+static void lm_dbus_call_cb(GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+    GTask *task = G_TASK(user_data);
+    lm_dbus_call_t *call = g_task_get_task_data(task);
+    GError *error = NULL;
+
+    GVariant *reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+    lm_dbus_call_done(call->rtt, call->name, call->path, call->start, FALSE, reply, error);
+
+    if (error)
+        g_task_return_error(task, error);
+    else
+        g_task_return_pointer(task, reply, (GDestroyNotify)g_variant_unref);
+    g_object_unref(task);
+}
+
+static void lm_dbus_call_free(gpointer data)
+{
+    lm_dbus_call_t *call = (lm_dbus_call_t *)data;
+
+    g_free(call->name);
+    g_free(call->path);
+    g_free(call);
+}
+
+void lm_dbus_call(GDBusConnection *connection,
+                  const gchar *bus_name,
+                  const gchar *object_path,
+                  const gchar *interface_name,
+                  const gchar *method_name,
+                  GVariant *parameters,
+                  const GVariantType *reply_type,
+                  GDBusCallFlags flags,
+                  gint timeout_msec,
+                  GCancellable *cancellable,
+                  GAsyncReadyCallback callback,
+                  gpointer user_data)
+{
+    gchar name[DBUS_CALL_NAME_MAX];
+
+    g_assert(connection);
+    g_assert(object_path);
+    g_assert(interface_name);
+    g_assert(method_name);
+
+    lm_dbus_call_t *call = g_new0(lm_dbus_call_t, 1);
+    call->rtt = lm_dbus_call_histogram(interface_name, method_name, name, sizeof(name));
+    call->name = g_strdup(name);
+    call->path = g_strdup(object_path);
+
+    /* the task keeps the caller's thread-default context for the reply */
+    GTask *task = g_task_new(connection, cancellable, callback, user_data);
+    g_task_set_task_data(task, call, lm_dbus_call_free);
+
+    GVariant *reply = NULL;
+    GError *error = NULL;
+    if (lm_dbus_replay_lookup(name, object_path, &reply, &error)) {
+        if (parameters)
+            g_variant_unref(g_variant_ref_sink(parameters));
+        if (error)
+            g_task_return_error(task, error);
+        else
+            g_task_return_pointer(task, reply, (GDestroyNotify)g_variant_unref);
+        g_object_unref(task);
+        return;
+    }
+
+    call->start = g_get_monotonic_time();
+    g_dbus_connection_call(connection,
+                           bus_name,
+                           object_path,
+                           interface_name,
+                           method_name,
+                           parameters,
+                           reply_type,
+                           flags,
+                           timeout_msec,
+                           cancellable,
+                           lm_dbus_call_cb,
+                           task);
+}
+
+GVariant *lm_dbus_call_finish(GAsyncResult *res, GError **error)
+{
+    g_assert(res);
+    return g_task_propagate_pointer(G_TASK(res), error);
+}
+
+GVariant *lm_dbus_call_sync(GDBusConnection *connection,
+                            const gchar *bus_name,
+                            const gchar *object_path,
+                            const gchar *interface_name,
+                            const gchar *method_name,
+                            GVariant *parameters,
+                            const GVariantType *reply_type,
+                            GDBusCallFlags flags,
+                            gint timeout_msec,
+                            GCancellable *cancellable,
+                            GError **error)
+{
+    return lm_dbus_call_with_unix_fd_list_sync(connection, bus_name, object_path, interface_name,
+                                               method_name, parameters, reply_type, flags, timeout_msec,
+                                               NULL, NULL, cancellable, error);
+}
+
+GVariant *lm_dbus_call_with_unix_fd_list_sync(GDBusConnection *connection,
+                                              const gchar *bus_name,
+                                              const gchar *object_path,
+                                              const gchar *interface_name,
+                                              const gchar *method_name,
+                                              GVariant *parameters,
+                                              const GVariantType *reply_type,
+                                              GDBusCallFlags flags,
+                                              gint timeout_msec,
+                                              GUnixFDList *fd_list,
+                                              GUnixFDList **out_fd_list,
+                                              GCancellable *cancellable,
+                                              GError **error)
+{
+    gchar name[DBUS_CALL_NAME_MAX];
+    GError *local_error = NULL;
+
+    g_assert(connection);
+    g_assert(object_path);
+    g_assert(interface_name);
+    g_assert(method_name);
+
+    lm_histogram_t *rtt = lm_dbus_call_histogram(interface_name, method_name, name, sizeof(name));
+
+    GVariant *replayed = NULL;
+    if (lm_dbus_replay_lookup(name, object_path, &replayed, error)) {
+        /* fds are not captured, callers see a reply without them */
+        if (out_fd_list)
+            *out_fd_list = NULL;
+        if (parameters)
+            g_variant_unref(g_variant_ref_sink(parameters));
+        return replayed;
+    }
+
+    gint64 start = g_get_monotonic_time();
+    GVariant *reply = g_dbus_connection_call_with_unix_fd_list_sync(connection,
+                                                                    bus_name,
+                                                                    object_path,
+                                                                    interface_name,
+                                                                    method_name,
+                                                                    parameters,
+                                                                    reply_type,
+                                                                    flags,
+                                                                    timeout_msec,
+                                                                    fd_list,
+                                                                    out_fd_list,
+                                                                    cancellable,
+                                                                    &local_error);
+    lm_dbus_call_done(rtt, name, object_path, start, TRUE, reply, local_error);
+
+    if (local_error)
+        g_propagate_error(error, local_error);
+
+    return reply;
+}
+
+lm_status_t lm_dbus_trace_enable(guint capacity)
+{
+    if (capacity == 0)
+        return LM_STATUS_INVALID_ARGS;
+
+    g_mutex_lock(&trace_mutex);
+    g_free(trace_ring);
+    trace_ring = g_new0(lm_dbus_trace_entry_t, capacity);
+    trace_capacity = capacity;
+    trace_next = 0;
+    trace_count = 0;
+    g_atomic_int_set(&trace_enabled, TRUE);
+    g_mutex_unlock(&trace_mutex);
+
+    return LM_STATUS_SUCCESS;
+}
+
+void lm_dbus_trace_disable(void)
+{
+    g_mutex_lock(&trace_mutex);
+    g_atomic_int_set(&trace_enabled, FALSE);
+    g_free(trace_ring);
+    trace_ring = NULL;
+    trace_capacity = 0;
+    trace_next = 0;
+    trace_count = 0;
+    g_mutex_unlock(&trace_mutex);
+}
+
+guint lm_dbus_trace_get(lm_dbus_trace_entry_t *entries, guint max)
+{
+    guint copied = 0;
+
+    g_assert(entries || max == 0);
+
+    g_mutex_lock(&trace_mutex);
+    if (trace_ring) {
+        guint oldest = (trace_next + trace_capacity - trace_count) % trace_capacity;
+        for (copied = 0; copied < MIN(max, trace_count); copied++)
+            entries[copied] = trace_ring[(oldest + copied) % trace_capacity];
+    }
+    g_mutex_unlock(&trace_mutex);
+
+    return copied;
+}
+
+void lm_dbus_trace_dump(void)
+{
+    g_mutex_lock(&trace_mutex);
+    guint capacity = trace_capacity;
+    g_mutex_unlock(&trace_mutex);
+
+    if (capacity == 0) {
+        lm_log_info(TAG, "trace disabled");
+        return;
+    }
+
+    lm_dbus_trace_entry_t *entries = g_new(lm_dbus_trace_entry_t, capacity);
+    guint count = lm_dbus_trace_get(entries, capacity);
+    for (guint i = 0; i < count; i++) {
+        lm_log_info(TAG, "%" G_GINT64_FORMAT " %s%s '%s' %" G_GUINT64_FORMAT " us error %d",
+                    entries[i].start_us, entries[i].method, entries[i].sync ? " (sync)" : "",
+                    entries[i].path, entries[i].duration_us, entries[i].error_code);
+    }
+    g_free(entries);
+}
+
+void lm_dbus_set_slow_call_threshold(guint64 threshold_us)
+{
+    __atomic_store_n(&slow_call_threshold, threshold_us, __ATOMIC_RELAXED);
+}
+
+static void lm_dbus_subscription_unref(gpointer data)
+{
+    lm_dbus_subscription_t *subscription = (lm_dbus_subscription_t *)data;
+
+    if (!g_atomic_int_dec_and_test(&subscription->ref_count))
+        return;
+
+    g_free(subscription->interface_name);
+    g_free(subscription->member);
+    g_free(subscription->object_path);
+    g_free(subscription->arg0);
+    g_main_context_unref(subscription->context);
+    g_free(subscription);
+}
+
+static void lm_dbus_signal_cb(GDBusConnection *connection,
+                              const gchar *sender_name,
+                              const gchar *object_path,
+                              const gchar *interface_name,
+                              const gchar *signal_name,
+                              GVariant *parameters,
+                              gpointer user_data)
+{
+    lm_dbus_subscription_t *subscription = (lm_dbus_subscription_t *)user_data;
+
+    subscription->callback(connection, sender_name, object_path, interface_name, signal_name, parameters,
+                           subscription->user_data);
+}
+
+guint lm_dbus_signal_subscribe(GDBusConnection *connection,
+                               const gchar *sender,
+                               const gchar *interface_name,
+                               const gchar *member,
+                               const gchar *object_path,
+                               const gchar *arg0,
+                               GDBusSignalFlags flags,
+                               GDBusSignalCallback callback,
+                               gpointer user_data)
+{
+    g_assert(connection);
+    g_assert(callback);
+
+    lm_dbus_subscription_t *subscription = g_new0(lm_dbus_subscription_t, 1);
+    subscription->ref_count = 2; // GDBus and the subscription table
+    subscription->active = TRUE;
+    subscription->interface_name = g_strdup(interface_name);
+    subscription->member = g_strdup(member);
+    subscription->object_path = g_strdup(object_path);
+    subscription->arg0 = g_strdup(arg0);
+    subscription->flags = flags;
+    subscription->callback = callback;
+    subscription->user_data = user_data;
+    subscription->context = g_main_context_ref_thread_default();
+
+    guint id = g_dbus_connection_signal_subscribe(connection, sender, interface_name, member, object_path, arg0,
+                                                  flags, lm_dbus_signal_cb, subscription,
+                                                  lm_dbus_subscription_unref);
+
+    g_mutex_lock(&subscription_mutex);
+    if (!subscriptions)
+        subscriptions = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, lm_dbus_subscription_unref);
+    g_hash_table_insert(subscriptions, GUINT_TO_POINTER(id), subscription);
+    g_mutex_unlock(&subscription_mutex);
+
+    return id;
+}
+
+void lm_dbus_signal_unsubscribe(GDBusConnection *connection, guint subscription_id)
+{
+    g_assert(connection);
+
+    if (subscription_id == 0)
+        return;
+
+    g_mutex_lock(&subscription_mutex);
+    lm_dbus_subscription_t *subscription = subscriptions ?
+        g_hash_table_lookup(subscriptions, GUINT_TO_POINTER(subscription_id)) : NULL;
+    if (subscription) {
+        subscription->active = FALSE;
+        g_hash_table_remove(subscriptions, GUINT_TO_POINTER(subscription_id));
+    }
+    g_mutex_unlock(&subscription_mutex);
+
+    g_dbus_connection_signal_unsubscribe(connection, subscription_id);
+}
+
+/* Called with record_mutex held, FALSE once the file failed */
+static gboolean lm_dbus_record_write(const void *data, gsize size)
+{
+    if (!record_file)
+        return FALSE;
+
+    if (size && fwrite(data, size, 1, record_file) != 1) {
+        lm_log_error(TAG, "capture write failed, recording stopped");
+        fclose(record_file);
+        g_atomic_pointer_set(&record_file, NULL);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* Called with record_mutex held, defines the string on first use */
+static guint16 lm_dbus_record_string(const gchar *string)
+{
+    if (!string || !record_file)
+        return RECORD_STRING_NONE;
+
+    guint id = GPOINTER_TO_UINT(g_hash_table_lookup(record_strings, string));
+    if (id)
+        return (guint16)(id - 1);
+
+    guint count = g_hash_table_size(record_strings);
+    gsize len = strlen(string);
+    if (count >= RECORD_STRING_MAX || len > G_MAXUINT16)
+        return RECORD_STRING_NONE;
+
+    guint8 kind = RECORD_KIND_STRING;
+    guint16 new_id = (guint16)count;
+    guint16 new_len = (guint16)len;
+    lm_dbus_record_write(&kind, sizeof(kind));
+    lm_dbus_record_write(&new_id, sizeof(new_id));
+    lm_dbus_record_write(&new_len, sizeof(new_len));
+    if (!lm_dbus_record_write(string, len))
+        return RECORD_STRING_NONE;
+
+    g_hash_table_insert(record_strings, g_strdup(string), GUINT_TO_POINTER(count + 1));
+    return new_id;
+}
+
+/* Called with record_mutex held, the type string must already be defined */
+static void lm_dbus_record_body(GVariant *body)
+{
+    guint16 type = lm_dbus_record_string(body ? g_variant_get_type_string(body) : NULL);
+    guint32 len = body ? (guint32)g_variant_get_size(body) : 0;
+    lm_dbus_record_write(&type, sizeof(type));
+    if (lm_dbus_record_write(&len, sizeof(len)) && len)
+        lm_dbus_record_write(g_variant_get_data(body), len);
+}
+
+static void lm_dbus_record_reply(const gchar *name, const gchar *path, GVariant *reply, const GError *error)
+{
+    g_mutex_lock(&record_mutex);
+    if (record_file) {
+        guint8 kind = error ? RECORD_KIND_ERROR : RECORD_KIND_REPLY;
+        guint64 time_us = (guint64)(g_get_monotonic_time() - record_start);
+        guint16 method = lm_dbus_record_string(name);
+        guint16 object = lm_dbus_record_string(path);
+        if (error) {
+            gchar *error_name = g_dbus_error_encode_gerror(error);
+            guint16 error_id = lm_dbus_record_string(error_name);
+            guint16 message_id = lm_dbus_record_string(error->message);
+            g_free(error_name);
+
+            lm_dbus_record_write(&kind, sizeof(kind));
+            lm_dbus_record_write(&time_us, sizeof(time_us));
+            lm_dbus_record_write(&method, sizeof(method));
+            lm_dbus_record_write(&object, sizeof(object));
+            lm_dbus_record_write(&error_id, sizeof(error_id));
+            lm_dbus_record_write(&message_id, sizeof(message_id));
+        } else {
+            lm_dbus_record_string(reply ? g_variant_get_type_string(reply) : NULL);
+            lm_dbus_record_write(&kind, sizeof(kind));
+            lm_dbus_record_write(&time_us, sizeof(time_us));
+            lm_dbus_record_write(&method, sizeof(method));
+            lm_dbus_record_write(&object, sizeof(object));
+            lm_dbus_record_body(reply);
+        }
+    }
+    g_mutex_unlock(&record_mutex);
+}
+
+/* Runs on the GDBus worker thread, so a signal is recorded once however many subscriptions match it */
+static GDBusMessage *lm_dbus_record_filter(__attribute__((unused)) GDBusConnection *connection,
+                                          GDBusMessage *message,
+                                          gboolean incoming,
+                                          __attribute__((unused)) gpointer user_data)
+{
+    if (!incoming || g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_SIGNAL)
+        return message;
+
+    g_mutex_lock(&record_mutex);
+    if (record_file) {
+        guint8 kind = RECORD_KIND_SIGNAL;
+        guint64 time_us = (guint64)(g_get_monotonic_time() - record_start);
+        GVariant *body = g_dbus_message_get_body(message);
+        guint16 path = lm_dbus_record_string(g_dbus_message_get_path(message));
+        guint16 interface_name = lm_dbus_record_string(g_dbus_message_get_interface(message));
+        guint16 member = lm_dbus_record_string(g_dbus_message_get_member(message));
+        lm_dbus_record_string(body ? g_variant_get_type_string(body) : NULL);
+
+        lm_dbus_record_write(&kind, sizeof(kind));
+        lm_dbus_record_write(&time_us, sizeof(time_us));
+        lm_dbus_record_write(&path, sizeof(path));
+        lm_dbus_record_write(&interface_name, sizeof(interface_name));
+        lm_dbus_record_write(&member, sizeof(member));
+        lm_dbus_record_body(body);
+    }
+    g_mutex_unlock(&record_mutex);
+
+    return message;
+}
+
+lm_status_t lm_dbus_record_start(const gchar *filename)
+{
+    g_assert(filename);
+
+    GDBusConnection *connection = lm_get_gdbus_connection();
+    if (!connection)
+        return LM_STATUS_NOT_READY;
+
+    g_mutex_lock(&record_mutex);
+    if (record_file || record_filter_id) {
+        g_mutex_unlock(&record_mutex);
+        return LM_STATUS_BUSY;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (!file) {
+        g_mutex_unlock(&record_mutex);
+        lm_log_error(TAG, "cannot open capture '%s'", filename);
+        return LM_STATUS_FAIL;
+    }
+
+    guint32 version = RECORD_VERSION;
+    g_atomic_pointer_set(&record_file, file);
+    lm_dbus_record_write(RECORD_MAGIC, 4);
+    lm_dbus_record_write(&version, sizeof(version));
+    record_strings = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    record_start = g_get_monotonic_time();
+    record_connection = connection;
+    record_filter_id = g_dbus_connection_add_filter(connection, lm_dbus_record_filter, NULL, NULL);
+    g_mutex_unlock(&record_mutex);
+
+    lm_log_info(TAG, "recording to '%s'", filename);
+    return LM_STATUS_SUCCESS;
+}
+
+void lm_dbus_record_stop(void)
+{
+    g_mutex_lock(&record_mutex);
+    GDBusConnection *connection = record_connection;
+    guint filter_id = record_filter_id;
+    record_connection = NULL;
+    record_filter_id = 0;
+    if (record_file) {
+        fclose(record_file);
+        g_atomic_pointer_set(&record_file, NULL);
+    }
+    if (record_strings) {
+        g_hash_table_destroy(record_strings);
+        record_strings = NULL;
+    }
+    g_mutex_unlock(&record_mutex);
+
+    /* the filter may still run once more, it finds record_file NULL */
+    if (filter_id)
+        g_dbus_connection_remove_filter(connection, filter_id);
+}
+
+static gboolean lm_dbus_replay_read(const guint8 **cursor, const guint8 *end, void *out, gsize size)
+{
+    if ((gsize)(end - *cursor) < size)
+        return FALSE;
+    memcpy(out, *cursor, size);
+    *cursor += size;
+    return TRUE;
+}
+
+static const gchar *lm_dbus_replay_string(GPtrArray *strings, guint16 id)
+{
+    return id < strings->len ? g_ptr_array_index(strings, id) : NULL;
+}
+
+static gboolean lm_dbus_replay_read_body(const guint8 **cursor, const guint8 *end, GPtrArray *strings,
+                                         GVariant **body)
+{
+    guint16 type;
+    guint32 len;
+
+    if (!lm_dbus_replay_read(cursor, end, &type, sizeof(type)) ||
+        !lm_dbus_replay_read(cursor, end, &len, sizeof(len)) ||
+        (gsize)(end - *cursor) < len)
+        return FALSE;
+
+    const gchar *type_string = lm_dbus_replay_string(strings, type);
+    *body = NULL;
+    if (type_string) {
+        if (!g_variant_type_string_is_valid(type_string))
+            return FALSE;
+        GBytes *bytes = g_bytes_new(*cursor, len);
+        *body = g_variant_ref_sink(g_variant_new_from_bytes(G_VARIANT_TYPE(type_string), bytes, FALSE));
+        g_bytes_unref(bytes);
+        lm_mem_charge(LM_MEM_VARIANT, len);
+    }
+    *cursor += len;
+    return TRUE;
+}
+
+static void lm_dbus_replay_record_free(gpointer data)
+{
+    lm_dbus_replay_record_t *record = (lm_dbus_replay_record_t *)data;
+
+    if (record->body) {
+        lm_mem_uncharge(LM_MEM_VARIANT, g_variant_get_size(record->body));
+        g_variant_unref(record->body);
+    }
+    g_free(record);
+}
+
+/* strings receives the string table, records the signals, replies and errors in file order */
+static gboolean lm_dbus_replay_load(const gchar *filename, GPtrArray *strings, GPtrArray *records)
+{
+    gchar *contents = NULL;
+    gsize length = 0;
+    gboolean ok = TRUE;
+
+    if (!g_file_get_contents(filename, &contents, &length, NULL)) {
+        lm_log_error(TAG, "cannot read capture '%s'", filename);
+        return FALSE;
+    }
+
+    const guint8 *cursor = (const guint8 *)contents;
+    const guint8 *end = cursor + length;
+    guint32 version = 0;
+    if (length < 8 || memcmp(cursor, RECORD_MAGIC, 4) != 0) {
+        lm_log_error(TAG, "'%s' is not a capture", filename);
+        g_free(contents);
+        return FALSE;
+    }
+    cursor += 4;
+    lm_dbus_replay_read(&cursor, end, &version, sizeof(version));
+    if (version != RECORD_VERSION) {
+        lm_log_error(TAG, "capture '%s' has version %u", filename, version);
+        g_free(contents);
+        return FALSE;
+    }
+
+    while (ok && cursor < end) {
+        guint8 kind = *cursor++;
+        guint16 id, len, path, interface_name, member, error_name, message;
+
+        switch (kind) {
+            case RECORD_KIND_STRING:
+                ok = lm_dbus_replay_read(&cursor, end, &id, sizeof(id)) &&
+                     lm_dbus_replay_read(&cursor, end, &len, sizeof(len)) &&
+                     id == strings->len && (gsize)(end - cursor) >= len;
+                if (ok) {
+                    g_ptr_array_add(strings, g_strndup((const gchar *)cursor, len));
+                    cursor += len;
+                }
+                break;
+            case RECORD_KIND_SIGNAL: {
+                lm_dbus_replay_record_t *record = g_new0(lm_dbus_replay_record_t, 1);
+                record->kind = RECORD_KIND_SIGNAL;
+                ok = lm_dbus_replay_read(&cursor, end, &record->time_us, sizeof(record->time_us)) &&
+                     lm_dbus_replay_read(&cursor, end, &path, sizeof(path)) &&
+                     lm_dbus_replay_read(&cursor, end, &interface_name, sizeof(interface_name)) &&
+                     lm_dbus_replay_read(&cursor, end, &member, sizeof(member)) &&
+                     lm_dbus_replay_read_body(&cursor, end, strings, &record->body);
+                if (ok) {
+                    record->path = lm_dbus_replay_string(strings, path);
+                    record->interface_name = lm_dbus_replay_string(strings, interface_name);
+                    record->member = lm_dbus_replay_string(strings, member);
+                }
+                g_ptr_array_add(records, record);
+                break;
+            }
+            case RECORD_KIND_REPLY:
+            case RECORD_KIND_ERROR: {
+                lm_dbus_replay_record_t *record = g_new0(lm_dbus_replay_record_t, 1);
+                record->kind = kind;
+                ok = lm_dbus_replay_read(&cursor, end, &record->time_us, sizeof(record->time_us)) &&
+                     lm_dbus_replay_read(&cursor, end, &member, sizeof(member)) &&
+                     lm_dbus_replay_read(&cursor, end, &path, sizeof(path));
+                if (ok && kind == RECORD_KIND_REPLY) {
+                    ok = lm_dbus_replay_read_body(&cursor, end, strings, &record->body);
+                } else if (ok) {
+                    ok = lm_dbus_replay_read(&cursor, end, &error_name, sizeof(error_name)) &&
+                         lm_dbus_replay_read(&cursor, end, &message, sizeof(message));
+                    if (ok) {
+                        record->error_name = lm_dbus_replay_string(strings, error_name);
+                        record->error_message = lm_dbus_replay_string(strings, message);
+                    }
+                }
+                if (ok) {
+                    record->member = lm_dbus_replay_string(strings, member);
+                    record->path = lm_dbus_replay_string(strings, path);
+                }
+                g_ptr_array_add(records, record);
+                break;
+            }
+            default:
+                ok = FALSE;
+                break;
+        }
+    }
+    g_free(contents);
+
+    if (!ok)
+        lm_log_error(TAG, "capture '%s' is truncated or corrupt", filename);
+    return ok;
+}
+
+static gboolean lm_dbus_replay_lookup(const gchar *name, const gchar *path, GVariant **reply, GError **error)
+{
+    if (!g_atomic_pointer_get(&replay_replies))
+        return FALSE;
+
+    gchar *key = g_strconcat(name, " ", path, NULL);
+    g_mutex_lock(&replay_mutex);
+    if (!replay_replies) {
+        g_mutex_unlock(&replay_mutex);
+        g_free(key);
+        return FALSE;
+    }
+
+    /* nothing goes to the bus while replaying, calls missing from the capture fail */
+    GQueue *queue = g_hash_table_lookup(replay_replies, key);
+    lm_dbus_replay_record_t *record = queue ? g_queue_pop_head(queue) : NULL;
+    if (!record) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "%s on '%s' is not in the capture", name, path);
+    } else if (record->kind == RECORD_KIND_ERROR) {
+        if (error)
+            *error = g_dbus_error_new_for_dbus_error(record->error_name ? record->error_name :
+                                                     "org.freedesktop.DBus.Error.Failed",
+                                                     record->error_message ? record->error_message : "");
+    } else {
+        *reply = record->body ? g_variant_ref(record->body) : g_variant_ref_sink(g_variant_new("()"));
+    }
+    g_mutex_unlock(&replay_mutex);
+    g_free(key);
+
+    return TRUE;
+}
+
+/* GDBus arg0path rule: equal, or one is a prefix of the other ending with '/' */
+static gboolean lm_dbus_replay_arg0_path_matches(const gchar *rule, const gchar *arg0)
+{
+    gsize rule_len = strlen(rule);
+    gsize arg0_len = strlen(arg0);
+
+    if (rule_len == arg0_len)
+        return strcmp(rule, arg0) == 0;
+    if (rule_len < arg0_len)
+        return rule_len > 0 && rule[rule_len - 1] == '/' && strncmp(rule, arg0, rule_len) == 0;
+    return arg0_len > 0 && arg0[arg0_len - 1] == '/' && strncmp(rule, arg0, arg0_len) == 0;
+}
+
+static gboolean lm_dbus_replay_matches(const lm_dbus_subscription_t *subscription,
+                                       const lm_dbus_replay_record_t *record)
+{
+    if (subscription->interface_name && g_strcmp0(subscription->interface_name, record->interface_name) != 0)
+        return FALSE;
+    if (subscription->member && g_strcmp0(subscription->member, record->member) != 0)
+        return FALSE;
+    if (subscription->object_path && g_strcmp0(subscription->object_path, record->path) != 0)
+        return FALSE;
+    if (!subscription->arg0)
+        return TRUE;
+
+    /* the string stays valid after the unref, it lives in the body */
+    const gchar *arg0 = NULL;
+    if (record->body && g_variant_is_container(record->body) && g_variant_n_children(record->body) > 0) {
+        GVariant *child = g_variant_get_child_value(record->body, 0);
+        if (g_variant_is_of_type(child, G_VARIANT_TYPE_STRING) ||
+            g_variant_is_of_type(child, G_VARIANT_TYPE_OBJECT_PATH))
+            arg0 = g_variant_get_string(child, NULL);
+        g_variant_unref(child);
+    }
+    if (!arg0)
+        return FALSE;
+
+    if (subscription->flags & G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_PATH)
+        return lm_dbus_replay_arg0_path_matches(subscription->arg0, arg0);
+    if (subscription->flags & G_DBUS_SIGNAL_FLAGS_MATCH_ARG0_NAMESPACE) {
+        gsize len = strlen(subscription->arg0);
+        return strncmp(arg0, subscription->arg0, len) == 0 && (arg0[len] == '\0' || arg0[len] == '.');
+    }
+    return strcmp(subscription->arg0, arg0) == 0;
+}
+
+static gboolean lm_dbus_replay_dispatch_cb(gpointer user_data)
+{
+    lm_dbus_replay_dispatch_t *dispatch = (lm_dbus_replay_dispatch_t *)user_data;
+    lm_dbus_subscription_t *subscription = dispatch->subscription;
+    lm_dbus_replay_record_t *record = dispatch->record;
+
+    g_mutex_lock(&subscription_mutex);
+    gboolean active = subscription->active;
+    g_mutex_unlock(&subscription_mutex);
+
+    if (active) {
+        GVariant *body = record->body ? g_variant_ref(record->body) : g_variant_ref_sink(g_variant_new("()"));
+        subscription->callback(lm_get_gdbus_connection(), BLUEZ_DBUS, record->path,
+                               record->interface_name, record->member, body, subscription->user_data);
+        g_variant_unref(body);
+    }
+
+    lm_dbus_subscription_unref(subscription);
+    g_free(dispatch);
+
+    g_mutex_lock(&replay_mutex);
+    if (--replay_pending == 0)
+        g_cond_broadcast(&replay_cond);
+    g_mutex_unlock(&replay_mutex);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Queued on each subscriber's context, returns the number of handlers */
+static guint lm_dbus_replay_signal(lm_dbus_replay_record_t *record)
+{
+    GHashTableIter iter;
+    gpointer value;
+    guint dispatched = 0;
+
+    g_mutex_lock(&subscription_mutex);
+    if (subscriptions) {
+        g_hash_table_iter_init(&iter, subscriptions);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            lm_dbus_subscription_t *subscription = (lm_dbus_subscription_t *)value;
+            if (!lm_dbus_replay_matches(subscription, record))
+                continue;
+
+            lm_dbus_replay_dispatch_t *dispatch = g_new0(lm_dbus_replay_dispatch_t, 1);
+            g_atomic_int_inc(&subscription->ref_count);
+            dispatch->subscription = subscription;
+            dispatch->record = record;
+
+            g_mutex_lock(&replay_mutex);
+            replay_pending++;
+            g_mutex_unlock(&replay_mutex);
+
+            GSource *source = g_idle_source_new();
+            g_source_set_priority(source, G_PRIORITY_DEFAULT);
+            g_source_set_callback(source, lm_dbus_replay_dispatch_cb, dispatch, NULL);
+            g_source_attach(source, subscription->context);
+            g_source_unref(source);
+            dispatched++;
+        }
+    }
+    g_mutex_unlock(&subscription_mutex);
+
+    return dispatched;
+}
+
+lm_status_t lm_dbus_replay(const gchar *filename, lm_dbus_replay_speed_t speed, lm_dbus_replay_stats_t *stats)
+{
+    g_assert(filename);
+
+    GPtrArray *strings = g_ptr_array_new_with_free_func(g_free);
+    GPtrArray *records = g_ptr_array_new_with_free_func(lm_dbus_replay_record_free);
+    if (!lm_dbus_replay_load(filename, strings, records)) {
+        g_ptr_array_free(records, TRUE);
+        g_ptr_array_free(strings, TRUE);
+        return LM_STATUS_FAIL;
+    }
+
+    /* replies are served per method and path in capture order, whenever the library asks */
+    GHashTable *replies = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_queue_free);
+    lm_dbus_replay_stats_t result = { 0 };
+    for (guint i = 0; i < records->len; i++) {
+        lm_dbus_replay_record_t *record = g_ptr_array_index(records, i);
+        if (record->kind == RECORD_KIND_SIGNAL || !record->member || !record->path)
+            continue;
+
+        gchar *key = g_strconcat(record->member, " ", record->path, NULL);
+        GQueue *queue = g_hash_table_lookup(replies, key);
+        if (!queue) {
+            queue = g_queue_new();
+            g_hash_table_insert(replies, key, queue);
+        } else {
+            g_free(key);
+        }
+        g_queue_push_tail(queue, record);
+        result.replies++;
+    }
+
+    g_mutex_lock(&replay_mutex);
+    if (replay_replies) {
+        g_mutex_unlock(&replay_mutex);
+        g_hash_table_destroy(replies);
+        g_ptr_array_free(records, TRUE);
+        g_ptr_array_free(strings, TRUE);
+        return LM_STATUS_BUSY;
+    }
+    g_atomic_pointer_set(&replay_replies, replies);
+    g_mutex_unlock(&replay_mutex);
+
+    lm_log_info(TAG, "replaying '%s', %u records", filename, records->len);
+
+    gint64 start = g_get_monotonic_time();
+    for (guint i = 0; i < records->len; i++) {
+        lm_dbus_replay_record_t *record = g_ptr_array_index(records, i);
+        if (record->kind != RECORD_KIND_SIGNAL)
+            continue;
+
+        if (speed == LM_DBUS_REPLAY_REAL_TIME) {
+            gint64 delay = start + (gint64)record->time_us - g_get_monotonic_time();
+            if (delay > 0)
+                g_usleep((gulong)delay);
+        }
+        result.signals++;
+        result.dispatched += lm_dbus_replay_signal(record);
+
+        /*
+         * Handlers may subscribe, e.g. for a device added by this record, so
+         * the next record is matched only once they all returned, as on the bus.
+         */
+        g_mutex_lock(&replay_mutex);
+        while (replay_pending > 0)
+            g_cond_wait(&replay_cond, &replay_mutex);
+        g_mutex_unlock(&replay_mutex);
+    }
+
+    g_mutex_lock(&replay_mutex);
+    g_atomic_pointer_set(&replay_replies, NULL);
+    g_mutex_unlock(&replay_mutex);
+    result.elapsed_us = (guint64)(g_get_monotonic_time() - start);
+
+    lm_log_info(TAG, "replayed %u signals to %u handlers in %" G_GUINT64_FORMAT " us",
+                result.signals, result.dispatched, result.elapsed_us);
+
+    g_hash_table_destroy(replies);
+    g_ptr_array_free(records, TRUE);
+    g_ptr_array_free(strings, TRUE);
+
+    if (stats)
+        *stats = result;
+    return LM_STATUS_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#ifndef __LM_DBUS_PRIV_H__
+#define __LM_DBUS_PRIV_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include "lm_dbus.h"
+
+/*
+ * Drop-in replacements for g_dbus_connection_call() and friends. The ready
+ * callback receives the connection as source object like before, but the
+ * result must be finished with lm_dbus_call_finish().
+ */
+void lm_dbus_call(GDBusConnection *connection,
+                  const gchar *bus_name,
+                  const gchar *object_path,
+                  const gchar *interface_name,
+                  const gchar *method_name,
+                  GVariant *parameters,
+                  const GVariantType *reply_type,
+                  GDBusCallFlags flags,
+                  gint timeout_msec,
+                  GCancellable *cancellable,
+                  GAsyncReadyCallback callback,
+                  gpointer user_data);
+
+GVariant *lm_dbus_call_finish(GAsyncResult *res, GError **error);
+
+GVariant *lm_dbus_call_sync(GDBusConnection *connection,
+                            const gchar *bus_name,
+                            const gchar *object_path,
+                            const gchar *interface_name,
+                            const gchar *method_name,
+                            GVariant *parameters,
+                            const GVariantType *reply_type,
+                            GDBusCallFlags flags,
+                            gint timeout_msec,
+                            GCancellable *cancellable,
+                            GError **error);
+
+GVariant *lm_dbus_call_with_unix_fd_list_sync(GDBusConnection *connection,
+                                              const gchar *bus_name,
+                                              const gchar *object_path,
+                                              const gchar *interface_name,
+                                              const gchar *method_name,
+                                              GVariant *parameters,
+                                              const GVariantType *reply_type,
+                                              GDBusCallFlags flags,
+                                              gint timeout_msec,
+                                              GUnixFDList *fd_list,
+                                              GUnixFDList **out_fd_list,
+                                              GCancellable *cancellable,
+                                              GError **error);
+
+/*
+ * Same as g_dbus_connection_signal_subscribe() without user_data_free, the
+ * subscription is also fed by lm_dbus_replay(). Must be removed with
+ * lm_dbus_signal_unsubscribe().
+ */
+guint lm_dbus_signal_subscribe(GDBusConnection *connection,
+                               const gchar *sender,
+                               const gchar *interface_name,
+                               const gchar *member,
+                               const gchar *object_path,
+                               const gchar *arg0,
+                               GDBusSignalFlags flags,
+                               GDBusSignalCallback callback,
+                               gpointer user_data);
+
+void lm_dbus_signal_unsubscribe(GDBusConnection *connection, guint subscription_id);
+
+#endif //__LM_DBUS_PRIV_H__
@@ -1,5 +1,6 @@
 #include "lm_device.h"
 #include "lm_device_priv.h"
+#include "lm_adapter_priv.h"
 #include "bluez_dbus.h"
 #include "lm_adapter.h"
 #include "lm_player.h"
@@ -7,6 +8,9 @@
 #include "lm_transport.h"
 #include "lm_transport_priv.h"
 #include "lm_log.h"
+#include "lm_dbus_priv.h"
+#include "lm_stats.h"
+#include "lm_mem.h"
 #include "lm_utils.h"
 #include "lm_uuids.h"
 #include "lm.h"
@@ -21,52 +25,94 @@
 
 #define BCAST_TRANSPORT_TIMER_LENGTH (100) /*unit: milliseconds*/
 
+/* Names up to this length minus the terminator and the set flag live inside the device */
+#define DEVICE_INLINE_NAME_LEN      24
+#define DEVICE_ADDRESS_LEN          18  /* "XX:XX:XX:XX:XX:XX" */
+
+/* RSSI smoothing: EWMA with alpha 1/4, kept with 4 fractional bits */
+#define RSSI_EWMA_SHIFT             2
+#define RSSI_FRACTION_BITS          4
+
+typedef enum {
+    RSSI_LEVEL_UNKNOWN = 0,
+    RSSI_LEVEL_BELOW,
+    RSSI_LEVEL_BETWEEN,
+    RSSI_LEVEL_ABOVE
+} lm_device_rssi_level_state_t;
+
+/* Last LM_DEVICE_RSSI_HISTORY_LEN samples, statistics are updated on insert */
+typedef struct {
+    gint64 time_us[LM_DEVICE_RSSI_HISTORY_LEN]; // monotonic
+    gint16 rssi[LM_DEVICE_RSSI_HISTORY_LEN];
+    guint8 head; // slot of the next sample
+    guint8 count;
+    gint16 min;
+    gint16 max;
+    gint32 sum;
+    gint64 sum_sq;
+    gint32 ewma; // RSSI << RSSI_FRACTION_BITS
+
+    gboolean thresholds_set;
+    gint16 low_threshold;
+    gint16 high_threshold;
+    lm_device_rssi_level_state_t level;
+} lm_device_rssi_history_t;
+
+/* A short name is kept inline, a longer one on the heap, an empty one is still set */
+typedef struct {
+    gchar *heap; // Owned, NULL while the value fits inline
+    gchar inline_buf[DEVICE_INLINE_NAME_LEN - 1];
+    guint8 set;
+} lm_device_str_t;
+
+/* Fields most scans touch come first, the path is allocated with the device */
 struct lm_device {
     GDBusConnection *dbus_conn; // Borrowed
-    bdaddr_t addr;  // Owned
     lm_adapter_t *adapter; // Borrowed
-    const gchar *path; // Owned
-    const gchar *name; // Owned
-    const gchar *address; // Owned
-    const gchar *address_type; // Owned
-    const gchar *alias; // Owned
-    gboolean services_resolved;
-    gboolean service_discovery_started;
-    gboolean paired;
+    bdaddr_t addr;  // Owned
+    guint8 address_type; // lm_device_address_type_t
     gint16 rssi;
-    gboolean trusted;
     gint16 txpower;
+    guint services_resolved : 1;
+    guint service_discovery_started : 1;
+    guint paired : 1;
+    guint trusted : 1;
+    guint bcast_sync_notified : 1;
+    lm_device_connection_state_t connection_state;
+    lm_device_bonding_state_t bonding_state;
+    lm_device_conn_bearer_t conn_bearer; // Owned, indicates the connection bearer of the device
+    guint mtu;
+    gchar address[DEVICE_ADDRESS_LEN]; // formatted from addr
+    lm_device_str_t name;
+    lm_device_str_t alias;
     GHashTable *manufacturer_data; // Owned
     GHashTable *service_data; // Owned
     GList *uuids; // Owned
-    guint mtu;
-    GList *services_list; // Owned
+    gsize mem_size; // charged to LM_MEM_DEVICE
 
-    lm_device_connection_state_t connection_state;
-    lm_device_bonding_state_t bonding_state;
-    lm_device_conn_bearer_t conn_bearer; // Owned, indicates the connection bearer of the device
+    lm_device_rssi_history_t rssi_history;
 
     guint player_prop_changed;
     guint transport_prop_changed;
     guint iface_added;
     guint iface_removed;
 
-    GHashTable *services; // Borrowed
-    GHashTable *characteristics; // Borrowed
-    GHashTable *descriptors; // Borrowed
-
     lm_player_t *active_player; // Owned, the player that is currently active on this device
-    GHashTable *players;
+    GHashTable *players; // Owned, NULL until the first player appears
 
     lm_transport_t *active_transport; // Owned, the transport that is currently active on this device
-    GHashTable *transports;
+    GHashTable *transports; // Owned, NULL until the first transport appears
 
     guint bcast_transport_timer_id;
     lm_transport_audio_location_t bcast_audio_location;
-    gboolean bcast_sync_notified;
 
-    /* memory self-management */
-    gint ref_count;
+    gchar path[]; // Owned, allocated with the device
+};
+
+static const gchar *address_type_names[] = {
+    [LM_DEVICE_ADDRESS_TYPE_UNKNOWN] = "unknown",
+    [LM_DEVICE_ADDRESS_TYPE_PUBLIC] = "public",
+    [LM_DEVICE_ADDRESS_TYPE_RANDOM] = "random"
 };
 
 static const gchar *connection_state_names[] = {
@@ -79,15 +125,78 @@ static const gchar *connection_state_names[] = {
 static void lm_device_free_uuids(lm_device_t *device);
 static void lm_device_free_manufacturer_data(lm_device_t *device);
 static void lm_device_free_service_data(lm_device_t *device);
+static void lm_device_mem_update(lm_device_t *device);
 static void lm_device_set_conn_state(lm_device_t *device,
                                               lm_device_connection_state_t state);
 
+static const gchar *lm_device_str_get(const lm_device_str_t *str)
+{
+    if (str->heap)
+        return str->heap;
+    return str->set ? str->inline_buf : NULL;
+}
+
+static void lm_device_str_set(lm_device_str_t *str, const gchar *value)
+{
+    if (g_strcmp0(lm_device_str_get(str), value) == 0)
+        return;
+
+    gsize len = strlen(value);
+    g_free(str->heap);
+    str->heap = NULL;
+    if (len < sizeof(str->inline_buf)) {
+        memcpy(str->inline_buf, value, len + 1);
+    } else {
+        str->inline_buf[0] = '\0';
+        str->heap = g_strndup(value, len);
+    }
+    str->set = TRUE;
+}
+
+static void lm_device_str_clear(lm_device_str_t *str)
+{
+    g_free(str->heap);
+    str->heap = NULL;
+    str->inline_buf[0] = '\0';
+    str->set = FALSE;
+}
+
+/* Most scanned devices never get a player or transport, the tables are made on first use */
+static GHashTable *lm_device_ensure_players(lm_device_t *device)
+{
+    if (!device->players)
+        device->players = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                                (GDestroyNotify) lm_player_destroy);
+    return device->players;
+}
+
+static GHashTable *lm_device_ensure_transports(lm_device_t *device)
+{
+    if (!device->transports)
+        device->transports = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                                   (GDestroyNotify) lm_transport_destroy);
+    return device->transports;
+}
+
+static lm_player_t *lm_device_lookup_player(lm_device_t *device, const gchar *path)
+{
+    return device->players ? (lm_player_t *)g_hash_table_lookup(device->players, path) : NULL;
+}
+
+static lm_transport_t *lm_device_lookup_transport(lm_device_t *device, const gchar *path)
+{
+    return device->transports ? (lm_transport_t *)g_hash_table_lookup(device->transports, path) : NULL;
+}
+
 static lm_player_t *lm_device_find_player(lm_device_t *device, lm_player_profile_t profile)
 {
     g_assert (device);
 
     lm_player_t *player = NULL;
 
+    if (!device->players)
+        return NULL;
+
     GList *all_players = g_hash_table_get_values(device->players);
     if (g_list_length(all_players) <= 0) {
         g_list_free(all_players);
@@ -146,6 +255,9 @@ static lm_transport_t *lm_device_find_transport(lm_device_t *device, lm_transpor
 
     lm_transport_t *transport = NULL;
 
+    if (!device->transports)
+        return NULL;
+
     GList *all_trans = g_hash_table_get_values(device->transports);
     if (g_list_length(all_trans) <= 0) {
         g_list_free(all_trans);
@@ -227,6 +339,9 @@ static gboolean bcast_sink_transport_timer_cb(gpointer user_data)
         g_list_length(connected_devices) == 0)
         ind.method = LM_ADAPTER_BCAST_DISCOVERED_BY_SINK_SCAN;
 
+    for (guint i = 0; i < bcast_transports->len; i++)
+        lm_transport_mark_discovered(g_ptr_array_index(bcast_transports, i));
+
     lm_app_event_callback(LM_ADAPTER_BCAST_DISCOVERED_IND, LM_STATUS_SUCCESS, &ind);
 
     status = LM_STATUS_SUCCESS;
@@ -274,10 +389,11 @@ static void on_interface_appeared(__attribute__((unused)) GDBusConnection *conn,
 
             lm_log_debug(TAG, "media player '%s' added", object);
 
-            lm_player_t *player = (lm_player_t *)g_hash_table_lookup(device->players, object);
+            lm_player_t *player = lm_device_lookup_player(device, object);
             if (!player) {
                 player = lm_player_create(device, object);
-                g_hash_table_insert(device->players, g_strdup(object), player);
+                g_hash_table_insert(lm_device_ensure_players(device), g_strdup(object), player);
+                lm_device_mem_update(device);
             }
             g_variant_iter_init(&iter, properties);
             while (g_variant_iter_loop(&iter, "{&sv}", &property_name, &property_value)) {
@@ -292,10 +408,11 @@ static void on_interface_appeared(__attribute__((unused)) GDBusConnection *conn,
             lm_log_debug(TAG, "media transport '%s' added", object);
 
             lm_transport_t *transport = NULL;
-            transport = (lm_transport_t *)g_hash_table_lookup(device->transports, object);
+            transport = lm_device_lookup_transport(device, object);
             if (!transport) {
                 transport = lm_transport_create(device, object);
-                g_hash_table_insert(device->transports, g_strdup(object), transport);
+                g_hash_table_insert(lm_device_ensure_transports(device), g_strdup(object), transport);
+                lm_device_mem_update(device);
             }
             g_variant_iter_init(&iter, properties);
             while (g_variant_iter_loop(&iter, "{&sv}", &property_name, &property_value)) {
@@ -309,7 +426,8 @@ static void on_interface_appeared(__attribute__((unused)) GDBusConnection *conn,
 
                 if (!device->bcast_transport_timer_id) {
                     /* delay to wait transport setup done */
-                    device->bcast_transport_timer_id = g_timeout_add(BCAST_TRANSPORT_TIMER_LENGTH,
+                    device->bcast_transport_timer_id = lm_adapter_timeout_add(device->adapter,
+                                                                    BCAST_TRANSPORT_TIMER_LENGTH,
                                                                     bcast_sink_transport_timer_cb,
                                                                     device);
                 }
@@ -350,11 +468,12 @@ static void on_interface_disappeared(__attribute__((unused)) GDBusConnection *co
 
             lm_log_debug(TAG, "media player '%s' removed", object);
 
-            lm_player_t *player = (lm_player_t *)g_hash_table_lookup(device->players, object);
+            lm_player_t *player = lm_device_lookup_player(device, object);
             if (!player)
                 continue;
 
             g_hash_table_remove(device->players, object);
+            lm_device_mem_update(device);
             lm_device_update_active_player(device);
         } else if (g_str_equal(interface_name, INTERFACE_MEDIA_TRANSPORT)) {
             // Skip this player if it is not for this device
@@ -363,12 +482,13 @@ static void on_interface_disappeared(__attribute__((unused)) GDBusConnection *co
 
             lm_log_debug(TAG, "media transport '%s' removed", object);
 
-            lm_transport_t *transport = (lm_transport_t *)g_hash_table_lookup(device->transports, object);
+            lm_transport_t *transport = lm_device_lookup_transport(device, object);
             if (!transport)
                 continue;
 
             lm_transport_profile_t profile = lm_transport_get_profile(transport);
             g_hash_table_remove(device->transports, object);
+            lm_device_mem_update(device);
             lm_device_update_active_transport(device);
             if (profile == LM_TRANSPORT_PROFILE_BAP_BCAST_SINK) {
                 lm_log_debug(TAG, "bcast transport '%s' disappeared", object);
@@ -412,7 +532,7 @@ static void on_player_prop_changed(__attribute__((unused)) GDBusConnection *conn
     if (!g_str_has_prefix(path, device->path))
         return;
 
-    lm_player_t *player = (lm_player_t *)g_hash_table_lookup(device->players, path);
+    lm_player_t *player = lm_device_lookup_player(device, path);
     if (!player) {
         lm_log_error(TAG, "player not found for path: '%s' on device '%s'", path, device->path);
         return;
@@ -455,7 +575,7 @@ static void on_transport_prop_changed(__attribute__((unused)) GDBusConnection *c
     if (!g_str_has_prefix(path, device->path))
         return;
 
-    lm_transport_t *transport = (lm_transport_t *)g_hash_table_lookup(device->transports, path);
+    lm_transport_t *transport = lm_device_lookup_transport(device, path);
     if (!transport) {
         lm_log_error(TAG, "transport not found for path: %s on device '%s'", path, device->path);
         return;
@@ -491,7 +611,9 @@ static void lm_device_subscribe_signal(lm_device_t *device)
 {
     g_assert(device);
 
-    device->iface_added = g_dbus_connection_signal_subscribe(device->dbus_conn,
+    lm_adapter_push_context(device->adapter);
+
+    device->iface_added = lm_dbus_signal_subscribe(device->dbus_conn,
                                                             BLUEZ_DBUS,
                                                             INTERFACE_OBJECT_MANAGER,
                                                             OBJECT_MANAGER_SIGNAL_INTERFACE_ADDED,
@@ -499,10 +621,9 @@ static void lm_device_subscribe_signal(lm_device_t *device)
                                                             NULL,
                                                             G_DBUS_SIGNAL_FLAGS_NONE,
                                                             on_interface_appeared,
-                                                            device,
-                                                            NULL);
+                                                            device);
 
-    device->iface_removed = g_dbus_connection_signal_subscribe(device->dbus_conn,
+    device->iface_removed = lm_dbus_signal_subscribe(device->dbus_conn,
                                                             BLUEZ_DBUS,
                                                             INTERFACE_OBJECT_MANAGER,
                                                             OBJECT_MANAGER_SIGNAL_INTERFACE_REMOVED,
@@ -510,10 +631,9 @@ static void lm_device_subscribe_signal(lm_device_t *device)
                                                             NULL,
                                                             G_DBUS_SIGNAL_FLAGS_NONE,
                                                             on_interface_disappeared,
-                                                            device,
-                                                            NULL);
+                                                            device);
 
-    device->transport_prop_changed = g_dbus_connection_signal_subscribe(device->dbus_conn,
+    device->transport_prop_changed = lm_dbus_signal_subscribe(device->dbus_conn,
                                                             BLUEZ_DBUS,
                                                             INTERFACE_PROPERTIES,
                                                             PROPERTIES_SIGNAL_CHANGED,
@@ -521,10 +641,9 @@ static void lm_device_subscribe_signal(lm_device_t *device)
                                                             INTERFACE_MEDIA_TRANSPORT,
                                                             G_DBUS_SIGNAL_FLAGS_NONE,
                                                             on_transport_prop_changed,
-                                                            device,
-                                                            NULL);
+                                                            device);
 
-    device->player_prop_changed = g_dbus_connection_signal_subscribe(device->dbus_conn,
+    device->player_prop_changed = lm_dbus_signal_subscribe(device->dbus_conn,
                                                             BLUEZ_DBUS,
                                                             INTERFACE_PROPERTIES,
                                                             PROPERTIES_SIGNAL_CHANGED,
@@ -532,49 +651,102 @@ static void lm_device_subscribe_signal(lm_device_t *device)
                                                             INTERFACE_MEDIA_PLAYER,
                                                             G_DBUS_SIGNAL_FLAGS_NONE,
                                                             on_player_prop_changed,
-                                                            device,
-                                                            NULL);
+                                                            device);
+
+    lm_adapter_pop_context(device->adapter);
 }
 
 static void lm_device_unsubscribe_signal(lm_device_t *device)
 {
     g_assert(device);
 
-    g_dbus_connection_signal_unsubscribe(device->dbus_conn, device->iface_added);
+    lm_dbus_signal_unsubscribe(device->dbus_conn, device->iface_added);
     device->iface_added = 0;
-    g_dbus_connection_signal_unsubscribe(device->dbus_conn, device->iface_removed);
+    lm_dbus_signal_unsubscribe(device->dbus_conn, device->iface_removed);
     device->iface_removed = 0;
-    g_dbus_connection_signal_unsubscribe(device->dbus_conn, device->transport_prop_changed);
+    lm_dbus_signal_unsubscribe(device->dbus_conn, device->transport_prop_changed);
     device->transport_prop_changed = 0;
-    g_dbus_connection_signal_unsubscribe(device->dbus_conn, device->player_prop_changed);
+    lm_dbus_signal_unsubscribe(device->dbus_conn, device->player_prop_changed);
     device->player_prop_changed = 0;
 }
 
-lm_device_t *lm_device_create_with_bdaddr(lm_adapter_t *adapter, const bdaddr_t *addr)
+static gsize lm_device_data_size(GHashTable *data, gboolean string_keys)
 {
-    lm_device_t *device;
-    g_assert(adapter && addr);
+    GHashTableIter iter;
+    gpointer key, value;
+    gsize size = lm_mem_hash_table_size(data);
 
-    if ((device = g_new0(lm_device_t, 1)) == NULL)
-        return NULL;
+    if (data) {
+        g_hash_table_iter_init(&iter, data);
+        while (g_hash_table_iter_next(&iter, &key, &value))
+            size += (string_keys ? lm_mem_string_size(key) : sizeof(gint)) + lm_mem_byte_array_size(value);
+    }
+    return size;
+}
+
+/* Players and transports charge themselves, only the tables holding them count here */
+static gsize lm_device_mem_size(lm_device_t *device)
+{
+    gsize size = sizeof(lm_device_t) + lm_mem_string_size(device->path);
+
+    size += lm_mem_string_size(device->name.heap);
+    size += lm_mem_string_size(device->alias.heap);
+    size += lm_mem_list_size(device->uuids);
+    for (GList *iterator = device->uuids; iterator; iterator = iterator->next)
+        size += lm_mem_string_size(iterator->data);
+    size += lm_device_data_size(device->manufacturer_data, FALSE);
+    size += lm_device_data_size(device->service_data, TRUE);
+    size += lm_mem_hash_table_size(device->players);
+    size += lm_mem_hash_table_size(device->transports);
+    return size;
+}
+
+static void lm_device_mem_update(lm_device_t *device)
+{
+    gsize size = lm_device_mem_size(device);
+
+    lm_mem_recharge(LM_MEM_DEVICE, device->mem_size, size);
+    device->mem_size = size;
+}
+
+static void lm_device_format_address(lm_device_t *device)
+{
+    const bdaddr_t *addr = &device->addr;
+
+    g_snprintf(device->address, sizeof(device->address), "%.2X:%.2X:%.2X:%.2X:%.2X:%.2X",
+        addr->b[5], addr->b[4], addr->b[3], addr->b[2], addr->b[1], addr->b[0]);
+}
+
+/* One allocation for the device and its path */
+static lm_device_t *lm_device_alloc(lm_adapter_t *adapter, const gchar *path, const bdaddr_t *addr)
+{
+    gsize path_size = strlen(path) + 1;
+    lm_device_t *device = g_malloc0(sizeof(lm_device_t) + path_size);
 
     device->adapter = adapter;
     device->dbus_conn = lm_adapter_get_dbus_conn(adapter);
     device->rssi = -255;
     device->txpower = -255;
     device->mtu = 23;
+    memcpy(device->path, path, path_size);
     bacpy(&device->addr, addr);
-    device->address = g_strdup_printf("%.2X:%.2X:%.2X:%.2X:%.2X:%.2X",
-        addr->b[5], addr->b[4], addr->b[3], addr->b[2], addr->b[1], addr->b[0]);
+    lm_device_format_address(device);
+
+    lm_device_subscribe_signal(device);
+    device->mem_size = lm_device_mem_size(device);
+    lm_mem_object_new(LM_MEM_DEVICE, device->mem_size);
+    return device;
+}
 
-    device->path = g_strdup_printf("%s/dev_%.2X_%.2X_%.2X_%.2X_%.2X_%.2X",
+lm_device_t *lm_device_create_with_bdaddr(lm_adapter_t *adapter, const bdaddr_t *addr)
+{
+    g_assert(adapter && addr);
+
+    gchar *path = g_strdup_printf("%s/dev_%.2X_%.2X_%.2X_%.2X_%.2X_%.2X",
         lm_adapter_get_path(adapter),
         addr->b[5], addr->b[4], addr->b[3], addr->b[2], addr->b[1], addr->b[0]);
-    device->players = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-                                                (GDestroyNotify) lm_player_destroy);
-    device->transports = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-                                                (GDestroyNotify) lm_transport_destroy);
-    lm_device_subscribe_signal(device);
+    lm_device_t *device = lm_device_alloc(adapter, path, addr);
+    g_free(path);
 
     lm_log_debug(TAG, "create device '%s' success", device->path);
     return device;
@@ -582,31 +754,12 @@ lm_device_t *lm_device_create_with_bdaddr(lm_adapter_t *adapter, const bdaddr_t
 
 lm_device_t *lm_device_create_with_path(lm_adapter_t *adapter, const gchar *path)
 {
-    lm_device_t *device;
     bdaddr_t addr;
 
     g_assert(adapter && path);
 
-    if ((device = g_new0(lm_device_t, 1)) == NULL)
-        return NULL;
-
-    device->adapter = adapter;
-    device->dbus_conn = lm_adapter_get_dbus_conn(adapter);
-    device->adapter = adapter;
-    device->rssi = -255;
-    device->txpower = -255;
-    device->mtu = 23;
-    device->path = g_strdup(path);
     lm_utils_dbus_bluez_object_path_to_bdaddr(path, &addr);
-    bacpy(&device->addr, &addr);
-
-    device->address = g_strdup_printf("%.2X:%.2X:%.2X:%.2X:%.2X:%.2X",
-        addr.b[5], addr.b[4], addr.b[3], addr.b[2], addr.b[1], addr.b[0]);
-    device->players = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-                                                (GDestroyNotify) lm_player_destroy);
-    device->transports = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-                                                (GDestroyNotify) lm_transport_destroy);
-    lm_device_subscribe_signal(device);
+    lm_device_t *device = lm_device_alloc(adapter, path, &addr);
 
     lm_log_debug(TAG, "create device '%s'", path);
     return device;
@@ -620,20 +773,14 @@ void lm_device_destroy(lm_device_t *device)
 
     lm_device_unsubscribe_signal(device);
 
-    if (device->path)
-        g_free((gpointer)device->path);
-
-    if (device->name)
-        g_free((gpointer)device->name);
-
-    if (device->address)
-        g_free((gpointer)device->address);
+    if (device->bcast_transport_timer_id) {
+        lm_adapter_source_remove(device->adapter, device->bcast_transport_timer_id);
+        device->bcast_transport_timer_id = 0;
+    }
 
-    if (device->address_type)
-        g_free((gpointer)device->address_type);
+    lm_device_str_clear(&device->name);
 
-    if (device->alias)
-        g_free((gpointer)device->alias);
+    lm_device_str_clear(&device->alias);
 
     if (device->transports)
         g_hash_table_destroy(device->transports);
@@ -647,6 +794,7 @@ void lm_device_destroy(lm_device_t *device)
 
     lm_device_free_service_data(device);
 
+    lm_mem_object_free(LM_MEM_DEVICE, device->mem_size);
     g_free((gpointer)device);
 }
 
@@ -680,7 +828,7 @@ static void lm_device_load_properties_cb(__attribute__((unused)) GObject *source
     g_assert(device != NULL);
 
     GError *error = NULL;
-    GVariant *result = g_dbus_connection_call_finish(device->dbus_conn, res, &error);
+    GVariant *result = lm_dbus_call_finish(res, &error);
 
     if (error != NULL) {
         lm_log_error(TAG, "failed to call '%s' (error %d: %s)", "GetAll", error->code, error->message);
@@ -706,18 +854,20 @@ static void lm_device_load_properties_cb(__attribute__((unused)) GObject *source
 }
 
 void lm_device_load_properties(lm_device_t *device) {
-    g_dbus_connection_call(device->dbus_conn,
-                           BLUEZ_DBUS,
-                           device->path,
-                           INTERFACE_PROPERTIES,
-                           PROPERTIES_METHOD_GET_ALL,
-                           g_variant_new("(s)", INTERFACE_DEVICE),
-                           G_VARIANT_TYPE("(a{sv})"),
-                           G_DBUS_CALL_FLAGS_NONE,
-                           BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                           NULL,
-                           (GAsyncReadyCallback) lm_device_load_properties_cb,
-                           device);
+    lm_adapter_push_context(device->adapter);
+    lm_dbus_call(device->dbus_conn,
+                 BLUEZ_DBUS,
+                 device->path,
+                 INTERFACE_PROPERTIES,
+                 PROPERTIES_METHOD_GET_ALL,
+                 g_variant_new("(s)", INTERFACE_DEVICE),
+                 G_VARIANT_TYPE("(a{sv})"),
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 NULL,
+                 (GAsyncReadyCallback) lm_device_load_properties_cb,
+                 device);
+    lm_adapter_pop_context(device->adapter);
 }
 
 static void lm_device_free_uuids(lm_device_t *device)
@@ -818,9 +968,9 @@ gchar *lm_device_to_string(const lm_device_t *device) {
 
     gchar *result = g_strdup_printf(
             "device{name='%s', address='%s', address_type=%s, rssi=%d, uuids=%s, manufacturer_data=%s, service_data=%s, paired=%s, txpower=%d path='%s' }",
-            device->name,
+            lm_device_str_get(&device->name) ? lm_device_str_get(&device->name) : "",
             device->address,
-            device->address_type,
+            address_type_names[device->address_type],
             device->rssi,
             uuids->str,
             manufacturer_data->str,
@@ -857,43 +1007,48 @@ const gchar *lm_device_get_address(const lm_device_t *device) {
     return device->address;
 }
 
+/* The path already names the address, a different one from bluez is taken as is */
 void lm_device_set_address(lm_device_t *device, const gchar *address) {
     g_assert(device != NULL);
     g_assert(address != NULL);
 
-    g_free((gchar *) device->address);
-    device->address = g_strdup(address);
+    str2ba(address, &device->addr);
+    lm_device_format_address(device);
 }
 
-const gchar *lm_device_get_address_type(const lm_device_t *device) {
+lm_device_address_type_t lm_device_get_address_type(const lm_device_t *device) {
     g_assert(device != NULL);
-    return device->address_type;
+    return (lm_device_address_type_t)device->address_type;
 }
 
 void lm_device_set_address_type(lm_device_t *device, const gchar *address_type) {
     g_assert(device != NULL);
     g_assert(address_type != NULL);
 
-    g_free((gchar *) device->address_type);
-    device->address_type = g_strdup(address_type);
+    if (g_str_equal(address_type, "random"))
+        device->address_type = LM_DEVICE_ADDRESS_TYPE_RANDOM;
+    else if (g_str_equal(address_type, "public"))
+        device->address_type = LM_DEVICE_ADDRESS_TYPE_PUBLIC;
+    else
+        device->address_type = LM_DEVICE_ADDRESS_TYPE_UNKNOWN;
 }
 
 const gchar *lm_device_get_alias(lm_device_t *device) {
     g_assert(device != NULL);
-    return device->alias;
+    return lm_device_str_get(&device->alias);
 }
 
 void lm_device_set_alias(lm_device_t *device, const gchar *alias) {
     g_assert(device != NULL);
     g_assert(alias != NULL);
 
-    g_free((gchar *) device->alias);
-    device->alias = g_strdup(alias);
+    lm_device_str_set(&device->alias, alias);
+    lm_device_mem_update(device);
 }
 
 const gchar *lm_device_get_name(lm_device_t *device) {
     g_assert(device != NULL);
-    return device->name;
+    return lm_device_str_get(&device->name);
 }
 
 void lm_device_set_name(lm_device_t *device, const gchar *name) {
@@ -901,8 +1056,8 @@ void lm_device_set_name(lm_device_t *device, const gchar *name) {
     g_assert(name != NULL);
     g_assert(strlen(name) > 0);
 
-    g_free((gchar *) device->name);
-    device->name = g_strdup(name);
+    lm_device_str_set(&device->name, name);
+    lm_device_mem_update(device);
 }
 
 const gchar *lm_device_get_path(lm_device_t *device) {
@@ -910,14 +1065,6 @@ const gchar *lm_device_get_path(lm_device_t *device) {
     return device->path;
 }
 
-void lm_device_set_path(lm_device_t *device, const gchar *path) {
-    g_assert(device != NULL);
-    g_assert(path != NULL);
-
-    g_free((gchar *) device->path);
-    device->path = g_strdup(path);
-}
-
 gboolean lm_device_get_paired(lm_device_t *device) {
     g_assert(device != NULL);
     return device->paired;
@@ -934,9 +1081,157 @@ gint16 lm_device_get_rssi(const lm_device_t *device) {
     return device->rssi;
 }
 
+static void lm_device_rssi_check_thresholds(lm_device_t *device)
+{
+    lm_device_rssi_history_t *history = &device->rssi_history;
+    if (!history->thresholds_set)
+        return;
+
+    /* between the thresholds the previous level holds, that is the hysteresis */
+    gint16 smoothed = (gint16)(history->ewma / (1 << RSSI_FRACTION_BITS));
+    lm_device_rssi_level_state_t level = history->level;
+    if (smoothed >= history->high_threshold)
+        level = RSSI_LEVEL_ABOVE;
+    else if (smoothed <= history->low_threshold)
+        level = RSSI_LEVEL_BELOW;
+    else if (level == RSSI_LEVEL_UNKNOWN)
+        level = RSSI_LEVEL_BETWEEN;
+
+    if (level == history->level)
+        return;
+    history->level = level;
+    if (level == RSSI_LEVEL_BETWEEN)
+        return;
+
+    lm_device_rssi_threshold_ind_t ind = {
+        .adapter = device->adapter,
+        .device = device,
+        .level = level == RSSI_LEVEL_ABOVE ? LM_DEVICE_RSSI_ABOVE : LM_DEVICE_RSSI_BELOW,
+        .smoothed_rssi = smoothed
+    };
+    lm_app_event_callback(LM_DEVICE_RSSI_THRESHOLD_IND, LM_STATUS_SUCCESS, &ind);
+}
+
+static void lm_device_rssi_history_add(lm_device_t *device, gint16 rssi)
+{
+    lm_device_rssi_history_t *history = &device->rssi_history;
+    gboolean rescan = FALSE;
+
+    if (history->count == LM_DEVICE_RSSI_HISTORY_LEN) {
+        gint16 evicted = history->rssi[history->head];
+        history->sum -= evicted;
+        history->sum_sq -= (gint64)evicted * evicted;
+        rescan = evicted == history->min || evicted == history->max;
+    } else {
+        history->count++;
+    }
+
+    history->rssi[history->head] = rssi;
+    history->time_us[history->head] = g_get_monotonic_time();
+    history->head = (history->head + 1) % LM_DEVICE_RSSI_HISTORY_LEN;
+    history->sum += rssi;
+    history->sum_sq += (gint64)rssi * rssi;
+
+    if (history->count == 1) {
+        history->min = history->max = rssi;
+        history->ewma = (gint32)rssi * (1 << RSSI_FRACTION_BITS);
+    } else {
+        gint32 sample = (gint32)rssi * (1 << RSSI_FRACTION_BITS);
+        history->ewma += (sample - history->ewma) / (1 << RSSI_EWMA_SHIFT);
+        if (rescan) {
+            history->min = history->max = rssi;
+            for (guint i = 0; i < history->count; i++) {
+                history->min = MIN(history->min, history->rssi[i]);
+                history->max = MAX(history->max, history->rssi[i]);
+            }
+        } else {
+            history->min = MIN(history->min, rssi);
+            history->max = MAX(history->max, rssi);
+        }
+    }
+
+    lm_device_rssi_check_thresholds(device);
+}
+
 void lm_device_set_rssi(lm_device_t *device, gint16 rssi) {
     g_assert(device != NULL);
     device->rssi = rssi;
+    lm_device_rssi_history_add(device, rssi);
+}
+
+gint16 lm_device_get_smoothed_rssi(const lm_device_t *device)
+{
+    g_assert(device != NULL);
+
+    if (device->rssi_history.count == 0)
+        return G_MININT16;
+    return (gint16)(device->rssi_history.ewma / (1 << RSSI_FRACTION_BITS));
+}
+
+lm_status_t lm_device_get_rssi_stats(const lm_device_t *device, lm_device_rssi_stats_t *stats)
+{
+    g_assert(device != NULL);
+    g_assert(stats != NULL);
+
+    const lm_device_rssi_history_t *history = &device->rssi_history;
+    if (history->count == 0)
+        return LM_STATUS_FAIL;
+
+    guint newest = (history->head + LM_DEVICE_RSSI_HISTORY_LEN - 1) % LM_DEVICE_RSSI_HISTORY_LEN;
+    guint oldest = (history->head + LM_DEVICE_RSSI_HISTORY_LEN - history->count) % LM_DEVICE_RSSI_HISTORY_LEN;
+    gdouble mean = (gdouble)history->sum / history->count;
+
+    stats->last = history->rssi[newest];
+    stats->last_time_us = history->time_us[newest];
+    stats->smoothed = (gint16)(history->ewma / (1 << RSSI_FRACTION_BITS));
+    stats->min = history->min;
+    stats->max = history->max;
+    stats->mean = mean;
+    stats->variance = MAX(0.0, (gdouble)history->sum_sq / history->count - mean * mean);
+    stats->trend = 0.0;
+    if (history->time_us[newest] > history->time_us[oldest])
+        stats->trend = (gdouble)(history->rssi[newest] - history->rssi[oldest]) * G_USEC_PER_SEC /
+                       (gdouble)(history->time_us[newest] - history->time_us[oldest]);
+    stats->samples = history->count;
+
+    return LM_STATUS_SUCCESS;
+}
+
+guint lm_device_get_rssi_history(const lm_device_t *device, gint16 *rssi, gint64 *time_us, guint max)
+{
+    g_assert(device != NULL);
+    g_assert(rssi != NULL || max == 0);
+
+    const lm_device_rssi_history_t *history = &device->rssi_history;
+    guint count = MIN(max, history->count);
+    guint oldest = (history->head + LM_DEVICE_RSSI_HISTORY_LEN - count) % LM_DEVICE_RSSI_HISTORY_LEN;
+    for (guint i = 0; i < count; i++) {
+        guint slot = (oldest + i) % LM_DEVICE_RSSI_HISTORY_LEN;
+        rssi[i] = history->rssi[slot];
+        if (time_us)
+            time_us[i] = history->time_us[slot];
+    }
+    return count;
+}
+
+lm_status_t lm_device_set_rssi_thresholds(lm_device_t *device, gint16 low, gint16 high)
+{
+    g_assert(device != NULL);
+
+    if (low > high)
+        return LM_STATUS_INVALID_ARGS;
+
+    device->rssi_history.thresholds_set = TRUE;
+    device->rssi_history.low_threshold = low;
+    device->rssi_history.high_threshold = high;
+    device->rssi_history.level = RSSI_LEVEL_UNKNOWN;
+    return LM_STATUS_SUCCESS;
+}
+
+void lm_device_clear_rssi_thresholds(lm_device_t *device)
+{
+    g_assert(device != NULL);
+    device->rssi_history.thresholds_set = FALSE;
 }
 
 gboolean lm_device_get_trusted(lm_device_t *device) {
@@ -969,6 +1264,7 @@ void lm_device_set_uuids(lm_device_t *device, GList *uuids) {
 
     lm_device_free_uuids(device);
     device->uuids = uuids;
+    lm_device_mem_update(device);
 }
 
 GHashTable *lm_device_get_manufacturer_data(const lm_device_t *device) {
@@ -981,6 +1277,7 @@ void lm_device_set_manufacturer_data(lm_device_t *device, GHashTable *manufactur
 
     lm_device_free_manufacturer_data(device);
     device->manufacturer_data = manufacturer_data;
+    lm_device_mem_update(device);
 }
 
 GHashTable *lm_device_get_service_data(const lm_device_t *device)
@@ -994,6 +1291,7 @@ void lm_device_set_service_data(lm_device_t *device, GHashTable *service_data) {
 
     lm_device_free_service_data(device);
     device->service_data = service_data;
+    lm_device_mem_update(device);
 }
 
 GDBusConnection *lm_device_get_dbus_conn(const lm_device_t *device)
@@ -1033,6 +1331,7 @@ gboolean lm_device_has_service(const lm_device_t *device, const gchar *service_u
 
 void lm_device_update_property(lm_device_t *device, const gchar *property_name, GVariant *property_value) {
     lm_log_debug(TAG, "%s property_name:%s",  __func__, property_name);
+    lm_stats_count(LM_STATS_PROPERTY, property_name);
     if (g_str_equal(property_name, DEVICE_PROPERTY_ADDRESS)) {
         lm_device_set_address(device, g_variant_get_string(property_value, NULL));
     } else if (g_str_equal(property_name, DEVICE_PROPERTY_ADDRESS_TYPE)) {
@@ -1169,7 +1468,7 @@ static void lm_device_disconnect_cb(__attribute__((unused)) GObject *source_obje
     g_assert(device != NULL);
 
     GError *error = NULL;
-    GVariant *value = g_dbus_connection_call_finish(device->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
     if (value != NULL) {
         g_variant_unref(value);
     }
@@ -1184,40 +1483,40 @@ static void lm_device_disconnect_cb(__attribute__((unused)) GObject *source_obje
 void lm_device_disconnect(lm_device_t *device)
 {
     g_assert(device != NULL);
-    g_assert(device->path != NULL);
 
     if (device->connection_state != LM_DEVICE_CONNECTED)
         return;
 
-    lm_log_debug(TAG, "Disconnecting '%s' (%s)", device->name, device->address);
+    lm_log_debug(TAG, "Disconnecting '%s' (%s)", lm_device_str_get(&device->name), device->address);
 
     lm_device_set_conn_state(device, LM_DEVICE_DISCONNECTING);
-    g_dbus_connection_call(device->dbus_conn,
-                           BLUEZ_DBUS,
-                           device->path,
-                           INTERFACE_DEVICE,
-                           DEVICE_METHOD_DISCONNECT,
-                           NULL,
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                           NULL,
-                           (GAsyncReadyCallback) lm_device_disconnect_cb,
-                           device);
+    lm_adapter_push_context(device->adapter);
+    lm_dbus_call(device->dbus_conn,
+                 BLUEZ_DBUS,
+                 device->path,
+                 INTERFACE_DEVICE,
+                 DEVICE_METHOD_DISCONNECT,
+                 NULL,
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 NULL,
+                 (GAsyncReadyCallback) lm_device_disconnect_cb,
+                 device);
+    lm_adapter_pop_context(device->adapter);
 }
 
 lm_status_t lm_device_disconnect_sync(lm_device_t *device)
 {
     GError *error = NULL;
     g_assert(device != NULL);
-    g_assert(device->path != NULL);
 
     if (device->connection_state != LM_DEVICE_CONNECTED)
         return LM_STATUS_FAIL;
 
-    lm_log_debug(TAG, "Disconnecting '%s' (%s)", device->name, device->address);
+    lm_log_debug(TAG, "Disconnecting '%s' (%s)", lm_device_str_get(&device->name), device->address);
 
-    g_dbus_connection_call_sync(device->dbus_conn,
+    lm_dbus_call_sync(device->dbus_conn,
                            BLUEZ_DBUS,
                            device->path,
                            INTERFACE_DEVICE,
@@ -1244,14 +1543,13 @@ lm_status_t lm_device_connect_sync(lm_device_t *device)
 {
     GError *error = NULL;
     g_assert(device != NULL);
-    g_assert(device->path != NULL);
 
     if (device->connection_state != LM_DEVICE_DISCONNECTED)
         return LM_STATUS_FAIL;
 
-    lm_log_debug(TAG, "Connecting '%s' (%s)", device->name, device->address);
+    lm_log_debug(TAG, "Connecting '%s' (%s)", lm_device_str_get(&device->name), device->address);
 
-    g_dbus_connection_call_sync(device->dbus_conn,
+    lm_dbus_call_sync(device->dbus_conn,
                            BLUEZ_DBUS,
                            device->path,
                            INTERFACE_DEVICE,
@@ -1325,7 +1623,12 @@ lm_status_t lm_device_stop_sync_broadcast(lm_device_t *device)
         lm_log_error(TAG, "No broadcast transports available");
         return LM_STATUS_FAIL;
     }
-    return lm_adapter_remove_device(device->adapter, device);
+    g_ptr_array_free(bcast_transports, TRUE);
+
+    /* the outcome arrives as LM_ADAPTER_REMOVE_DEVICE_CNF */
+    if (lm_adapter_remove_device(device->adapter, device) == 0)
+        return LM_STATUS_FAIL;
+    return LM_STATUS_PENDING;
 }
 
 GPtrArray *lm_device_get_transports(lm_device_t *device, lm_transport_profile_t profile)
@@ -1335,6 +1638,9 @@ GPtrArray *lm_device_get_transports(lm_device_t *device, lm_transport_profile_t
     gpointer key, value;
     GPtrArray *result = g_ptr_array_new();
 
+    if (!device->transports)
+        return result;
+
     g_hash_table_iter_init(&hash_iter, device->transports);
     while (g_hash_table_iter_next(&hash_iter, &key, &value)) {
         lm_transport_t *transport = (lm_transport_t *)value;
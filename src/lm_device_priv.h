@@ -7,6 +7,12 @@
 #include "lm_device.h"
 #include "lm_adapter.h"
 
+typedef enum {
+    LM_DEVICE_ADDRESS_TYPE_UNKNOWN = 0,     /* AddressType not reported yet */
+    LM_DEVICE_ADDRESS_TYPE_PUBLIC,
+    LM_DEVICE_ADDRESS_TYPE_RANDOM
+} lm_device_address_type_t;
+
 lm_device_t *lm_device_create_with_bdaddr(lm_adapter_t *adapter, const bdaddr_t *addr);
 
 lm_device_t *lm_device_create_with_path(lm_adapter_t *adapter, const gchar *path);
@@ -27,6 +33,12 @@ void lm_device_set_conn_bearer(lm_device_t *device, lm_device_conn_bearer_t bear
 
 void lm_device_reset_conn_bearer(lm_device_t *device, lm_device_conn_bearer_t bearer);
 
+gboolean lm_device_get_paired(lm_device_t *device);
+
+gboolean lm_device_get_trusted(lm_device_t *device);
+
+lm_device_address_type_t lm_device_get_address_type(const lm_device_t *device);
+
 gboolean lm_device_has_bearer(lm_device_t *device, lm_device_conn_bearer_t bearer);
 
 #endif //__LM_DEVICE_PRIV_H__
\ No newline at end of file
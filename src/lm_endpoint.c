@@ -0,0 +1,336 @@
+#include "lm_endpoint.h"
+#include "lm.h"
+#include "lm_log.h"
+#include "lm_dbus_priv.h"
+#include "lm_adapter.h"
+#include "bluez_dbus.h"
+#include "bluez_iface.h"
+#include <glib.h>
+#include <gio/gio.h>
+
+#define TAG "lm_endpoint"
+
+struct lm_endpoint {
+    GDBusConnection *dbus_conn;     // Borrowed
+    lm_adapter_t *adapter;          // Borrowed
+    gchar *path;                    // Owned
+    gchar *uuid;                    // Owned
+    guint8 codec;
+    guint32 vendor;
+    GBytes *capabilities;           // Owned
+    gboolean delay_reporting;
+    lm_endpoint_select_callback_t select_callback;
+    gpointer user_data;
+    guint registration_id;
+    GMutex lock;                    /* protects configurations */
+    GHashTable *configurations;     /* GBytes capabilities -> GVariant "(ay)" reply */
+    guint cache_hits;
+    guint cache_misses;
+};
+
+static guint endpoint_instance_id = 0;
+
+static GVariant *lm_endpoint_build_reply(const guint8 *configuration, gsize configuration_size)
+{
+    GVariant *array = g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, configuration, configuration_size, sizeof(guint8));
+    return g_variant_ref_sink(g_variant_new_tuple(&array, 1));
+}
+
+static void lm_endpoint_select_configuration(lm_endpoint_t *endpoint, GDBusMethodInvocation *invocation, GVariant *params)
+{
+    GVariant *caps_variant = g_variant_get_child_value(params, 0);
+    gsize caps_size = 0;
+    const guint8 *caps = g_variant_get_fixed_array(caps_variant, &caps_size, sizeof(guint8));
+    GBytes *key = g_bytes_new_static(caps, caps_size);
+
+    g_mutex_lock(&endpoint->lock);
+    GVariant *reply = g_hash_table_lookup(endpoint->configurations, key);
+    if (reply) {
+        endpoint->cache_hits++;
+        g_variant_ref(reply);
+    } else {
+        endpoint->cache_misses++;
+    }
+    g_mutex_unlock(&endpoint->lock);
+
+    if (reply) {
+        lm_log_debug(TAG, "select configuration on '%s' from cache", endpoint->path);
+        goto reply;
+    }
+
+    GByteArray *configuration = g_byte_array_new();
+    lm_status_t status = endpoint->select_callback ?
+        endpoint->select_callback(endpoint, caps, caps_size, configuration, endpoint->user_data) : LM_STATUS_FAIL;
+
+    if (status == LM_STATUS_SUCCESS && configuration->len > 0) {
+        reply = lm_endpoint_build_reply(configuration->data, configuration->len);
+        g_mutex_lock(&endpoint->lock);
+        g_hash_table_replace(endpoint->configurations, g_bytes_new(caps, caps_size), g_variant_ref(reply));
+        g_mutex_unlock(&endpoint->lock);
+    }
+    g_byte_array_free(configuration, TRUE);
+
+reply:
+    if (reply) {
+        g_dbus_method_invocation_return_value(invocation, reply);
+        g_variant_unref(reply);
+    } else {
+        lm_log_error(TAG, "no configuration for %zu bytes of capabilities on '%s'", caps_size, endpoint->path);
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.InvalidArguments",
+                                                   "No supported configuration");
+    }
+    g_bytes_unref(key);
+    g_variant_unref(caps_variant);
+}
+
+static void lm_endpoint_method_call(__attribute__((unused)) GDBusConnection *conn,
+                                    __attribute__((unused)) const gchar *sender,
+                                    __attribute__((unused)) const gchar *path,
+                                    __attribute__((unused)) const gchar *interface,
+                                    const gchar *method,
+                                    GVariant *params,
+                                    GDBusMethodInvocation *invocation,
+                                    void *userdata)
+{
+    lm_endpoint_t *endpoint = (lm_endpoint_t *)userdata;
+    g_assert(endpoint != NULL);
+
+    lm_log_debug(TAG, "lm_endpoint_method_call '%s'", method);
+
+    if (g_str_equal(method, MEDIA_ENDPOINT_METHOD_SELECT_CONFIGURATION)) {
+        lm_endpoint_select_configuration(endpoint, invocation, params);
+    } else if (g_str_equal(method, MEDIA_ENDPOINT_METHOD_SET_CONFIGURATION)) {
+        const gchar *transport_path = NULL;
+        GVariant *properties = NULL;
+        g_variant_get(params, "(&o@a{sv})", &transport_path, &properties);
+        lm_log_info(TAG, "set configuration '%s' on '%s'", transport_path, endpoint->path);
+        lm_endpoint_set_configuration_ind_t ind = {
+            .endpoint = endpoint,
+            .transport_path = transport_path,
+            .properties = properties
+        };
+        lm_app_event_callback(LM_ENDPOINT_SET_CONFIGURATION_IND, LM_STATUS_SUCCESS, &ind);
+        g_variant_unref(properties);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (g_str_equal(method, MEDIA_ENDPOINT_METHOD_CLEAR_CONFIGURATION)) {
+        const gchar *transport_path = NULL;
+        g_variant_get(params, "(&o)", &transport_path);
+        lm_log_info(TAG, "clear configuration '%s' on '%s'", transport_path, endpoint->path);
+        lm_endpoint_clear_configuration_ind_t ind = {
+            .endpoint = endpoint,
+            .transport_path = transport_path
+        };
+        lm_app_event_callback(LM_ENDPOINT_CLEAR_CONFIGURATION_IND, LM_STATUS_SUCCESS, &ind);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (g_str_equal(method, MEDIA_ENDPOINT_METHOD_RELEASE)) {
+        lm_log_info(TAG, "endpoint '%s' released", endpoint->path);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+        lm_endpoint_released_ind_t ind = {
+            .endpoint = endpoint
+        };
+        lm_app_event_callback(LM_ENDPOINT_RELEASED_IND, LM_STATUS_SUCCESS, &ind);
+    } else {
+        lm_log_error(TAG, "We should not come here, unknown method");
+    }
+}
+
+static GVariant *lm_endpoint_capabilities_variant(lm_endpoint_t *endpoint)
+{
+    gsize size = 0;
+    gconstpointer data = endpoint->capabilities ? g_bytes_get_data(endpoint->capabilities, &size) : NULL;
+    return g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, data, size, sizeof(guint8));
+}
+
+static GVariant *lm_endpoint_get_property(__attribute__((unused)) GDBusConnection *connection,
+                                          __attribute__((unused)) const gchar *sender,
+                                          __attribute__((unused)) const gchar *object_path,
+                                          __attribute__((unused)) const gchar *interface_name,
+                                          const gchar *property_name,
+                                          GError **error,
+                                          gpointer user_data)
+{
+    GVariant *ret = NULL;
+    lm_endpoint_t *endpoint = user_data;
+    g_assert(endpoint);
+
+    if (g_str_equal(property_name, MEDIA_ENDPOINT_PROPERTY_UUID)) {
+        ret = g_variant_new_string(endpoint->uuid);
+    } else if (g_str_equal(property_name, MEDIA_ENDPOINT_PROPERTY_CODEC)) {
+        ret = g_variant_new_byte(endpoint->codec);
+    } else if (g_str_equal(property_name, MEDIA_ENDPOINT_PROPERTY_VENDOR) && endpoint->vendor) {
+        ret = g_variant_new_uint32(endpoint->vendor);
+    } else if (g_str_equal(property_name, MEDIA_ENDPOINT_PROPERTY_CAPABILITIES)) {
+        ret = lm_endpoint_capabilities_variant(endpoint);
+    } else if (g_str_equal(property_name, MEDIA_ENDPOINT_PROPERTY_DELAY_REPORTING)) {
+        ret = g_variant_new_boolean(endpoint->delay_reporting);
+    } else {
+        /* Vendor without a vendor codec and Device of a local endpoint are not set, as in RegisterEndpoint */
+        g_set_error(error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, "property '%s' is not set", property_name);
+    }
+    return ret;
+}
+
+static const GDBusInterfaceVTable endpoint_method_table = {
+    .method_call = lm_endpoint_method_call,
+    .get_property = lm_endpoint_get_property
+};
+
+static lm_status_t lm_endpoint_media_call_method(lm_endpoint_t *endpoint, const gchar *method, GVariant *param)
+{
+    GError *error = NULL;
+
+    GVariant *result = lm_dbus_call_sync(endpoint->dbus_conn,
+                                         BLUEZ_DBUS,
+                                         lm_adapter_get_path(endpoint->adapter),
+                                         INTERFACE_MEDIA,
+                                         method,
+                                         param,
+                                         NULL,
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                                         NULL,
+                                         &error);
+    if (result)
+        g_variant_unref(result);
+
+    if (error != NULL) {
+        lm_log_error(TAG, "Media call failed '%s': %s", method, error->message);
+        g_clear_error(&error);
+        return LM_STATUS_FAIL;
+    }
+
+    return LM_STATUS_SUCCESS;
+}
+
+static GVariant *lm_endpoint_build_properties(lm_endpoint_t *endpoint)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    g_variant_builder_add(&builder, "{sv}", MEDIA_ENDPOINT_PROPERTY_UUID, g_variant_new_string(endpoint->uuid));
+    g_variant_builder_add(&builder, "{sv}", MEDIA_ENDPOINT_PROPERTY_CODEC, g_variant_new_byte(endpoint->codec));
+    if (endpoint->vendor)
+        g_variant_builder_add(&builder, "{sv}", MEDIA_ENDPOINT_PROPERTY_VENDOR, g_variant_new_uint32(endpoint->vendor));
+    g_variant_builder_add(&builder, "{sv}", MEDIA_ENDPOINT_PROPERTY_CAPABILITIES, lm_endpoint_capabilities_variant(endpoint));
+    g_variant_builder_add(&builder, "{sv}", MEDIA_ENDPOINT_PROPERTY_DELAY_REPORTING, g_variant_new_boolean(endpoint->delay_reporting));
+
+    return g_variant_builder_end(&builder);
+}
+
+static void lm_endpoint_free(lm_endpoint_t *endpoint)
+{
+    g_hash_table_destroy(endpoint->configurations);
+    g_mutex_clear(&endpoint->lock);
+    if (endpoint->capabilities)
+        g_bytes_unref(endpoint->capabilities);
+    g_free(endpoint->uuid);
+    g_free(endpoint->path);
+    g_free(endpoint);
+}
+
+lm_endpoint_t *lm_endpoint_register(lm_adapter_t *adapter, const lm_endpoint_config_t *config,
+                lm_endpoint_select_callback_t select_callback, gpointer user_data)
+{
+    g_assert(adapter);
+    g_assert(config);
+    g_assert(config->uuid);
+
+    GError *error = NULL;
+
+    lm_endpoint_t *endpoint = g_new0(lm_endpoint_t, 1);
+    endpoint->dbus_conn = lm_adapter_get_dbus_conn(adapter);
+    endpoint->adapter = adapter;
+    endpoint->path = g_strdup_printf("/org/bluez/lm_endpoint%u", endpoint_instance_id++);
+    endpoint->uuid = g_strdup(config->uuid);
+    endpoint->codec = config->codec;
+    endpoint->vendor = config->vendor;
+    if (config->capabilities && config->capabilities_size)
+        endpoint->capabilities = g_bytes_new(config->capabilities, config->capabilities_size);
+    endpoint->delay_reporting = config->delay_reporting;
+    endpoint->select_callback = select_callback;
+    endpoint->user_data = user_data;
+    endpoint->configurations = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+                                                     (GDestroyNotify) g_bytes_unref,
+                                                     (GDestroyNotify) g_variant_unref);
+    g_mutex_init(&endpoint->lock);
+
+    endpoint->registration_id = g_dbus_connection_register_object(endpoint->dbus_conn,
+                                                                  endpoint->path,
+                                                                  (GDBusInterfaceInfo *)&bluez_mediaendpoint1_interface,
+                                                                  &endpoint_method_table,
+                                                                  endpoint, NULL, &error);
+    if (error != NULL) {
+        lm_log_error(TAG, "Register endpoint object failed %s", error->message);
+        g_clear_error(&error);
+        lm_endpoint_free(endpoint);
+        return NULL;
+    }
+
+    if (lm_endpoint_media_call_method(endpoint, MEDIA_METHOD_REGISTER_ENDPOINT,
+            g_variant_new("(o@a{sv})", endpoint->path, lm_endpoint_build_properties(endpoint))) != LM_STATUS_SUCCESS) {
+        g_dbus_connection_unregister_object(endpoint->dbus_conn, endpoint->registration_id);
+        lm_endpoint_free(endpoint);
+        return NULL;
+    }
+
+    lm_log_info(TAG, "endpoint %s codec 0x%x registered at '%s'", endpoint->uuid, endpoint->codec, endpoint->path);
+    return endpoint;
+}
+
+void lm_endpoint_unregister(lm_endpoint_t *endpoint)
+{
+    g_assert(endpoint);
+
+    lm_endpoint_media_call_method(endpoint, MEDIA_METHOD_UNREGISTER_ENDPOINT, g_variant_new("(o)", endpoint->path));
+    if (!g_dbus_connection_unregister_object(endpoint->dbus_conn, endpoint->registration_id))
+        lm_log_error(TAG, "could not unregister endpoint");
+
+    lm_log_info(TAG, "endpoint '%s' unregistered (cache hits %u misses %u)", endpoint->path,
+                endpoint->cache_hits, endpoint->cache_misses);
+    lm_endpoint_free(endpoint);
+}
+
+lm_status_t lm_endpoint_add_configuration(lm_endpoint_t *endpoint,
+                const guint8 *capabilities, gsize capabilities_size,
+                const guint8 *configuration, gsize configuration_size)
+{
+    g_assert(endpoint);
+
+    if (!capabilities || !configuration || configuration_size == 0)
+        return LM_STATUS_INVALID_ARGS;
+
+    g_mutex_lock(&endpoint->lock);
+    g_hash_table_replace(endpoint->configurations,
+                         g_bytes_new(capabilities, capabilities_size),
+                         lm_endpoint_build_reply(configuration, configuration_size));
+    g_mutex_unlock(&endpoint->lock);
+
+    return LM_STATUS_SUCCESS;
+}
+
+void lm_endpoint_clear_configurations(lm_endpoint_t *endpoint)
+{
+    g_assert(endpoint);
+
+    g_mutex_lock(&endpoint->lock);
+    g_hash_table_remove_all(endpoint->configurations);
+    g_mutex_unlock(&endpoint->lock);
+}
+
+const gchar *lm_endpoint_get_path(const lm_endpoint_t *endpoint)
+{
+    g_assert(endpoint);
+    return endpoint->path;
+}
+
+void lm_endpoint_get_cache_stats(lm_endpoint_t *endpoint, guint *hits, guint *misses)
+{
+    g_assert(endpoint);
+
+    g_mutex_lock(&endpoint->lock);
+    if (hits)
+        *hits = endpoint->cache_hits;
+    if (misses)
+        *misses = endpoint->cache_misses;
+    g_mutex_unlock(&endpoint->lock);
+}
@@ -0,0 +1,324 @@
+#include "lm_filter.h"
+#include "lm_filter_priv.h"
+#include "lm_device.h"
+#include "lm_log.h"
+#include "lm_utils.h"
+#include <glib.h>
+#include <string.h>
+
+#define TAG "lm_filter"
+
+#define SIG_UUID16_COUNT        65536
+
+/* Children of a node form a sibling list, index 0 is the root and never a child */
+typedef struct {
+    guint32 child;
+    guint32 sibling;
+    gint32 rule; // -1 unless a prefix ends here
+    gchar label;
+} lm_filter_trie_node_t;
+
+typedef struct {
+    gint rule;
+    guint8 *data; // Owned, NULL matches any data
+    guint8 *mask; // Owned, all bits set when the rule had none
+    guint data_len;
+} lm_filter_data_rule_t;
+
+struct lm_filter {
+    guint n_rules;
+    GArray *name_trie; // Owned, NULL without name rules
+    GArray *address_trie; // Owned, NULL without address rules
+    GHashTable *manufacturer; // Owned, company id -> GPtrArray of lm_filter_data_rule_t
+    GHashTable *service_data; // Owned, lowercase uuid -> GPtrArray of lm_filter_data_rule_t
+    GHashTable *uuids; // Owned, lowercase uuid -> rule index + 1
+    guint32 *uuid16_bits; // Owned, SIG 16 bit uuids of uuids, rejects most lookups early
+};
+
+static GArray *lm_filter_trie_new(void)
+{
+    GArray *trie = g_array_new(FALSE, TRUE, sizeof(lm_filter_trie_node_t));
+    lm_filter_trie_node_t root = { .rule = -1 };
+    g_array_append_val(trie, root);
+    return trie;
+}
+
+static guint32 lm_filter_trie_find_child(GArray *trie, guint32 node, gchar label)
+{
+    guint32 child = g_array_index(trie, lm_filter_trie_node_t, node).child;
+    while (child && g_array_index(trie, lm_filter_trie_node_t, child).label != label)
+        child = g_array_index(trie, lm_filter_trie_node_t, child).sibling;
+    return child;
+}
+
+static void lm_filter_trie_insert(GArray *trie, const gchar *prefix, gint rule, gboolean fold_case)
+{
+    guint32 node = 0;
+
+    for (const gchar *p = prefix; *p; p++) {
+        gchar label = fold_case ? g_ascii_toupper(*p) : *p;
+        guint32 child = lm_filter_trie_find_child(trie, node, label);
+        if (!child) {
+            lm_filter_trie_node_t new_node = {
+                .sibling = g_array_index(trie, lm_filter_trie_node_t, node).child,
+                .rule = -1,
+                .label = label
+            };
+            child = trie->len;
+            g_array_append_val(trie, new_node);
+            g_array_index(trie, lm_filter_trie_node_t, node).child = child;
+        }
+        node = child;
+    }
+
+    /* the first rule with this prefix wins */
+    lm_filter_trie_node_t *end = &g_array_index(trie, lm_filter_trie_node_t, node);
+    if (end->rule < 0)
+        end->rule = rule;
+}
+
+/* Stops at the first, i.e. shortest, prefix that ends on the way down */
+static gint lm_filter_trie_match(const GArray *trie, const gchar *str, gboolean fold_case)
+{
+    guint32 node = 0;
+
+    for (const gchar *p = str; *p; p++) {
+        node = lm_filter_trie_find_child((GArray *)trie, node, fold_case ? g_ascii_toupper(*p) : *p);
+        if (!node)
+            return -1;
+
+        gint rule = g_array_index(trie, lm_filter_trie_node_t, node).rule;
+        if (rule >= 0)
+            return rule;
+    }
+    return -1;
+}
+
+static void lm_filter_data_rule_free(gpointer data)
+{
+    lm_filter_data_rule_t *rule = (lm_filter_data_rule_t *)data;
+
+    g_free(rule->data);
+    g_free(rule->mask);
+    g_free(rule);
+}
+
+/* string keys are copied on insert */
+static GPtrArray *lm_filter_data_rules_get(GHashTable *table, gconstpointer key, gboolean string_key)
+{
+    GPtrArray *rules = g_hash_table_lookup(table, key);
+    if (!rules) {
+        rules = g_ptr_array_new_with_free_func(lm_filter_data_rule_free);
+        g_hash_table_insert(table, string_key ? g_strdup(key) : (gpointer)key, rules);
+    }
+    return rules;
+}
+
+static void lm_filter_data_rule_add(GPtrArray *rules, const lm_filter_rule_t *rule, gint index)
+{
+    lm_filter_data_rule_t *data_rule = g_new0(lm_filter_data_rule_t, 1);
+    data_rule->rule = index;
+    if (rule->data && rule->data_len) {
+        data_rule->data_len = rule->data_len;
+        data_rule->data = g_memdup2(rule->data, rule->data_len);
+        if (rule->mask) {
+            data_rule->mask = g_memdup2(rule->mask, rule->data_len);
+        } else {
+            data_rule->mask = g_malloc(rule->data_len);
+            memset(data_rule->mask, 0xff, rule->data_len);
+        }
+    }
+    g_ptr_array_add(rules, data_rule);
+}
+
+static gint lm_filter_data_rules_match(const GPtrArray *rules, const GByteArray *value)
+{
+    for (guint i = 0; i < rules->len; i++) {
+        const lm_filter_data_rule_t *rule = g_ptr_array_index(rules, i);
+        if (!rule->data)
+            return rule->rule;
+        if (!value || value->len < rule->data_len)
+            continue;
+
+        guint j = 0;
+        while (j < rule->data_len && ((value->data[j] ^ rule->data[j]) & rule->mask[j]) == 0)
+            j++;
+        if (j == rule->data_len)
+            return rule->rule;
+    }
+    return -1;
+}
+
+static gboolean lm_filter_rule_is_valid(const lm_filter_rule_t *rule)
+{
+    switch (rule->type) {
+        case LM_FILTER_RULE_NAME_PREFIX:
+        case LM_FILTER_RULE_ADDRESS_PREFIX:
+            return rule->string != NULL && rule->string[0] != '\0';
+        case LM_FILTER_RULE_MANUFACTURER:
+            return rule->data_len == 0 || rule->data != NULL;
+        case LM_FILTER_RULE_SERVICE_UUID:
+            return rule->string != NULL && g_uuid_string_is_valid(rule->string);
+        case LM_FILTER_RULE_SERVICE_DATA:
+            return rule->string != NULL && g_uuid_string_is_valid(rule->string) &&
+                   (rule->data_len == 0 || rule->data != NULL);
+        default:
+            return FALSE;
+    }
+}
+
+lm_filter_t *lm_filter_compile(const lm_filter_rule_t *rules, guint n_rules)
+{
+    g_assert(rules || n_rules == 0);
+
+    for (guint i = 0; i < n_rules; i++) {
+        if (!lm_filter_rule_is_valid(&rules[i])) {
+            lm_log_error(TAG, "rule %u of type %d is invalid", i, rules[i].type);
+            return NULL;
+        }
+    }
+
+    lm_filter_t *filter = g_new0(lm_filter_t, 1);
+    filter->n_rules = n_rules;
+
+    for (guint i = 0; i < n_rules; i++) {
+        const lm_filter_rule_t *rule = &rules[i];
+        switch (rule->type) {
+            case LM_FILTER_RULE_NAME_PREFIX:
+                if (!filter->name_trie)
+                    filter->name_trie = lm_filter_trie_new();
+                lm_filter_trie_insert(filter->name_trie, rule->string, (gint)i, TRUE);
+                break;
+            case LM_FILTER_RULE_ADDRESS_PREFIX:
+                if (!filter->address_trie)
+                    filter->address_trie = lm_filter_trie_new();
+                lm_filter_trie_insert(filter->address_trie, rule->string, (gint)i, TRUE);
+                break;
+            case LM_FILTER_RULE_MANUFACTURER:
+                if (!filter->manufacturer)
+                    filter->manufacturer = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+                                                                 (GDestroyNotify)g_ptr_array_unref);
+                lm_filter_data_rule_add(lm_filter_data_rules_get(filter->manufacturer,
+                                                                 GUINT_TO_POINTER(rule->company_id), FALSE),
+                                        rule, (gint)i);
+                break;
+            case LM_FILTER_RULE_SERVICE_UUID: {
+                if (!filter->uuids)
+                    filter->uuids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+                gchar *uuid = g_ascii_strdown(rule->string, -1);
+                if (g_hash_table_contains(filter->uuids, uuid)) {
+                    g_free(uuid);
+                    break;
+                }
+                gint uuid16 = lm_utils_uuid16(uuid);
+                if (uuid16 >= 0) {
+                    if (!filter->uuid16_bits)
+                        filter->uuid16_bits = g_new0(guint32, SIG_UUID16_COUNT / 32);
+                    filter->uuid16_bits[uuid16 / 32] |= 1u << (uuid16 % 32);
+                }
+                g_hash_table_insert(filter->uuids, uuid, GINT_TO_POINTER(i + 1));
+                break;
+            }
+            case LM_FILTER_RULE_SERVICE_DATA: {
+                if (!filter->service_data)
+                    filter->service_data = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                                                 (GDestroyNotify)g_ptr_array_unref);
+                gchar *uuid = g_ascii_strdown(rule->string, -1);
+                lm_filter_data_rule_add(lm_filter_data_rules_get(filter->service_data, uuid, TRUE), rule, (gint)i);
+                g_free(uuid);
+                break;
+            }
+        }
+    }
+
+    lm_log_debug(TAG, "compiled %u rules", n_rules);
+    return filter;
+}
+
+void lm_filter_destroy(lm_filter_t *filter)
+{
+    g_assert(filter);
+
+    if (filter->name_trie)
+        g_array_free(filter->name_trie, TRUE);
+    if (filter->address_trie)
+        g_array_free(filter->address_trie, TRUE);
+    if (filter->manufacturer)
+        g_hash_table_destroy(filter->manufacturer);
+    if (filter->service_data)
+        g_hash_table_destroy(filter->service_data);
+    if (filter->uuids)
+        g_hash_table_destroy(filter->uuids);
+    g_free(filter->uuid16_bits);
+    g_free(filter);
+}
+
+static gint lm_filter_match_uuid(const lm_filter_t *filter, const gchar *uuid)
+{
+    gint uuid16 = lm_utils_uuid16(uuid);
+    if (uuid16 >= 0 && (!filter->uuid16_bits || !(filter->uuid16_bits[uuid16 / 32] & (1u << (uuid16 % 32)))))
+        return -1;
+
+    /* bluez reports uuids in lowercase */
+    return GPOINTER_TO_INT(g_hash_table_lookup(filter->uuids, uuid)) - 1;
+}
+
+gint lm_filter_match_prefix(const lm_filter_t *filter, const gchar *name, const gchar *address)
+{
+    gint rule = -1;
+
+    g_assert(filter);
+
+    if (filter->name_trie && name)
+        rule = lm_filter_trie_match(filter->name_trie, name, TRUE);
+    if (rule < 0 && filter->address_trie && address)
+        rule = lm_filter_trie_match(filter->address_trie, address, TRUE);
+    return rule;
+}
+
+gboolean lm_filter_match(const lm_filter_t *filter, lm_device_t *device, gint *rule_index)
+{
+    g_assert(filter);
+    g_assert(device);
+
+    gint rule = lm_filter_match_prefix(filter, lm_device_get_name(device), lm_device_get_address(device));
+
+    GHashTable *manufacturer_data = lm_device_get_manufacturer_data(device);
+    if (rule < 0 && filter->manufacturer && manufacturer_data) {
+        GHashTableIter iter;
+        gpointer key, value;
+        g_hash_table_iter_init(&iter, manufacturer_data);
+        while (rule < 0 && g_hash_table_iter_next(&iter, &key, &value)) {
+            GPtrArray *rules = g_hash_table_lookup(filter->manufacturer, GUINT_TO_POINTER(*(gint *)key));
+            if (rules)
+                rule = lm_filter_data_rules_match(rules, value);
+        }
+    }
+
+    if (rule < 0 && filter->uuids) {
+        for (GList *iterator = lm_device_get_uuids(device); rule < 0 && iterator; iterator = iterator->next)
+            rule = lm_filter_match_uuid(filter, iterator->data);
+    }
+
+    GHashTable *service_data = lm_device_get_service_data(device);
+    if (rule < 0 && filter->service_data && service_data) {
+        GHashTableIter iter;
+        gpointer key, value;
+        g_hash_table_iter_init(&iter, service_data);
+        while (rule < 0 && g_hash_table_iter_next(&iter, &key, &value)) {
+            GPtrArray *rules = g_hash_table_lookup(filter->service_data, key);
+            if (rules)
+                rule = lm_filter_data_rules_match(rules, value);
+        }
+    }
+
+    if (rule_index)
+        *rule_index = rule;
+    return rule >= 0;
+}
+
+guint lm_filter_get_rule_count(const lm_filter_t *filter)
+{
+    g_assert(filter);
+    return filter->n_rules;
+}
@@ -0,0 +1,11 @@
+#ifndef __LM_FILTER_PRIV_H__
+#define __LM_FILTER_PRIV_H__
+#include "lm_type.h"
+#include <glib.h>
+#include "lm_forward_decl.h"
+#include "lm_filter.h"
+
+/* Index of the name or address prefix rule matching, -1 for none. Either string may be NULL */
+gint lm_filter_match_prefix(const lm_filter_t *filter, const gchar *name, const gchar *address);
+
+#endif //__LM_FILTER_PRIV_H__
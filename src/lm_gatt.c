@@ -0,0 +1,735 @@
+#define _GNU_SOURCE /* recvmmsg */
+#include "lm_gatt.h"
+#include "lm_gatt_priv.h"
+#include "lm.h"
+#include "lm_io.h"
+#include "lm_log.h"
+#include "lm_dbus_priv.h"
+#include "lm_device.h"
+#include "lm_device_priv.h"
+#include "bluez_dbus.h"
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define TAG "lm_gatt"
+
+/* Notifications drained per recvmmsg() call */
+#define NOTIFY_BATCH_SIZE       16
+#define NOTIFY_DEFAULT_MTU      23
+
+/* Writes handed to sendmmsg() at once */
+#define WRITE_BATCH_SIZE        16
+/* ATT opcode + handle of a Write Without Response */
+#define WRITE_ATT_HEADER_SIZE   3
+/* lm_gatt_write_stream_write() returns LM_STATUS_BUSY above this, unless the queue is empty */
+#define WRITE_QUEUE_MAX         (256 * 1024)
+
+struct lm_gatt_notify {
+    GDBusConnection *dbus_conn;
+    lm_device_t *device;            // Borrowed
+    gchar *path;                    /* characteristic object path */
+    lm_gatt_notify_callback_t callback;
+    gpointer user_data;
+    guint16 mtu;
+    gint fd;                        /* acquired fd, -1 with StartNotify fallback */
+    lm_io_watch_t *watch;
+    GMutex lock;                    /* protects watch/fd between io thread and stop */
+    guint8 *buffers;                /* NOTIFY_BATCH_SIZE * mtu */
+    struct mmsghdr msgs[NOTIFY_BATCH_SIZE];
+    struct iovec iovecs[NOTIFY_BATCH_SIZE];
+    guint value_changed_id;
+    gboolean stopped;
+    gint ref_count;
+};
+
+struct lm_gatt_write_stream {
+    lm_device_t *device;            // Borrowed
+    gchar *path;                    /* characteristic object path */
+    lm_gatt_write_progress_callback_t callback;
+    gpointer user_data;
+    guint16 mtu;
+    gsize chunk_size;               /* payload per write */
+    gint fd;
+    lm_io_watch_t *watch;
+    GMutex lock;                    /* protects queue, watch and counters */
+    GByteArray *queue;
+    gsize queue_head;               /* first unsent byte in queue */
+    guint64 bytes_written;
+    gint64 start_time;
+    gboolean closed;
+    gint ref_count;
+};
+
+static lm_gatt_notify_t *lm_gatt_notify_ref(lm_gatt_notify_t *notify)
+{
+    g_atomic_int_inc(&notify->ref_count);
+    return notify;
+}
+
+static void lm_gatt_notify_unref(lm_gatt_notify_t *notify)
+{
+    if (!g_atomic_int_dec_and_test(&notify->ref_count))
+        return;
+
+    g_mutex_clear(&notify->lock);
+    g_free(notify->buffers);
+    g_free(notify->path);
+    g_free(notify);
+}
+
+/* Returns the object path of the characteristic with uuid under device, or NULL */
+static gchar *lm_gatt_find_characteristic(GDBusConnection *dbus_conn, const gchar *device_path, const gchar *uuid)
+{
+    GError *error = NULL;
+    gchar *char_path = NULL;
+    gchar *prefix = g_strdup_printf("%s/", device_path);
+
+    GVariant *result = lm_dbus_call_sync(dbus_conn,
+                                         BLUEZ_DBUS,
+                                         "/",
+                                         INTERFACE_OBJECT_MANAGER,
+                                         OBJECT_MANAGER_METHOD_GET_MANAGED_OBJECTS,
+                                         NULL,
+                                         G_VARIANT_TYPE("(a{oa{sa{sv}}})"),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                                         NULL,
+                                         &error);
+    if (!result) {
+        lm_log_error(TAG, "Error GetManagedObjects: %s", error->message);
+        g_clear_error(&error);
+        g_free(prefix);
+        return NULL;
+    }
+
+    GVariantIter *iter = NULL;
+    const gchar *object_path;
+    GVariant *ifaces_and_properties;
+
+    g_variant_get(result, "(a{oa{sa{sv}}})", &iter);
+    while (char_path == NULL &&
+           g_variant_iter_loop(iter, "{&o@a{sa{sv}}}", &object_path, &ifaces_and_properties)) {
+        if (!g_str_has_prefix(object_path, prefix))
+            continue;
+
+        GVariant *properties = g_variant_lookup_value(ifaces_and_properties, INTERFACE_CHARACTERISTIC,
+                                                      G_VARIANT_TYPE_VARDICT);
+        if (!properties)
+            continue;
+
+        const gchar *char_uuid = NULL;
+        if (g_variant_lookup(properties, CHARACTERISTIC_PROPERTY_UUID, "&s", &char_uuid) &&
+            g_ascii_strcasecmp(char_uuid, uuid) == 0)
+            char_path = g_strdup(object_path);
+        g_variant_unref(properties);
+    }
+
+    g_variant_iter_free(iter);
+    g_variant_unref(result);
+    g_free(prefix);
+
+    return char_path;
+}
+
+/* Calls AcquireWrite/AcquireNotify, returns a non-blocking fd or -1 */
+static gint lm_gatt_acquire(GDBusConnection *dbus_conn, const gchar *path, const gchar *method, guint16 *mtu)
+{
+    GError *error = NULL;
+    GUnixFDList *fd_list = NULL;
+    gint32 fd_index = -1;
+    gint fd = -1;
+
+    GVariant *result = lm_dbus_call_with_unix_fd_list_sync(dbus_conn,
+                                                   BLUEZ_DBUS,
+                                                   path,
+                                                   INTERFACE_CHARACTERISTIC,
+                                                   method,
+                                                   g_variant_new("(@a{sv})", g_variant_new_array(G_VARIANT_TYPE("{sv}"), NULL, 0)),
+                                                   G_VARIANT_TYPE("(hq)"),
+                                                   G_DBUS_CALL_FLAGS_NONE,
+                                                   BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                                                   NULL,
+                                                   &fd_list,
+                                                   NULL,
+                                                   &error);
+    if (!result) {
+        gchar *remote_error = g_dbus_error_get_remote_error(error);
+        lm_log_info(TAG, "%s on '%s' failed (%s: %s)", method, path,
+                    remote_error ? remote_error : "local", error->message);
+        g_free(remote_error);
+        g_clear_error(&error);
+        return -1;
+    }
+
+    g_variant_get(result, "(hq)", &fd_index, mtu);
+    g_variant_unref(result);
+
+    if (fd_list) {
+        fd = g_unix_fd_list_get(fd_list, fd_index, &error);
+        g_object_unref(fd_list);
+    }
+    if (fd < 0) {
+        lm_log_error(TAG, "%s on '%s' returned no fd", method, path);
+        g_clear_error(&error);
+        return -1;
+    }
+
+    gint flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        lm_log_error(TAG, "failed to set fd non-blocking (%s)", g_strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static gboolean lm_gatt_notify_stopped_idle(gpointer user_data)
+{
+    lm_gatt_notify_t *notify = (lm_gatt_notify_t *)user_data;
+
+    if (!notify->stopped) {
+        lm_gatt_notify_stopped_ind_t ind = {
+            .notify = notify
+        };
+        lm_app_event_callback(LM_GATT_NOTIFY_STOPPED_IND, LM_STATUS_SUCCESS, &ind);
+    }
+    lm_gatt_notify_unref(notify);
+
+    return FALSE;
+}
+
+/* Returns TRUE while the watch is still installed, stop may run from the callback */
+static gboolean lm_gatt_notify_is_watched(lm_gatt_notify_t *notify)
+{
+    g_mutex_lock(&notify->lock);
+    gboolean watched = notify->watch != NULL;
+    g_mutex_unlock(&notify->lock);
+
+    return watched;
+}
+
+/*
+ * io thread. Zero-length notifications are valid, so the peer closing is only
+ * known from EPOLLHUP/EPOLLRDHUP or a failed read; once it is, an empty read
+ * is the end of the queued data.
+ */
+static void lm_gatt_notify_io_cb(gint fd, guint32 events, gpointer user_data)
+{
+    lm_gatt_notify_t *notify = lm_gatt_notify_ref((lm_gatt_notify_t *)user_data);
+    gboolean hangup = (events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) != 0;
+    gboolean failed = FALSE;
+    gboolean more = (events & EPOLLIN) != 0;
+
+    /* Drain what is queued even if the peer already hung up */
+    while (more) {
+        gint n = recvmmsg(fd, notify->msgs, NOTIFY_BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                lm_log_error(TAG, "read notification on '%s' failed (%s)", notify->path, g_strerror(errno));
+                failed = TRUE;
+            }
+            break;
+        }
+        more = n == NOTIFY_BATCH_SIZE;
+        for (gint i = 0; i < n; i++) {
+            if (notify->msgs[i].msg_len == 0) {
+                /* the peer may have closed since epoll_wait, the next wakeup tells */
+                more = FALSE;
+                if (hangup)
+                    break;
+            }
+            notify->callback(notify, notify->iovecs[i].iov_base, notify->msgs[i].msg_len, notify->user_data);
+            if (!lm_gatt_notify_is_watched(notify))
+                goto exit;
+        }
+    }
+
+    if (!hangup && !failed)
+        goto exit;
+
+    g_mutex_lock(&notify->lock);
+    lm_io_watch_t *watch = notify->watch;
+    notify->watch = NULL;
+    g_mutex_unlock(&notify->lock);
+
+    if (!watch)
+        goto exit;
+
+    lm_log_info(TAG, "notify fd of '%s' closed", notify->path);
+    lm_io_remove_watch(watch);
+    close(notify->fd);
+    notify->fd = -1;
+    g_idle_add(lm_gatt_notify_stopped_idle, lm_gatt_notify_ref(notify));
+
+exit:
+    lm_gatt_notify_unref(notify);
+}
+
+static void on_value_changed(__attribute__((unused)) GDBusConnection *conn,
+                             __attribute__((unused)) const gchar *sender_name,
+                             __attribute__((unused)) const gchar *object_path,
+                             __attribute__((unused)) const gchar *interface,
+                             __attribute__((unused)) const gchar *signal_name,
+                             GVariant *parameters,
+                             gpointer user_data)
+{
+    lm_gatt_notify_t *notify = (lm_gatt_notify_t *)user_data;
+    GVariant *properties = NULL;
+    const gchar *iface = NULL;
+
+    g_variant_get(parameters, "(&s@a{sv}as)", &iface, &properties, NULL);
+
+    GVariant *value = g_variant_lookup_value(properties, CHARACTERISTIC_PROPERTY_VALUE, G_VARIANT_TYPE_BYTESTRING);
+    if (value) {
+        gsize len = 0;
+        const guint8 *data = g_variant_get_fixed_array(value, &len, sizeof(guint8));
+        notify->callback(notify, data, len, notify->user_data);
+        g_variant_unref(value);
+    }
+    g_variant_unref(properties);
+}
+
+static void lm_gatt_call_method_cb(__attribute__((unused)) GObject *source_object, GAsyncResult *res,
+                                   gpointer user_data)
+{
+    const gchar *method = (const gchar *)user_data;
+
+    GError *error = NULL;
+    GVariant *value = lm_dbus_call_finish(res, &error);
+    if (value != NULL) {
+        g_variant_unref(value);
+    }
+
+    if (error != NULL) {
+        lm_log_error(TAG, "failed to call %s (error %d '%s')", method, error->code, error->message);
+        g_clear_error(&error);
+    }
+}
+
+static void lm_gatt_call_method(GDBusConnection *dbus_conn, const gchar *path, const gchar *method)
+{
+    lm_dbus_call(dbus_conn,
+                 BLUEZ_DBUS,
+                 path,
+                 INTERFACE_CHARACTERISTIC,
+                 method,
+                 NULL,
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 NULL,
+                 (GAsyncReadyCallback) lm_gatt_call_method_cb,
+                 (gpointer)method);
+}
+
+static lm_status_t lm_gatt_notify_setup_fd(lm_gatt_notify_t *notify, gint fd)
+{
+    notify->fd = fd;
+    if (notify->mtu == 0)
+        notify->mtu = NOTIFY_DEFAULT_MTU;
+
+    notify->buffers = g_malloc((gsize)NOTIFY_BATCH_SIZE * notify->mtu);
+    for (guint i = 0; i < NOTIFY_BATCH_SIZE; i++) {
+        notify->iovecs[i].iov_base = notify->buffers + (gsize)i * notify->mtu;
+        notify->iovecs[i].iov_len = notify->mtu;
+        notify->msgs[i].msg_hdr.msg_iov = &notify->iovecs[i];
+        notify->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if (lm_io_ref() != LM_STATUS_SUCCESS)
+        return LM_STATUS_FAIL;
+
+    notify->watch = lm_io_add_watch(fd, EPOLLIN | EPOLLRDHUP, lm_gatt_notify_io_cb, notify);
+    if (!notify->watch) {
+        lm_io_unref();
+        return LM_STATUS_FAIL;
+    }
+
+    return LM_STATUS_SUCCESS;
+}
+
+lm_gatt_notify_t *lm_gatt_notify_start(lm_device_t *device, const gchar *char_uuid,
+                lm_gatt_notify_callback_t callback, gpointer user_data)
+{
+    g_assert(device);
+    g_assert(char_uuid);
+    g_assert(callback);
+
+    GDBusConnection *dbus_conn = lm_device_get_dbus_conn(device);
+    gchar *path = lm_gatt_find_characteristic(dbus_conn, lm_device_get_path(device), char_uuid);
+    if (!path) {
+        lm_log_error(TAG, "characteristic %s not found on '%s'", char_uuid, lm_device_get_path(device));
+        return NULL;
+    }
+
+    lm_gatt_notify_t *notify = g_new0(lm_gatt_notify_t, 1);
+    notify->dbus_conn = dbus_conn;
+    notify->device = device;
+    notify->path = path;
+    notify->callback = callback;
+    notify->user_data = user_data;
+    notify->fd = -1;
+    notify->ref_count = 1;
+    g_mutex_init(&notify->lock);
+
+    gint fd = lm_gatt_acquire(dbus_conn, path, CHARACTERISTIC_METHOD_ACQUIRE_NOTIFY, &notify->mtu);
+    if (fd >= 0) {
+        if (lm_gatt_notify_setup_fd(notify, fd) == LM_STATUS_SUCCESS) {
+            lm_log_info(TAG, "notify '%s' acquired, fd %d mtu %d", path, fd, notify->mtu);
+            return notify;
+        }
+        close(fd);
+        notify->fd = -1;
+        g_clear_pointer(&notify->buffers, g_free);
+    }
+
+    /* Fallback: notifications through PropertiesChanged */
+    notify->value_changed_id = g_dbus_connection_signal_subscribe(dbus_conn,
+                                                     BLUEZ_DBUS,
+                                                     INTERFACE_PROPERTIES,
+                                                     PROPERTIES_SIGNAL_CHANGED,
+                                                     path,
+                                                     INTERFACE_CHARACTERISTIC,
+                                                     G_DBUS_SIGNAL_FLAGS_NONE,
+                                                     on_value_changed,
+                                                     lm_gatt_notify_ref(notify),
+                                                     (GDestroyNotify) lm_gatt_notify_unref);
+    lm_gatt_call_method(dbus_conn, path, CHARACTERISTIC_METHOD_START_NOTIFY);
+    lm_log_info(TAG, "notify '%s' through StartNotify", path);
+
+    return notify;
+}
+
+void lm_gatt_notify_stop(lm_gatt_notify_t *notify)
+{
+    g_assert(notify);
+
+    lm_log_debug(TAG, "stop notify '%s'", notify->path);
+    notify->stopped = TRUE;
+
+    if (notify->value_changed_id) {
+        g_dbus_connection_signal_unsubscribe(notify->dbus_conn, notify->value_changed_id);
+        notify->value_changed_id = 0;
+        lm_gatt_call_method(notify->dbus_conn, notify->path, CHARACTERISTIC_METHOD_STOP_NOTIFY);
+    }
+
+    g_mutex_lock(&notify->lock);
+    lm_io_watch_t *watch = notify->watch;
+    notify->watch = NULL;
+    g_mutex_unlock(&notify->lock);
+
+    if (watch) {
+        lm_io_remove_watch(watch);
+        /* Closing the fd is enough for bluez to stop notifying */
+        close(notify->fd);
+        notify->fd = -1;
+    }
+    if (notify->buffers)
+        lm_io_unref();
+
+    lm_gatt_notify_unref(notify);
+}
+
+lm_device_t *lm_gatt_notify_get_device(const lm_gatt_notify_t *notify)
+{
+    g_assert(notify);
+    return notify->device;
+}
+
+const gchar *lm_gatt_notify_get_path(const lm_gatt_notify_t *notify)
+{
+    g_assert(notify);
+    return notify->path;
+}
+
+gboolean lm_gatt_notify_is_acquired(const lm_gatt_notify_t *notify)
+{
+    g_assert(notify);
+    return notify->buffers != NULL;
+}
+
+guint16 lm_gatt_notify_get_mtu(const lm_gatt_notify_t *notify)
+{
+    g_assert(notify);
+    return notify->mtu;
+}
+
+static lm_gatt_write_stream_t *lm_gatt_write_stream_ref(lm_gatt_write_stream_t *stream)
+{
+    g_atomic_int_inc(&stream->ref_count);
+    return stream;
+}
+
+static void lm_gatt_write_stream_unref(lm_gatt_write_stream_t *stream)
+{
+    if (!g_atomic_int_dec_and_test(&stream->ref_count))
+        return;
+
+    g_mutex_clear(&stream->lock);
+    g_byte_array_free(stream->queue, TRUE);
+    g_free(stream->path);
+    g_free(stream);
+}
+
+static gsize lm_gatt_write_stream_pending_locked(lm_gatt_write_stream_t *stream)
+{
+    return stream->queue->len - stream->queue_head;
+}
+
+static void lm_gatt_write_stream_progress_locked(lm_gatt_write_stream_t *stream, lm_gatt_write_progress_t *progress)
+{
+    progress->bytes_written = stream->bytes_written;
+    progress->bytes_pending = lm_gatt_write_stream_pending_locked(stream);
+    progress->elapsed_us = stream->start_time ? g_get_monotonic_time() - stream->start_time : 0;
+    progress->bytes_per_sec = progress->elapsed_us > 0 ?
+        (stream->bytes_written * G_USEC_PER_SEC) / (guint64)progress->elapsed_us : 0;
+}
+
+static gboolean lm_gatt_write_stream_closed_idle(gpointer user_data)
+{
+    lm_gatt_write_stream_t *stream = (lm_gatt_write_stream_t *)user_data;
+
+    if (!stream->closed) {
+        lm_gatt_write_stream_closed_ind_t ind = {
+            .stream = stream
+        };
+        lm_app_event_callback(LM_GATT_WRITE_STREAM_CLOSED_IND, LM_STATUS_SUCCESS, &ind);
+    }
+    lm_gatt_write_stream_unref(stream);
+
+    return FALSE;
+}
+
+/* Returns FALSE when the socket is gone */
+static gboolean lm_gatt_write_stream_flush_locked(lm_gatt_write_stream_t *stream)
+{
+    struct mmsghdr msgs[WRITE_BATCH_SIZE];
+    struct iovec iovecs[WRITE_BATCH_SIZE];
+
+    while (lm_gatt_write_stream_pending_locked(stream) > 0) {
+        guint8 *data = stream->queue->data + stream->queue_head;
+        gsize pending = lm_gatt_write_stream_pending_locked(stream);
+        guint count = 0;
+
+        memset(msgs, 0, sizeof(msgs));
+        while (count < WRITE_BATCH_SIZE && pending > 0) {
+            gsize len = MIN(pending, stream->chunk_size);
+            iovecs[count].iov_base = data;
+            iovecs[count].iov_len = len;
+            msgs[count].msg_hdr.msg_iov = &iovecs[count];
+            msgs[count].msg_hdr.msg_iovlen = 1;
+            data += len;
+            pending -= len;
+            count++;
+        }
+
+        gint n = sendmmsg(stream->fd, msgs, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+            lm_log_error(TAG, "write to '%s' failed (%s)", stream->path, g_strerror(errno));
+            return FALSE;
+        }
+
+        gsize sent = 0;
+        for (gint i = 0; i < n; i++)
+            sent += iovecs[i].iov_len;
+        stream->queue_head += sent;
+        stream->bytes_written += sent;
+
+        if ((guint)n < count)
+            break;
+    }
+
+    /* Compact once the consumed part dominates */
+    if (stream->queue_head == stream->queue->len) {
+        g_byte_array_set_size(stream->queue, 0);
+        stream->queue_head = 0;
+    } else if (stream->queue_head > stream->queue->len / 2) {
+        g_byte_array_remove_range(stream->queue, 0, stream->queue_head);
+        stream->queue_head = 0;
+    }
+
+    lm_io_modify_watch(stream->watch, lm_gatt_write_stream_pending_locked(stream) > 0 ? EPOLLOUT : 0);
+
+    return TRUE;
+}
+
+/* io thread */
+static void lm_gatt_write_stream_io_cb(__attribute__((unused)) gint fd, guint32 events, gpointer user_data)
+{
+    lm_gatt_write_stream_t *stream = (lm_gatt_write_stream_t *)user_data;
+    lm_gatt_write_progress_t progress;
+    gboolean alive = TRUE;
+    guint64 before;
+
+    g_mutex_lock(&stream->lock);
+    before = stream->bytes_written;
+    if (events & (EPOLLHUP | EPOLLERR))
+        alive = FALSE;
+    else if (events & EPOLLOUT)
+        alive = lm_gatt_write_stream_flush_locked(stream);
+    lm_gatt_write_stream_progress_locked(stream, &progress);
+
+    lm_io_watch_t *watch = NULL;
+    if (!alive) {
+        watch = stream->watch;
+        stream->watch = NULL;
+        lm_gatt_write_stream_ref(stream);
+    }
+    g_mutex_unlock(&stream->lock);
+
+    if (progress.bytes_written != before && stream->callback)
+        stream->callback(stream, &progress, stream->user_data);
+
+    if (alive || !watch)
+        return;
+
+    lm_log_info(TAG, "write fd of '%s' closed", stream->path);
+    lm_io_remove_watch(watch);
+    close(stream->fd);
+    stream->fd = -1;
+    g_idle_add(lm_gatt_write_stream_closed_idle, stream);
+}
+
+lm_gatt_write_stream_t *lm_gatt_write_stream_open(lm_device_t *device, const gchar *char_uuid,
+                lm_gatt_write_progress_callback_t callback, gpointer user_data)
+{
+    g_assert(device);
+    g_assert(char_uuid);
+
+    GDBusConnection *dbus_conn = lm_device_get_dbus_conn(device);
+    gchar *path = lm_gatt_find_characteristic(dbus_conn, lm_device_get_path(device), char_uuid);
+    if (!path) {
+        lm_log_error(TAG, "characteristic %s not found on '%s'", char_uuid, lm_device_get_path(device));
+        return NULL;
+    }
+
+    guint16 mtu = 0;
+    gint fd = lm_gatt_acquire(dbus_conn, path, CHARACTERISTIC_METHOD_ACQUIRE_WRITE, &mtu);
+    if (fd < 0) {
+        lm_log_error(TAG, "failed to acquire write on '%s'", path);
+        g_free(path);
+        return NULL;
+    }
+
+    lm_gatt_write_stream_t *stream = lm_gatt_write_stream_new_for_fd(device, path, fd, mtu, callback, user_data);
+    g_free(path);
+    return stream;
+}
+
+lm_gatt_write_stream_t *lm_gatt_write_stream_new_for_fd(lm_device_t *device, const gchar *path, gint fd,
+                guint16 mtu, lm_gatt_write_progress_callback_t callback, gpointer user_data)
+{
+    g_assert(path);
+    g_assert(fd >= 0);
+
+    if (lm_io_ref() != LM_STATUS_SUCCESS) {
+        close(fd);
+        return NULL;
+    }
+
+    lm_gatt_write_stream_t *stream = g_new0(lm_gatt_write_stream_t, 1);
+    stream->device = device;
+    stream->path = g_strdup(path);
+    stream->callback = callback;
+    stream->user_data = user_data;
+    stream->mtu = mtu;
+    stream->chunk_size = mtu > WRITE_ATT_HEADER_SIZE ? mtu - WRITE_ATT_HEADER_SIZE : NOTIFY_DEFAULT_MTU - WRITE_ATT_HEADER_SIZE;
+    stream->fd = fd;
+    stream->queue = g_byte_array_new();
+    stream->ref_count = 1;
+    g_mutex_init(&stream->lock);
+
+    /* Armed for EPOLLOUT only while data is queued */
+    stream->watch = lm_io_add_watch(fd, 0, lm_gatt_write_stream_io_cb, stream);
+    if (!stream->watch) {
+        close(fd);
+        lm_io_unref();
+        lm_gatt_write_stream_unref(stream);
+        return NULL;
+    }
+
+    lm_log_info(TAG, "write '%s' acquired, fd %d mtu %d", path, fd, mtu);
+    return stream;
+}
+
+lm_status_t lm_gatt_write_stream_write(lm_gatt_write_stream_t *stream, const guint8 *data, gsize len)
+{
+    g_assert(stream);
+    g_assert(data || len == 0);
+
+    lm_status_t status = LM_STATUS_SUCCESS;
+
+    g_mutex_lock(&stream->lock);
+    if (!stream->watch) {
+        status = LM_STATUS_NOT_READY;
+    } else if (lm_gatt_write_stream_pending_locked(stream) > 0 &&
+               lm_gatt_write_stream_pending_locked(stream) + len > WRITE_QUEUE_MAX) {
+        /* a larger write is still taken on an empty queue, it could never fit otherwise */
+        status = LM_STATUS_BUSY;
+    } else if (len > 0) {
+        if (stream->start_time == 0)
+            stream->start_time = g_get_monotonic_time();
+        g_byte_array_append(stream->queue, data, len);
+        lm_io_modify_watch(stream->watch, EPOLLOUT);
+    }
+    g_mutex_unlock(&stream->lock);
+
+    return status;
+}
+
+void lm_gatt_write_stream_close(lm_gatt_write_stream_t *stream)
+{
+    g_assert(stream);
+
+    g_mutex_lock(&stream->lock);
+    stream->closed = TRUE;
+    lm_io_watch_t *watch = stream->watch;
+    stream->watch = NULL;
+    if (lm_gatt_write_stream_pending_locked(stream) > 0)
+        lm_log_info(TAG, "close '%s' with %zu bytes pending", stream->path, lm_gatt_write_stream_pending_locked(stream));
+    g_mutex_unlock(&stream->lock);
+
+    if (watch) {
+        lm_io_remove_watch(watch);
+        close(stream->fd);
+        stream->fd = -1;
+    }
+    lm_io_unref();
+
+    lm_gatt_write_stream_unref(stream);
+}
+
+gsize lm_gatt_write_stream_get_pending(lm_gatt_write_stream_t *stream)
+{
+    g_assert(stream);
+
+    g_mutex_lock(&stream->lock);
+    gsize pending = lm_gatt_write_stream_pending_locked(stream);
+    g_mutex_unlock(&stream->lock);
+
+    return pending;
+}
+
+void lm_gatt_write_stream_get_progress(lm_gatt_write_stream_t *stream, lm_gatt_write_progress_t *progress)
+{
+    g_assert(stream);
+    g_assert(progress);
+
+    g_mutex_lock(&stream->lock);
+    lm_gatt_write_stream_progress_locked(stream, progress);
+    g_mutex_unlock(&stream->lock);
+}
+
+guint16 lm_gatt_write_stream_get_mtu(const lm_gatt_write_stream_t *stream)
+{
+    g_assert(stream);
+    return stream->mtu;
+}
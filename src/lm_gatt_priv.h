@@ -0,0 +1,12 @@
+#ifndef __LM_GATT_PRIV_H__
+#define __LM_GATT_PRIV_H__
+#include "lm_type.h"
+#include <glib.h>
+#include "lm_forward_decl.h"
+#include "lm_gatt.h"
+
+/* Takes fd, an acquired write socket. device may be NULL, it is only reported back */
+lm_gatt_write_stream_t *lm_gatt_write_stream_new_for_fd(lm_device_t *device, const gchar *path, gint fd,
+                guint16 mtu, lm_gatt_write_progress_callback_t callback, gpointer user_data);
+
+#endif //__LM_GATT_PRIV_H__
@@ -0,0 +1,184 @@
+#include "lm_histogram.h"
+#include "lm_log.h"
+#include <glib.h>
+#include <string.h>
+
+#define TAG "lm_histogram"
+
+#define SUB_BUCKET_BITS     4
+#define SUB_BUCKET_COUNT    (1 << SUB_BUCKET_BITS)
+/* Values below LINEAR_LIMIT get one bucket each */
+#define LINEAR_LIMIT        (SUB_BUCKET_COUNT << 1)
+
+struct lm_histogram {
+    gchar *name;
+    guint64 highest_value;
+    guint bucket_count;
+    guint64 count;
+    guint64 sum;
+    guint64 min;
+    guint64 max;
+    guint64 *buckets;
+};
+
+static guint lm_histogram_value_to_index(guint64 value)
+{
+    if (value < LINEAR_LIMIT)
+        return (guint)value;
+
+    guint msb = 63 - __builtin_clzll(value);
+    guint shift = msb - SUB_BUCKET_BITS;
+    guint sub = (guint)(value >> shift) - SUB_BUCKET_COUNT;
+    return LINEAR_LIMIT + (shift - 1) * SUB_BUCKET_COUNT + sub;
+}
+
+/* Highest value that falls into the bucket */
+static guint64 lm_histogram_index_to_value(guint index)
+{
+    if (index < LINEAR_LIMIT)
+        return index;
+
+    guint shift = (index - LINEAR_LIMIT) / SUB_BUCKET_COUNT + 1;
+    guint64 sub = (index - LINEAR_LIMIT) % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+lm_histogram_t *lm_histogram_create(const gchar *name, guint64 highest_value)
+{
+    g_assert(name);
+    g_assert(highest_value > 0);
+
+    lm_histogram_t *histogram = g_new0(lm_histogram_t, 1);
+    histogram->name = g_strdup(name);
+    histogram->highest_value = highest_value;
+    histogram->bucket_count = lm_histogram_value_to_index(highest_value) + 1;
+    histogram->buckets = g_new0(guint64, histogram->bucket_count);
+    histogram->min = G_MAXUINT64;
+
+    return histogram;
+}
+
+void lm_histogram_destroy(lm_histogram_t *histogram)
+{
+    g_assert(histogram);
+
+    g_free(histogram->buckets);
+    g_free(histogram->name);
+    g_free(histogram);
+}
+
+void lm_histogram_record(lm_histogram_t *histogram, guint64 value)
+{
+    g_assert(histogram);
+
+    /* Out of range values are counted in the last bucket, min/max stay exact */
+    guint index = MIN(lm_histogram_value_to_index(value), histogram->bucket_count - 1);
+    __atomic_fetch_add(&histogram->buckets[index], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+
+    guint64 cur = __atomic_load_n(&histogram->min, __ATOMIC_RELAXED);
+    while (value < cur &&
+           !__atomic_compare_exchange_n(&histogram->min, &cur, value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    cur = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while (value > cur &&
+           !__atomic_compare_exchange_n(&histogram->max, &cur, value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+
+    /* Published last so a reader seeing count N sees at least N bucket hits */
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELEASE);
+}
+
+void lm_histogram_reset(lm_histogram_t *histogram)
+{
+    g_assert(histogram);
+
+    __atomic_store_n(&histogram->count, 0, __ATOMIC_RELEASE);
+    for (guint i = 0; i < histogram->bucket_count; i++)
+        __atomic_store_n(&histogram->buckets[i], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->sum, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->min, G_MAXUINT64, __ATOMIC_RELAXED);
+    __atomic_store_n(&histogram->max, 0, __ATOMIC_RELAXED);
+}
+
+const gchar *lm_histogram_get_name(const lm_histogram_t *histogram)
+{
+    g_assert(histogram);
+    return histogram->name;
+}
+
+gsize lm_histogram_get_memory_size(const lm_histogram_t *histogram)
+{
+    g_assert(histogram);
+    return sizeof(*histogram) + strlen(histogram->name) + 1 + histogram->bucket_count * sizeof(guint64);
+}
+
+guint64 lm_histogram_get_count(const lm_histogram_t *histogram)
+{
+    g_assert(histogram);
+    return __atomic_load_n(&histogram->count, __ATOMIC_ACQUIRE);
+}
+
+guint64 lm_histogram_get_min(const lm_histogram_t *histogram)
+{
+    g_assert(histogram);
+    if (lm_histogram_get_count(histogram) == 0)
+        return 0;
+    return __atomic_load_n(&histogram->min, __ATOMIC_RELAXED);
+}
+
+guint64 lm_histogram_get_max(const lm_histogram_t *histogram)
+{
+    g_assert(histogram);
+    return __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+}
+
+gdouble lm_histogram_get_mean(const lm_histogram_t *histogram)
+{
+    g_assert(histogram);
+
+    guint64 count = lm_histogram_get_count(histogram);
+    if (count == 0)
+        return 0.0;
+    return (gdouble)__atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) / (gdouble)count;
+}
+
+guint64 lm_histogram_get_percentile(const lm_histogram_t *histogram, gdouble percentile)
+{
+    g_assert(histogram);
+
+    guint64 count = lm_histogram_get_count(histogram);
+    if (count == 0)
+        return 0;
+
+    percentile = CLAMP(percentile, 0.0, 100.0);
+    guint64 target = (guint64)((percentile / 100.0) * (gdouble)count + 0.5);
+    if (target == 0)
+        target = 1;
+
+    guint64 seen = 0;
+    guint64 max = lm_histogram_get_max(histogram);
+    for (guint i = 0; i < histogram->bucket_count; i++) {
+        seen += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= target)
+            return MIN(lm_histogram_index_to_value(i), max);
+    }
+    return max;
+}
+
+void lm_histogram_dump(const lm_histogram_t *histogram, const gchar *tag)
+{
+    g_assert(histogram);
+
+    lm_log_info(tag ? tag : TAG, "%s: count %" G_GUINT64_FORMAT " min %" G_GUINT64_FORMAT
+                " mean %.1f p50 %" G_GUINT64_FORMAT " p90 %" G_GUINT64_FORMAT
+                " p99 %" G_GUINT64_FORMAT " max %" G_GUINT64_FORMAT,
+                histogram->name,
+                lm_histogram_get_count(histogram),
+                lm_histogram_get_min(histogram),
+                lm_histogram_get_mean(histogram),
+                lm_histogram_get_percentile(histogram, 50.0),
+                lm_histogram_get_percentile(histogram, 90.0),
+                lm_histogram_get_percentile(histogram, 99.0),
+                lm_histogram_get_max(histogram));
+}
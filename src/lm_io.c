@@ -0,0 +1,242 @@
+#include "lm_io.h"
+#include "lm_log.h"
+#include <glib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define TAG "lm_io"
+
+#define LM_IO_MAX_EVENTS    64
+
+struct lm_io_watch {
+    gint fd;
+    guint32 events;
+    lm_io_callback_t callback;
+    gpointer user_data;
+    gboolean removed;
+};
+
+typedef struct {
+    gint ref_count;
+    gint epoll_fd;
+    gint wakeup_fd;
+    pthread_t thread_id;
+    gboolean running;
+    GMutex lock;
+    GCond cond;
+    lm_io_watch_t *dispatching;     /* watch whose callback is running */
+    GList *zombies;                 /* removed watches, freed after the current batch */
+} lm_io_context_t;
+
+static lm_io_context_t lm_io_context = {0};
+static GMutex lm_io_ref_lock;
+
+gboolean lm_io_is_io_thread(void)
+{
+    return lm_io_context.running && pthread_equal(pthread_self(), lm_io_context.thread_id);
+}
+
+static void lm_io_dispatch(struct epoll_event *events, gint n)
+{
+    for (gint i = 0; i < n; i++) {
+        lm_io_watch_t *watch = (lm_io_watch_t *)events[i].data.ptr;
+        if (watch == NULL) {
+            guint64 value;
+            if (read(lm_io_context.wakeup_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+                lm_log_debug(TAG, "failed to read eventfd (%s)", g_strerror(errno));
+            continue;
+        }
+
+        g_mutex_lock(&lm_io_context.lock);
+        if (watch->removed) {
+            g_mutex_unlock(&lm_io_context.lock);
+            continue;
+        }
+        lm_io_context.dispatching = watch;
+        g_mutex_unlock(&lm_io_context.lock);
+
+        watch->callback(watch->fd, events[i].events, watch->user_data);
+
+        g_mutex_lock(&lm_io_context.lock);
+        lm_io_context.dispatching = NULL;
+        g_cond_broadcast(&lm_io_context.cond);
+        g_mutex_unlock(&lm_io_context.lock);
+    }
+
+    g_mutex_lock(&lm_io_context.lock);
+    GList *zombies = lm_io_context.zombies;
+    lm_io_context.zombies = NULL;
+    g_mutex_unlock(&lm_io_context.lock);
+    g_list_free_full(zombies, g_free);
+}
+
+static void *lm_io_thread(__attribute__((unused)) void *user_data)
+{
+    struct epoll_event events[LM_IO_MAX_EVENTS];
+
+    lm_log_info(TAG, "enter io thread");
+    while (g_atomic_int_get(&lm_io_context.running)) {
+        gint n = epoll_wait(lm_io_context.epoll_fd, events, LM_IO_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            lm_log_error(TAG, "epoll_wait failed (%s)", g_strerror(errno));
+            break;
+        }
+        lm_io_dispatch(events, n);
+    }
+    lm_log_info(TAG, "exit io thread");
+
+    return NULL;
+}
+
+lm_status_t lm_io_ref(void)
+{
+    lm_status_t status = LM_STATUS_SUCCESS;
+
+    g_mutex_lock(&lm_io_ref_lock);
+    if (lm_io_context.ref_count++ > 0)
+        goto exit;
+
+    lm_io_context.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    lm_io_context.wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (lm_io_context.epoll_fd < 0 || lm_io_context.wakeup_fd < 0) {
+        lm_log_error(TAG, "failed to create epoll/eventfd (%s)", g_strerror(errno));
+        goto fail;
+    }
+
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(lm_io_context.epoll_fd, EPOLL_CTL_ADD, lm_io_context.wakeup_fd, &ev) < 0) {
+        lm_log_error(TAG, "failed to watch eventfd (%s)", g_strerror(errno));
+        goto fail;
+    }
+
+    g_mutex_init(&lm_io_context.lock);
+    g_cond_init(&lm_io_context.cond);
+    lm_io_context.running = TRUE;
+    if (pthread_create(&lm_io_context.thread_id, NULL, lm_io_thread, NULL)) {
+        lm_log_error(TAG, "thread create failed");
+        lm_io_context.running = FALSE;
+        g_cond_clear(&lm_io_context.cond);
+        g_mutex_clear(&lm_io_context.lock);
+        goto fail;
+    }
+    goto exit;
+
+fail:
+    if (lm_io_context.wakeup_fd >= 0)
+        close(lm_io_context.wakeup_fd);
+    if (lm_io_context.epoll_fd >= 0)
+        close(lm_io_context.epoll_fd);
+    lm_io_context.wakeup_fd = -1;
+    lm_io_context.epoll_fd = -1;
+    lm_io_context.ref_count = 0;
+    status = LM_STATUS_FAIL;
+
+exit:
+    g_mutex_unlock(&lm_io_ref_lock);
+    return status;
+}
+
+static gboolean lm_io_unref_idle(__attribute__((unused)) gpointer user_data)
+{
+    lm_io_unref();
+    return FALSE;
+}
+
+void lm_io_unref(void)
+{
+    /* the io thread cannot join itself, a callback's unref completes from the main loop */
+    if (lm_io_is_io_thread()) {
+        g_idle_add(lm_io_unref_idle, NULL);
+        return;
+    }
+
+    g_mutex_lock(&lm_io_ref_lock);
+    g_assert(lm_io_context.ref_count > 0);
+    if (--lm_io_context.ref_count > 0) {
+        g_mutex_unlock(&lm_io_ref_lock);
+        return;
+    }
+
+    g_atomic_int_set(&lm_io_context.running, FALSE);
+    guint64 one = 1;
+    if (write(lm_io_context.wakeup_fd, &one, sizeof(one)) < 0)
+        lm_log_error(TAG, "failed to wake up io thread (%s)", g_strerror(errno));
+    pthread_join(lm_io_context.thread_id, NULL);
+
+    close(lm_io_context.wakeup_fd);
+    close(lm_io_context.epoll_fd);
+    lm_io_context.wakeup_fd = -1;
+    lm_io_context.epoll_fd = -1;
+
+    g_list_free_full(lm_io_context.zombies, g_free);
+    lm_io_context.zombies = NULL;
+    g_cond_clear(&lm_io_context.cond);
+    g_mutex_clear(&lm_io_context.lock);
+    g_mutex_unlock(&lm_io_ref_lock);
+}
+
+lm_io_watch_t *lm_io_add_watch(gint fd, guint32 events, lm_io_callback_t callback, gpointer user_data)
+{
+    g_assert(fd >= 0);
+    g_assert(callback);
+    g_assert(lm_io_context.ref_count > 0);
+
+    lm_io_watch_t *watch = g_new0(lm_io_watch_t, 1);
+    watch->fd = fd;
+    watch->events = events;
+    watch->callback = callback;
+    watch->user_data = user_data;
+
+    struct epoll_event ev = { .events = events, .data.ptr = watch };
+    if (epoll_ctl(lm_io_context.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        lm_log_error(TAG, "failed to add fd %d (%s)", fd, g_strerror(errno));
+        g_free(watch);
+        return NULL;
+    }
+
+    return watch;
+}
+
+lm_status_t lm_io_modify_watch(lm_io_watch_t *watch, guint32 events)
+{
+    g_assert(watch);
+
+    if (watch->events == events)
+        return LM_STATUS_SUCCESS;
+
+    struct epoll_event ev = { .events = events, .data.ptr = watch };
+    if (epoll_ctl(lm_io_context.epoll_fd, EPOLL_CTL_MOD, watch->fd, &ev) < 0) {
+        lm_log_error(TAG, "failed to modify fd %d (%s)", watch->fd, g_strerror(errno));
+        return LM_STATUS_FAIL;
+    }
+    watch->events = events;
+
+    return LM_STATUS_SUCCESS;
+}
+
+void lm_io_remove_watch(lm_io_watch_t *watch)
+{
+    g_assert(watch);
+
+    if (epoll_ctl(lm_io_context.epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL) < 0)
+        lm_log_debug(TAG, "failed to remove fd %d (%s)", watch->fd, g_strerror(errno));
+
+    g_mutex_lock(&lm_io_context.lock);
+    watch->removed = TRUE;
+    if (!lm_io_is_io_thread()) {
+        while (lm_io_context.dispatching == watch)
+            g_cond_wait(&lm_io_context.cond, &lm_io_context.lock);
+    }
+    lm_io_context.zombies = g_list_prepend(lm_io_context.zombies, watch);
+    g_mutex_unlock(&lm_io_context.lock);
+
+    /* Let the io thread finish its batch and release the watch */
+    guint64 one = 1;
+    if (!lm_io_is_io_thread() && write(lm_io_context.wakeup_fd, &one, sizeof(one)) < 0)
+        lm_log_debug(TAG, "failed to wake up io thread (%s)", g_strerror(errno));
+}
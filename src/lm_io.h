@@ -0,0 +1,34 @@
+#ifndef __LM_IO_H__
+#define __LM_IO_H__
+
+#include "lm_type.h"
+#include <glib.h>
+#include <sys/epoll.h>
+
+/*
+ * Single epoll driven I/O thread shared by the socket based modules (GATT
+ * acquired fds, profile connections). Callbacks run on the I/O thread.
+ */
+
+typedef struct lm_io_watch lm_io_watch_t;
+
+/* events is a mask of EPOLLIN/EPOLLOUT/EPOLLRDHUP/EPOLLERR/EPOLLHUP */
+typedef void (*lm_io_callback_t)(gint fd, guint32 events, gpointer user_data);
+
+/* Reference counted, the thread is started by the first user */
+lm_status_t lm_io_ref(void);
+
+/* May be called from a callback, the reference is then dropped once it returned */
+void lm_io_unref(void);
+
+lm_io_watch_t *lm_io_add_watch(gint fd, guint32 events, lm_io_callback_t callback, gpointer user_data);
+
+lm_status_t lm_io_modify_watch(lm_io_watch_t *watch, guint32 events);
+
+/* Once this returns the callback is not running and will not be called again,
+ * unless called from the callback itself. */
+void lm_io_remove_watch(lm_io_watch_t *watch);
+
+gboolean lm_io_is_io_thread(void);
+
+#endif //__LM_IO_H__
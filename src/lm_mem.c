@@ -0,0 +1,153 @@
+#include "lm_mem.h"
+#include "lm_log.h"
+#include <glib.h>
+#include <string.h>
+
+#define TAG "lm_mem"
+
+/* glib internals are opaque, sizes below follow glib 2.5x on 64 bit */
+#define HASH_TABLE_HEADER_SIZE  88
+#define HASH_TABLE_MIN_BUCKETS  8
+#define HASH_TABLE_BUCKET_SIZE  (2 * sizeof(gpointer) + sizeof(guint))
+#define BYTE_ARRAY_HEADER_SIZE  40
+
+typedef struct {
+    guint64 live_bytes;
+    guint64 peak_bytes;
+    guint64 objects;
+    guint64 peak_objects;
+} lm_mem_counter_t;
+
+static lm_mem_counter_t counters[LM_MEM_MODULE_MAX];
+
+static const gchar *module_names[] = {
+    "adapter",
+    "device",
+    "transport",
+    "player",
+    "adv",
+    "agent",
+    "variant"
+};
+
+static void lm_mem_update_peak(guint64 *peak, guint64 value)
+{
+    guint64 current = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (value > current &&
+           !__atomic_compare_exchange_n(peak, &current, value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+static void lm_mem_account(lm_mem_module_t module, gint64 bytes, gint64 objects)
+{
+    g_assert(module < LM_MEM_MODULE_MAX);
+
+    lm_mem_counter_t *counter = &counters[module];
+    if (bytes) {
+        guint64 live = __atomic_add_fetch(&counter->live_bytes, (guint64)bytes, __ATOMIC_RELAXED);
+        if (bytes > 0)
+            lm_mem_update_peak(&counter->peak_bytes, live);
+    }
+    if (objects) {
+        guint64 live = __atomic_add_fetch(&counter->objects, (guint64)objects, __ATOMIC_RELAXED);
+        if (objects > 0)
+            lm_mem_update_peak(&counter->peak_objects, live);
+    }
+}
+
+void lm_mem_charge(lm_mem_module_t module, gsize bytes)
+{
+    lm_mem_account(module, (gint64)bytes, 0);
+}
+
+void lm_mem_uncharge(lm_mem_module_t module, gsize bytes)
+{
+    lm_mem_account(module, -(gint64)bytes, 0);
+}
+
+void lm_mem_object_new(lm_mem_module_t module, gsize bytes)
+{
+    lm_mem_account(module, (gint64)bytes, 1);
+}
+
+void lm_mem_object_free(lm_mem_module_t module, gsize bytes)
+{
+    lm_mem_account(module, -(gint64)bytes, -1);
+}
+
+void lm_mem_recharge(lm_mem_module_t module, gsize old_bytes, gsize new_bytes)
+{
+    lm_mem_account(module, (gint64)new_bytes - (gint64)old_bytes, 0);
+}
+
+void lm_mem_get_usage(lm_mem_module_t module, lm_mem_usage_t *usage)
+{
+    g_assert(module < LM_MEM_MODULE_MAX);
+    g_assert(usage);
+
+    lm_mem_counter_t *counter = &counters[module];
+    usage->name = module_names[module];
+    usage->live_bytes = __atomic_load_n(&counter->live_bytes, __ATOMIC_RELAXED);
+    usage->peak_bytes = __atomic_load_n(&counter->peak_bytes, __ATOMIC_RELAXED);
+    usage->objects = __atomic_load_n(&counter->objects, __ATOMIC_RELAXED);
+    usage->peak_objects = __atomic_load_n(&counter->peak_objects, __ATOMIC_RELAXED);
+}
+
+guint64 lm_mem_get_live_bytes(void)
+{
+    guint64 total = 0;
+
+    for (guint i = 0; i < LM_MEM_MODULE_MAX; i++)
+        total += __atomic_load_n(&counters[i].live_bytes, __ATOMIC_RELAXED);
+    return total;
+}
+
+void lm_mem_reset_peak(void)
+{
+    for (guint i = 0; i < LM_MEM_MODULE_MAX; i++) {
+        __atomic_store_n(&counters[i].peak_bytes,
+                         __atomic_load_n(&counters[i].live_bytes, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        __atomic_store_n(&counters[i].peak_objects,
+                         __atomic_load_n(&counters[i].objects, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    }
+}
+
+void lm_mem_dump(void)
+{
+    lm_mem_usage_t usage;
+
+    for (guint i = 0; i < LM_MEM_MODULE_MAX; i++) {
+        lm_mem_get_usage(i, &usage);
+        lm_log_info(TAG, "%-9s live %" G_GUINT64_FORMAT " peak %" G_GUINT64_FORMAT
+                    " objects %" G_GUINT64_FORMAT " peak %" G_GUINT64_FORMAT,
+                    usage.name, usage.live_bytes, usage.peak_bytes, usage.objects, usage.peak_objects);
+    }
+    lm_log_info(TAG, "total     live %" G_GUINT64_FORMAT, lm_mem_get_live_bytes());
+}
+
+gsize lm_mem_string_size(const gchar *string)
+{
+    return string ? strlen(string) + 1 : 0;
+}
+
+gsize lm_mem_list_size(GList *list)
+{
+    return g_list_length(list) * sizeof(GList);
+}
+
+/* glib keeps the bucket count near the power of two closest to twice the entries */
+gsize lm_mem_hash_table_size(GHashTable *table)
+{
+    if (!table)
+        return 0;
+
+    gsize buckets = HASH_TABLE_MIN_BUCKETS;
+    while (buckets < 2 * (gsize)g_hash_table_size(table))
+        buckets <<= 1;
+    return HASH_TABLE_HEADER_SIZE + buckets * HASH_TABLE_BUCKET_SIZE;
+}
+
+gsize lm_mem_byte_array_size(GByteArray *array)
+{
+    return array ? BYTE_ARRAY_HEADER_SIZE + array->len : 0;
+}
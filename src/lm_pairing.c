@@ -0,0 +1,418 @@
+#include "bluez_dbus.h"
+#include "lm_pairing.h"
+#include "lm_agent.h"
+#include "lm_agent_priv.h"
+#include "lm_adapter.h"
+#include "lm_adapter_priv.h"
+#include "lm_device.h"
+#include "lm_device_priv.h"
+#include "lm_dbus_priv.h"
+#include "lm_log.h"
+#include "lm.h"
+#include <glib.h>
+#include <gio/gio.h>
+#include <string.h>
+
+#define TAG "lm_pairing"
+
+/* Pair covers user interaction on the remote side, give it more than a plain call */
+#define LM_PAIRING_PAIR_TIMEOUT_MS      60000
+
+static const gchar *pairing_stage_str[LM_PAIRING_STAGE_COUNT] = {
+    "pair",
+    "trust",
+    "connect"
+};
+
+typedef struct {
+    lm_pairing_t *pairing; // Borrowed, the batch owns the jobs
+    gchar *path; // Owned, the device is looked up at each stage
+    lm_pairing_stage_t stage;
+    gint64 stage_start;
+    guint64 stage_us[LM_PAIRING_STAGE_COUNT];
+} lm_pairing_job_t;
+
+typedef struct {
+    gchar *address; // Owned, NULL matches every device
+    guint32 passkey;
+    gboolean reject;
+} lm_pairing_rule_t;
+
+struct lm_pairing {
+    gint ref;
+    lm_adapter_t *adapter; // Borrowed
+    GDBusConnection *dbus_conn; // Borrowed
+    lm_agent_t *agent; // Owned
+    GArray *rules; // Owned, lm_pairing_rule_t
+    GPtrArray *jobs; // Owned
+    GCancellable *cancellable; // Owned
+    guint max_parallel;
+    gboolean connect;
+    GMutex mutex; // guards the counters below
+    guint next_job;
+    guint running;
+    guint succeeded;
+    guint failed;
+    gboolean completed;
+    gboolean destroyed;
+    gint64 start;
+};
+
+static lm_status_t lm_pairing_advance(lm_pairing_job_t *job);
+static void lm_pairing_fill(lm_pairing_t *pairing);
+
+static lm_pairing_t *lm_pairing_ref(lm_pairing_t *pairing)
+{
+    g_atomic_int_inc(&pairing->ref);
+    return pairing;
+}
+
+static void lm_pairing_job_free(gpointer data)
+{
+    lm_pairing_job_t *job = (lm_pairing_job_t *) data;
+
+    g_free(job->path);
+    g_free(job);
+}
+
+static void lm_pairing_rule_clear(gpointer data)
+{
+    lm_pairing_rule_t *rule = (lm_pairing_rule_t *) data;
+    g_free(rule->address);
+}
+
+static void lm_pairing_unref(lm_pairing_t *pairing)
+{
+    if (!g_atomic_int_dec_and_test(&pairing->ref))
+        return;
+
+    if (pairing->agent)
+        lm_agent_destroy(pairing->agent);
+    g_ptr_array_free(pairing->jobs, TRUE);
+    g_array_free(pairing->rules, TRUE);
+    g_object_unref(pairing->cancellable);
+    g_mutex_clear(&pairing->mutex);
+    g_free(pairing);
+}
+
+static lm_agent_policy_result_t lm_pairing_policy(lm_device_t *device, const gchar *method, guint32 *passkey,
+                                                  gpointer user_data)
+{
+    lm_pairing_t *pairing = (lm_pairing_t *) user_data;
+    const gchar *address = device ? lm_device_get_address(device) : NULL;
+
+    for (guint i = 0; i < pairing->rules->len; i++) {
+        lm_pairing_rule_t *rule = &g_array_index(pairing->rules, lm_pairing_rule_t, i);
+        if (rule->address && (!address || g_ascii_strcasecmp(rule->address, address) != 0))
+            continue;
+
+        lm_log_debug(TAG, "%s for '%s' %s by policy", method, address ? address : "unknown",
+                     rule->reject ? "rejected" : "accepted");
+        if (rule->reject)
+            return LM_AGENT_POLICY_REJECT;
+        *passkey = rule->passkey;
+        return LM_AGENT_POLICY_ACCEPT;
+    }
+
+    return LM_AGENT_POLICY_DEFER;
+}
+
+static lm_status_t lm_pairing_error_status(const GError *error)
+{
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        return LM_STATUS_CANCELLED;
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) ||
+        g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_NO_REPLY) ||
+        g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_TIMED_OUT))
+        return LM_STATUS_TIMEOUT;
+    return LM_STATUS_FAIL;
+}
+
+static void lm_pairing_check_complete(lm_pairing_t *pairing)
+{
+    lm_agent_t *agent = NULL;
+
+    g_mutex_lock(&pairing->mutex);
+    gboolean complete = !pairing->completed && pairing->running == 0 &&
+                        pairing->next_job >= pairing->jobs->len;
+    if (complete) {
+        pairing->completed = TRUE;
+        agent = pairing->agent;
+        pairing->agent = NULL;
+    }
+    gboolean notify = complete && !pairing->destroyed;
+    lm_pairing_complete_ind_t ind = {
+        .pairing = pairing,
+        .succeeded = pairing->succeeded,
+        .failed = pairing->failed,
+        .elapsed_us = (guint64)(g_get_monotonic_time() - pairing->start)
+    };
+    g_mutex_unlock(&pairing->mutex);
+
+    if (!complete)
+        return;
+
+    /* stop being the default agent, bluez falls back to the previous one */
+    if (agent)
+        lm_agent_destroy(agent);
+
+    if (ind.elapsed_us)
+        ind.devices_per_minute = (gdouble) ind.succeeded * 60e6 / (gdouble) ind.elapsed_us;
+
+    lm_log_info(TAG, "batch done, %u paired, %u failed in %" G_GUINT64_FORMAT " ms (%.1f devices/min)",
+                ind.succeeded, ind.failed, ind.elapsed_us / 1000, ind.devices_per_minute);
+    if (notify)
+        lm_app_event_callback(LM_PAIRING_COMPLETE_IND, LM_STATUS_SUCCESS, &ind);
+}
+
+/* bluez may remove the device between stages, e.g. a temporary one after a failed Pair */
+static lm_device_t *lm_pairing_job_lookup_device(lm_pairing_job_t *job)
+{
+    return g_hash_table_lookup(lm_adapter_get_device_cache(job->pairing->adapter), job->path);
+}
+
+static void lm_pairing_job_done(lm_pairing_job_t *job, lm_status_t status, gboolean started)
+{
+    lm_pairing_t *pairing = job->pairing;
+
+    g_mutex_lock(&pairing->mutex);
+    if (started)
+        pairing->running--;
+    if (status == LM_STATUS_SUCCESS)
+        pairing->succeeded++;
+    else
+        pairing->failed++;
+    gboolean notify = !pairing->destroyed;
+    g_mutex_unlock(&pairing->mutex);
+
+    if (status == LM_STATUS_SUCCESS)
+        lm_log_info(TAG, "'%s' done", job->path);
+    else
+        lm_log_warn(TAG, "'%s' failed at %s, status 0x%x", job->path, pairing_stage_str[job->stage], status);
+
+    if (notify) {
+        lm_pairing_device_done_ind_t ind = {
+            .pairing = pairing,
+            .path = job->path,
+            .device = lm_pairing_job_lookup_device(job),
+            .failed_stage = job->stage
+        };
+        memcpy(ind.stage_us, job->stage_us, sizeof(ind.stage_us));
+        lm_app_event_callback(LM_PAIRING_DEVICE_DONE_IND, status, &ind);
+    }
+}
+
+static void lm_pairing_stage_cb(__attribute__((unused)) GObject *source_object,
+                                GAsyncResult *res,
+                                gpointer user_data)
+{
+    lm_pairing_job_t *job = (lm_pairing_job_t *) user_data;
+    lm_pairing_t *pairing = job->pairing;
+
+    GError *error = NULL;
+    GVariant *value = lm_dbus_call_finish(res, &error);
+    if (value != NULL) {
+        g_variant_unref(value);
+    }
+
+    job->stage_us[job->stage] = (guint64)(g_get_monotonic_time() - job->stage_start);
+
+    if (error != NULL) {
+        lm_status_t status = lm_pairing_error_status(error);
+        if (status != LM_STATUS_CANCELLED)
+            lm_log_error(TAG, "%s '%s' failed (error %d: %s)", pairing_stage_str[job->stage], job->path,
+                         error->code, error->message);
+        g_clear_error(&error);
+        lm_pairing_job_done(job, status, TRUE);
+        lm_pairing_fill(pairing);
+    } else {
+        job->stage++;
+        lm_status_t status = lm_pairing_advance(job);
+        if (status != LM_STATUS_PENDING) {
+            lm_pairing_job_done(job, status, TRUE);
+            lm_pairing_fill(pairing);
+        }
+    }
+
+    lm_pairing_unref(pairing);
+}
+
+static gboolean lm_pairing_stage_needed(lm_pairing_job_t *job, lm_device_t *device)
+{
+    switch (job->stage) {
+        case LM_PAIRING_STAGE_PAIR:
+            return !lm_device_get_paired(device);
+        case LM_PAIRING_STAGE_TRUST:
+            return !lm_device_get_trusted(device);
+        case LM_PAIRING_STAGE_CONNECT:
+            return job->pairing->connect &&
+                   lm_device_get_connection_state(device) != LM_DEVICE_CONNECTED;
+        default:
+            return FALSE;
+    }
+}
+
+/*
+ * Issue the next stage that is not already satisfied. Returns LM_STATUS_PENDING
+ * while a stage runs, LM_STATUS_SUCCESS when none is left and LM_STATUS_FAIL
+ * when the device is gone.
+ */
+static lm_status_t lm_pairing_advance(lm_pairing_job_t *job)
+{
+    lm_pairing_t *pairing = job->pairing;
+
+    if (job->stage == LM_PAIRING_STAGE_COUNT)
+        return LM_STATUS_SUCCESS;
+
+    lm_device_t *device = lm_pairing_job_lookup_device(job);
+    if (!device) {
+        lm_log_error(TAG, "'%s' is gone before %s", job->path, pairing_stage_str[job->stage]);
+        return LM_STATUS_FAIL;
+    }
+
+    while (job->stage < LM_PAIRING_STAGE_COUNT && !lm_pairing_stage_needed(job, device))
+        job->stage++;
+
+    if (job->stage == LM_PAIRING_STAGE_COUNT)
+        return LM_STATUS_SUCCESS;
+
+    const gchar *interface_name = INTERFACE_DEVICE;
+    const gchar *method_name = NULL;
+    GVariant *parameters = NULL;
+    gint timeout = BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT;
+
+    switch (job->stage) {
+        case LM_PAIRING_STAGE_PAIR:
+            method_name = DEVICE_METHOD_PAIR;
+            timeout = LM_PAIRING_PAIR_TIMEOUT_MS;
+            break;
+        case LM_PAIRING_STAGE_TRUST:
+            interface_name = INTERFACE_PROPERTIES;
+            method_name = PROPERTIES_METHOD_SET;
+            parameters = g_variant_new("(ssv)", INTERFACE_DEVICE, DEVICE_PROPERTY_TRUSTED,
+                                       g_variant_new_boolean(TRUE));
+            break;
+        case LM_PAIRING_STAGE_CONNECT:
+        default:
+            method_name = DEVICE_METHOD_CONNECT;
+            break;
+    }
+
+    lm_log_debug(TAG, "%s '%s'", pairing_stage_str[job->stage], job->path);
+    job->stage_start = g_get_monotonic_time();
+
+    lm_pairing_ref(pairing);
+    lm_adapter_push_context(pairing->adapter);
+    lm_dbus_call(pairing->dbus_conn,
+                 BLUEZ_DBUS,
+                 job->path,
+                 interface_name,
+                 method_name,
+                 parameters,
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 timeout,
+                 pairing->cancellable,
+                 (GAsyncReadyCallback) lm_pairing_stage_cb,
+                 job);
+    lm_adapter_pop_context(pairing->adapter);
+    return LM_STATUS_PENDING;
+}
+
+/*
+ * Start jobs up to the concurrency budget, after a cancel drain the rest.
+ * Jobs with nothing left to do finish here, so a batch of paired devices
+ * loops instead of recursing.
+ */
+static void lm_pairing_fill(lm_pairing_t *pairing)
+{
+    for (;;) {
+        g_mutex_lock(&pairing->mutex);
+        gboolean cancelled = g_cancellable_is_cancelled(pairing->cancellable);
+        if (pairing->next_job >= pairing->jobs->len ||
+            (!cancelled && pairing->running >= pairing->max_parallel)) {
+            g_mutex_unlock(&pairing->mutex);
+            break;
+        }
+        lm_pairing_job_t *job = g_ptr_array_index(pairing->jobs, pairing->next_job++);
+        if (!cancelled)
+            pairing->running++;
+        g_mutex_unlock(&pairing->mutex);
+
+        if (cancelled) {
+            lm_pairing_job_done(job, LM_STATUS_CANCELLED, FALSE);
+        } else {
+            job->stage = LM_PAIRING_STAGE_PAIR;
+            lm_status_t status = lm_pairing_advance(job);
+            if (status != LM_STATUS_PENDING)
+                lm_pairing_job_done(job, status, TRUE);
+        }
+    }
+
+    lm_pairing_check_complete(pairing);
+}
+
+lm_pairing_t *lm_pairing_start(lm_adapter_t *adapter, const GPtrArray *devices, const lm_pairing_config_t *config)
+{
+    g_assert(adapter);
+    g_assert(devices);
+    g_assert(config);
+    g_assert(config->policies || config->n_policies == 0);
+
+    lm_pairing_t *pairing = g_new0(lm_pairing_t, 1);
+    pairing->ref = 1;
+    pairing->adapter = adapter;
+    pairing->dbus_conn = lm_adapter_get_dbus_conn(adapter);
+    pairing->max_parallel = config->max_parallel ? config->max_parallel : LM_PAIRING_DEFAULT_MAX_PARALLEL;
+    pairing->connect = config->connect;
+    pairing->cancellable = g_cancellable_new();
+    g_mutex_init(&pairing->mutex);
+
+    pairing->rules = g_array_sized_new(FALSE, TRUE, sizeof(lm_pairing_rule_t), config->n_policies);
+    g_array_set_clear_func(pairing->rules, lm_pairing_rule_clear);
+    for (guint i = 0; i < config->n_policies; i++) {
+        lm_pairing_rule_t rule = {
+            .address = g_strdup(config->policies[i].address),
+            .passkey = config->policies[i].passkey,
+            .reject = config->policies[i].reject
+        };
+        g_array_append_val(pairing->rules, rule);
+    }
+
+    pairing->jobs = g_ptr_array_new_with_free_func(lm_pairing_job_free);
+    for (guint i = 0; i < devices->len; i++) {
+        lm_device_t *device = g_ptr_array_index(devices, i);
+        lm_pairing_job_t *job = g_new0(lm_pairing_job_t, 1);
+        job->pairing = pairing;
+        job->path = g_strdup(lm_device_get_path(device));
+        g_ptr_array_add(pairing->jobs, job);
+    }
+
+    pairing->agent = lm_agent_create_with_policy(adapter, config->io_capability, lm_pairing_policy, pairing);
+
+    lm_log_info(TAG, "pairing %u devices, %u at a time", pairing->jobs->len, pairing->max_parallel);
+    pairing->start = g_get_monotonic_time();
+    lm_pairing_fill(pairing);
+
+    return pairing;
+}
+
+void lm_pairing_cancel(lm_pairing_t *pairing)
+{
+    g_assert(pairing);
+
+    g_cancellable_cancel(pairing->cancellable);
+    lm_pairing_fill(pairing);
+}
+
+void lm_pairing_destroy(lm_pairing_t *pairing)
+{
+    g_assert(pairing);
+
+    g_mutex_lock(&pairing->mutex);
+    pairing->destroyed = TRUE;
+    g_mutex_unlock(&pairing->mutex);
+
+    lm_pairing_cancel(pairing);
+    lm_pairing_unref(pairing);
+}
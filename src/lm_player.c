@@ -4,10 +4,32 @@
 #include "lm_device.h"
 #include "lm_device_priv.h"
 #include "lm_log.h"
+#include "lm_dbus_priv.h"
+#include "lm_stats.h"
+#include "lm_mem.h"
 #include "lm_utils.h"
+#include <string.h>
 
 #define TAG "lm_player"
 
+/* Most titles, artists and image handles fit, longer ones go to the heap */
+#define LM_PLAYER_INLINE_STR_LEN    48
+
+typedef struct {
+    gchar *heap; // Owned, NULL while the value fits inline
+    gchar inline_buf[LM_PLAYER_INLINE_STR_LEN];
+} lm_player_str_t;
+
+/* Backing storage of the public track, its string fields point in here */
+typedef struct {
+    lm_player_track_t track;
+    lm_player_str_t title;
+    lm_player_str_t artist;
+    lm_player_str_t album;
+    lm_player_str_t genre;
+    lm_player_str_t image_handle;
+} lm_player_track_storage_t;
+
 struct lm_player {
     GDBusConnection *dbus_conn; // Borrowed
     lm_device_t *device; // Borrowed
@@ -15,10 +37,16 @@ struct lm_player {
     gchar *path; // Owned
     gchar *name; // Owned
     gchar *type; // Owned
-    gchar *status; // Owned
-    guint32 position; // Owned
-    lm_player_track_t *track;	/* Player current track */
+    /* written by the dbus thread, read from any thread, guarded by position_lock */
+    GMutex position_lock;
+    lm_player_status_t status;
+    guint32 position; // ms as last reported or folded in at a status change
+    gint64 position_time; // g_get_monotonic_time() when position was taken
+    guint32 reported_position; // last Position from bluez
+    guint32 duration; // track duration, the extrapolation stops there
+    lm_player_track_storage_t *track;	/* Player current track */
     lm_player_profile_t profile; // Owned
+    gsize mem_size; // charged to LM_MEM_PLAYER
 };
 
 static const gchar *player_status_str[] = {
@@ -53,49 +81,94 @@ static lm_player_profile_t lm_player_path_to_profile(const gchar *path)
     return LM_PLAYER_PROFILE_NULL;
 }
 
-static lm_player_track_t *lm_player_track_create(void)
+static lm_player_track_storage_t *lm_player_track_create(void)
 {
-    lm_player_track_t *track = g_new0(lm_player_track_t, 1);
-    track->title = NULL;
-    track->artist = NULL;
-    track->album = NULL;
-    track->gerneral_name = NULL;
-    track->number_of_tracks = 0;
-    track->track_number = 0;
-    track->duration = 0;
-    track->image_handle = NULL;
-
-    return track;
+    return g_new0(lm_player_track_storage_t, 1);
 }
 
-static void lm_player_track_destroy(lm_player_track_t *track)
+static void lm_player_track_destroy(lm_player_track_storage_t *track)
 {
     g_assert(track);
 
-    if (track->title)
-        g_free((gpointer)track->title);
-    if (track->artist)
-        g_free((gpointer)track->artist);
-    if (track->album)
-        g_free((gpointer)track->album);
-    if (track->gerneral_name)
-        g_free((gpointer)track->gerneral_name);
-    if (track->image_handle)
-        g_free((gpointer)track->image_handle);
+    g_free(track->title.heap);
+    g_free(track->artist.heap);
+    g_free(track->album.heap);
+    g_free(track->genre.heap);
+    g_free(track->image_handle.heap);
 
     g_free(track);
 }
 
+/* Store value behind *field, returns FALSE without touching anything when it is unchanged */
+static gboolean lm_player_str_set(lm_player_str_t *str, gchar **field, const gchar *value)
+{
+    if (*field && g_str_equal(*field, value))
+        return FALSE;
+
+    gsize len = strlen(value);
+    if (len < sizeof(str->inline_buf)) {
+        memcpy(str->inline_buf, value, len + 1);
+        g_free(str->heap);
+        str->heap = NULL;
+        *field = str->inline_buf;
+    } else {
+        g_free(str->heap);
+        str->heap = g_strndup(value, len);
+        *field = str->heap;
+    }
+    return TRUE;
+}
+
+static gboolean lm_player_uint_set(guint32 *field, guint32 value)
+{
+    if (*field == value)
+        return FALSE;
+    *field = value;
+    return TRUE;
+}
+
+/* Position in ms at now, advancing in real time while the player is playing */
+static guint32 lm_player_extrapolate_position_locked(lm_player_t *player, gint64 now)
+{
+    if (player->status != LM_PLAYER_PLAYING)
+        return player->position;
+
+    guint64 position = player->position + (guint64)MAX(now - player->position_time, 0) / 1000;
+    if (player->duration && position > player->duration)
+        position = player->duration;
+
+    return (guint32)MIN(position, G_MAXUINT32);
+}
+
+static gsize lm_player_mem_size(lm_player_t *player)
+{
+    gsize size = sizeof(lm_player_t) + sizeof(lm_player_track_storage_t);
+
+    size += lm_mem_string_size(player->path);
+    size += lm_mem_string_size(player->name);
+    size += lm_mem_string_size(player->type);
+    size += lm_mem_string_size(player->track->title.heap);
+    size += lm_mem_string_size(player->track->artist.heap);
+    size += lm_mem_string_size(player->track->album.heap);
+    size += lm_mem_string_size(player->track->genre.heap);
+    size += lm_mem_string_size(player->track->image_handle.heap);
+    return size;
+}
+
 lm_player_t *lm_player_create(lm_device_t *device, const gchar *path)
 {
     lm_player_t *player = g_new0(lm_player_t, 1);
     player->dbus_conn = lm_device_get_dbus_conn(device);
     player->device = device;
     player->path = g_strdup(path);
-    player->status = g_strdup("stopped");
+    g_mutex_init(&player->position_lock);
+    player->status = LM_PLAYER_STOPPED;
     player->position = 0;
+    player->position_time = g_get_monotonic_time();
     player->profile = lm_player_path_to_profile(path);
     player->track = lm_player_track_create();
+    player->mem_size = lm_player_mem_size(player);
+    lm_mem_object_new(LM_MEM_PLAYER, player->mem_size);
 
     lm_log_debug(TAG, "create player '%s' success", path);
     return player;
@@ -113,11 +186,11 @@ void lm_player_destroy(lm_player_t *player)
         g_free((gpointer)player->name);
     if (player->type)
         g_free((gpointer)player->type);
-    if (player->status)
-        g_free((gpointer)player->status);
     if (player->track)
         lm_player_track_destroy(player->track);
+    g_mutex_clear(&player->position_lock);
 
+    lm_mem_object_free(LM_MEM_PLAYER, player->mem_size);
     g_free(player);
 }
 
@@ -125,6 +198,7 @@ void lm_player_update_property(lm_player_t *player,
         const char *property_name, GVariant *property_value)
 {
     lm_log_debug(TAG, "%s property_name:%s",  __func__, property_name);
+    lm_stats_count(LM_STATS_PROPERTY, property_name);
     if (g_str_equal(property_name, MEDIA_PLAYER_PROPERTY_DEVICE)) {
         if (player->device_path)
             g_free((gpointer)player->device_path);
@@ -142,10 +216,15 @@ void lm_player_update_property(lm_player_t *player,
         player->type = g_strdup(g_variant_get_string(property_value, NULL));
         lm_log_info(TAG, "type '%s'", player->type);
     } else if (g_str_equal(property_name, MEDIA_PLAYER_PROPERTY_STATUS)) {
-        if (player->status)
-            g_free((gpointer)player->status);
-        player->status = g_strdup(g_variant_get_string(property_value, NULL));
-        lm_log_info(TAG, "status '%s'", player->status);
+        /* keep the distance covered so far, extrapolation restarts from here */
+        const gchar *status = g_variant_get_string(property_value, NULL);
+        gint64 now = g_get_monotonic_time();
+        g_mutex_lock(&player->position_lock);
+        player->position = lm_player_extrapolate_position_locked(player, now);
+        player->position_time = now;
+        player->status = lm_player_string_to_status(status);
+        g_mutex_unlock(&player->position_lock);
+        lm_log_info(TAG, "status '%s'", status);
         if (lm_device_get_active_player(player->device) == player) {
             lm_player_status_change_ind_t ind = {
                 .player = player
@@ -153,71 +232,115 @@ void lm_player_update_property(lm_player_t *player,
             lm_app_event_callback(LM_PLAYER_STATUS_CHANGE_IND, LM_STATUS_SUCCESS, &ind);
         }
     } else if (g_str_equal(property_name, MEDIA_PLAYER_PROPERTY_POSITION)) {
-        player->position = g_variant_get_uint32(property_value);
-        lm_log_debug(TAG, "position %d", player->position);
+        guint32 position = g_variant_get_uint32(property_value);
+        g_mutex_lock(&player->position_lock);
+        player->position = position;
+        player->position_time = g_get_monotonic_time();
+        player->reported_position = position;
+        g_mutex_unlock(&player->position_lock);
+        lm_log_debug(TAG, "position %d", position);
     } else if (g_str_equal(property_name, MEDIA_PLAYER_PROPERTY_TRACK)) {
+        /* phones resend the whole dict with every tick, only changed fields count */
+        lm_player_track_storage_t *storage = player->track;
+        lm_player_track_t *track = &storage->track;
+        guint32 changed_mask = 0;
         GVariantIter track_iter;
         g_variant_iter_init(&track_iter, property_value);
         char *track_key = NULL;
         GVariant *track_value = NULL;
         while (g_variant_iter_loop(&track_iter, "{sv}", &track_key, &track_value)) {
             if (g_str_equal(track_key, "Title")) {
-                if (player->track->title)
-                    g_free((gpointer)player->track->title);
-                player->track->title = g_strdup(g_variant_get_string(track_value, NULL));
-                lm_log_info(TAG, "title name '%s'", player->track->title);
+                if (lm_player_str_set(&storage->title, &track->title, g_variant_get_string(track_value, NULL))) {
+                    changed_mask |= LM_PLAYER_TRACK_TITLE;
+                    lm_log_info(TAG, "title name '%s'", track->title);
+                }
             } else if (g_str_equal(track_key, "Artist")) {
-                if (player->track->artist)
-                    g_free((gpointer)player->track->artist);
-                player->track->artist = g_strdup(g_variant_get_string(track_value, NULL));
-                lm_log_debug(TAG, "artist name '%s'", player->track->artist);
+                if (lm_player_str_set(&storage->artist, &track->artist, g_variant_get_string(track_value, NULL))) {
+                    changed_mask |= LM_PLAYER_TRACK_ARTIST;
+                    lm_log_debug(TAG, "artist name '%s'", track->artist);
+                }
             } else if (g_str_equal(track_key, "Album")) {
-                if (player->track->album)
-                    g_free((gpointer)player->track->album);
-                player->track->album = g_strdup(g_variant_get_string(track_value, NULL));
-                lm_log_debug(TAG, "album name '%s'", player->track->album);
+                if (lm_player_str_set(&storage->album, &track->album, g_variant_get_string(track_value, NULL))) {
+                    changed_mask |= LM_PLAYER_TRACK_ALBUM;
+                    lm_log_debug(TAG, "album name '%s'", track->album);
+                }
             } else if (g_str_equal(track_key, "Genre")) {
-                if (player->track->gerneral_name)
-                    g_free((gpointer)player->track->gerneral_name);
-                player->track->gerneral_name = g_strdup(g_variant_get_string(track_value, NULL));
-                lm_log_debug(TAG, "gerneral name '%s'", player->track->gerneral_name);
+                if (lm_player_str_set(&storage->genre, &track->gerneral_name,
+                                      g_variant_get_string(track_value, NULL))) {
+                    changed_mask |= LM_PLAYER_TRACK_GENRE;
+                    lm_log_debug(TAG, "gerneral name '%s'", track->gerneral_name);
+                }
             } else if (g_str_equal(track_key, "NumberOfTracks")) {
-                player->track->number_of_tracks = g_variant_get_uint32(track_value);
-                lm_log_debug(TAG, "number of tracks 0x%x", player->track->number_of_tracks);
+                if (lm_player_uint_set(&track->number_of_tracks, g_variant_get_uint32(track_value))) {
+                    changed_mask |= LM_PLAYER_TRACK_NUMBER_OF_TRACKS;
+                    lm_log_debug(TAG, "number of tracks 0x%x", track->number_of_tracks);
+                }
             } else if (g_str_equal(track_key, "TrackNumber")) {
-                player->track->track_number = g_variant_get_uint32(track_value);
-                lm_log_debug(TAG, "track number 0x%x", player->track->track_number);
+                if (lm_player_uint_set(&track->track_number, g_variant_get_uint32(track_value))) {
+                    changed_mask |= LM_PLAYER_TRACK_TRACK_NUMBER;
+                    lm_log_debug(TAG, "track number 0x%x", track->track_number);
+                }
             } else if (g_str_equal(track_key, "Duration")) {
-                player->track->duration = g_variant_get_uint32(track_value);
-                lm_log_debug(TAG, "duration 0x%x", player->track->duration);
+                if (lm_player_uint_set(&track->duration, g_variant_get_uint32(track_value))) {
+                    g_mutex_lock(&player->position_lock);
+                    player->duration = track->duration;
+                    g_mutex_unlock(&player->position_lock);
+                    changed_mask |= LM_PLAYER_TRACK_DURATION;
+                    lm_log_debug(TAG, "duration 0x%x", track->duration);
+                }
             } else if (g_str_equal(track_key, "ImgHandle")) {
-                if (player->track->image_handle)
-                    g_free((gpointer)player->track->image_handle);
-                player->track->image_handle = g_strdup(g_variant_get_string(track_value, NULL));
-                lm_log_debug(TAG, "image handle '%s'", player->track->image_handle);
+                if (lm_player_str_set(&storage->image_handle, &track->image_handle,
+                                      g_variant_get_string(track_value, NULL))) {
+                    changed_mask |= LM_PLAYER_TRACK_IMAGE_HANDLE;
+                    lm_log_debug(TAG, "image handle '%s'", track->image_handle);
+                }
             }
         }
-        if (lm_device_get_active_player(player->device) == player) {
+        if (changed_mask && lm_device_get_active_player(player->device) == player) {
             lm_player_track_update_ind_t ind = {
-                .player = player
+                .player = player,
+                .changed_mask = changed_mask
             };
             lm_app_event_callback(LM_PLAYER_TRACK_UPDATE_IND, LM_STATUS_SUCCESS, &ind);
         }
     }
+
+    gsize size = lm_player_mem_size(player);
+    lm_mem_recharge(LM_MEM_PLAYER, player->mem_size, size);
+    player->mem_size = size;
 }
 
 lm_player_status_t lm_player_get_status(lm_player_t *player)
 {
     g_assert(player);
 
-    return lm_player_string_to_status(player->status);
+    g_mutex_lock(&player->position_lock);
+    lm_player_status_t status = player->status;
+    g_mutex_unlock(&player->position_lock);
+
+    return status;
 }
 
 guint32 lm_player_get_position(lm_player_t *player)
 {
     g_assert(player);
 
-    return player->position;
+    g_mutex_lock(&player->position_lock);
+    guint32 position = lm_player_extrapolate_position_locked(player, g_get_monotonic_time());
+    g_mutex_unlock(&player->position_lock);
+
+    return position;
+}
+
+guint32 lm_player_get_reported_position(lm_player_t *player)
+{
+    g_assert(player);
+
+    g_mutex_lock(&player->position_lock);
+    guint32 position = player->reported_position;
+    g_mutex_unlock(&player->position_lock);
+
+    return position;
 }
 
 gchar *lm_player_get_name(lm_player_t *player)
@@ -245,7 +368,7 @@ lm_player_track_t *lm_player_get_track(lm_player_t *player)
 {
     g_assert(player);
 
-    return player->track;
+    return &player->track->track;
 }
 
 static void lm_player_call_method_cb(__attribute__((unused)) GObject *source_object,
@@ -256,7 +379,7 @@ static void lm_player_call_method_cb(__attribute__((unused)) GObject *source_obj
     g_assert(player != NULL);
 
     GError *error = NULL;
-    GVariant *value = g_dbus_connection_call_finish(player->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
     if (value != NULL) {
         g_variant_unref(value);
     }
@@ -272,18 +395,18 @@ static void lm_player_call_method(lm_player_t *player, const gchar *method, GVar
     g_assert(player != NULL);
     g_assert(method != NULL);
 
-    g_dbus_connection_call(player->dbus_conn,
-                           BLUEZ_DBUS,
-                           player->path,
-                           INTERFACE_MEDIA_PLAYER,
-                           method,
-                           parameters,
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                           NULL,
-                           (GAsyncReadyCallback) lm_player_call_method_cb,
-                           player);
+    lm_dbus_call(player->dbus_conn,
+                 BLUEZ_DBUS,
+                 player->path,
+                 INTERFACE_MEDIA_PLAYER,
+                 method,
+                 parameters,
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 NULL,
+                 (GAsyncReadyCallback) lm_player_call_method_cb,
+                 player);
 }
 
 lm_status_t lm_player_play(lm_player_t *player)
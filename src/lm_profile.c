@@ -0,0 +1,445 @@
+#include "lm_profile.h"
+#include "lm.h"
+#include "lm_io.h"
+#include "lm_log.h"
+#include "lm_dbus_priv.h"
+#include "lm_adapter.h"
+#include "lm_device.h"
+#include "bluez_dbus.h"
+#include "bluez_iface.h"
+#include <glib.h>
+#include <gio/gio.h>
+#include <gio/gunixfdlist.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define TAG "lm_profile"
+
+#define PROFILE_RX_BUFFER_SIZE      4096
+#define PROFILE_TX_BUFFER_SIZE      16384
+/* Reads per wakeup before yielding to other connections */
+#define PROFILE_RX_BUDGET           16
+
+struct lm_profile {
+    GDBusConnection *dbus_conn;     // Borrowed
+    lm_adapter_t *adapter;          // Borrowed
+    gchar *path;                    // Owned
+    gchar *uuid;                    // Owned
+    lm_profile_callbacks_t callbacks;
+    gpointer user_data;
+    gsize rx_buffer_size;
+    gsize tx_buffer_size;
+    guint registration_id;
+    GMutex lock;                    /* protects connections */
+    GList *connections;             /* the list owns the lm_profile_conn_t */
+};
+
+struct lm_profile_conn {
+    lm_profile_t *profile;          // Borrowed
+    lm_device_t *device;            // Borrowed
+    gchar *device_path;             // Owned
+    gint fd;
+    lm_io_watch_t *watch;
+    GMutex lock;                    /* protects tx */
+    guint8 *rx;                     /* rx_buffer_size */
+    guint8 *tx;                     /* tx_buffer_size */
+    gsize tx_head;
+    gsize tx_len;
+};
+
+static const gchar *profile_role_str[] = {
+    NULL,
+    "client",
+    "server"
+};
+
+static guint profile_instance_id = 0;
+
+/* Caller must have removed conn from profile->connections */
+static void lm_profile_conn_teardown(lm_profile_conn_t *conn)
+{
+    lm_profile_t *profile = conn->profile;
+
+    lm_log_info(TAG, "connection from '%s' closed", conn->device_path);
+
+    if (conn->watch)
+        lm_io_remove_watch(conn->watch);
+    close(conn->fd);
+
+    if (profile->callbacks.disconnected)
+        profile->callbacks.disconnected(profile, conn, profile->user_data);
+
+    g_mutex_clear(&conn->lock);
+    g_free(conn->rx);
+    g_free(conn->tx);
+    g_free(conn->device_path);
+    g_free(conn);
+}
+
+/* TRUE when the caller now owns conn */
+static gboolean lm_profile_take_connection(lm_profile_t *profile, lm_profile_conn_t *conn)
+{
+    gboolean found = FALSE;
+
+    g_mutex_lock(&profile->lock);
+    GList *link = g_list_find(profile->connections, conn);
+    if (link) {
+        profile->connections = g_list_delete_link(profile->connections, link);
+        found = TRUE;
+    }
+    g_mutex_unlock(&profile->lock);
+
+    return found;
+}
+
+/* Returns FALSE on a fatal socket error */
+static gboolean lm_profile_conn_flush_locked(lm_profile_conn_t *conn)
+{
+    while (conn->tx_head < conn->tx_len) {
+        gssize n = send(conn->fd, conn->tx + conn->tx_head, conn->tx_len - conn->tx_head, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                break;
+            lm_log_error(TAG, "write to '%s' failed (%s)", conn->device_path, g_strerror(errno));
+            return FALSE;
+        }
+        conn->tx_head += n;
+    }
+
+    if (conn->tx_head == conn->tx_len)
+        conn->tx_head = conn->tx_len = 0;
+
+    lm_io_modify_watch(conn->watch, conn->tx_len > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN);
+
+    return TRUE;
+}
+
+/* io thread */
+static void lm_profile_conn_io_cb(gint fd, guint32 events, gpointer user_data)
+{
+    lm_profile_conn_t *conn = (lm_profile_conn_t *)user_data;
+    lm_profile_t *profile = conn->profile;
+    gboolean hangup = FALSE;
+
+    for (guint i = 0; (events & EPOLLIN) && i < PROFILE_RX_BUDGET; i++) {
+        gssize n = recv(fd, conn->rx, profile->rx_buffer_size, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                lm_log_error(TAG, "read from '%s' failed (%s)", conn->device_path, g_strerror(errno));
+                hangup = TRUE;
+            }
+            break;
+        }
+        if (n == 0) {
+            hangup = TRUE;
+            break;
+        }
+        if (profile->callbacks.data)
+            profile->callbacks.data(profile, conn, conn->rx, (gsize)n, profile->user_data);
+    }
+
+    if (!hangup && (events & EPOLLOUT)) {
+        g_mutex_lock(&conn->lock);
+        hangup = !lm_profile_conn_flush_locked(conn);
+        g_mutex_unlock(&conn->lock);
+    }
+
+    if (events & (EPOLLHUP | EPOLLERR))
+        hangup = TRUE;
+
+    /* Someone else (unregister) may already own the connection */
+    if (hangup && lm_profile_take_connection(profile, conn))
+        lm_profile_conn_teardown(conn);
+}
+
+static void lm_profile_new_connection(lm_profile_t *profile, GDBusMethodInvocation *invocation, GVariant *params)
+{
+    const gchar *device_path = NULL;
+    gint32 fd_index = -1;
+    GError *error = NULL;
+    gint fd = -1;
+
+    g_variant_get(params, "(&oh@a{sv})", &device_path, &fd_index, NULL);
+
+    GUnixFDList *fd_list = g_dbus_message_get_unix_fd_list(g_dbus_method_invocation_get_message(invocation));
+    if (fd_list)
+        fd = g_unix_fd_list_get(fd_list, fd_index, &error);
+    if (fd < 0) {
+        lm_log_error(TAG, "NewConnection from '%s' without fd", device_path);
+        g_clear_error(&error);
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Rejected", "No fd");
+        return;
+    }
+
+    gint flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        lm_log_error(TAG, "failed to set fd non-blocking (%s)", g_strerror(errno));
+        close(fd);
+        g_dbus_method_invocation_return_dbus_error(invocation, "org.bluez.Error.Rejected", "Bad fd");
+        return;
+    }
+
+    lm_profile_conn_t *conn = g_new0(lm_profile_conn_t, 1);
+    conn->profile = profile;
+    conn->device = profile->adapter ? lm_device_lookup_by_path(profile->adapter, device_path) : NULL;
+    conn->device_path = g_strdup(device_path);
+    conn->fd = fd;
+    conn->rx = g_malloc(profile->rx_buffer_size);
+    conn->tx = g_malloc(profile->tx_buffer_size);
+    g_mutex_init(&conn->lock);
+
+    lm_log_info(TAG, "new connection from '%s' on '%s', fd %d", device_path, profile->path, fd);
+    g_dbus_method_invocation_return_value(invocation, NULL);
+
+    if (profile->callbacks.connected)
+        profile->callbacks.connected(profile, conn, profile->user_data);
+
+    g_mutex_lock(&profile->lock);
+    profile->connections = g_list_prepend(profile->connections, conn);
+    g_mutex_unlock(&profile->lock);
+
+    g_mutex_lock(&conn->lock);
+    conn->watch = lm_io_add_watch(fd, conn->tx_len > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN, lm_profile_conn_io_cb, conn);
+    g_mutex_unlock(&conn->lock);
+
+    if (!conn->watch && lm_profile_take_connection(profile, conn))
+        lm_profile_conn_teardown(conn);
+}
+
+static void lm_profile_request_disconnection(lm_profile_t *profile, const gchar *device_path)
+{
+    g_mutex_lock(&profile->lock);
+    for (GList *iter = profile->connections; iter; iter = iter->next) {
+        lm_profile_conn_t *conn = (lm_profile_conn_t *)iter->data;
+        /* The io thread notices the hang up and tears the connection down */
+        if (g_str_equal(conn->device_path, device_path))
+            shutdown(conn->fd, SHUT_RDWR);
+    }
+    g_mutex_unlock(&profile->lock);
+}
+
+static void lm_profile_method_call(__attribute__((unused)) GDBusConnection *conn,
+                                   __attribute__((unused)) const gchar *sender,
+                                   __attribute__((unused)) const gchar *path,
+                                   __attribute__((unused)) const gchar *interface,
+                                   const gchar *method,
+                                   GVariant *params,
+                                   GDBusMethodInvocation *invocation,
+                                   void *userdata)
+{
+    lm_profile_t *profile = (lm_profile_t *)userdata;
+    g_assert(profile != NULL);
+
+    lm_log_debug(TAG, "lm_profile_method_call '%s'", method);
+
+    if (g_str_equal(method, PROFILE_METHOD_NEW_CONNECTION)) {
+        lm_profile_new_connection(profile, invocation, params);
+    } else if (g_str_equal(method, PROFILE_METHOD_REQUEST_DISCONNECTION)) {
+        const gchar *device_path = NULL;
+        g_variant_get(params, "(&o)", &device_path);
+        lm_profile_request_disconnection(profile, device_path);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (g_str_equal(method, PROFILE_METHOD_RELEASE)) {
+        lm_log_debug(TAG, "profile '%s' released", profile->path);
+        g_dbus_method_invocation_return_value(invocation, NULL);
+    } else {
+        lm_log_error(TAG, "We should not come here, unknown method");
+    }
+}
+
+static const GDBusInterfaceVTable profile_method_table = {
+    .method_call = lm_profile_method_call,
+};
+
+static lm_status_t lm_profile_manager_call_method(lm_profile_t *profile, const gchar *method, GVariant *param)
+{
+    GError *error = NULL;
+
+    GVariant *result = lm_dbus_call_sync(profile->dbus_conn,
+                                         BLUEZ_DBUS,
+                                         "/org/bluez",
+                                         INTERFACE_PROFILE_MANAGER,
+                                         method,
+                                         param,
+                                         NULL,
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                                         NULL,
+                                         &error);
+    if (result)
+        g_variant_unref(result);
+
+    if (error != NULL) {
+        lm_log_error(TAG, "ProfileManager call failed '%s': %s", method, error->message);
+        g_clear_error(&error);
+        return LM_STATUS_FAIL;
+    }
+
+    return LM_STATUS_SUCCESS;
+}
+
+static GVariant *lm_profile_build_options(const lm_profile_config_t *config)
+{
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{sv}"));
+
+    if (config->name)
+        g_variant_builder_add(&builder, "{sv}", "Name", g_variant_new_string(config->name));
+    if (profile_role_str[config->role])
+        g_variant_builder_add(&builder, "{sv}", "Role", g_variant_new_string(profile_role_str[config->role]));
+    if (config->channel)
+        g_variant_builder_add(&builder, "{sv}", "Channel", g_variant_new_uint16(config->channel));
+    if (config->psm)
+        g_variant_builder_add(&builder, "{sv}", "PSM", g_variant_new_uint16(config->psm));
+    g_variant_builder_add(&builder, "{sv}", "RequireAuthentication", g_variant_new_boolean(config->require_authentication));
+    g_variant_builder_add(&builder, "{sv}", "RequireAuthorization", g_variant_new_boolean(config->require_authorization));
+    g_variant_builder_add(&builder, "{sv}", "AutoConnect", g_variant_new_boolean(config->auto_connect));
+
+    return g_variant_builder_end(&builder);
+}
+
+lm_profile_t *lm_profile_register(lm_adapter_t *adapter, const lm_profile_config_t *config,
+                const lm_profile_callbacks_t *callbacks, gpointer user_data)
+{
+    g_assert(config);
+    g_assert(config->uuid);
+    g_assert(callbacks);
+
+    GError *error = NULL;
+
+    if (lm_io_ref() != LM_STATUS_SUCCESS)
+        return NULL;
+
+    lm_profile_t *profile = g_new0(lm_profile_t, 1);
+    profile->dbus_conn = adapter ? lm_adapter_get_dbus_conn(adapter) : lm_get_gdbus_connection();
+    profile->adapter = adapter;
+    profile->path = g_strdup_printf("/org/bluez/lm_profile%u", profile_instance_id++);
+    profile->uuid = g_strdup(config->uuid);
+    profile->callbacks = *callbacks;
+    profile->user_data = user_data;
+    profile->rx_buffer_size = config->rx_buffer_size ? config->rx_buffer_size : PROFILE_RX_BUFFER_SIZE;
+    profile->tx_buffer_size = config->tx_buffer_size ? config->tx_buffer_size : PROFILE_TX_BUFFER_SIZE;
+    g_mutex_init(&profile->lock);
+
+    profile->registration_id = g_dbus_connection_register_object(profile->dbus_conn,
+                                                                 profile->path,
+                                                                 (GDBusInterfaceInfo *)&bluez_profile1_interface,
+                                                                 &profile_method_table,
+                                                                 profile, NULL, &error);
+    if (error != NULL) {
+        lm_log_error(TAG, "Register profile object failed %s", error->message);
+        g_clear_error(&error);
+        goto fail;
+    }
+
+    if (lm_profile_manager_call_method(profile, PROFILE_MANAGER_METHOD_REGISTER,
+            g_variant_new("(os@a{sv})", profile->path, profile->uuid, lm_profile_build_options(config))) != LM_STATUS_SUCCESS) {
+        g_dbus_connection_unregister_object(profile->dbus_conn, profile->registration_id);
+        goto fail;
+    }
+
+    lm_log_info(TAG, "profile %s registered at '%s'", profile->uuid, profile->path);
+    return profile;
+
+fail:
+    g_mutex_clear(&profile->lock);
+    g_free(profile->uuid);
+    g_free(profile->path);
+    g_free(profile);
+    lm_io_unref();
+    return NULL;
+}
+
+void lm_profile_unregister(lm_profile_t *profile)
+{
+    g_assert(profile);
+    g_assert(!lm_io_is_io_thread());
+
+    lm_profile_manager_call_method(profile, PROFILE_MANAGER_METHOD_UNREGISTER, g_variant_new("(o)", profile->path));
+    if (!g_dbus_connection_unregister_object(profile->dbus_conn, profile->registration_id))
+        lm_log_error(TAG, "could not unregister profile");
+
+    g_mutex_lock(&profile->lock);
+    GList *connections = profile->connections;
+    profile->connections = NULL;
+    g_mutex_unlock(&profile->lock);
+
+    for (GList *iter = connections; iter; iter = iter->next)
+        lm_profile_conn_teardown((lm_profile_conn_t *)iter->data);
+    g_list_free(connections);
+
+    lm_log_info(TAG, "profile '%s' unregistered", profile->path);
+
+    g_mutex_clear(&profile->lock);
+    g_free(profile->uuid);
+    g_free(profile->path);
+    g_free(profile);
+    lm_io_unref();
+}
+
+const gchar *lm_profile_get_path(const lm_profile_t *profile)
+{
+    g_assert(profile);
+    return profile->path;
+}
+
+guint lm_profile_get_connection_count(lm_profile_t *profile)
+{
+    g_assert(profile);
+
+    g_mutex_lock(&profile->lock);
+    guint count = g_list_length(profile->connections);
+    g_mutex_unlock(&profile->lock);
+
+    return count;
+}
+
+lm_status_t lm_profile_send(lm_profile_conn_t *conn, const guint8 *data, gsize len)
+{
+    g_assert(conn);
+    g_assert(data || len == 0);
+
+    lm_status_t status = LM_STATUS_SUCCESS;
+    gsize size = conn->profile->tx_buffer_size;
+
+    g_mutex_lock(&conn->lock);
+    if (conn->tx_len - conn->tx_head + len > size) {
+        status = LM_STATUS_BUSY;
+    } else if (len > 0) {
+        if (conn->tx_len + len > size) {
+            memmove(conn->tx, conn->tx + conn->tx_head, conn->tx_len - conn->tx_head);
+            conn->tx_len -= conn->tx_head;
+            conn->tx_head = 0;
+        }
+        memcpy(conn->tx + conn->tx_len, data, len);
+        conn->tx_len += len;
+        /* Not watched yet while the connected callback runs */
+        if (conn->watch)
+            lm_io_modify_watch(conn->watch, EPOLLIN | EPOLLOUT);
+    }
+    g_mutex_unlock(&conn->lock);
+
+    return status;
+}
+
+void lm_profile_disconnect(lm_profile_conn_t *conn)
+{
+    g_assert(conn);
+
+    /* The io thread notices the hang up and tears the connection down */
+    shutdown(conn->fd, SHUT_RDWR);
+}
+
+lm_device_t *lm_profile_conn_get_device(const lm_profile_conn_t *conn)
+{
+    g_assert(conn);
+    return conn->device;
+}
+
+const gchar *lm_profile_conn_get_device_path(const lm_profile_conn_t *conn)
+{
+    g_assert(conn);
+    return conn->device_path;
+}
@@ -0,0 +1,199 @@
+#include "lm_scan_feed.h"
+#include "lm_device.h"
+#include "lm_device_priv.h"
+#include "lm_log.h"
+#include "lm_utils.h"
+#include <glib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <bluetooth/bluetooth.h>
+
+#define TAG "lm_scan_feed"
+
+#define AD_TYPE_COMPLETE_NAME       0x09
+#define AD_TYPE_SHORT_NAME          0x08
+#define AD_TYPE_SERVICE_DATA_16     0x16
+#define AD_TYPE_MANUFACTURER_DATA   0xff
+
+struct lm_scan_feed {
+    gchar *name; // Owned
+    gint fd;
+    gsize size;
+    lm_scan_feed_header_t *header; // Owned, mapping
+    lm_scan_record_t *records; // Borrowed, points into the mapping
+    guint32 mask;
+};
+
+lm_scan_feed_t *lm_scan_feed_create(const gchar *name, guint capacity)
+{
+    g_assert(name);
+
+    if (capacity == 0)
+        capacity = LM_SCAN_FEED_DEFAULT_CAPACITY;
+    if (capacity > G_MAXUINT32 / 2)
+        return NULL;
+    guint32 ring_capacity = 1;
+    while (ring_capacity < capacity)
+        ring_capacity <<= 1;
+
+    /*
+     * Never resize a segment in place, readers still mapping it would fault.
+     * A stale one is unlinked, they keep the old pages, and O_EXCL fails
+     * if another writer recreates the name in between.
+     */
+    shm_unlink(name);
+    gint fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        lm_log_error(TAG, "shm_open '%s' failed, error '%s'", name, g_strerror(errno));
+        return NULL;
+    }
+
+    gsize size = sizeof(lm_scan_feed_header_t) + (gsize)ring_capacity * sizeof(lm_scan_record_t);
+    if (ftruncate(fd, (off_t)size) < 0) {
+        lm_log_error(TAG, "sizing '%s' failed, error '%s'", name, g_strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        lm_log_error(TAG, "mmap '%s' failed, error '%s'", name, g_strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    lm_scan_feed_t *feed = g_new0(lm_scan_feed_t, 1);
+    feed->name = g_strdup(name);
+    feed->fd = fd;
+    feed->size = size;
+    feed->header = map;
+    feed->records = (lm_scan_record_t *)(feed->header + 1);
+    feed->mask = ring_capacity - 1;
+
+    /* the segment is zero filled, magic goes last so readers never see a partial header */
+    feed->header->version = LM_SCAN_FEED_VERSION;
+    feed->header->capacity = ring_capacity;
+    feed->header->record_size = sizeof(lm_scan_record_t);
+    __atomic_store_n(&feed->header->magic, LM_SCAN_FEED_MAGIC, __ATOMIC_RELEASE);
+
+    lm_log_info(TAG, "scan feed '%s' with %u records", name, ring_capacity);
+    return feed;
+}
+
+void lm_scan_feed_destroy(lm_scan_feed_t *feed)
+{
+    g_assert(feed);
+
+    shm_unlink(feed->name);
+    munmap(feed->header, feed->size);
+    close(feed->fd);
+    g_free(feed->name);
+    g_free(feed);
+}
+
+/* Appends one AD structure, FALSE when it does not fit */
+static gboolean lm_scan_feed_add_ad(lm_scan_record_t *record, guint8 type, const guint8 *prefix, guint prefix_len,
+                                    const guint8 *data, guint data_len)
+{
+    guint len = 1 + prefix_len + data_len;
+    if (record->ad_len + 1 + len > LM_SCAN_RECORD_AD_MAX)
+        return FALSE;
+
+    guint8 *p = &record->ad[record->ad_len];
+    *p++ = (guint8)len;
+    *p++ = type;
+    memcpy(p, prefix, prefix_len);
+    memcpy(p + prefix_len, data, data_len);
+    record->ad_len += 1 + len;
+    return TRUE;
+}
+
+static void lm_scan_feed_build_ad(lm_scan_record_t *record, lm_device_t *device)
+{
+    gboolean fits = TRUE;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    GHashTable *manufacturer_data = lm_device_get_manufacturer_data(device);
+    if (manufacturer_data) {
+        g_hash_table_iter_init(&iter, manufacturer_data);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            GByteArray *data = value;
+            guint8 company[2] = { *(gint *)key & 0xff, (*(gint *)key >> 8) & 0xff };
+            fits &= lm_scan_feed_add_ad(record, AD_TYPE_MANUFACTURER_DATA, company, sizeof(company),
+                                        data->data, data->len);
+        }
+    }
+
+    /* only SIG 16 bit service data has a compact AD form */
+    GHashTable *service_data = lm_device_get_service_data(device);
+    if (service_data) {
+        g_hash_table_iter_init(&iter, service_data);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            GByteArray *data = value;
+            gint uuid16 = lm_utils_uuid16(key);
+            if (uuid16 < 0) {
+                fits = FALSE;
+                continue;
+            }
+            guint8 uuid[2] = { uuid16 & 0xff, (uuid16 >> 8) & 0xff };
+            fits &= lm_scan_feed_add_ad(record, AD_TYPE_SERVICE_DATA_16, uuid, sizeof(uuid), data->data, data->len);
+        }
+    }
+
+    /* the name goes last and is shortened to whatever room is left */
+    const gchar *name = lm_device_get_name(device);
+    if (name) {
+        guint name_len = (guint)strlen(name);
+        guint room = LM_SCAN_RECORD_AD_MAX - record->ad_len;
+        if (room > 2 && name_len <= room - 2) {
+            lm_scan_feed_add_ad(record, AD_TYPE_COMPLETE_NAME, NULL, 0, (const guint8 *)name, name_len);
+        } else {
+            if (room > 2)
+                lm_scan_feed_add_ad(record, AD_TYPE_SHORT_NAME, NULL, 0, (const guint8 *)name, room - 2);
+            fits = FALSE;
+        }
+    }
+
+    if (!fits)
+        record->flags |= LM_SCAN_RECORD_FLAG_AD_TRUNCATED;
+}
+
+void lm_scan_feed_publish(lm_scan_feed_t *feed, lm_device_t *device)
+{
+    g_assert(feed);
+    g_assert(device);
+
+    lm_scan_record_t record = { 0 };
+    bdaddr_t bdaddr = lm_device_get_bdaddr(device);
+    memcpy(record.bdaddr, bdaddr.b, sizeof(record.bdaddr));
+    record.rssi = (gint8)CLAMP(lm_device_get_rssi(device), G_MININT8, G_MAXINT8);
+    record.timestamp_us = (guint64)g_get_monotonic_time();
+    if (lm_device_get_address_type(device) == LM_DEVICE_ADDRESS_TYPE_RANDOM)
+        record.flags |= LM_SCAN_RECORD_FLAG_RANDOM_ADDRESS;
+    if (lm_device_get_paired(device))
+        record.flags |= LM_SCAN_RECORD_FLAG_PAIRED;
+    lm_scan_feed_build_ad(&record, device);
+
+    guint64 n = __atomic_load_n(&feed->header->head, __ATOMIC_RELAXED);
+    lm_scan_record_t *slot = &feed->records[n & feed->mask];
+
+    /* odd seq marks the slot as being written, the fence keeps the payload behind it */
+    __atomic_store_n(&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy((guint8 *)slot + sizeof(slot->seq), (const guint8 *)&record + sizeof(record.seq),
+           sizeof(record) - sizeof(record.seq));
+    __atomic_store_n(&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&feed->header->head, n + 1, __ATOMIC_RELEASE);
+}
+
+guint64 lm_scan_feed_get_published(lm_scan_feed_t *feed)
+{
+    g_assert(feed);
+    return __atomic_load_n(&feed->header->head, __ATOMIC_RELAXED);
+}
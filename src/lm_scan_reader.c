@@ -0,0 +1,123 @@
+#include "lm_scan_reader.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Kept free of glib, consumers link only this file */
+
+struct lm_scan_reader {
+    int fd;
+    size_t size;
+    const lm_scan_feed_header_t *header; // Owned, read only mapping
+    const lm_scan_record_t *records; // Borrowed, points into the mapping
+    uint32_t mask;
+    uint64_t next;
+    uint64_t dropped;
+};
+
+lm_scan_reader_t *lm_scan_reader_open(const char *name)
+{
+    struct stat st;
+
+    if (!name) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(lm_scan_feed_header_t)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    const lm_scan_feed_header_t *header = map;
+    uint32_t capacity = header->capacity;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != LM_SCAN_FEED_MAGIC ||
+        header->version != LM_SCAN_FEED_VERSION ||
+        header->record_size != sizeof(lm_scan_record_t) ||
+        capacity == 0 || (capacity & (capacity - 1)) != 0 ||
+        (size_t)st.st_size < sizeof(*header) + (size_t)capacity * sizeof(lm_scan_record_t)) {
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    lm_scan_reader_t *reader = calloc(1, sizeof(*reader));
+    if (!reader) {
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+    reader->fd = fd;
+    reader->size = (size_t)st.st_size;
+    reader->header = header;
+    reader->records = (const lm_scan_record_t *)(header + 1);
+    reader->mask = capacity - 1;
+    reader->next = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE);
+    return reader;
+}
+
+void lm_scan_reader_close(lm_scan_reader_t *reader)
+{
+    if (!reader)
+        return;
+
+    munmap((void *)reader->header, reader->size);
+    close(reader->fd);
+    free(reader);
+}
+
+int lm_scan_reader_next(lm_scan_reader_t *reader, lm_scan_record_t *record)
+{
+    for (;;) {
+        uint64_t head = __atomic_load_n(&reader->header->head, __ATOMIC_ACQUIRE);
+        if (reader->next >= head)
+            return 0;
+
+        /* the writer lapped us, jump to the oldest record still in the ring */
+        uint64_t capacity = (uint64_t)reader->mask + 1;
+        if (head - reader->next > capacity) {
+            reader->dropped += head - capacity - reader->next;
+            reader->next = head - capacity;
+        }
+
+        const lm_scan_record_t *slot = &reader->records[reader->next & reader->mask];
+        uint64_t expected = 2 * reader->next + 2;
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == expected) {
+            memcpy(record, slot, sizeof(*record));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == expected) {
+                record->seq = reader->next++;
+                return 1;
+            }
+        }
+
+        /* overwritten while we looked, count it and move on */
+        reader->dropped++;
+        reader->next++;
+    }
+}
+
+uint64_t lm_scan_reader_get_dropped(const lm_scan_reader_t *reader)
+{
+    return reader->dropped;
+}
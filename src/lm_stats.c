@@ -0,0 +1,332 @@
+#include "lm_stats.h"
+#include "lm_stats_priv.h"
+#include "lm_histogram.h"
+#include "lm_log.h"
+#include <glib.h>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define TAG "lm_stats"
+
+/* power of two, open addressing with linear probing */
+#define STATS_TABLE_SIZE        512
+#define STATS_NAME_MAX          128
+/* one minute in us, longer samples land in the last bucket */
+#define STATS_HISTOGRAM_HIGHEST (60 * G_USEC_PER_SEC)
+
+typedef struct {
+    gchar *name; // Owned
+    guint64 value;
+    lm_histogram_t *histogram; // Owned, histogram tables only
+} lm_stats_entry_t;
+
+/*
+ * Append only: a slot goes from NULL to an entry exactly once, so readers
+ * only need an acquire load to see a fully built entry.
+ */
+typedef struct {
+    lm_stats_entry_t *slots[STATS_TABLE_SIZE];
+} lm_stats_table_t;
+
+static lm_stats_table_t counter_tables[LM_STATS_COUNTER_MAX];
+static lm_stats_table_t histogram_tables[LM_STATS_HISTOGRAM_MAX];
+static guint stats_overflow;
+
+static GMutex dump_mutex;
+static guint dump_timer_id;
+static gchar *dump_file_path;
+
+static const gchar *counter_kind_names[] = {
+    "signal",
+    "property",
+    "event",
+    "gauge"
+};
+
+static const gchar *histogram_kind_names[] = {
+    "callback_us",
+    "method_rtt_us"
+};
+
+static lm_stats_entry_t *lm_stats_lookup(lm_stats_table_t *table, const gchar *name, gboolean histogram)
+{
+    guint hash = g_str_hash(name);
+
+    for (guint i = 0; i < STATS_TABLE_SIZE; i++) {
+        lm_stats_entry_t **slot = &table->slots[(hash + i) & (STATS_TABLE_SIZE - 1)];
+        lm_stats_entry_t *entry = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+        if (!entry) {
+            lm_stats_entry_t *new_entry = g_new0(lm_stats_entry_t, 1);
+            new_entry->name = g_strdup(name);
+            if (histogram)
+                new_entry->histogram = lm_histogram_create(name, STATS_HISTOGRAM_HIGHEST);
+
+            if (__atomic_compare_exchange_n(slot, &entry, new_entry, FALSE,
+                                            __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+                return new_entry;
+
+            /* lost the race, entry now holds the winner */
+            if (new_entry->histogram)
+                lm_histogram_destroy(new_entry->histogram);
+            g_free(new_entry->name);
+            g_free(new_entry);
+        }
+
+        if (g_str_equal(entry->name, name))
+            return entry;
+    }
+
+    __atomic_fetch_add(&stats_overflow, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+void lm_stats_count(lm_stats_counter_kind_t kind, const gchar *name)
+{
+    lm_stats_add(kind, name, 1);
+}
+
+void lm_stats_add(lm_stats_counter_kind_t kind, const gchar *name, guint64 delta)
+{
+    g_assert(kind < LM_STATS_COUNTER_MAX);
+    g_assert(name);
+
+    lm_stats_entry_t *entry = lm_stats_lookup(&counter_tables[kind], name, FALSE);
+    if (entry)
+        __atomic_fetch_add(&entry->value, delta, __ATOMIC_RELAXED);
+}
+
+void lm_stats_set(lm_stats_counter_kind_t kind, const gchar *name, guint64 value)
+{
+    g_assert(kind < LM_STATS_COUNTER_MAX);
+    g_assert(name);
+
+    lm_stats_entry_t *entry = lm_stats_lookup(&counter_tables[kind], name, FALSE);
+    if (entry)
+        __atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+}
+
+guint64 *lm_stats_get_counter(lm_stats_counter_kind_t kind, const gchar *name)
+{
+    g_assert(kind < LM_STATS_COUNTER_MAX);
+    g_assert(name);
+
+    lm_stats_entry_t *entry = lm_stats_lookup(&counter_tables[kind], name, FALSE);
+    return entry ? &entry->value : NULL;
+}
+
+lm_histogram_t *lm_stats_get_histogram(lm_stats_histogram_kind_t kind, const gchar *name)
+{
+    g_assert(kind < LM_STATS_HISTOGRAM_MAX);
+    g_assert(name);
+
+    lm_stats_entry_t *entry = lm_stats_lookup(&histogram_tables[kind], name, TRUE);
+    return entry ? entry->histogram : NULL;
+}
+
+void lm_stats_record(lm_stats_histogram_kind_t kind, const gchar *name, guint64 value)
+{
+    lm_histogram_t *histogram = lm_stats_get_histogram(kind, name);
+    if (histogram)
+        lm_histogram_record(histogram, value);
+}
+
+GDBusMessage *lm_stats_dbus_filter(__attribute__((unused)) GDBusConnection *conn,
+                                   GDBusMessage *message,
+                                   gboolean incoming,
+                                   __attribute__((unused)) gpointer user_data)
+{
+    gchar name[STATS_NAME_MAX];
+
+    if (!incoming || g_dbus_message_get_message_type(message) != G_DBUS_MESSAGE_TYPE_SIGNAL)
+        return message;
+
+    g_snprintf(name, sizeof(name), "%s.%s",
+               g_dbus_message_get_interface(message), g_dbus_message_get_member(message));
+    lm_stats_count(LM_STATS_SIGNAL, name);
+
+    return message;
+}
+
+lm_stats_snapshot_t *lm_stats_snapshot(void)
+{
+    lm_stats_snapshot_t *snapshot = g_new0(lm_stats_snapshot_t, 1);
+    snapshot->timestamp_us = g_get_real_time();
+    snapshot->overflow = __atomic_load_n(&stats_overflow, __ATOMIC_RELAXED);
+
+    for (guint kind = 0; kind < LM_STATS_COUNTER_MAX; kind++) {
+        snapshot->counters[kind] = g_array_new(FALSE, FALSE, sizeof(lm_stats_counter_t));
+        for (guint i = 0; i < STATS_TABLE_SIZE; i++) {
+            lm_stats_entry_t *entry = __atomic_load_n(&counter_tables[kind].slots[i], __ATOMIC_ACQUIRE);
+            if (!entry)
+                continue;
+            lm_stats_counter_t counter = {
+                .name = entry->name,
+                .value = __atomic_load_n(&entry->value, __ATOMIC_RELAXED)
+            };
+            g_array_append_val(snapshot->counters[kind], counter);
+        }
+    }
+
+    for (guint kind = 0; kind < LM_STATS_HISTOGRAM_MAX; kind++) {
+        snapshot->histograms[kind] = g_array_new(FALSE, FALSE, sizeof(lm_stats_histogram_summary_t));
+        for (guint i = 0; i < STATS_TABLE_SIZE; i++) {
+            lm_stats_entry_t *entry = __atomic_load_n(&histogram_tables[kind].slots[i], __ATOMIC_ACQUIRE);
+            if (!entry)
+                continue;
+            lm_stats_histogram_summary_t summary = {
+                .name = entry->name,
+                .count = lm_histogram_get_count(entry->histogram),
+                .min = lm_histogram_get_min(entry->histogram),
+                .p50 = lm_histogram_get_percentile(entry->histogram, 50.0),
+                .p90 = lm_histogram_get_percentile(entry->histogram, 90.0),
+                .p99 = lm_histogram_get_percentile(entry->histogram, 99.0),
+                .max = lm_histogram_get_max(entry->histogram),
+                .mean = lm_histogram_get_mean(entry->histogram)
+            };
+            g_array_append_val(snapshot->histograms[kind], summary);
+        }
+    }
+
+    return snapshot;
+}
+
+void lm_stats_snapshot_free(lm_stats_snapshot_t *snapshot)
+{
+    g_assert(snapshot);
+
+    for (guint kind = 0; kind < LM_STATS_COUNTER_MAX; kind++)
+        g_array_free(snapshot->counters[kind], TRUE);
+    for (guint kind = 0; kind < LM_STATS_HISTOGRAM_MAX; kind++)
+        g_array_free(snapshot->histograms[kind], TRUE);
+    g_free(snapshot);
+}
+
+void lm_stats_reset(void)
+{
+    for (guint kind = 0; kind < LM_STATS_COUNTER_MAX; kind++) {
+        for (guint i = 0; i < STATS_TABLE_SIZE; i++) {
+            lm_stats_entry_t *entry = __atomic_load_n(&counter_tables[kind].slots[i], __ATOMIC_ACQUIRE);
+            if (entry)
+                __atomic_store_n(&entry->value, 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (guint kind = 0; kind < LM_STATS_HISTOGRAM_MAX; kind++) {
+        for (guint i = 0; i < STATS_TABLE_SIZE; i++) {
+            lm_stats_entry_t *entry = __atomic_load_n(&histogram_tables[kind].slots[i], __ATOMIC_ACQUIRE);
+            if (entry)
+                lm_histogram_reset(entry->histogram);
+        }
+    }
+
+    __atomic_store_n(&stats_overflow, 0, __ATOMIC_RELAXED);
+}
+
+static void lm_stats_write_snapshot(FILE *file, const lm_stats_snapshot_t *snapshot)
+{
+    fprintf(file, "# lm_stats %" G_GINT64_FORMAT " overflow %u\n", snapshot->timestamp_us, snapshot->overflow);
+
+    for (guint kind = 0; kind < LM_STATS_COUNTER_MAX; kind++) {
+        for (guint i = 0; i < snapshot->counters[kind]->len; i++) {
+            lm_stats_counter_t *counter = &g_array_index(snapshot->counters[kind], lm_stats_counter_t, i);
+            fprintf(file, "%s %s %" G_GUINT64_FORMAT "\n", counter_kind_names[kind], counter->name, counter->value);
+        }
+    }
+
+    for (guint kind = 0; kind < LM_STATS_HISTOGRAM_MAX; kind++) {
+        for (guint i = 0; i < snapshot->histograms[kind]->len; i++) {
+            lm_stats_histogram_summary_t *summary =
+                &g_array_index(snapshot->histograms[kind], lm_stats_histogram_summary_t, i);
+            fprintf(file, "%s %s count %" G_GUINT64_FORMAT " min %" G_GUINT64_FORMAT " mean %.1f"
+                    " p50 %" G_GUINT64_FORMAT " p90 %" G_GUINT64_FORMAT " p99 %" G_GUINT64_FORMAT
+                    " max %" G_GUINT64_FORMAT "\n",
+                    histogram_kind_names[kind], summary->name, summary->count, summary->min, summary->mean,
+                    summary->p50, summary->p90, summary->p99, summary->max);
+        }
+    }
+}
+
+static void lm_stats_log_snapshot(const lm_stats_snapshot_t *snapshot)
+{
+    lm_log_info(TAG, "snapshot, overflow %u", snapshot->overflow);
+
+    for (guint kind = 0; kind < LM_STATS_COUNTER_MAX; kind++) {
+        for (guint i = 0; i < snapshot->counters[kind]->len; i++) {
+            lm_stats_counter_t *counter = &g_array_index(snapshot->counters[kind], lm_stats_counter_t, i);
+            lm_log_info(TAG, "%s %s %" G_GUINT64_FORMAT, counter_kind_names[kind], counter->name, counter->value);
+        }
+    }
+
+    for (guint kind = 0; kind < LM_STATS_HISTOGRAM_MAX; kind++) {
+        for (guint i = 0; i < snapshot->histograms[kind]->len; i++) {
+            lm_stats_histogram_summary_t *summary =
+                &g_array_index(snapshot->histograms[kind], lm_stats_histogram_summary_t, i);
+            lm_log_info(TAG, "%s %s count %" G_GUINT64_FORMAT " min %" G_GUINT64_FORMAT " mean %.1f"
+                        " p50 %" G_GUINT64_FORMAT " p90 %" G_GUINT64_FORMAT " p99 %" G_GUINT64_FORMAT
+                        " max %" G_GUINT64_FORMAT,
+                        histogram_kind_names[kind], summary->name, summary->count, summary->min, summary->mean,
+                        summary->p50, summary->p90, summary->p99, summary->max);
+        }
+    }
+}
+
+lm_status_t lm_stats_dump(const gchar *file_path)
+{
+    lm_stats_snapshot_t *snapshot = lm_stats_snapshot();
+    lm_status_t status = LM_STATUS_SUCCESS;
+
+    if (file_path) {
+        FILE *file = fopen(file_path, "a");
+        if (file) {
+            lm_stats_write_snapshot(file, snapshot);
+            fclose(file);
+        } else {
+            lm_log_error(TAG, "failed to open '%s': %s", file_path, g_strerror(errno));
+            status = LM_STATUS_FAIL;
+        }
+    } else {
+        lm_stats_log_snapshot(snapshot);
+    }
+
+    lm_stats_snapshot_free(snapshot);
+    return status;
+}
+
+static gboolean lm_stats_dump_timer_cb(__attribute__((unused)) gpointer user_data)
+{
+    g_mutex_lock(&dump_mutex);
+    lm_stats_dump(dump_file_path);
+    g_mutex_unlock(&dump_mutex);
+
+    return TRUE;
+}
+
+lm_status_t lm_stats_start_periodic_dump(guint interval_sec, const gchar *file_path)
+{
+    if (interval_sec == 0)
+        return LM_STATUS_INVALID_ARGS;
+
+    lm_stats_stop_periodic_dump();
+
+    g_mutex_lock(&dump_mutex);
+    dump_file_path = g_strdup(file_path);
+    dump_timer_id = g_timeout_add_seconds(interval_sec, lm_stats_dump_timer_cb, NULL);
+    g_mutex_unlock(&dump_mutex);
+
+    lm_log_info(TAG, "periodic dump every %u s to %s", interval_sec, file_path ? file_path : "log");
+    return LM_STATUS_SUCCESS;
+}
+
+void lm_stats_stop_periodic_dump(void)
+{
+    g_mutex_lock(&dump_mutex);
+    if (dump_timer_id) {
+        g_source_remove(dump_timer_id);
+        dump_timer_id = 0;
+    }
+    g_free(dump_file_path);
+    dump_file_path = NULL;
+    g_mutex_unlock(&dump_mutex);
+}
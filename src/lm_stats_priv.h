@@ -0,0 +1,15 @@
+#ifndef __LM_STATS_PRIV_H__
+#define __LM_STATS_PRIV_H__
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "lm_stats.h"
+
+/* g_dbus_connection_add_filter() callback counting incoming signals, runs on the GDBus worker thread */
+GDBusMessage *lm_stats_dbus_filter(GDBusConnection *conn, GDBusMessage *message, gboolean incoming,
+                                   gpointer user_data);
+
+/* Look the counter up once and add to it atomically on hot paths, NULL when the table is full */
+guint64 *lm_stats_get_counter(lm_stats_counter_kind_t kind, const gchar *name);
+
+#endif //__LM_STATS_PRIV_H__
@@ -3,10 +3,14 @@
 #include "lm_device_priv.h"
 #include "lm_adapter.h"
 #include "lm_log.h"
+#include "lm_dbus_priv.h"
+#include "lm_stats.h"
 #include "lm_utils.h"
 #include "lm_uuids.h"
 #include "lm_transport.h"
 #include "lm_transport_priv.h"
+#include "lm_histogram.h"
+#include "lm_mem.h"
 #include <math.h>
 
 #define TAG "lm_transport"
@@ -19,6 +23,9 @@
 
 #define VOLUME_PERCENTAGE_MAX 100.0f
 
+/* Highest trackable latency, larger samples fall into the last bucket */
+#define METRIC_HIGHEST_VALUE_US (60 * G_USEC_PER_SEC)
+
 struct lm_transport {
     GDBusConnection *dbus_conn;
     lm_device_t *device;
@@ -38,6 +45,14 @@ struct lm_transport {
     GPtrArray *links;       /* Linked transport objects which the transport is associated with. */
     lm_transport_qos_t qos;
     lm_transport_profile_t profile; /* Indicates the profile of the transport. */
+    gint64 state_time[LM_TRANSPORT_ACTIVE + 1]; /* monotonic time of last entry into each state */
+    /* set by the application, cleared by the dispatching thread, accessed atomically */
+    gint64 select_time;     /* 0 when no Select() is outstanding */
+    gint64 discovered_time; /* 0 when not waiting for streaming */
+    gboolean delay_valid;   /* delay holds a previous report */
+    lm_histogram_t *metrics[LM_TRANSPORT_METRIC_MAX]; // Owned
+    gsize mem_size; // charged to LM_MEM_TRANSPORT
+    gint ref_count;         /* the owner and each outstanding Select() */
 };
 
 typedef struct {
@@ -67,6 +82,14 @@ static const gchar *transport_profile_str[] = {
     "bap_bcast_src"
 };
 
+static const gchar *transport_metric_str[] = {
+    "select_to_active",
+    "discovered_to_streaming",
+    "pending_to_active",
+    "delay",
+    "delay_jitter"
+};
+
 static const lm_transport_profile_map_t transport_profile_map[] = {
     {LM_TRANSPORT_PROFILE_NULL,           NULL_SERVICE_UUID},
     {LM_TRANSPORT_PROFILE_A2DP_SINK,      AUDIO_SINK_SERVICE_UUID},
@@ -101,6 +124,20 @@ static lm_transport_profile_t lm_transport_uuid_to_profile(const gchar *uuid)
     return LM_TRANSPORT_PROFILE_NULL;
 }
 
+static gsize lm_transport_mem_size(lm_transport_t *transport)
+{
+    gsize size = sizeof(lm_transport_t) + transport->config_size + transport->meta_size;
+
+    size += lm_mem_string_size(transport->path);
+    size += lm_mem_string_size(transport->device_path);
+    size += lm_mem_string_size(transport->uuid);
+    size += lm_mem_string_size(transport->state);
+    size += lm_mem_string_size(transport->endpoint);
+    for (guint i = 0; i < LM_TRANSPORT_METRIC_MAX; i++)
+        size += lm_histogram_get_memory_size(transport->metrics[i]);
+    return size;
+}
+
 lm_transport_t *lm_transport_create(lm_device_t *device, const gchar *path)
 {
     g_assert(path);
@@ -110,16 +147,26 @@ lm_transport_t *lm_transport_create(lm_device_t *device, const gchar *path)
     transport->dbus_conn = device ? lm_device_get_dbus_conn(device) : lm_get_gdbus_connection();
     transport->device = device;
     transport->path = g_strdup(path);
+    for (guint i = 0; i < LM_TRANSPORT_METRIC_MAX; i++)
+        transport->metrics[i] = lm_histogram_create(transport_metric_str[i], METRIC_HIGHEST_VALUE_US);
+    transport->mem_size = lm_transport_mem_size(transport);
+    transport->ref_count = 1;
+    lm_mem_object_new(LM_MEM_TRANSPORT, transport->mem_size);
 
     lm_log_debug(TAG, "create transport '%s'", path);
     return transport;
 }
 
-void lm_transport_destroy(lm_transport_t *transport)
+static lm_transport_t *lm_transport_ref(lm_transport_t *transport)
 {
-    g_assert(transport);
+    g_atomic_int_inc(&transport->ref_count);
+    return transport;
+}
 
-    lm_log_debug(TAG, "destroy transport '%s'", transport->path);
+static void lm_transport_unref(lm_transport_t *transport)
+{
+    if (!g_atomic_int_dec_and_test(&transport->ref_count))
+        return;
 
     if (transport->path)
         g_free((gpointer)transport->path);
@@ -139,10 +186,22 @@ void lm_transport_destroy(lm_transport_t *transport)
    //      g_strfreev((gchar **)transport->links);
     if (transport->qos.bcode)
         g_free((gpointer)transport->qos.bcode);
+    for (guint i = 0; i < LM_TRANSPORT_METRIC_MAX; i++)
+        lm_histogram_destroy(transport->metrics[i]);
 
+    lm_mem_object_free(LM_MEM_TRANSPORT, transport->mem_size);
     g_free(transport);
 }
 
+/* An outstanding Select() keeps the transport until it completes */
+void lm_transport_destroy(lm_transport_t *transport)
+{
+    g_assert(transport);
+
+    lm_log_debug(TAG, "destroy transport '%s'", transport->path);
+    lm_transport_unref(transport);
+}
+
 const gchar *lm_transport_get_path(lm_transport_t *transport)
 {
     g_assert(transport);
@@ -203,6 +262,90 @@ const gchar *lm_transport_get_profile_name(lm_transport_t *transport)
     return transport_profile_str[transport->profile];
 }
 
+gint64 lm_transport_get_state_timestamp(lm_transport_t *transport, lm_transport_state_t state)
+{
+    g_assert(transport);
+    g_assert(state <= LM_TRANSPORT_ACTIVE);
+    return transport->state_time[state];
+}
+
+const lm_histogram_t *lm_transport_get_histogram(lm_transport_t *transport, lm_transport_metric_t metric)
+{
+    g_assert(transport);
+    g_assert(metric < LM_TRANSPORT_METRIC_MAX);
+    return transport->metrics[metric];
+}
+
+void lm_transport_reset_metrics(lm_transport_t *transport)
+{
+    g_assert(transport);
+
+    for (guint i = 0; i < LM_TRANSPORT_METRIC_MAX; i++)
+        lm_histogram_reset(transport->metrics[i]);
+    transport->delay_valid = FALSE;
+}
+
+void lm_transport_dump_metrics(lm_transport_t *transport)
+{
+    g_assert(transport);
+
+    lm_log_info(TAG, "transport '%s %s' metrics (us)", transport->path, lm_transport_get_profile_name(transport));
+    for (guint i = 0; i < LM_TRANSPORT_METRIC_MAX; i++)
+        lm_histogram_dump(transport->metrics[i], TAG);
+}
+
+void lm_transport_mark_discovered(lm_transport_t *transport)
+{
+    g_assert(transport);
+    __atomic_store_n(&transport->discovered_time, g_get_monotonic_time(), __ATOMIC_RELAXED);
+}
+
+static void lm_transport_record_state_change(lm_transport_t *transport,
+                lm_transport_state_t old_state, lm_transport_state_t new_state)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if (new_state == old_state)
+        return;
+
+    transport->state_time[new_state] = now;
+
+    if (new_state == LM_TRANSPORT_ACTIVE) {
+        gint64 select_time = __atomic_exchange_n(&transport->select_time, 0, __ATOMIC_RELAXED);
+        if (select_time) {
+            lm_histogram_record(transport->metrics[LM_TRANSPORT_METRIC_SELECT_TO_ACTIVE],
+                                now - select_time);
+        }
+        if (old_state == LM_TRANSPORT_PENDING && transport->state_time[LM_TRANSPORT_PENDING]) {
+            lm_histogram_record(transport->metrics[LM_TRANSPORT_METRIC_PENDING_TO_ACTIVE],
+                                now - transport->state_time[LM_TRANSPORT_PENDING]);
+        }
+    }
+
+    if (new_state == LM_TRANSPORT_BROADCASTING || new_state == LM_TRANSPORT_ACTIVE) {
+        gint64 discovered_time = __atomic_exchange_n(&transport->discovered_time, 0, __ATOMIC_RELAXED);
+        if (discovered_time) {
+            lm_histogram_record(transport->metrics[LM_TRANSPORT_METRIC_DISCOVERED_TO_STREAMING],
+                                now - discovered_time);
+        }
+    }
+
+    /* Select() failed or the stream was torn down before it became active */
+    if (new_state == LM_TRANSPORT_IDLE)
+        __atomic_store_n(&transport->select_time, 0, __ATOMIC_RELAXED);
+}
+
+static void lm_transport_record_delay(lm_transport_t *transport, guint16 delay)
+{
+    /* delay is in 1/10 of millisecond */
+    lm_histogram_record(transport->metrics[LM_TRANSPORT_METRIC_DELAY], (guint64)delay * 100);
+    if (transport->delay_valid) {
+        gint32 diff = (gint32)delay - (gint32)transport->delay;
+        lm_histogram_record(transport->metrics[LM_TRANSPORT_METRIC_DELAY_JITTER], (guint64)ABS(diff) * 100);
+    }
+    transport->delay_valid = TRUE;
+}
+
 static void lm_transport_call_method_cb(__attribute__((unused)) GObject *source_object,
                                         GAsyncResult *res,
                                         gpointer user_data)
@@ -211,7 +354,7 @@ static void lm_transport_call_method_cb(__attribute__((unused)) GObject *source_
     g_assert(transport != NULL);
 
     GError *error = NULL;
-    GVariant *value = g_dbus_connection_call_finish(transport->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
     if (value != NULL) {
         g_variant_unref(value);
     }
@@ -222,23 +365,56 @@ static void lm_transport_call_method_cb(__attribute__((unused)) GObject *source_
     }
 }
 
-static void lm_transport_call_method(lm_transport_t *transport, const gchar *method, GVariant *parameters)
+/*
+ * A failed Select() leaves the transport idle, nothing else would clear the
+ * start time. Holds the reference taken by lm_transport_select().
+ */
+static void lm_transport_select_cb(__attribute__((unused)) GObject *source_object,
+                                   GAsyncResult *res,
+                                   gpointer user_data)
+{
+    lm_transport_t *transport = (lm_transport_t *) user_data;
+    g_assert(transport != NULL);
+
+    GError *error = NULL;
+    GVariant *value = lm_dbus_call_finish(res, &error);
+    if (value != NULL) {
+        g_variant_unref(value);
+    }
+
+    if (error != NULL) {
+        lm_log_error(TAG, "failed to select transport '%s' (error %d '%s')",
+            transport->path, error->code, error->message);
+        g_clear_error(&error);
+        __atomic_store_n(&transport->select_time, 0, __ATOMIC_RELAXED);
+    }
+    lm_transport_unref(transport);
+}
+
+static void lm_transport_call_method_full(lm_transport_t *transport, const gchar *method, GVariant *parameters,
+                                          GAsyncReadyCallback callback, gpointer user_data)
 {
     g_assert(transport != NULL);
     g_assert(method != NULL);
 
-    g_dbus_connection_call(transport->dbus_conn,
-                           BLUEZ_DBUS,
-                           transport->path,
-                           INTERFACE_MEDIA_TRANSPORT,
-                           method,
-                           parameters,
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                           NULL,
-                           (GAsyncReadyCallback) lm_transport_call_method_cb,
-                           transport);
+    lm_dbus_call(transport->dbus_conn,
+                 BLUEZ_DBUS,
+                 transport->path,
+                 INTERFACE_MEDIA_TRANSPORT,
+                 method,
+                 parameters,
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 NULL,
+                 callback,
+                 user_data);
+}
+
+static void lm_transport_call_method(lm_transport_t *transport, const gchar *method, GVariant *parameters)
+{
+    lm_transport_call_method_full(transport, method, parameters, (GAsyncReadyCallback) lm_transport_call_method_cb,
+                                  transport);
 }
 
 lm_status_t lm_transport_select(lm_transport_t *transport)
@@ -250,7 +426,9 @@ lm_status_t lm_transport_select(lm_transport_t *transport)
         return LM_STATUS_FAIL;
     }
 
-    lm_transport_call_method(transport, MEDIA_TRANSPORT_METHOD_SELECT, NULL);
+    __atomic_store_n(&transport->select_time, g_get_monotonic_time(), __ATOMIC_RELAXED);
+    lm_transport_call_method_full(transport, MEDIA_TRANSPORT_METHOD_SELECT, NULL, lm_transport_select_cb,
+                                  lm_transport_ref(transport));
 
     return LM_STATUS_SUCCESS;
 }
@@ -277,7 +455,7 @@ static void __attribute__((unused)) lm_transport_set_property_cb(__attribute__((
     g_assert(transport != NULL);
 
     GError *error = NULL;
-    GVariant *value = g_dbus_connection_call_finish(transport->dbus_conn, res, &error);
+    GVariant *value = lm_dbus_call_finish(res, &error);
     if (value != NULL) {
         g_variant_unref(value);
     }
@@ -295,18 +473,18 @@ static lm_status_t __attribute__((unused)) lm_transport_set_property_async(lm_tr
     g_assert(property != NULL);
     g_assert(value != NULL);
 
-    g_dbus_connection_call(transport->dbus_conn,
-                           BLUEZ_DBUS,
-                           transport->path,
-                           INTERFACE_PROPERTIES,
-                           PROPERTIES_METHOD_SET,
-                           g_variant_new("(ssv)", INTERFACE_MEDIA_TRANSPORT, property, value),
-                           NULL,
-                           G_DBUS_CALL_FLAGS_NONE,
-                           BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
-                           NULL,
-                           (GAsyncReadyCallback) lm_transport_set_property_cb,
-                           transport);
+    lm_dbus_call(transport->dbus_conn,
+                 BLUEZ_DBUS,
+                 transport->path,
+                 INTERFACE_PROPERTIES,
+                 PROPERTIES_METHOD_SET,
+                 g_variant_new("(ssv)", INTERFACE_MEDIA_TRANSPORT, property, value),
+                 NULL,
+                 G_DBUS_CALL_FLAGS_NONE,
+                 BLUEZ_DBUS_CONNECTION_CALL_TIMEOUT,
+                 NULL,
+                 (GAsyncReadyCallback) lm_transport_set_property_cb,
+                 transport);
 
     return LM_STATUS_SUCCESS;
 }
@@ -318,7 +496,7 @@ static lm_status_t lm_transport_set_property_sync(lm_transport_t *transport, con
     g_assert(value != NULL);
 
     GError *error = NULL;
-    GVariant *result = g_dbus_connection_call_sync(transport->dbus_conn,
+    GVariant *result = lm_dbus_call_sync(transport->dbus_conn,
                            BLUEZ_DBUS,
                            transport->path,
                            INTERFACE_PROPERTIES,
@@ -408,10 +586,11 @@ lm_status_t lm_transport_set_volume_percentage(lm_transport_t *transport, float
    return status;
 }
 
-void lm_transport_update_property(lm_transport_t *transport,
-                  const char *property_name, GVariant *property_value)
+static void lm_transport_apply_property(lm_transport_t *transport,
+                                        const char *property_name, GVariant *property_value)
 {
     lm_log_debug(TAG, "transport '%s %s' property update", transport->path, lm_transport_get_profile_name(transport));
+    lm_stats_count(LM_STATS_PROPERTY, property_name);
 
     if (g_str_equal(property_name, MEDIA_TRANSPORT_PROPERTY_DEVICE)) {
         if (transport->device_path)
@@ -439,10 +618,12 @@ void lm_transport_update_property(lm_transport_t *transport,
            lm_log_debug(TAG, "config[%d]:0x%x", i, transport->config[i]);
         }
     } else if (g_str_equal(property_name, MEDIA_TRANSPORT_PROPERTY_STATE)) {
+        lm_transport_state_t old_state = lm_transport_get_state(transport);
         if (transport->state)
             g_free((gpointer)transport->state);
         transport->state = g_strdup(g_variant_get_string(property_value, NULL));
         lm_log_info(TAG, "state:'%s'", transport->state);
+        lm_transport_record_state_change(transport, old_state, lm_transport_get_state(transport));
 
         if (!transport->device)
             return;
@@ -454,7 +635,9 @@ void lm_transport_update_property(lm_transport_t *transport,
             lm_app_event_callback(LM_TRANSPORT_STATE_CHANGE_IND, LM_STATUS_SUCCESS, &ind);
         }
     } else if (g_str_equal(property_name, MEDIA_TRANSPORT_PROPERTY_DELAY)) {
-        transport->delay = g_variant_get_uint16(property_value);
+        guint16 delay = g_variant_get_uint16(property_value);
+        lm_transport_record_delay(transport, delay);
+        transport->delay = delay;
         lm_log_debug(TAG, "delay 0x%x", transport->delay);
     } else if (g_str_equal(property_name, MEDIA_TRANSPORT_PROPERTY_VOLUME)) {
         transport->volume = g_variant_get_uint16(property_value);
@@ -543,4 +726,14 @@ void lm_transport_update_property(lm_transport_t *transport,
             lm_app_event_callback(LM_TRANSPORT_QOS_UPDATE_IND, LM_STATUS_SUCCESS, &ind);
         }
     }
+}
+
+void lm_transport_update_property(lm_transport_t *transport,
+                  const char *property_name, GVariant *property_value)
+{
+    lm_transport_apply_property(transport, property_name, property_value);
+
+    gsize size = lm_transport_mem_size(transport);
+    lm_mem_recharge(LM_MEM_TRANSPORT, transport->mem_size, size);
+    transport->mem_size = size;
 }
\ No newline at end of file
@@ -21,4 +21,7 @@ lm_status_t lm_transport_unselect(lm_transport_t *transport);
 
 lm_status_t lm_transport_set_links(GPtrArray *transports);
 
+/* Start of LM_TRANSPORT_METRIC_DISCOVERED_TO_STREAMING */
+void lm_transport_mark_discovered(lm_transport_t *transport);
+
 #endif //__LM_TRANSPORT_PRIV_H__
\ No newline at end of file
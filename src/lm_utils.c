@@ -154,6 +154,21 @@ gboolean lm_utils_is_valid_uuid(const gchar *uuid) {
     return TRUE;
 }
 
+gint lm_utils_uuid16(const gchar *uuid) {
+    if (strlen(uuid) != 36 || !g_str_has_prefix(uuid, "0000") ||
+        g_ascii_strcasecmp(uuid + 8, "-0000-1000-8000-00805f9b34fb") != 0)
+        return -1;
+
+    gint value = 0;
+    for (guint i = 4; i < 8; i++) {
+        gint digit = g_ascii_xdigit_value(uuid[i]);
+        if (digit < 0)
+            return -1;
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
 gchar* lm_utils_replace_char(gchar* str, gchar find, gchar replace){
     gchar *current_pos = strchr(str,find);
     while (current_pos) {
@@ -31,4 +31,7 @@ gchar* lm_utils_random_string(gsize length);
 
 gboolean lm_utils_is_valid_uuid(const gchar *uuid);
 
+/* 16 bit value of a uuid on the SIG base, -1 for any other uuid */
+gint lm_utils_uuid16(const gchar *uuid);
+
 #endif //__LM_UTILS_H__
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "lm_filter.h"
+#include "lm_filter_priv.h"
+#include "lm_log.h"
+#include <glib.h>
+
+/* Name and address prefix rules of lm_filter_compile(), both ASCII case insensitive */
+
+static const lm_filter_rule_t prefix_rules[] = {
+    { .type = LM_FILTER_RULE_NAME_PREFIX, .string = "Galaxy Buds" },
+    { .type = LM_FILTER_RULE_NAME_PREFIX, .string = "le-" },
+    { .type = LM_FILTER_RULE_ADDRESS_PREFIX, .string = "00:1a:7d" },
+};
+
+static void test_name_prefix_case(void)
+{
+    lm_filter_t *filter = lm_filter_compile(prefix_rules, G_N_ELEMENTS(prefix_rules));
+    g_assert_nonnull(filter);
+
+    /* as written */
+    g_assert_cmpint(lm_filter_match_prefix(filter, "Galaxy Buds2 Pro", NULL), ==, 0);
+    g_assert_cmpint(lm_filter_match_prefix(filter, "le-Device-00001", NULL), ==, 1);
+
+    /* other case */
+    g_assert_cmpint(lm_filter_match_prefix(filter, "GALAXY BUDS Live", NULL), ==, 0);
+    g_assert_cmpint(lm_filter_match_prefix(filter, "galaxy buds", NULL), ==, 0);
+    g_assert_cmpint(lm_filter_match_prefix(filter, "LE-Device-00001", NULL), ==, 1);
+
+    g_assert_cmpint(lm_filter_match_prefix(filter, "Galaxy Bud", NULL), ==, -1);
+    g_assert_cmpint(lm_filter_match_prefix(filter, "Pixel Buds", NULL), ==, -1);
+    g_assert_cmpint(lm_filter_match_prefix(filter, NULL, NULL), ==, -1);
+
+    lm_filter_destroy(filter);
+}
+
+static void test_address_prefix_case(void)
+{
+    lm_filter_t *filter = lm_filter_compile(prefix_rules, G_N_ELEMENTS(prefix_rules));
+    g_assert_nonnull(filter);
+
+    g_assert_cmpint(lm_filter_match_prefix(filter, NULL, "00:1A:7D:DA:71:13"), ==, 2);
+    g_assert_cmpint(lm_filter_match_prefix(filter, NULL, "00:1a:7d:da:71:13"), ==, 2);
+    g_assert_cmpint(lm_filter_match_prefix(filter, NULL, "00:1B:7D:DA:71:13"), ==, -1);
+
+    /* a name that does not match leaves the address to decide */
+    g_assert_cmpint(lm_filter_match_prefix(filter, "Pixel Buds", "00:1A:7D:DA:71:13"), ==, 2);
+
+    lm_filter_destroy(filter);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    lm_log_set_level(LM_LOG_WARN);
+
+    g_test_add_func("/filter/name_prefix_case", test_name_prefix_case);
+    g_test_add_func("/filter/address_prefix_case", test_address_prefix_case);
+
+    return g_test_run();
+}
@@ -0,0 +1,85 @@
+#include "lm_gatt.h"
+#include "lm_gatt_priv.h"
+#include "lm_log.h"
+#include <glib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Queue limits of lm_gatt_write_stream_write(). The stream writes to one end
+ * of a socketpair nobody reads, so queued data stays pending.
+ */
+
+#define TEST_MTU        23
+/* WRITE_QUEUE_MAX in lm_gatt.c */
+#define TEST_QUEUE_MAX  (256 * 1024)
+
+static lm_gatt_write_stream_t *test_stream_open(gint *peer)
+{
+    gint fds[2];
+
+    g_assert_cmpint(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds), ==, 0);
+    *peer = fds[1];
+
+    lm_gatt_write_stream_t *stream = lm_gatt_write_stream_new_for_fd(NULL, "/test/char", fds[0],
+                                                                    TEST_MTU, NULL, NULL);
+    g_assert_nonnull(stream);
+    return stream;
+}
+
+static void test_write_small(void)
+{
+    gint peer;
+    guint8 data[64] = { 0 };
+    lm_gatt_write_stream_t *stream = test_stream_open(&peer);
+
+    g_assert_cmpint(lm_gatt_write_stream_write(stream, data, sizeof(data)), ==, LM_STATUS_SUCCESS);
+    g_assert_cmpint(lm_gatt_write_stream_write(stream, data, 0), ==, LM_STATUS_SUCCESS);
+
+    lm_gatt_write_stream_close(stream);
+    close(peer);
+}
+
+static void test_write_oversize_on_empty_queue(void)
+{
+    gint peer;
+    gsize len = TEST_QUEUE_MAX + 1;
+    guint8 *data = g_malloc0(len);
+    lm_gatt_write_stream_t *stream = test_stream_open(&peer);
+
+    g_assert_cmpuint(lm_gatt_write_stream_get_pending(stream), ==, 0);
+    g_assert_cmpint(lm_gatt_write_stream_write(stream, data, len), ==, LM_STATUS_SUCCESS);
+
+    lm_gatt_write_stream_close(stream);
+    close(peer);
+    g_free(data);
+}
+
+static void test_write_oversize_while_pending(void)
+{
+    gint peer;
+    gsize len = TEST_QUEUE_MAX + 1;
+    guint8 *data = g_malloc0(len);
+    lm_gatt_write_stream_t *stream = test_stream_open(&peer);
+
+    g_assert_cmpint(lm_gatt_write_stream_write(stream, data, len), ==, LM_STATUS_SUCCESS);
+    /* the socket buffer takes far less than the queue */
+    g_assert_cmpuint(lm_gatt_write_stream_get_pending(stream), >, 0);
+    g_assert_cmpint(lm_gatt_write_stream_write(stream, data, len), ==, LM_STATUS_BUSY);
+
+    lm_gatt_write_stream_close(stream);
+    close(peer);
+    g_free(data);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    lm_log_set_level(LM_LOG_WARN);
+
+    g_test_add_func("/gatt/write_stream/small", test_write_small);
+    g_test_add_func("/gatt/write_stream/oversize_on_empty_queue", test_write_oversize_on_empty_queue);
+    g_test_add_func("/gatt/write_stream/oversize_while_pending", test_write_oversize_while_pending);
+
+    return g_test_run();
+}
@@ -0,0 +1,124 @@
+#include "lm.h"
+#include "lm_log.h"
+#include "lm_mem.h"
+#include "lm_adapter.h"
+#include "lm_device.h"
+#include "lm_device_priv.h"
+#include "bluez_dbus.h"
+#include <glib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <bluetooth/bluetooth.h>
+
+#define TAG "lm_mem_bench"
+
+/*
+ * Bytes per cached lm_device_t. Devices are created on the default adapter
+ * and filled with what a typical LE scan result carries, then the device
+ * accounting and the process RSS are compared against the empty state.
+ * Needs bluetoothd with an adapter, nothing is sent to remote devices.
+ */
+
+static const guint device_counts[] = { 1000, 10000, 50000 };
+
+static guint64 lm_mem_bench_rss(void)
+{
+    unsigned long size = 0, resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+
+    if (!file)
+        return 0;
+    if (fscanf(file, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(file);
+    return (guint64)resident * (guint64)sysconf(_SC_PAGESIZE);
+}
+
+static void lm_mem_bench_update(lm_device_t *device, const gchar *property_name, GVariant *value)
+{
+    g_variant_ref_sink(value);
+    lm_device_update_property(device, property_name, value);
+    g_variant_unref(value);
+}
+
+static void lm_mem_bench_fill(lm_device_t *device, guint index)
+{
+    static const guint8 payload[] = { 0x02, 0x15, 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77 };
+    gchar name[32];
+
+    g_snprintf(name, sizeof(name), "LE-Device-%05u", index);
+    lm_mem_bench_update(device, DEVICE_PROPERTY_NAME, g_variant_new_string(name));
+    lm_mem_bench_update(device, DEVICE_PROPERTY_ALIAS, g_variant_new_string(name));
+    lm_mem_bench_update(device, DEVICE_PROPERTY_ADDRESS_TYPE, g_variant_new_string("random"));
+    lm_mem_bench_update(device, DEVICE_PROPERTY_RSSI, g_variant_new_int16((gint16)(-40 - (gint)(index % 50))));
+
+    const gchar *uuids[] = { "0000180f-0000-1000-8000-00805f9b34fb", NULL };
+    lm_mem_bench_update(device, DEVICE_PROPERTY_UUIDS, g_variant_new_strv(uuids, -1));
+
+    GVariantBuilder builder;
+    g_variant_builder_init(&builder, G_VARIANT_TYPE("a{qv}"));
+    g_variant_builder_add(&builder, "{qv}", (guint16)0x004c,
+                          g_variant_new_fixed_array(G_VARIANT_TYPE_BYTE, payload, sizeof(payload), 1));
+    lm_mem_bench_update(device, DEVICE_PROPERTY_MANUFACTURER_DATA, g_variant_builder_end(&builder));
+}
+
+static void lm_mem_bench_run(lm_adapter_t *adapter, guint count)
+{
+    lm_mem_usage_t before, after;
+    GPtrArray *devices = g_ptr_array_new_full(count, NULL);
+
+    lm_mem_get_usage(LM_MEM_DEVICE, &before);
+    guint64 rss_before = lm_mem_bench_rss();
+
+    for (guint i = 0; i < count; i++) {
+        bdaddr_t addr = { { (guint8)i, (guint8)(i >> 8), (guint8)(i >> 16), 0x5a, 0x4d, 0xc0 } };
+        lm_device_t *device = lm_device_create_with_bdaddr(adapter, &addr);
+        if (!device)
+            break;
+        lm_mem_bench_fill(device, i);
+        g_ptr_array_add(devices, device);
+    }
+
+    lm_mem_get_usage(LM_MEM_DEVICE, &after);
+    guint64 rss_after = lm_mem_bench_rss();
+    guint created = devices->len;
+
+    printf("%6u devices: accounted %6.1f bytes/device, rss %6.1f bytes/device\n", created,
+           created ? (gdouble)(after.live_bytes - before.live_bytes) / created : 0.0,
+           created ? (gdouble)(gint64)(rss_after - rss_before) / created : 0.0);
+
+    for (guint i = 0; i < devices->len; i++)
+        lm_device_destroy(g_ptr_array_index(devices, i));
+    g_ptr_array_free(devices, TRUE);
+
+    lm_mem_get_usage(LM_MEM_DEVICE, &after);
+    if (after.live_bytes != before.live_bytes)
+        printf("%6u devices: %" G_GINT64_FORMAT " bytes still charged after destroy\n", created,
+               (gint64)(after.live_bytes - before.live_bytes));
+}
+
+int main(void)
+{
+    lm_log_set_level(LM_LOG_WARN);
+
+    if (lm_init() != LM_STATUS_SUCCESS) {
+        fprintf(stderr, "lm_init failed\n");
+        return 1;
+    }
+
+    lm_adapter_t *adapter = lm_adapter_get_default();
+    if (!adapter) {
+        fprintf(stderr, "no adapter\n");
+        lm_deinit();
+        return 1;
+    }
+
+    for (guint i = 0; i < G_N_ELEMENTS(device_counts); i++)
+        lm_mem_bench_run(adapter, device_counts[i]);
+
+    lm_mem_dump();
+    lm_adapter_destroy(adapter);
+    lm_deinit();
+    return 0;
+}